@@ -0,0 +1,1143 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * Benchmark driver: runs one workload against a mounted OFS and prints
+ * the result as a JSON object. Started by run-bench.sh, see there.
+ * The workloads that time a single component run it in this process,
+ * with the state in a scratch directory.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#ifdef HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+#ifdef HAVE_ATTR_XATTR_H
+#include <attr/xattr.h>
+#endif
+#include "ofsenvironment.h"
+#include "ofslog.h"
+#include "synclogger.h"
+#include "metastore.h"
+#include "filecopy.h"
+#include "readahead.h"
+#include "backingtreemanager.h"
+#include "backingtreepersistence.h"
+// every persistence header names its module for its own .cpp
+#undef PERSISTENCE_MODULE_NAME
+#include "synchronizationpersistence.h"
+
+using namespace std;
+
+/// bytes written per call by the small-file and edit workloads
+#define SMALL_FILE_SIZE     4096
+/// bytes per call of the sequential workloads
+#define SEQ_BLOCK_SIZE      (128 * 1024)
+/// seconds the startup workload waits for the first read
+#define STARTUP_TIMEOUT     120
+
+/**
+ * Latencies of the operations of one workload
+ */
+class Run
+{
+public:
+    Run(const char *workload) : workload(workload), bytes(0)
+        { start = now(); }
+
+    static double now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+    /// time an operation started at begin
+    void op(double begin) { latencies.push_back(now() - begin); }
+    void addBytes(unsigned long long n) { bytes += n; }
+    /// report a value other than the operations, e.g. a count
+    void addField(const char *name, double value)
+        { fields.push_back(make_pair(string(name), value)); }
+    /// take the operations of a run of another thread
+    void merge(const Run& other)
+    {
+        latencies.insert(latencies.end(), other.latencies.begin(),
+                         other.latencies.end());
+        bytes += other.bytes;
+    }
+
+    /**
+     * Print the result, the wall time includes everything since the run
+     * was created
+     */
+    void print()
+    {
+        double seconds = now() - start;
+        sort(latencies.begin(), latencies.end());
+        printf("{\"workload\": \"%s\", \"ops\": %lu, \"seconds\": %.6f, "
+               "\"ops_per_sec\": %.1f",
+               workload, (unsigned long)latencies.size(), seconds,
+               seconds > 0 ? latencies.size() / seconds : 0.0);
+        if (bytes > 0)
+            printf(", \"bytes\": %llu, \"mb_per_sec\": %.2f", bytes,
+                   seconds > 0 ? bytes / seconds / 1048576 : 0.0);
+        for (size_t i = 0; i < fields.size(); ++i)
+            printf(", \"%s\": %.15g", fields[i].first.c_str(), fields[i].second);
+        printf(", \"latency_us\": {\"min\": %.1f, \"p50\": %.1f, "
+               "\"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}\n",
+               percentile(0), percentile(0.5), percentile(0.9),
+               percentile(0.99), percentile(1));
+    }
+
+private:
+    /// nearest rank percentile in microseconds
+    double percentile(double fraction)
+    {
+        if (latencies.empty())
+            return 0;
+        size_t rank = (size_t)(fraction * latencies.size());
+        if (rank >= latencies.size())
+            rank = latencies.size() - 1;
+        return latencies[rank] * 1e6;
+    }
+
+    const char *workload;
+    double start;
+    unsigned long long bytes;
+    vector<pair<string, double> > fields;
+    vector<double> latencies;
+};
+
+static void fail(const string& what)
+{
+    fprintf(stderr, "ofsbench: %s: %s\n", what.c_str(), strerror(errno));
+    exit(1);
+}
+
+static string child(const string& dir, const char *prefix, int n)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%s%05d", prefix, n);
+    return dir + name;
+}
+
+static void writeFile(const string& path, size_t size, const char *buf)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail(path);
+    for (size_t done = 0; done < size; ) {
+        size_t n = min(size - done, (size_t)SMALL_FILE_SIZE);
+        if (write(fd, buf, n) != (ssize_t)n)
+            fail(path);
+        done += n;
+    }
+    if (close(fd) < 0)
+        fail(path);
+}
+
+/**
+ * Generate dirs directories of files files of size bytes each, not
+ * timed; used to fill the remote share before mounting
+ */
+static void tree(const string& root, int dirs, int files, size_t size)
+{
+    vector<char> buf(SMALL_FILE_SIZE, 'x');
+    if (mkdir(root.c_str(), 0755) < 0 && errno != EEXIST)
+        fail(root);
+    for (int d = 0; d < dirs; ++d) {
+        string dir = child(root, "d", d);
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+            fail(dir);
+        for (int f = 0; f < files; ++f)
+            writeFile(child(dir, "f", f), size, &buf[0]);
+    }
+}
+
+/**
+ * List every directory of a tree and stat every entry, rounds times
+ */
+static void metadata(const string& root, int rounds)
+{
+    Run run("metadata");
+    for (int r = 0; r < rounds; ++r) {
+        vector<string> dirs(1, root);
+        while (!dirs.empty()) {
+            string dir = dirs.back();
+            dirs.pop_back();
+            vector<string> names;
+            double begin = Run::now();
+            DIR *dh = opendir(dir.c_str());
+            if (dh == NULL)
+                fail(dir);
+            struct dirent *de;
+            while ((de = readdir(dh)) != NULL)
+                if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+                    names.push_back(dir + "/" + de->d_name);
+            closedir(dh);
+            run.op(begin);
+            for (size_t i = 0; i < names.size(); ++i) {
+                struct stat st;
+                begin = Run::now();
+                if (lstat(names[i].c_str(), &st) < 0)
+                    fail(names[i]);
+                run.op(begin);
+                if (S_ISDIR(st.st_mode))
+                    dirs.push_back(names[i]);
+            }
+        }
+    }
+    run.print();
+}
+
+/**
+ * Create count files of SMALL_FILE_SIZE bytes
+ */
+static void create(const string& dir, int count)
+{
+    vector<char> buf(SMALL_FILE_SIZE, 'c');
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+        fail(dir);
+    Run run("create");
+    for (int i = 0; i < count; ++i) {
+        double begin = Run::now();
+        writeFile(child(dir, "c", i), SMALL_FILE_SIZE, &buf[0]);
+        run.op(begin);
+        run.addBytes(SMALL_FILE_SIZE);
+    }
+    run.print();
+}
+
+/**
+ * Write a file sequentially and sync it, the result is named after the
+ * label if there is one
+ */
+static void seqwrite(const string& path, unsigned long long size,
+                     const char *label)
+{
+    vector<char> buf(SEQ_BLOCK_SIZE, 's');
+    string name = "seqwrite";
+    if (label != NULL)
+        name = name + "-" + label;
+    Run run(name.c_str());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail(path);
+    for (unsigned long long done = 0; done < size; done += SEQ_BLOCK_SIZE) {
+        double begin = Run::now();
+        if (write(fd, &buf[0], SEQ_BLOCK_SIZE) != SEQ_BLOCK_SIZE)
+            fail(path);
+        run.op(begin);
+        run.addBytes(SEQ_BLOCK_SIZE);
+    }
+    if (fsync(fd) < 0 || close(fd) < 0)
+        fail(path);
+    run.print();
+}
+
+static void seqread(const string& path)
+{
+    vector<char> buf(SEQ_BLOCK_SIZE);
+    Run run("seqread");
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        fail(path);
+    for (;;) {
+        double begin = Run::now();
+        ssize_t n = read(fd, &buf[0], SEQ_BLOCK_SIZE);
+        if (n < 0)
+            fail(path);
+        if (n == 0)
+            break;
+        run.op(begin);
+        run.addBytes(n);
+    }
+    close(fd);
+    run.print();
+}
+
+static void setAttribute(const string& path, const char *name)
+{
+#ifdef XATTR_ADD_OPT
+    if (setxattr(path.c_str(), name, "yes", 3, 0, 0) < 0)
+#else
+    if (setxattr(path.c_str(), name, "yes", 3, 0) < 0)
+#endif
+        fail(path + " " + name);
+}
+
+/**
+ * Make a tree available offline, which copies it into the cache before
+ * the call returns
+ */
+static void pin(const string& path)
+{
+    Run run("pin");
+    double begin = Run::now();
+    setAttribute(path, "ofs.offline");
+    run.op(begin);
+    run.print();
+}
+
+/**
+ * Get up to count files of a tree made by tree()
+ */
+static void treeFiles(const string& root, int count, vector<string>& paths)
+{
+    for (int d = 0; (int)paths.size() < count; ++d) {
+        string dir = child(root, "d", d);
+        if (access(dir.c_str(), F_OK) < 0)
+            break;
+        for (int f = 0; (int)paths.size() < count; ++f) {
+            string path = child(dir, "f", f);
+            if (access(path.c_str(), F_OK) < 0)
+                break;
+            paths.push_back(path);
+        }
+    }
+}
+
+/**
+ * Stat up to count files of a tree made by tree() once the kernel has
+ * dropped their attributes, so each stat reaches the daemon; the result
+ * is named after the log level of the mount
+ */
+static void getattr(const string& root, int count, int loglevel)
+{
+    vector<string> paths;
+    treeFiles(root, count, paths);
+    // longer than the attr_timeout of 1 s of the kernel
+    sleep(2);
+    char name[32];
+    snprintf(name, sizeof(name), "getattr-loglevel-%d", loglevel);
+    Run run(name);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        struct stat st;
+        double begin = Run::now();
+        if (lstat(paths[i].c_str(), &st) < 0)
+            fail(paths[i]);
+        run.op(begin);
+    }
+    run.print();
+}
+
+/// one thread of the stat storm
+struct StatStorm
+{
+    const vector<string> *paths;
+    size_t first;
+    size_t step;
+    Run *run;
+};
+
+static void *statStormThread(void *arg)
+{
+    StatStorm *storm = (StatStorm *)arg;
+    for (size_t i = storm->first; i < storm->paths->size(); i += storm->step) {
+        const string& path = (*storm->paths)[i];
+        struct stat st;
+        double begin = Run::now();
+        if (lstat(path.c_str(), &st) < 0)
+            fail(path);
+        storm->run->op(begin);
+    }
+    return NULL;
+}
+
+/**
+ * Stat up to count files of a tree made by tree() from threads threads,
+ * each taking every threads-th file
+ */
+static void statStorm(const string& root, int count, int threads)
+{
+    vector<string> paths;
+    treeFiles(root, count, paths);
+    // let the kernel forget the attributes looked up by treeFiles()
+    sleep(2);
+
+    char name[32];
+    snprintf(name, sizeof(name), "stat-storm-%d", threads);
+    vector<Run *> runs;
+    vector<StatStorm> storms(threads);
+    vector<pthread_t> ids(threads);
+    Run run(name);
+    for (int t = 0; t < threads; ++t) {
+        runs.push_back(new Run(name));
+        storms[t].paths = &paths;
+        storms[t].first = t;
+        storms[t].step = threads;
+        storms[t].run = runs[t];
+        errno = pthread_create(&ids[t], NULL, statStormThread, &storms[t]);
+        if (errno != 0)
+            fail("pthread_create");
+    }
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        run.merge(*runs[t]);
+        delete runs[t];
+    }
+    run.print();
+}
+
+static void goOffline(const string& mountpoint)
+{
+#ifdef XATTR_ADD_OPT
+    if (removexattr(mountpoint.c_str(), "ofs.available", 0) < 0)
+#else
+    if (removexattr(mountpoint.c_str(), "ofs.available") < 0)
+#endif
+        fail(mountpoint + " ofs.available");
+}
+
+/// overwrite the start of a file
+static void edit(const string& path, const char *buf)
+{
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0 || pwrite(fd, buf, SMALL_FILE_SIZE, 0) < 0 || close(fd) < 0)
+        fail(path);
+}
+
+/**
+ * Go offline and overwrite the start of up to count files of a pinned
+ * tree made by tree()
+ */
+static void offlineEdit(const string& mountpoint, const string& root,
+                        int count)
+{
+    vector<string> paths;
+    treeFiles(root, count, paths);
+    vector<char> buf(SMALL_FILE_SIZE, 'e');
+    goOffline(mountpoint);
+    Run run("offline-edit");
+    for (size_t i = 0; i < paths.size(); ++i) {
+        double begin = Run::now();
+        edit(paths[i], &buf[0]);
+        run.op(begin);
+        run.addBytes(SMALL_FILE_SIZE);
+    }
+    run.print();
+}
+
+/**
+ * Go offline and overwrite the start of tracked files of a pinned tree
+ * made by tree() untimed, which makes the write-back track their paths,
+ * then time overwriting up to count further files
+ */
+static void trackedEdit(const string& mountpoint, const string& root,
+                        int tracked, int count)
+{
+    vector<string> paths;
+    treeFiles(root, tracked + count, paths);
+    if ((int)paths.size() <= tracked) {
+        fprintf(stderr, "ofsbench: %s has only %lu files\n", root.c_str(),
+                (unsigned long)paths.size());
+        exit(1);
+    }
+    vector<char> buf(SMALL_FILE_SIZE, 't');
+    goOffline(mountpoint);
+    for (int i = 0; i < tracked; ++i)
+        edit(paths[i], &buf[0]);
+    Run run("tracked-edit");
+    for (size_t i = tracked; i < paths.size(); ++i) {
+        double begin = Run::now();
+        edit(paths[i], &buf[0]);
+        run.op(begin);
+        run.addBytes(SMALL_FILE_SIZE);
+    }
+    run.print();
+}
+
+/**
+ * Go online again, which writes back the offline changes before the call
+ * returns
+ */
+static void reintegrate(const string& mountpoint)
+{
+    Run run("reintegrate");
+    double begin = Run::now();
+    setAttribute(mountpoint, "ofs.available");
+    run.op(begin);
+    run.print();
+}
+
+/**
+ * Run the mount command and time until the first read of a file below
+ * the mount point succeeds, the result is named after the number of
+ * paths the state of the mount tracks
+ */
+static void startup(const string& path, int paths, char *argv[])
+{
+    char name[32];
+    snprintf(name, sizeof(name), "startup-%d", paths);
+    Run run(name);
+    double begin = Run::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        fail("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "ofsbench: %s failed\n", argv[0]);
+        exit(1);
+    }
+
+    char buf[SMALL_FILE_SIZE];
+    for (;;) {
+        // the mount point has to serve the file, not the directory below
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            close(fd);
+            if (n >= 0)
+                break;
+        }
+        if (Run::now() - begin > STARTUP_TIMEOUT) {
+            fprintf(stderr, "ofsbench: %s not readable after %d s\n",
+                    path.c_str(), STARTUP_TIMEOUT);
+            exit(1);
+        }
+        usleep(1000);
+    }
+    run.op(begin);
+    run.print();
+}
+
+/**
+ * Set up OFSEnvironment for a workload that runs components in this
+ * process, with the state of share "bench" in dir
+ * @param extra further mount options
+ */
+static void initState(const string& dir, const string& extra = "")
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+        fail(dir);
+    string options = "statedir=" + dir + ",backing=" + dir + ",shareid=bench";
+    if (!extra.empty())
+        options += "," + extra;
+    const char *args[] = { "ofsbench", "file:///", "/", "-o", options.c_str() };
+    if (!ofslog::init())
+        fail("ofslog::init");
+    try {
+        OFSEnvironment::init(5, const_cast<char **>(args));
+    } catch (OFSException& e) {
+        fprintf(stderr, "ofsbench: %s\n", e.what());
+        exit(1);
+    }
+}
+
+/**
+ * Store the modification times of paths tracked files, laid out like a
+ * tree made by tree() below /tracked, as the state of share "bench" in
+ * dir and merge them into the table like an unmount does
+ */
+static void track(const string& state, int paths)
+{
+    initState(state);
+    {
+        // one commit instead of one per path
+        MetaStore::Transaction transaction;
+        for (int i = 0; i < paths; ++i)
+            SynchronizationPersistence::Instance().add(
+                child(child("/tracked", "d", i / 100), "f", i % 100), 1);
+        if (!transaction.commit())
+            fail("tracked paths");
+    }
+    if (!MetaStore::Instance().checkpoint())
+        fail("checkpoint");
+}
+
+/**
+ * Fill the sync log with entries modified paths, which are laid out
+ * like a tree made by tree() below /dirty, then check count paths, half
+ * of them dirty, and count directories for dirty paths below them
+ */
+static void dirtyCheck(const string& state, int entries, int count)
+{
+    initState(state);
+    SyncLogger& log = SyncLogger::Instance();
+    const string share = OFSEnvironment::Instance().getShareID();
+    {
+        // one commit instead of one per entry
+        MetaStore::Transaction transaction;
+        for (int i = 0; i < entries; ++i)
+            log.AddEntry(share.c_str(),
+                child(child("/dirty", "d", i / 100), "f", i % 100).c_str(), 'm');
+        if (!transaction.commit())
+            fail("sync log");
+    }
+    if (log.GetEntryCount(share.c_str()) != entries) {
+        fprintf(stderr, "ofsbench: the sync log has %d entries\n",
+                log.GetEntryCount(share.c_str()));
+        exit(1);
+    }
+
+    Run run("dirty-check");
+    for (int i = 0; i < count; ++i) {
+        int n = (int)((i * 7919LL) % entries);
+        bool dirty = i % 2 == 0;
+        string path = child(child(dirty ? "/dirty" : "/clean", "d", n / 100),
+                            "f", n % 100);
+        double begin = Run::now();
+        bool found = log.IsDirty(share.c_str(), path);
+        run.op(begin);
+        if (found != dirty) {
+            fprintf(stderr, "ofsbench: wrong dirty state of %s\n", path.c_str());
+            exit(1);
+        }
+    }
+    run.print();
+
+    int dirs = (entries + 99) / 100;
+    Run below("dirty-below");
+    for (int i = 0; i < count; ++i) {
+        int n = (int)((i * 7919LL) % dirs);
+        bool dirty = i % 2 == 0;
+        string path = child(dirty ? "/dirty" : "/clean", "d", n);
+        double begin = Run::now();
+        bool found = log.HasDirtyBelow(share.c_str(), path);
+        below.op(begin);
+        if (found != dirty) {
+            fprintf(stderr, "ofsbench: wrong dirty state below %s\n", path.c_str());
+            exit(1);
+        }
+    }
+    below.print();
+}
+
+/**
+ * Store trees backing trees below /pinned as the state of share "bench"
+ * in dir and load them, then look up which one manages count files, half
+ * of them in a backing tree
+ */
+static void pinnedLookup(const string& state, int trees, int count)
+{
+    initState(state);
+    BackingtreeManager& manager = BackingtreeManager::Instance();
+    list<Backingtree> pinned;
+    for (int i = 0; i < trees; ++i) {
+        string path = child("/pinned", "t", i);
+        pinned.push_back(Backingtree(path, manager.get_Cache_Path() + path));
+    }
+    BackingtreePersistence::Instance().backingtrees(pinned);
+    manager.reinstate();
+
+    Run run("pinned-lookup");
+    for (int i = 0; i < count; ++i) {
+        int n = (int)((i * 7919LL) % trees);
+        bool inside = i % 2 == 0;
+        string path = child(child(child(inside ? "/pinned" : "/other", "t", n),
+                                  "d", i % 10), "f", i % 100);
+        string cachePath;
+        double begin = Run::now();
+        bool found = manager.Search_Backingtree_via_Path(path, cachePath);
+        run.op(begin);
+        if (found != inside) {
+            fprintf(stderr, "ofsbench: wrong backing tree of %s\n", path.c_str());
+            exit(1);
+        }
+    }
+    run.print();
+}
+
+/**
+ * Set up OFSEnvironment like initState() for the file:// share in the
+ * directory share
+ */
+static void initShare(const string& state, const string& share,
+                      const string& extra)
+{
+    initState(state, extra);
+    // what mounting a file:// share does
+    OFSEnvironment::Instance().setRemotePath(share);
+}
+
+/// sum of the sizes of the files below a directory
+static unsigned long long bytesBelow(const string& dir)
+{
+    unsigned long long bytes = 0;
+    DIR *dh = opendir(dir.c_str());
+    if (dh == NULL)
+        return 0;
+    struct dirent *de;
+    while ((de = readdir(dh)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        string path = dir + "/" + de->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) < 0)
+            fail(path);
+        if (S_ISDIR(st.st_mode))
+            bytes += bytesBelow(path);
+        else if (S_ISREG(st.st_mode))
+            bytes += st.st_size;
+    }
+    closedir(dh);
+    return bytes;
+}
+
+/**
+ * Generate files files of size bytes of random data in one directory,
+ * not timed; only distinct of them differ, the others are copies with
+ * a few bytes changed, like edited versions of the same documents
+ */
+static void dedupTree(const string& root, int files, size_t size, int distinct)
+{
+    vector<char> buf(size);
+    if (mkdir(root.c_str(), 0755) < 0 && errno != EEXIST)
+        fail(root);
+    for (int i = 0; i < files; ++i) {
+        // a linear congruential generator per original
+        unsigned long long x = i % distinct + 1;
+        for (size_t b = 0; b < size; ++b) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            buf[b] = (char)(x >> 56);
+        }
+        if (i >= distinct && size >= 16)
+            memset(&buf[(i * 7919ULL) % (size - 15)], i, 16);
+        // writeFile() repeats the start of its buffer
+        string path = child(root, "f", i);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, &buf[0], size) != (ssize_t)size || close(fd) < 0)
+            fail(path);
+    }
+}
+
+/**
+ * Copy a tree of the share in the directory share into the cache of a
+ * scratch state, like making it available offline does, and report how
+ * many bytes that stored: the cache, or with dedup the chunk store
+ * @param tree path of the tree in the share, e.g. /dedup
+ */
+static void fill(const string& state, const string& share, const string& tree,
+                 bool dedup)
+{
+    initShare(state, share, dedup ? "dedup" : "");
+    Run run(dedup ? "dedup-fill" : "fill");
+    double begin = Run::now();
+    BackingtreeManager::Instance().register_Backingtree(tree);
+    run.op(begin);
+    unsigned long long logical = bytesBelow(share + tree);
+    unsigned long long stored = dedup ?
+        bytesBelow(state + "/" + OFSEnvironment::Instance().getShareID() + "_chunks") :
+        bytesBelow(BackingtreeManager::Instance().get_Cache_Path() + tree);
+    run.addBytes(logical);
+    run.addField("stored_bytes", stored);
+    run.addField("dedup_ratio", stored > 0 ? (double)logical / stored : 0);
+    run.print();
+}
+
+/**
+ * Copy a tree of the share in the directory share into the cache of a
+ * scratch state, like making it available offline does, with the cache
+ * update running on threads workers
+ * @param tree path of the tree in the share, e.g. /walk
+ */
+static void walk(const string& state, const string& share, const string& tree,
+                 int threads)
+{
+    char option[32];
+    snprintf(option, sizeof(option), "cachethreads=%d", threads);
+    initShare(state, share, option);
+
+    char name[32];
+    snprintf(name, sizeof(name), "walk-%d", threads);
+    Run run(name);
+    double begin = Run::now();
+    BackingtreeManager::Instance().register_Backingtree(tree);
+    run.op(begin);
+    run.print();
+}
+
+/**
+ * Read a file the way OFS reads a remote one, through ReadAhead with a
+ * window of readahead KiB or with pread alone if it is 0: sequentially
+ * in SEQ_BLOCK_SIZE blocks, then count blocks of SMALL_FILE_SIZE at
+ * scattered offsets, each pass with its own ReadAhead
+ */
+static void remoteRead(const string& path, int readahead, int count)
+{
+    vector<char> buf(SEQ_BLOCK_SIZE);
+    char name[48];
+    snprintf(name, sizeof(name), "remote-seqread-%d", readahead);
+    Run seq(name);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        fail(path);
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        fail(path);
+    {
+        auto_ptr<ReadAhead> ahead(readahead > 0 ?
+            new ReadAhead(fd, readahead * 1024) : NULL);
+        for (off_t offset = 0; ; ) {
+            double begin = Run::now();
+            ssize_t n = ahead.get() != NULL ?
+                ahead->read(&buf[0], SEQ_BLOCK_SIZE, offset) :
+                pread(fd, &buf[0], SEQ_BLOCK_SIZE, offset);
+            if (n < 0)
+                fail(path);
+            if (n == 0)
+                break;
+            seq.op(begin);
+            seq.addBytes(n);
+            offset += n;
+        }
+    }
+    seq.print();
+
+    snprintf(name, sizeof(name), "remote-randread-%d", readahead);
+    Run random(name);
+    off_t blocks = st.st_size / SMALL_FILE_SIZE;
+    if (blocks > 0) {
+        auto_ptr<ReadAhead> ahead(readahead > 0 ?
+            new ReadAhead(fd, readahead * 1024) : NULL);
+        for (int i = 0; i < count; ++i) {
+            off_t offset = (off_t)((i * 7919LL) % blocks) * SMALL_FILE_SIZE;
+            double begin = Run::now();
+            ssize_t n = ahead.get() != NULL ?
+                ahead->read(&buf[0], SMALL_FILE_SIZE, offset) :
+                pread(fd, &buf[0], SMALL_FILE_SIZE, offset);
+            if (n < 0)
+                fail(path);
+            random.op(begin);
+            random.addBytes(n);
+        }
+    }
+    close(fd);
+    random.print();
+}
+
+/// one writer of the journal append workload
+struct JournalAppend
+{
+    int writer;
+    int count;
+    Run *run;
+};
+
+static void *journalAppendThread(void *arg)
+{
+    JournalAppend *append = (JournalAppend *)arg;
+    SyncLogger& log = SyncLogger::Instance();
+    const string share = OFSEnvironment::Instance().getShareID();
+    string dir = child("/append", "w", append->writer);
+    for (int i = 0; i < append->count; ++i) {
+        string path = child(dir, "f", i);
+        double begin = Run::now();
+        if (!log.AddEntry(share.c_str(), path.c_str(), 'm'))
+            fail(path);
+        append->run->op(begin);
+    }
+    return NULL;
+}
+
+/**
+ * Add count new paths to the sync log from each of writers threads, each
+ * append waits until it is durable, so concurrent appends share commits
+ */
+static void journalAppend(const string& state, int writers, int count)
+{
+    initState(state);
+    // load the log before the clock starts
+    SyncLogger::Instance().GetEntryCount(
+        OFSEnvironment::Instance().getShareID().c_str());
+
+    char name[32];
+    snprintf(name, sizeof(name), "journal-append-%d", writers);
+    vector<Run *> runs;
+    vector<JournalAppend> appends(writers);
+    vector<pthread_t> ids(writers);
+    Run run(name);
+    for (int t = 0; t < writers; ++t) {
+        runs.push_back(new Run(name));
+        appends[t].writer = t;
+        appends[t].count = count;
+        appends[t].run = runs[t];
+        errno = pthread_create(&ids[t], NULL, journalAppendThread, &appends[t]);
+        if (errno != 0)
+            fail("pthread_create");
+    }
+    for (int t = 0; t < writers; ++t) {
+        pthread_join(ids[t], NULL);
+        run.merge(*runs[t]);
+        delete runs[t];
+    }
+    run.print();
+}
+
+/**
+ * Copy a file of size bytes copies times with the loop of 1 KiB reads
+ * and writes the cache and the write-back used before, and copies times
+ * with FileCopy
+ */
+static void copy(const string& dir, unsigned long long size, int copies)
+{
+    initState(dir);
+    string source = dir + "/copy-source";
+    string dest = dir + "/copy-dest";
+    vector<char> buf(SMALL_FILE_SIZE, 'y');
+    // writeFile() takes a size_t, which may not hold size
+    int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail(source);
+    for (unsigned long long done = 0; done < size; done += SMALL_FILE_SIZE)
+        if (write(fd, &buf[0], min(size - done, (unsigned long long)SMALL_FILE_SIZE)) < 0)
+            fail(source);
+    if (close(fd) < 0)
+        fail(source);
+
+    char name[48];
+    snprintf(name, sizeof(name), "copy-loop-%llu", size);
+    Run loop(name);
+    for (int i = 0; i < copies; ++i) {
+        double begin = Run::now();
+        int in = open(source.c_str(), O_RDONLY);
+        int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0)
+            fail("copy");
+        char small[1024];
+        ssize_t n;
+        while ((n = read(in, small, sizeof(small))) > 0)
+            if (write(out, small, n) < 0)
+                fail(dest);
+        if (n < 0 || close(out) < 0)
+            fail("copy");
+        close(in);
+        loop.op(begin);
+        loop.addBytes(size);
+        unlink(dest.c_str());
+    }
+    loop.print();
+
+    snprintf(name, sizeof(name), "copy-%llu", size);
+    Run run(name);
+    for (int i = 0; i < copies; ++i) {
+        double begin = Run::now();
+        try {
+            FileCopy::copy(source, dest, 0644);
+        } catch (OFSException& e) {
+            fprintf(stderr, "ofsbench: %s\n", e.what());
+            exit(1);
+        }
+        run.op(begin);
+        run.addBytes(size);
+        unlink(dest.c_str());
+    }
+    run.print();
+    unlink(source.c_str());
+}
+
+static ssize_t getStats(const string& mountpoint, char *buf, size_t size)
+{
+#ifdef XATTR_ADD_OPT
+    return getxattr(mountpoint.c_str(), "ofs.stats", buf, size, 0, 0);
+#else
+    return getxattr(mountpoint.c_str(), "ofs.stats", buf, size);
+#endif
+}
+
+/// the ofs.stats attribute of the mount root
+static string readStats(const string& mountpoint)
+{
+    ssize_t size = getStats(mountpoint, NULL, 0);
+    if (size < 0)
+        fail(mountpoint + " ofs.stats");
+    vector<char> buf(size + 1);
+    size = getStats(mountpoint, &buf[0], size);
+    if (size < 0)
+        fail(mountpoint + " ofs.stats");
+    return string(&buf[0], size);
+}
+
+/**
+ * Read a counter from the ofs.stats attribute of the mount root
+ * @param name the counter with its labels as printed there
+ */
+static unsigned long long counter(const string& mountpoint, const string& name)
+{
+    string text = readStats(mountpoint);
+    size_t pos = text.find("\n" + name + " ");
+    if (pos == string::npos) {
+        fprintf(stderr, "ofsbench: no %s in ofs.stats\n", name.c_str());
+        exit(1);
+    }
+    return strtoull(text.c_str() + pos + name.size() + 2, NULL, 10);
+}
+
+/// time one stat of each path, counting how the daemon answered
+static void statPass(const string& mountpoint, const vector<string>& paths,
+                     const char *workload)
+{
+    unsigned long long hits = counter(mountpoint,
+        "ofs_getattrs_total{source=\"attrcache\"}");
+    unsigned long long misses =
+        counter(mountpoint, "ofs_getattrs_total{source=\"cache\"}") +
+        counter(mountpoint, "ofs_getattrs_total{source=\"remote\"}");
+    Run run(workload);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        struct stat st;
+        double begin = Run::now();
+        if (lstat(paths[i].c_str(), &st) < 0)
+            fail(paths[i]);
+        run.op(begin);
+    }
+    run.addField("attrcache_hits", counter(mountpoint,
+        "ofs_getattrs_total{source=\"attrcache\"}") - hits);
+    run.addField("attrcache_misses",
+        counter(mountpoint, "ofs_getattrs_total{source=\"cache\"}") +
+        counter(mountpoint, "ofs_getattrs_total{source=\"remote\"}") - misses);
+    run.print();
+}
+
+/**
+ * Stat up to count files of a tree made by tree() twice: once after
+ * every cached attribute has expired, then again once only the kernel
+ * has dropped them, so the stat reaches the attribute cache of OFS
+ */
+static void attrCache(const string& mountpoint, const string& root, int count)
+{
+    vector<string> paths;
+    treeFiles(root, count, paths);
+    // longer than the default attrcache=5
+    sleep(6);
+    statPass(mountpoint, paths, "attrcache-cold");
+    // longer than the attr_timeout of 1 s of the kernel
+    sleep(2);
+    statPass(mountpoint, paths, "attrcache-warm");
+}
+
+/**
+ * Print the ofs.stats attribute of the mount root
+ */
+static void stats(const string& mountpoint)
+{
+    string text = readStats(mountpoint);
+    fwrite(text.data(), 1, text.size(), stdout);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: ofsbench tree <dir> <dirs> <files> <bytes>\n"
+        "       ofsbench metadata <dir> <rounds>\n"
+        "       ofsbench create <dir> <files>\n"
+        "       ofsbench seqwrite <file> <MiB> [label]\n"
+        "       ofsbench seqread <file>\n"
+        "       ofsbench pin <dir>\n"
+        "       ofsbench getattr <dir> <files> <loglevel>\n"
+        "       ofsbench stat-storm <dir> <files> <threads>\n"
+        "       ofsbench offline-edit <mountpoint> <dir> <files>\n"
+        "       ofsbench tracked-edit <mountpoint> <dir> <tracked> <files>\n"
+        "       ofsbench attrcache <mountpoint> <dir> <files>\n"
+        "       ofsbench reintegrate <mountpoint>\n"
+        "       ofsbench stats <mountpoint>\n"
+        "       ofsbench track <state dir> <paths>\n"
+        "       ofsbench startup <file> <paths> <mount command> [args...]\n"
+        "       ofsbench dirty-check <state dir> <entries> <checks>\n"
+        "       ofsbench pinned-lookup <state dir> <trees> <lookups>\n"
+        "       ofsbench remote-read <file> <readahead KiB> <random reads>\n"
+        "       ofsbench dedup-tree <dir> <files> <bytes> <distinct>\n"
+        "       ofsbench fill <state dir> <share dir> <tree> [dedup]\n"
+        "       ofsbench walk <state dir> <share dir> <tree> <threads>\n"
+        "       ofsbench journal-append <state dir> <writers> <appends>\n"
+        "       ofsbench copy <dir> <bytes> <copies>\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+        usage();
+    string cmd = argv[1];
+    if (cmd == "tree" && argc == 6)
+        tree(argv[2], atoi(argv[3]), atoi(argv[4]), atol(argv[5]));
+    else if (cmd == "metadata" && argc == 4)
+        metadata(argv[2], atoi(argv[3]));
+    else if (cmd == "create" && argc == 4)
+        create(argv[2], atoi(argv[3]));
+    else if (cmd == "seqwrite" && (argc == 4 || argc == 5))
+        seqwrite(argv[2], atoll(argv[3]) * 1048576, argc == 5 ? argv[4] : NULL);
+    else if (cmd == "seqread" && argc == 3)
+        seqread(argv[2]);
+    else if (cmd == "pin" && argc == 3)
+        pin(argv[2]);
+    else if (cmd == "getattr" && argc == 5)
+        getattr(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "stat-storm" && argc == 5)
+        statStorm(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "offline-edit" && argc == 5)
+        offlineEdit(argv[2], argv[3], atoi(argv[4]));
+    else if (cmd == "tracked-edit" && argc == 6)
+        trackedEdit(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+    else if (cmd == "attrcache" && argc == 5)
+        attrCache(argv[2], argv[3], atoi(argv[4]));
+    else if (cmd == "reintegrate" && argc == 3)
+        reintegrate(argv[2]);
+    else if (cmd == "stats" && argc == 3)
+        stats(argv[2]);
+    else if (cmd == "track" && argc == 4)
+        track(argv[2], atoi(argv[3]));
+    else if (cmd == "startup" && argc >= 5)
+        startup(argv[2], atoi(argv[3]), argv + 4);
+    else if (cmd == "dirty-check" && argc == 5)
+        dirtyCheck(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "pinned-lookup" && argc == 5)
+        pinnedLookup(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "remote-read" && argc == 5)
+        remoteRead(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "dedup-tree" && argc == 6)
+        dedupTree(argv[2], atoi(argv[3]), atol(argv[4]), atoi(argv[5]));
+    else if (cmd == "fill" && (argc == 5 || (argc == 6 && !strcmp(argv[5], "dedup"))))
+        fill(argv[2], argv[3], argv[4], argc == 6);
+    else if (cmd == "walk" && argc == 6)
+        walk(argv[2], argv[3], argv[4], atoi(argv[5]));
+    else if (cmd == "journal-append" && argc == 5)
+        journalAppend(argv[2], atoi(argv[3]), atoi(argv[4]));
+    else if (cmd == "copy" && argc == 5)
+        copy(argv[2], atoll(argv[3]), atoi(argv[4]));
+    else
+        usage();
+    return 0;
+}
@@ -0,0 +1,272 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Latency injection for the benchmarks, loaded with LD_PRELOAD into ofs
+ * or ofsbench. Every call that would be a round trip to a remote file
+ * system takes OFSDELAY_USEC microseconds longer if its path is below
+ * OFSDELAY_PATH: opening and listing a path, getting its attributes,
+ * and each read of a file opened below it. Other paths are not slowed
+ * down, so the cache of OFS stays local.
+ *
+ * Paths of a file:// share start with two slashes, they are compared
+ * with repeated slashes collapsed.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* descriptors above this are never delayed */
+#define OFSDELAY_MAX_FD 65536
+
+static const char *prefix;
+static size_t prefixLength;
+static long delayUsec;
+/* descriptors of files opened below the prefix */
+static unsigned char delayedFd[OFSDELAY_MAX_FD];
+
+__attribute__((constructor)) static void init(void)
+{
+    const char *usec = getenv("OFSDELAY_USEC");
+    prefix = getenv("OFSDELAY_PATH");
+    if (prefix != NULL) {
+        /* a trailing slash would not match the directory itself */
+        prefixLength = strlen(prefix);
+        while (prefixLength > 1 && prefix[prefixLength - 1] == '/')
+            --prefixLength;
+    }
+    delayUsec = usec != NULL ? atol(usec) : 0;
+}
+
+static void *next(const char *name)
+{
+    return dlsym(RTLD_NEXT, name);
+}
+
+/* is the path below the prefix, with repeated slashes collapsed? */
+static int isDelayed(const char *path)
+{
+    size_t i = 0;
+    if (prefix == NULL || delayUsec <= 0 || path == NULL)
+        return 0;
+    while (i < prefixLength) {
+        if (*path == '\0')
+            return 0;
+        if (*path == '/' && prefix[i] == '/') {
+            while (*path == '/')
+                ++path;
+            while (i < prefixLength && prefix[i] == '/')
+                ++i;
+            continue;
+        }
+        if (*path++ != prefix[i++])
+            return 0;
+    }
+    return *path == '\0' || *path == '/';
+}
+
+static void delay(void)
+{
+    struct timespec ts;
+    int saved = errno;
+    ts.tv_sec = delayUsec / 1000000;
+    ts.tv_nsec = (delayUsec % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+    errno = saved;
+}
+
+static void delayPath(const char *path)
+{
+    if (isDelayed(path))
+        delay();
+}
+
+static void delayFd(int fd)
+{
+    if (fd >= 0 && fd < OFSDELAY_MAX_FD && delayedFd[fd])
+        delay();
+}
+
+static int opened(int fd, const char *path)
+{
+    if (fd >= 0 && fd < OFSDELAY_MAX_FD)
+        delayedFd[fd] = isDelayed(path);
+    return fd;
+}
+
+/* the mode is only passed if the file may be created */
+static mode_t modeOf(int flags, va_list ap)
+{
+#ifdef O_TMPFILE
+    if ((flags & O_TMPFILE) == O_TMPFILE)
+        return va_arg(ap, mode_t);
+#endif
+    if (flags & O_CREAT)
+        return va_arg(ap, mode_t);
+    return 0;
+}
+
+int open(const char *path, int flags, ...)
+{
+    static int (*real)(const char *, int, ...);
+    va_list ap;
+    mode_t mode;
+    va_start(ap, flags);
+    mode = modeOf(flags, ap);
+    va_end(ap);
+    if (real == NULL)
+        real = next("open");
+    delayPath(path);
+    return opened(real(path, flags, mode), path);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    static int (*real)(const char *, int, ...);
+    va_list ap;
+    mode_t mode;
+    va_start(ap, flags);
+    mode = modeOf(flags, ap);
+    va_end(ap);
+    if (real == NULL)
+        real = next("open64");
+    delayPath(path);
+    return opened(real(path, flags, mode), path);
+}
+
+int close(int fd)
+{
+    static int (*real)(int);
+    if (real == NULL)
+        real = next("close");
+    if (fd >= 0 && fd < OFSDELAY_MAX_FD)
+        delayedFd[fd] = 0;
+    return real(fd);
+}
+
+DIR *opendir(const char *path)
+{
+    static DIR *(*real)(const char *);
+    DIR *dir;
+    if (real == NULL)
+        real = next("opendir");
+    delayPath(path);
+    dir = real(path);
+    /* closedir() closes the descriptor without going through close() */
+    if (dir != NULL && dirfd(dir) >= 0 && dirfd(dir) < OFSDELAY_MAX_FD)
+        delayedFd[dirfd(dir)] = 0;
+    return dir;
+}
+
+/* glibc before 2.33 only exports the versioned stat functions */
+#define STAT_WRAPPER(name, type)                                        \
+int name(const char *path, struct type *buf)                            \
+{                                                                       \
+    static int (*real)(const char *, struct type *);                    \
+    if (real == NULL)                                                   \
+        real = next(#name);                                             \
+    delayPath(path);                                                    \
+    return real(path, buf);                                             \
+}
+#define XSTAT_WRAPPER(name, type)                                       \
+int name(int ver, const char *path, struct type *buf)                   \
+{                                                                       \
+    static int (*real)(int, const char *, struct type *);               \
+    if (real == NULL)                                                   \
+        real = next(#name);                                             \
+    delayPath(path);                                                    \
+    return real(ver, path, buf);                                        \
+}
+
+STAT_WRAPPER(stat, stat)
+STAT_WRAPPER(lstat, stat)
+STAT_WRAPPER(stat64, stat64)
+STAT_WRAPPER(lstat64, stat64)
+XSTAT_WRAPPER(__xstat, stat)
+XSTAT_WRAPPER(__lxstat, stat)
+XSTAT_WRAPPER(__xstat64, stat64)
+XSTAT_WRAPPER(__lxstat64, stat64)
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    static ssize_t (*real)(int, void *, size_t);
+    if (real == NULL)
+        real = next("read");
+    delayFd(fd);
+    return real(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    static ssize_t (*real)(int, void *, size_t, off_t);
+    if (real == NULL)
+        real = next("pread");
+    delayFd(fd);
+    return real(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset)
+{
+    static ssize_t (*real)(int, void *, size_t, off64_t);
+    if (real == NULL)
+        real = next("pread64");
+    delayFd(fd);
+    return real(fd, buf, count, offset);
+}
+
+ssize_t copy_file_range(int fdIn, loff_t *offIn, int fdOut, loff_t *offOut,
+                        size_t length, unsigned int flags)
+{
+    static ssize_t (*real)(int, loff_t *, int, loff_t *, size_t, unsigned int);
+    if (real == NULL)
+        real = next("copy_file_range");
+    delayFd(fdIn);
+    return real(fdIn, offIn, fdOut, offOut, length, flags);
+}
+
+ssize_t sendfile(int fdOut, int fdIn, off_t *offset, size_t count)
+{
+    static ssize_t (*real)(int, int, off_t *, size_t);
+    if (real == NULL)
+        real = next("sendfile");
+    delayFd(fdIn);
+    return real(fdOut, fdIn, offset, count);
+}
+
+ssize_t sendfile64(int fdOut, int fdIn, off64_t *offset, size_t count)
+{
+    static ssize_t (*real)(int, int, off64_t *, size_t);
+    if (real == NULL)
+        real = next("sendfile64");
+    delayFd(fdIn);
+    return real(fdOut, fdIn, offset, count);
+}
@@ -0,0 +1,166 @@
+#!/bin/sh
+#
+# Mounts OFS over a file:// share in a scratch directory, runs the
+# benchmark workloads through it and writes the results as JSON.
+#
+# usage: run-bench.sh [output file]
+#
+# Environment:
+#   OFS           ofs binary (default ../src/ofs)
+#   OFSBENCH      benchmark driver (default ./ofsbench)
+#   OFSDELAY      latency injection library (default ./.libs/ofsdelay.so)
+#   BENCH_DELAY   microseconds added to every remote call of the delayed
+#                 workloads (default 2000)
+#   BENCH_OPTIONS additional ofs mount options, e.g. lowlevel,attrcache=0
+#   BENCH_SCALE   multiplies the size of every workload (default 1)
+#   TMPDIR        where the scratch directory is created
+#
+# Mounting needs the rights to mount a FUSE file system with allow_other,
+# so this is usually run as root.
+
+set -e
+
+OFS=${OFS:-../src/ofs}
+OFSBENCH=${OFSBENCH:-./ofsbench}
+OFSDELAY=${OFSDELAY:-./.libs/ofsdelay.so}
+SCALE=${BENCH_SCALE:-1}
+delay=${BENCH_DELAY:-2000}
+out=${1:-bench-results.json}
+
+work=`mktemp -d "${TMPDIR:-/tmp}/ofsbench.XXXXXX"`
+remote=$work/remote
+mnt=$work/mnt
+mkdir "$remote" "$mnt" "$work/cache" "$work/state"
+
+unmount() {
+	fusermount -u "$mnt" 2>/dev/null || umount "$mnt" 2>/dev/null || true
+}
+trap 'unmount; rm -rf "$work"' EXIT
+trap 'exit 1' INT TERM
+
+# the trees are made on the share directly, so only the workloads go
+# through OFS
+"$OFSBENCH" tree "$remote/meta" `expr 20 \* $SCALE` 100 1024
+"$OFSBENCH" tree "$remote/pin" `expr 10 \* $SCALE` 100 16384
+"$OFSBENCH" tree "$remote/tracked" `expr 1010 \* $SCALE` 100 0
+"$OFSBENCH" tree "$remote/walk" `expr 50 \* $SCALE` 20 4096
+"$OFSBENCH" seqwrite "$remote/read" `expr 64 \* $SCALE` > /dev/null
+"$OFSBENCH" dedup-tree "$remote/dedup" `expr 100 \* $SCALE` 1048576 10
+
+# mount with the given options and wait until it is there
+mount_ofs() {
+	"$OFS" "file://$remote" "$mnt" -o "$1"
+	tries=0
+	until mount | grep -q " on $mnt "; do
+		tries=`expr $tries + 1`
+		if test $tries -gt 50; then
+			echo "run-bench.sh: $mnt did not get mounted" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+}
+
+options=backing=$work/cache,statedir=$work/state,shareid=bench
+test -n "$BENCH_OPTIONS" && options=$options,$BENCH_OPTIONS
+mount_ofs "$options"
+
+results=$work/results
+: > "$results"
+run() {
+	echo "run-bench.sh: $1" >&2
+	"$OFSBENCH" "$@" >> "$results"
+}
+# like run, with every call on a path below the directory $1 delayed
+run_delayed() {
+	prefix=$1
+	shift
+	echo "run-bench.sh: $1, $delay us per remote call" >&2
+	LD_PRELOAD=$OFSDELAY OFSDELAY_PATH=$prefix OFSDELAY_USEC=$delay \
+		"$OFSBENCH" "$@" >> "$results"
+}
+run metadata "$mnt/meta" 5
+run attrcache "$mnt" "$mnt/meta" `expr 2000 \* $SCALE`
+run create "$mnt/create" `expr 1000 \* $SCALE`
+run seqwrite "$mnt/seq" `expr 64 \* $SCALE`
+run seqread "$mnt/seq"
+run pin "$mnt/pin"
+run offline-edit "$mnt" "$mnt/pin" `expr 500 \* $SCALE`
+# a large offline write against the same write straight to the file
+# system of the cache
+run seqwrite "$mnt/pin/offline-seq" `expr 64 \* $SCALE` offline
+run seqwrite "$work/raw-seq" `expr 64 \* $SCALE` raw
+rm -f "$work/raw-seq"
+run reintegrate "$mnt"
+"$OFSBENCH" stats "$mnt" > "$work/stats" || true
+
+unmount
+
+# the cost of the debug messages of every getattr, errors only against
+# everything logged
+for level in 3 7; do
+	mount_ofs "$options,loglevel=$level"
+	run getattr "$mnt/meta" `expr 2000 \* $SCALE` $level
+	unmount
+done
+
+# time to the first op of a new mount whose state tracks this many paths,
+# the empty mount point has no file until OFS serves it
+for paths in 10000 100000 1000000; do
+	state=$work/startup-$paths
+	"$OFSBENCH" track "$state" $paths
+	mkdir "$state/cache"
+	run startup "$mnt/seq" $paths "$OFS" "file://$remote" "$mnt" \
+		-o "backing=$state/cache,statedir=$state,shareid=bench${BENCH_OPTIONS:+,$BENCH_OPTIONS}"
+	unmount
+	rm -rf "$state"
+done
+
+mount_ofs "$options"
+"$OFSBENCH" pin "$mnt/tracked" > /dev/null
+
+# stat the pinned files from more and more threads at once
+for threads in 1 2 4 8 16; do
+	run stat-storm "$mnt/tracked" `expr 100000 \* $SCALE` $threads
+done
+
+# offline small writes while the write-back tracks 100000 other paths
+run tracked-edit "$mnt" "$mnt/tracked" `expr 100000 \* $SCALE` `expr 1000 \* $SCALE`
+
+unmount
+
+# the components alone, in this process with a scratch state directory
+run dirty-check "$work/dirty-state" `expr 100000 \* $SCALE` 100000
+run pinned-lookup "$work/pinned-state" `expr 10000 \* $SCALE` 100000
+run journal-append "$work/append-1" 1 `expr 16000 \* $SCALE`
+run journal-append "$work/append-16" 16 `expr 1000 \* $SCALE`
+for threads in 1 4 16; do
+	run_delayed "$remote" walk "$work/walk-$threads" "$remote" /walk $threads
+	rm -rf "$work/walk-$threads"
+done
+for readahead in 0 1024 4096; do
+	run_delayed "$remote" remote-read "$remote/read" $readahead 1000
+done
+# 10 distinct files, the others edited copies, copied and deduplicated
+run fill "$work/fill" "$remote" /dedup
+run fill "$work/dedup-fill" "$remote" /dedup dedup
+rm -rf "$work/fill" "$work/dedup-fill"
+run copy "$work/copy" 4096 1000
+run copy "$work/copy" 1048576 100
+run copy "$work/copy" 4294967296 1
+
+{
+	echo "{"
+	echo "  \"version\": \"${PACKAGE_VERSION:-unknown}\","
+	echo "  \"date\": \"`date -u +%Y-%m-%dT%H:%M:%SZ`\","
+	echo "  \"host\": \"`uname -n`\","
+	echo "  \"options\": \"$BENCH_OPTIONS\","
+	echo "  \"scale\": $SCALE,"
+	echo "  \"results\": ["
+	sed -e 's/^/    /' -e '$!s/$/,/' "$results"
+	echo "  ]"
+	echo "}"
+} > "$out"
+# the daemon's own view of the run, next to the results
+cp "$work/stats" "${out%.json}.prom" 2>/dev/null || true
+echo "run-bench.sh: results written to $out" >&2
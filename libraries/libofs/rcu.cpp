@@ -0,0 +1,111 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "rcu.h"
+#include <sched.h>
+
+volatile unsigned long Rcu::period = 1;
+Rcu::Reader *Rcu::readers = NULL;
+pthread_mutex_t Rcu::registry = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t Rcu::key;
+pthread_once_t Rcu::keyOnce = PTHREAD_ONCE_INIT;
+/// record of the calling thread, the key only removes it at thread exit
+static __thread void *ownReader = NULL;
+
+void Rcu::readLock()
+{
+    Reader *reader = self();
+    if (reader->nesting++ == 0) {
+        reader->period = period;
+        // the period is visible to synchronize() before anything is read
+        __sync_synchronize();
+    }
+}
+
+void Rcu::readUnlock()
+{
+    Reader *reader = self();
+    if (--reader->nesting == 0) {
+        __sync_synchronize();
+        reader->period = 0;
+    }
+}
+
+/**
+ * Starts a new grace period and waits for the readers that have
+ * entered their section in an earlier one
+ */
+void Rcu::synchronize()
+{
+    __sync_synchronize();
+    pthread_mutex_lock(&registry);
+    unsigned long current = __sync_add_and_fetch(&period, 1);
+    for (Reader *reader = readers; reader != NULL; reader = reader->next) {
+        for (;;) {
+            unsigned long started = reader->period;
+            if (started == 0 || started >= current)
+                break;
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&registry);
+    __sync_synchronize();
+}
+
+/**
+ * Get the record of the calling thread, registering it on first use
+ */
+Rcu::Reader *Rcu::self()
+{
+    Reader *reader = (Reader *)ownReader;
+    if (reader == NULL) {
+        pthread_once(&keyOnce, createKey);
+        reader = new Reader;
+        reader->period = 0;
+        reader->nesting = 0;
+        pthread_mutex_lock(&registry);
+        reader->next = readers;
+        readers = reader;
+        pthread_mutex_unlock(&registry);
+        pthread_setspecific(key, reader);
+        ownReader = reader;
+    }
+    return reader;
+}
+
+void Rcu::createKey()
+{
+    pthread_key_create(&key, unregister);
+}
+
+/**
+ * Remove the record of an exiting thread
+ */
+void Rcu::unregister(void *reader)
+{
+    pthread_mutex_lock(&registry);
+    for (Reader **it = &readers; *it != NULL; it = &(*it)->next) {
+        if (*it == reader) {
+            *it = (*it)->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry);
+    delete (Reader *)reader;
+}
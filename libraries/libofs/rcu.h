@@ -0,0 +1,127 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RCU_H
+#define RCU_H
+#include <pthread.h>
+
+/**
+ * Read-copy-update for state that is read by every file system operation
+ * but rarely changed.
+ *
+ * Readers enclose their accesses in readLock()/readUnlock() (or a
+ * #RcuReadLocker) and take no lock: they only write to their own
+ * per-thread record. Writers never change a published object, they
+ * publish a changed copy through an #RcuPointer, which waits in
+ * synchronize() until no reader can still see the old copy and then
+ * deletes it.
+ *
+ * A thread must not call synchronize() (or publish anything) while it is
+ * inside a read-side section, it would wait for itself.
+ */
+class Rcu
+{
+public:
+    /**
+     * Enter a read-side section, may be nested
+     */
+    static void readLock();
+    /**
+     * Leave a read-side section
+     */
+    static void readUnlock();
+    /**
+     * Wait until all read-side sections that might have seen an object
+     * replaced before this call have ended
+     */
+    static void synchronize();
+
+private:
+    struct Reader
+    {
+        /// grace period the thread's section has started in, 0 outside
+        volatile unsigned long period;
+        int nesting;
+        Reader *next;
+    };
+
+    static Reader *self();
+    static void createKey();
+    static void unregister(void *reader);
+
+    static volatile unsigned long period;
+    static Reader *readers;
+    static pthread_mutex_t registry;
+    static pthread_key_t key;
+    static pthread_once_t keyOnce;
+};
+
+/**
+ * Keeps a read-side section open while in scope
+ */
+class RcuReadLocker
+{
+public:
+    RcuReadLocker() { Rcu::readLock(); }
+    ~RcuReadLocker() { Rcu::readUnlock(); }
+private:
+    RcuReadLocker(const RcuReadLocker&);
+    RcuReadLocker& operator=(const RcuReadLocker&);
+};
+
+/**
+ * Pointer to the current version of an object protected by #Rcu
+ *
+ * Writers have to be serialized by the owner of the pointer.
+ */
+template <class T>
+class RcuPointer
+{
+public:
+    explicit RcuPointer(T *initial) : current(initial) {}
+    ~RcuPointer() { delete current; }
+
+    /**
+     * Get the current version, which may only be used until the
+     * enclosing read-side section ends, or by the writer
+     */
+    inline const T *get() const { return current; }
+    /**
+     * Replace the current version and delete the old one once no reader
+     * uses it any more
+     * @param next new version, owned by the pointer from now on
+     */
+    void publish(T *next)
+    {
+        T *old = current;
+        // the new version is complete before readers can see it
+        __sync_synchronize();
+        current = next;
+        Rcu::synchronize();
+        delete old;
+    }
+
+private:
+    RcuPointer(const RcuPointer&);
+    RcuPointer& operator=(const RcuPointer&);
+
+    T * volatile current;
+};
+
+#endif
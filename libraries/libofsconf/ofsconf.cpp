@@ -28,12 +28,14 @@
 #define REMOTE_SHARE_VARNAME "remoteShare"
 #define LISTEN_DEVICES_VARNAME "listen"
 #define LOGLEVEL_VARNAME "loglevel"
+#define LOGFILE_VARNAME "logfile"
 
 // TODO: Do not hard code paths here. Add these to configuration.
 #define BACKING_TREE_PATH_DEFAULT OFS_STATE_DIR"/backing"
 #define MOUNT_REMOTE_PATHS_TO_DEFAULT OFS_STATE_DIR"/remote"
 #define LISTEN_DEVICES_DEFAULT "{eth0}"
 #define LOGLEVEL_DEFAULT LOG_INFO
+#define LOGFILE_DEFAULT ""
 
 // Initializes the class attributes.
 std::auto_ptr<OFSConf> OFSConf::theOFSConfInstance;
@@ -94,6 +96,7 @@ bool OFSConf::ParseFile()
 	CFG_STR(LISTEN_DEVICES_VARNAME,
 		LISTEN_DEVICES_DEFAULT, CFGF_NONE),
 	CFG_INT(LOGLEVEL_VARNAME,LOGLEVEL_DEFAULT,CFGF_NONE),
+	CFG_STR(LOGFILE_VARNAME,LOGFILE_DEFAULT,CFGF_NONE),
         CFG_END()
     };
 
@@ -111,6 +114,8 @@ bool OFSConf::ParseFile()
     backingPath = cfg_getstr(m_pCFG, BACKING_TREE_PATH_VARNAME);
     // log level
     m_logLvl = cfg_getint(m_pCFG,LOGLEVEL_VARNAME);
+    // log file, syslog if empty
+    m_logFile = cfg_getstr(m_pCFG,LOGFILE_VARNAME);
     // listening devices
     listendevices.clear();
     for(unsigned int i=0; i < cfg_size(m_pCFG, LISTEN_DEVICES_VARNAME); i++) {
@@ -84,6 +84,11 @@ public:
      * @return current loglevel
      */
     int GetLogLevel() { return m_logLvl;} ;
+    /**
+     * Return the file to log to instead of syslog
+     * @return path of the log file, empty for syslog
+     */
+    string GetLogFile() { return m_logFile;} ;
 
 
 protected:
@@ -113,6 +118,7 @@ private:
     string backingPath;
     list<string> listendevices;
     int m_logLvl;
+    string m_logFile;
 };
 
 #endif
@@ -29,3 +29,71 @@ string ofs_hash(string str) {
 	hash = hash.substr(0, hash.length() - 1);
 	return hash;
 }
+
+static unsigned int crc32_table[256];
+static bool crc32_table_ready = false;
+
+static void crc32_init_table() {
+	for(unsigned int i = 0; i < 256; i++) {
+		unsigned int c = i;
+		for(int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		crc32_table[i] = c;
+	}
+	crc32_table_ready = true;
+}
+
+unsigned int ofs_crc32(unsigned int crc, const void *buf, size_t len) {
+	// building the table twice from concurrent threads yields the same values
+	if(!crc32_table_ready)
+		crc32_init_table();
+	const unsigned char *p = (const unsigned char *)buf;
+	crc = crc ^ 0xFFFFFFFFU;
+	while(len--)
+		crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFU;
+}
+
+string ofs_sha1_hex(const void *buf, size_t len) {
+	static const char digits[] = "0123456789abcdef";
+	unsigned char sha1hash[20];
+	sha1((unsigned char *)buf, len, sha1hash);
+	string hex(40, '0');
+	for(int i = 0; i < 20; i++) {
+		hex[2*i] = digits[sha1hash[i] >> 4];
+		hex[2*i+1] = digits[sha1hash[i] & 0x0F];
+	}
+	return hex;
+}
+
+static unsigned long long gear_table[256];
+static bool gear_table_ready = false;
+
+static void gear_init_table() {
+	// fixed seed: the chunk boundaries must not change between runs
+	unsigned long long x = 0x9E3779B97F4A7C15ULL;
+	for(int i = 0; i < 256; i++) {
+		// xorshift64*
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		gear_table[i] = x * 0x2545F4914F6CDD1DULL;
+	}
+	gear_table_ready = true;
+}
+
+size_t ofs_chunk_length(const unsigned char *buf, size_t len,
+                        size_t min_size, unsigned long long mask, size_t max_size) {
+	if(!gear_table_ready)
+		gear_init_table();
+	if(len <= min_size)
+		return len;
+	size_t end = len < max_size ? len : max_size;
+	unsigned long long hash = 0;
+	for(size_t i = min_size; i < end; i++) {
+		hash = (hash << 1) + gear_table[buf[i]];
+		if((hash & mask) == 0)
+			return i + 1;
+	}
+	return end;
+}
@@ -18,6 +18,40 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include <string>
+#include <cstddef>
 using namespace std;
 
 string ofs_hash(string str);
+
+/**
+ * CRC-32 (IEEE 802.3 polynomial) over a buffer
+ * @param crc CRC of the preceding data or 0 to start a new checksum
+ * @param buf data to checksum
+ * @param len length of data in bytes
+ * @return updated checksum
+ */
+unsigned int ofs_crc32(unsigned int crc, const void *buf, size_t len);
+
+/**
+ * SHA-1 of a buffer as lower case hex string
+ * @param buf data to hash
+ * @param len length of data in bytes
+ * @return 40 hex digits
+ */
+string ofs_sha1_hex(const void *buf, size_t len);
+
+/**
+ * Find the end of the next content-defined chunk. Cut points are chosen
+ * by a rolling gear hash, so an insertion only changes the chunks around
+ * it and equal content produces equal chunks regardless of its offset.
+ * @param buf data starting at the beginning of the chunk
+ * @param len number of bytes available
+ * @param min_size smallest chunk size
+ * @param mask cut where (hash & mask) == 0, the average chunk size is
+ *             about min_size + mask + 1
+ * @param max_size largest chunk size
+ * @return length of the chunk, len if no cut point was found within
+ *         len bytes (and len < max_size)
+ */
+size_t ofs_chunk_length(const unsigned char *buf, size_t len,
+                        size_t min_size, unsigned long long mask, size_t max_size);
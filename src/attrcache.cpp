@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "attrcache.h"
+#include "ofsenvironment.h"
+#include "ofslog.h"
+
+std::auto_ptr<AttrCache> AttrCache::theAttrCacheInstance;
+Mutex AttrCache::m;
+pthread_once_t AttrCache::instanceOnce = PTHREAD_ONCE_INIT;
+
+AttrCache::AttrCache() : generation(0), hits(0), misses(0)
+{
+    ttl = static_cast<long long>(OFSEnvironment::Instance().getAttrCacheTimeout())
+        * 1000000LL;
+}
+
+AttrCache::~AttrCache()
+{
+}
+
+AttrCache& AttrCache::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theAttrCacheInstance;
+}
+
+void AttrCache::createInstance()
+{
+    theAttrCacheInstance.reset(new AttrCache);
+}
+
+long long AttrCache::now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<long long>(tv.tv_sec) * 1000000LL + tv.tv_usec;
+}
+
+string AttrCache::parent(const string& path)
+{
+    string::size_type pos = path.rfind('/');
+    if (pos == string::npos || pos == 0)
+        return "/";
+    return path.substr(0, pos);
+}
+
+bool AttrCache::lookup(const string& path, struct stat *stbuf)
+{
+    if (!isEnabled())
+        return false;
+    long long time = now();
+    MutexLocker obtain_lock(m);
+    map<string, Entry>::iterator it = entries.find(path);
+    if (it != entries.end())
+    {
+        // an entry from the future means the clock has been set back
+        if (time >= it->second.stored && time - it->second.stored < ttl)
+        {
+            *stbuf = it->second.attributes;
+            ++hits;
+            return true;
+        }
+        entries.erase(it);
+    }
+    ++misses;
+    return false;
+}
+
+unsigned long AttrCache::getGeneration()
+{
+    MutexLocker obtain_lock(m);
+    return generation;
+}
+
+void AttrCache::insert(const string& path, const struct stat *stbuf,
+                       unsigned long generation)
+{
+    if (!isEnabled())
+        return;
+    long long time = now();
+    MutexLocker obtain_lock(m);
+    if (generation != this->generation)
+        return;
+    if (entries.size() >= ATTR_CACHE_MAX_ENTRIES && entries.find(path) == entries.end())
+    {
+        expire(time);
+        if (entries.size() >= ATTR_CACHE_MAX_ENTRIES)
+            entries.clear();
+    }
+    Entry& entry = entries[path];
+    entry.attributes = *stbuf;
+    entry.stored = time;
+}
+
+void AttrCache::expire(long long time)
+{
+    map<string, Entry>::iterator it = entries.begin();
+    while (it != entries.end())
+    {
+        if (time < it->second.stored || time - it->second.stored >= ttl)
+            entries.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void AttrCache::invalidate(const string& path)
+{
+    if (!isEnabled())
+        return;
+    MutexLocker obtain_lock(m);
+    ++generation;
+    entries.erase(path);
+}
+
+void AttrCache::invalidateTree(const string& path)
+{
+    if (!isEnabled())
+        return;
+    MutexLocker obtain_lock(m);
+    ++generation;
+    entries.erase(path);
+    entries.erase(parent(path));
+    // "/a/b/" sorts before everything below /a/b and after /a/b itself,
+    // so /a/bc is not touched
+    string prefix = path == "/" ? path : path + "/";
+    map<string, Entry>::iterator it = entries.lower_bound(prefix);
+    while (it != entries.end() && it->first.compare(0, prefix.length(), prefix) == 0)
+        entries.erase(it++);
+}
+
+void AttrCache::invalidateAll()
+{
+    if (!isEnabled())
+        return;
+    MutexLocker obtain_lock(m);
+    ++generation;
+    entries.clear();
+}
+
+void AttrCache::logStatistics()
+{
+    if (!isEnabled())
+        return;
+    MutexLocker obtain_lock(m);
+    unsigned long long total = hits + misses;
+    ofslog::info("Attribute cache: %lu entries, %llu hits, %llu misses (%.1f%% hits)",
+                 static_cast<unsigned long>(entries.size()), hits, misses,
+                 total ? 100.0 * hits / total : 0.0);
+}
@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ATTRCACHE_H
+#define ATTRCACHE_H
+
+#include "mutexlocker.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+#include <map>
+#include <memory>
+
+using namespace std;
+
+/// the cache is emptied of expired entries when it grows beyond this size
+#define ATTR_CACHE_MAX_ENTRIES 65536
+
+/**
+ * Keeps the attributes returned by op_getattr for a short time (mount
+ * option "attrcache"), so repeated stat() calls do not cost a round trip
+ * to the remote file system each.
+ *
+ * Entries are keyed by the path relative to the share root. Every
+ * operation that changes a file drops the entry of the file and of its
+ * parent directory; a change of the availability drops all entries,
+ * because the attributes are then read from the other tree. Changes
+ * made on the remote side by other clients are only noticed when the
+ * entry expires.
+ */
+class AttrCache
+{
+public:
+    static AttrCache& Instance();
+    ~AttrCache();
+
+    /**
+     * Get the cached attributes of a path
+     * @param path path relative to the share root
+     * @param stbuf (out) receives the attributes
+     * @return false if there is no valid entry
+     */
+    bool lookup(const string& path, struct stat *stbuf);
+    /**
+     * Get the invalidation counter, to be passed to insert()
+     *
+     * Must be read before the attributes are read from the file system,
+     * so attributes that were read before a concurrent modification
+     * are not stored after the modification invalidated them.
+     */
+    unsigned long getGeneration();
+    /**
+     * Remember the attributes of a path
+     * @param path path relative to the share root
+     * @param stbuf attributes read from the file system
+     * @param generation result of getGeneration() before reading them
+     */
+    void insert(const string& path, const struct stat *stbuf,
+                unsigned long generation);
+    /**
+     * Drop the entry of a path
+     * @param path path relative to the share root
+     */
+    void invalidate(const string& path);
+    /**
+     * Drop the entries of a path, of everything below it and of its
+     * parent directory (rename and removal of directories)
+     * @param path path relative to the share root
+     */
+    void invalidateTree(const string& path);
+    /**
+     * Drop all entries
+     */
+    void invalidateAll();
+    /**
+     * Is the cache enabled at all?
+     */
+    inline bool isEnabled() { return ttl > 0; };
+    inline unsigned long long getHits() { return hits; };
+    inline unsigned long long getMisses() { return misses; };
+    /**
+     * Write the hit rate to the log
+     */
+    void logStatistics();
+
+protected:
+    AttrCache();
+
+private:
+    struct Entry
+    {
+        struct stat attributes;
+        /// time the attributes were read, in microseconds
+        long long stored;
+    };
+
+    static long long now();
+    static string parent(const string& path);
+    void expire(long long time);
+
+    map<string, Entry> entries;
+    /// time to live of an entry in microseconds, 0 disables the cache
+    long long ttl;
+    /// incremented by every invalidation
+    unsigned long generation;
+    unsigned long long hits;
+    unsigned long long misses;
+    static std::auto_ptr<AttrCache> theAttrCacheInstance;
+    static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+};
+
+/**
+ * Invalidates the attribute cache entries of a path when it goes out of
+ * scope, that is after the modifying operation has returned on whatever
+ * path
+ */
+class AttrCacheInvalidator
+{
+public:
+    /**
+     * @param path path relative to the share root
+     * @param tree also drop the parent directory and everything below the
+     *             path (operations that add, remove or rename entries)
+     */
+    AttrCacheInvalidator(const string& path, bool tree = false) :
+        path(path), tree(tree) {}
+    ~AttrCacheInvalidator()
+    {
+        if (tree)
+            AttrCache::Instance().invalidateTree(path);
+        else
+            AttrCache::Instance().invalidate(path);
+    }
+private:
+    string path;
+    bool tree;
+};
+
+#endif
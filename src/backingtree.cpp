@@ -21,11 +21,20 @@
 #include "filesystemstatusmanager.h"
 #include "ofsfile.h"
 #include "ofslog.h"
+#include "ofsenvironment.h"
+#include "chunkstore.h"
+#include "attrcache.h"
+#include "treewalker.h"
+#include "manifest.h"
+#include "placeholdermanager.h"
 #include <unistd.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
-#include <map>
+#include <set>
+#include <list>
+#include <memory>
 using namespace std;
 
 Backingtree::Backingtree(string rPath, string cPath) : status(online)
@@ -56,23 +65,27 @@ const string Backingtree::get_relative_path() {
 	return relative_path;
 }
 
+/**
+ * Check if parent is path itself or one of its parent directories,
+ * /foo is a parent of /foo/bar but not of /foobar
+ */
+static bool is_path_below(const string &path, const string &parent)
+{
+	if(path.compare(0, parent.length(), parent) != 0)
+		return false;
+	return path.length() == parent.length() || parent.empty()
+		|| parent[parent.length()-1] == '/' || path[parent.length()] == '/';
+}
+
 bool Backingtree::is_in_backingtree(string path)
 {
-	if(path.length() >= relative_path.length() &&
-		path.substr(0,relative_path.length()) == relative_path) {
-		return true;
-	}
-	return false;
+	return is_path_below(path, relative_path);
 }
 
 
 bool Backingtree::backingtree_is_in(string path)
 {
-	if(relative_path.length() >= path.length() &&
-		relative_path.substr(0,path.length()) == path) {
-		return true;
-	}
-	return false;
+	return is_path_below(relative_path, path);
 }
 
 string Backingtree::get_cache_path(string path)
@@ -104,11 +117,20 @@ void *Backingtree::updateCacheThread(void *arg)
     Backingtree *back = (Backingtree *)arg;
 	try
 	{
+		struct timeval start, end;
 		ofslog::info("Updating cache.");
+        gettimeofday(&start, NULL);
         back->status = updating;
         back->updateCacheRunner(back->get_relative_path());
         back->status = online;
-        ofslog::info("Update cache finished.");
+        gettimeofday(&end, NULL);
+        ofslog::info("Update cache finished in %.2fs.",
+            (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0);
+        if (OFSEnvironment::Instance().isDedup())
+            ChunkStore::Instance().collectGarbage();
+        if (OFSEnvironment::Instance().isLazyPin())
+            PlaceholderManager::Instance().startFetching();
+        AttrCache::Instance().logStatistics();
 	}
 	catch(OFSException &e)
 	{
@@ -118,12 +140,127 @@ void *Backingtree::updateCacheThread(void *arg)
     return NULL;
 }
 
+/**
+ * Passes the entries found by the walker to the backing tree and keeps
+ * the manifest, if there is one
+ */
+class CacheUpdater : public TreeWalker::Visitor
+{
+public:
+    /**
+     * @param manifest manifest to compare with and to fill, or NULL
+     * @param compare the manifest holds the last update
+     */
+    CacheUpdater(Backingtree& back, Manifest* manifest, bool compare)
+        : back(back), manifest(manifest), compare(compare), failed(false) {}
+    virtual void visitDirectory(const string& relativePath,
+                                list<string>& subdirs, list<string>& files)
+    {
+        struct stat remoteinfo;
+        bool known = false;
+        if (manifest != NULL)
+        {
+            OFSFile file(relativePath);
+            known = lstat(file.get_remote_path().c_str(), &remoteinfo) == 0;
+            // nothing has been added, removed or renamed in it, but the
+            // sub-directories may have changed
+            if (known && compare && manifest->unchanged(relativePath, remoteinfo)
+                && is_cached(file))
+            {
+                list<string> unchangedFiles;
+                manifest->listDirectory(relativePath, subdirs, unchangedFiles);
+                manifest->carryOver(relativePath);
+                manifest->add(relativePath, remoteinfo);
+                return;
+            }
+        }
+        if (!back.updateDirectory(relativePath, subdirs, files))
+            failed = true;
+        else if (known)
+            manifest->add(relativePath, remoteinfo);
+    }
+    virtual void visitFile(const string& relativePath)
+    {
+        try
+        {
+            // make sure the file is current
+            OFSFile file(relativePath);
+            struct stat remoteinfo;
+            bool known = manifest != NULL
+                && lstat(file.get_remote_path().c_str(), &remoteinfo) == 0;
+            ///\todo Only update the file if it has no local modifications
+            if (!known || !compare || !manifest->unchanged(relativePath, remoteinfo)
+                || !is_cached(file))
+                file.update_cache(true);
+            if (known)
+                manifest->add(relativePath, remoteinfo);
+        }
+        catch(OFSException &e)
+        {
+            failed = true;
+            ofslog::error("%s (%d) - %s", e.what(), e.get_posixerrno(), relativePath.c_str());
+        }
+    }
+    /**
+     * Has anything not been updated?
+     */
+    inline bool hasFailed() const { return failed; };
+private:
+    static bool is_cached(OFSFile& file)
+    {
+        struct stat cacheinfo;
+        return lstat(file.get_cache_path().c_str(), &cacheinfo) == 0;
+    }
+
+    Backingtree& back;
+    Manifest* manifest;
+    bool compare;
+    volatile bool failed;
+};
+
+/**
+ * Is the directory entry a directory? Only calls lstat if readdir
+ * does not tell.
+ */
+static bool is_directory(const string& absoluteDir, const struct dirent *entry)
+{
+    if(entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR;
+    struct stat fileinfo;
+    string absolutePath = absoluteDir+"/"+entry->d_name;
+    return lstat(absolutePath.c_str(), &fileinfo) == 0 && S_ISDIR(fileinfo.st_mode);
+}
+
 void Backingtree::updateCacheRunner(string relativeDir)
+{
+    TreeWalker walker("Updating cache of "+relativeDir);
+    std::auto_ptr<Manifest> manifest;
+    bool compare = false;
+    if (OFSEnvironment::Instance().isManifest())
+    {
+        manifest.reset(new Manifest(relativeDir));
+        compare = manifest->load();
+    }
+    CacheUpdater updater(*this, manifest.get(), compare);
+    walker.run(updater, relativeDir, OFSEnvironment::Instance().getCacheThreads());
+    ofslog::info("Updated %ld directories and %ld files in %s",
+        walker.getDirectories(), walker.getFiles(), relativeDir.c_str());
+    if (manifest.get() != NULL)
+    {
+        // skipping what failed now would hide it from all later updates
+        if (updater.hasFailed())
+            manifest->discard();
+        else
+            manifest->save();
+    }
+}
+
+bool Backingtree::updateDirectory(const string& relativeDir,
+    list<string>& subdirs, list<string>& files)
 {
     struct dirent *entry;
-    struct stat fileinfo;
-    map<string, struct stat> subdirs;
-    map<string, struct stat> regularfiles;    
+    set<string> remoteSubdirs;
+    set<string> remoteFiles;
     // update this directory
     OFSFile file(relativeDir);
     ///\todo What to do if there are local modifications regarding stat information
@@ -131,44 +268,32 @@ void Backingtree::updateCacheRunner(string relativeDir)
         file.update_cache();
     } catch (OFSException &e) {
     	ofslog::error("%s (%d) - %s", e.what(), e.get_posixerrno(), file.get_relative_path().c_str());
-    	return;
+    	return false;
     }
     string absoluteRemoteDir = file.get_remote_path();
-    string absoluteCacheDir = file.get_cache_path();;
+    string absoluteCacheDir = file.get_cache_path();
 
-    // first traverse remote directory 
-    // and make sure all files and directories in the cache are current
+    // first traverse remote directory, the files and sub-directories
+    // are made current by the walker
     DIR *dir = opendir(absoluteRemoteDir.c_str());
     if(dir == NULL)
-        return; ///\todo do something on error
+        return false; ///\todo do something on error
     
     while( (entry = readdir(dir)) != NULL)
     {
         string filename = entry->d_name;
         if(filename == "." || filename == "..")
             continue;
-        string absolutePath = absoluteRemoteDir+"/"+filename;
         string relativePath = relativeDir+"/"+filename;
-        int ret = lstat(absolutePath.c_str(), &fileinfo);
-        if(ret == 0)
+        if(is_directory(absoluteRemoteDir, entry))
         {
-            if(S_ISDIR(fileinfo.st_mode))
-                subdirs[filename] = fileinfo;
-            else
-            {
-            	try
-            	{
-                    regularfiles[filename] = fileinfo;
-            		// make sure the file is current
-                    OFSFile file(relativePath);
-                    ///\todo Only update the file if it has no local modifications
-                    file.update_cache();
-            	}
-            	catch(OFSException &e)
-            	{
-                	ofslog::error("%s (%d) - %s", e.what(), e.get_posixerrno(), relativePath.c_str());
-            	}
-            }
+            remoteSubdirs.insert(filename);
+            subdirs.push_back(relativePath);
+        }
+        else
+        {
+            remoteFiles.insert(filename);
+            files.push_back(relativePath);
         }
     }
     closedir(dir);
@@ -178,7 +303,7 @@ void Backingtree::updateCacheRunner(string relativeDir)
     dir = opendir(absoluteCacheDir.c_str());
     if( dir == NULL )
     {
-        return; ///\todo do something on error
+        return false; ///\todo do something on error
     }
     while( (entry = readdir(dir) ) != NULL)
     {
@@ -186,38 +311,20 @@ void Backingtree::updateCacheRunner(string relativeDir)
         if(filename == "." || filename == "..")
             continue;
         string absolutePath = absoluteCacheDir+"/"+filename;
-        string relativePath = relativeDir+"/"+filename;
         ///\todo Only delete the file if it has no local modifications
-        int ret = lstat(absolutePath.c_str(), &fileinfo);
-        if(ret == 0)
+        if(is_directory(absoluteCacheDir, entry))
         {
-            if(S_ISDIR(fileinfo.st_mode))
-            {
-                map<string, struct stat>::iterator iter = subdirs.find(filename);
-                if(iter == subdirs.end())
-                {
-                    this->recurs_rmdir(absolutePath);
-                }
-            }
-            else
-            {
-                map<string, struct stat>::iterator iter = regularfiles.find(filename);
-                if(iter == regularfiles.end())
-                {
-                    unlink(absolutePath.c_str());
-                }
-            }
+            if(remoteSubdirs.find(filename) == remoteSubdirs.end())
+                this->recurs_rmdir(absolutePath);
+        }
+        else
+        {
+            if(remoteFiles.find(filename) == remoteFiles.end())
+                unlink(absolutePath.c_str());
         }
     }
     closedir(dir);
-    
-    // recurse into sub-directories
-    map<string, struct stat>::iterator iter = subdirs.begin();
-    while(iter != subdirs.end())
-    {
-        updateCacheRunner(relativeDir+"/"+iter->first);
-        iter++;
-    }
+    return true;
 }
 
 /**
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <vector>
+#include <list>
 #include "file.h"
 // #include "fileref.h"
 #include "mutex.h"
@@ -87,7 +88,22 @@ public:
      * Start a thread updating the cache for this backing tree
      */
     void updateCache();
+    /**
+     * Make the cache of the tree below a directory current, using
+     * getCacheThreads() workers
+     * @param str path of the directory
+     */
     void updateCacheRunner(string str);
+    /**
+     * Make a single directory current and remove the entries which
+     * have been removed from the remote directory
+     * @param relativeDir path of the directory
+     * @param subdirs (out) receives the sub-directories to update
+     * @param files (out) receives the other entries to update
+     * @return false if the directory could not be updated
+     */
+    bool updateDirectory(const string& relativeDir,
+        list<string>& subdirs, list<string>& files);
     static void *updateCacheThread(void *);
 protected:
     string relative_path;
@@ -19,18 +19,23 @@
  ***************************************************************************/
 #include "backingtreemanager.h"
 #include "ofsenvironment.h"
+#include "filestatusmanager.h"
 
 std::auto_ptr<BackingtreeManager> BackingtreeManager::theBackingtreeManagerInstance;
 Mutex BackingtreeManager::m;
-BackingtreeManager::BackingtreeManager(){}
+pthread_once_t BackingtreeManager::instanceOnce = PTHREAD_ONCE_INIT;
+BackingtreeManager::BackingtreeManager() : backingtrees(new BackingtreeSet) {}
 BackingtreeManager::~BackingtreeManager(){}
 BackingtreeManager& BackingtreeManager::Instance()
 {
-    MutexLocker obtain_lock(m);
-    if (theBackingtreeManagerInstance.get() == 0)
-      theBackingtreeManagerInstance.reset(new BackingtreeManager());
+    pthread_once(&instanceOnce, createInstance);
     return *theBackingtreeManagerInstance;
 }
+
+void BackingtreeManager::createInstance()
+{
+    theBackingtreeManagerInstance.reset(new BackingtreeManager());
+}
 void BackingtreeManager::register_Backingtree(string relative_Path){
 	MutexLocker obtain_lock(m);
 	Backingtree back = Backingtree(
@@ -39,36 +44,44 @@ void BackingtreeManager::register_Backingtree(string relative_Path){
 	if(!Is_in_Backingtree(relative_Path)) {
 		// if there are backingtrees below this one, remove them,
 		// because the new one is the new root
+		list<Backingtree> trees = backingtrees.get()->trees;
 		list<Backingtree> subtrees =
 			getBackingtreesBelow(relative_Path);
 		for (list<Backingtree>::iterator it = subtrees.begin();
         		it != subtrees.end(); ++it) {
 			// I do not call the remove_Backingtree method here
 			// because this would always trigger persistation
-			backinglist.remove(*it);
+			trees.remove(*it);
 		}
 		// add the new backingtree and make list persistent
-		backinglist.push_back(back);
+		trees.push_back(back);
+		publish(trees);
 		persist();
+		Filestatusmanager::Instance().invalidate();
  	}
 	// start updating 
 	back.updateCache();
 }
 
 void BackingtreeManager::remove_Backingtree(string Relative_Path) {
-	for (list<Backingtree>::iterator it = backinglist.begin();
-        		it != backinglist.end(); ++it) {
+	MutexLocker obtain_lock(m);
+	list<Backingtree> trees = backingtrees.get()->trees;
+	for (list<Backingtree>::iterator it = trees.begin();
+        		it != trees.end(); ++it) {
 		if(it->get_relative_path() == Relative_Path)
 		{
-			backinglist.erase(it);
+			trees.erase(it);
 			break;
 		}
 	}
+	publish(trees);
 	persist();
+	Filestatusmanager::Instance().invalidate();
 }
 
 bool BackingtreeManager::Is_in_Backingtree(string path){
-	return Search_Backingtree_via_Path(path) != NULL;
+	string cache_path;
+	return Search_Backingtree_via_Path(path, cache_path);
 }
 string BackingtreeManager::get_Cache_Path()
 {
@@ -79,32 +92,53 @@ void BackingtreeManager::persist() const
 {
 	BackingtreePersistence &btp = BackingtreePersistence::Instance();
 	
-	btp.backingtrees(backinglist);
+	btp.backingtrees(backingtrees.get()->trees);
 }
 
 void BackingtreeManager::reinstate()
 {
 	BackingtreePersistence &btp = BackingtreePersistence::Instance();
-	backinglist=btp.backingtrees();
+	{
+		MutexLocker obtain_lock(m);
+		publish(btp.backingtrees());
+	}
+	Filestatusmanager::Instance().invalidate();
+}
+
+/**
+ * Replace the set of backingtrees, m has to be held
+ */
+void BackingtreeManager::publish(const list<Backingtree>& trees)
+{
+	BackingtreeSet *next = new BackingtreeSet;
+	next->trees = trees;
+	for (list<Backingtree>::iterator it = next->trees.begin();
+		it != next->trees.end(); ++it) {
+		next->index.insert(it->get_relative_path(), &(*it));
+	}
+	backingtrees.publish(next);
 }
 
 list<Backingtree> BackingtreeManager::getBackingtreesBelow(string path)
 {
+	list<Backingtree*> found;
 	list<Backingtree> trees;
-	for (list<Backingtree>::iterator it = backinglist.begin();
-		it != backinglist.end(); ++it) {
-		if(it->backingtree_is_in(path))
-			trees.push_back(*it);
+	RcuReadLocker read_lock;
+	backingtrees.get()->index.collectAtOrBelow(path, found);
+	for (list<Backingtree*>::iterator it = found.begin();
+		it != found.end(); ++it) {
+		trees.push_back(**it);
 	}
 	return trees;
 }
 
-Backingtree *BackingtreeManager::Search_Backingtree_via_Path(string path)
+bool BackingtreeManager::Search_Backingtree_via_Path(const string& path,
+                                                     string& cache_path)
 {
-	for (list<Backingtree>::iterator it = backinglist.begin();
-		it != backinglist.end(); ++it) {
-		if(it->is_in_backingtree(path))
-			return &(*it); // pull out pointer to element
-	}
-	return NULL;
+	RcuReadLocker read_lock;
+	Backingtree * const *back = backingtrees.get()->index.longestPrefix(path);
+	if (back == NULL)
+		return false;
+	cache_path = (*back)->get_cache_path(path);
+	return true;
 }
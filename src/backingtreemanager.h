@@ -23,6 +23,8 @@
 #include "backingtree.h"
 #include "persistable.h"
 #include "backingtreepersistence.h"
+#include "pathtrie.h"
+#include "rcu.h"
 #include <string>
 #include <list>
 #include <memory>
@@ -61,10 +63,13 @@ public:
     string get_Cache_Path();
     /**
      * Function to get the Backingtree to a given Path
-     * @param Relative_Path Path of the Backingtree
-     * @return Backingtree that manages the Path given or NULL of none
+     * @param Relative_Path Path of the file
+     * @param Cache_Path (out) receives the path of the file in the cache
+     *                   of the Backingtree that manages it
+     * @return false if no Backingtree manages the Path given
      */
-    Backingtree *Search_Backingtree_via_Path(string Relative_Path);
+    bool Search_Backingtree_via_Path(const string& Relative_Path,
+                                     string& Cache_Path);
     /**
      * Determines if a given file is in a Backingpath or not
      * @param path Path of the file
@@ -88,8 +93,21 @@ public:
 protected:
     BackingtreeManager();
   private:
+    /**
+     * The registered Backingtrees, never changed once published
+     */
+    struct BackingtreeSet
+    {
+        list<Backingtree> trees;
+        /// the elements of trees by their relative path
+        PathTrie<Backingtree*> index;
+    };
+    void publish(const list<Backingtree>& trees);
     static std::auto_ptr<BackingtreeManager> theBackingtreeManagerInstance;
-    list<Backingtree> backinglist;
+    /// read without locking, replaced by the writers holding m
+    RcuPointer<BackingtreeSet> backingtrees;
     static Mutex m; 
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 };
 #endif
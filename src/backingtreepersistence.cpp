@@ -50,21 +50,23 @@ cfg_opt_t *BackingtreePersistence::init_parser()
 	return opts;
 }
 
-string BackingtreePersistence::get_persistence()
+void BackingtreePersistence::get_records(map<string, string>& records)
 {
-	stringstream pers;
-	pers << CONFIGKEY_BACKINGTREES << " = {" << endl;
 	list<Backingtree>::iterator it;
-	bool first = true;
-	for ( it=p_backingtrees.begin() ; it != p_backingtrees.end(); it++ ) {
-		if(first)
-			first = false;
-		else
-			pers << "," << endl;
-		pers << "\"" << it->get_relative_path() << "\"";
-	}
-	pers << endl << "}" << endl;
-	return pers.str();
+	for ( it=p_backingtrees.begin() ; it != p_backingtrees.end(); it++ )
+		records[it->get_relative_path()] = "";
+}
+
+void BackingtreePersistence::set_records(const map<string, string>& records)
+{
+	p_backingtrees.clear();
+	map<string, string>::const_iterator it;
+	for ( it=records.begin() ; it != records.end(); it++ )
+		p_backingtrees.push_back(
+			Backingtree(it->first,
+			OFSEnvironment::Instance().getCachePath()
+				+it->first)
+			);
 }
 
 
@@ -57,7 +57,8 @@ protected:
      */
     BackingtreePersistence();
     virtual cfg_opt_t * init_parser();
-    virtual string get_persistence();
+    virtual void get_records(map<string, string>& records);
+    virtual void set_records(const map<string, string>& records);
     virtual void read_values();
 
 private:
@@ -0,0 +1,646 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "chunkstore.h"
+#include "ofsenvironment.h"
+#include "filestatusmanager.h"
+#include "synclogger.h"
+#include "ofshash.h"
+#include "ofslog.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <list>
+
+std::auto_ptr<ChunkStore> ChunkStore::theChunkStoreInstance;
+pthread_once_t ChunkStore::instanceOnce = PTHREAD_ONCE_INIT;
+
+/// fixed part of a recipe file, followed by the path and the chunk list
+struct RecipeHeader
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t state;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t pathLength;
+    int64_t size;
+};
+
+/// one entry of the chunk list
+struct RecipeChunk
+{
+    char hash[40];
+    uint32_t size;
+};
+
+#define RECIPE_STATE_OFFSET 5
+
+ChunkStore::ChunkStore() : importedBytes(0), storedBytes(0)
+{
+    basedir = OFSEnvironment::Instance().getOfsDir() + "/"
+        + OFSEnvironment::Instance().getShareID() + "_chunks";
+    load();
+}
+
+ChunkStore::~ChunkStore()
+{
+}
+
+ChunkStore& ChunkStore::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    if (theChunkStoreInstance.get() == 0)
+        throw OFSException("The chunk store could not be loaded", EIO, true);
+    return *theChunkStoreInstance;
+}
+
+/**
+ * The exception of a failed load must not leave pthread_once
+ */
+void ChunkStore::createInstance()
+{
+    try
+    {
+        theChunkStoreInstance.reset(new ChunkStore());
+    }
+    catch (OFSException& e)
+    {
+        ofslog::error("Could not load the chunk store: %s", e.what());
+    }
+}
+
+/**
+ * Create the directories, rebuild the reference counts from the recipes
+ * and remove chunks nobody refers to
+ */
+void ChunkStore::load()
+{
+    static const char digits[] = "0123456789abcdef";
+    mkdir(basedir.c_str(), S_IRWXU);
+    mkdir((basedir + "/recipes").c_str(), S_IRWXU);
+    mkdir((basedir + "/chunks").c_str(), S_IRWXU);
+    for (int i = 0; i < 256; i++)
+    {
+        char sub[3] = { digits[i >> 4], digits[i & 0x0F], '\0' };
+        mkdir((basedir + "/chunks/" + sub).c_str(), S_IRWXU);
+    }
+
+    DIR* dir = opendir((basedir + "/recipes").c_str());
+    if (dir == NULL)
+        throw OFSException(strerror(errno), errno, true);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        string filename = basedir + "/recipes/" + name;
+        Recipe recipe;
+        if (!readRecipe(filename, recipe) || recipeFile(recipe.path) != filename)
+        {
+            unlink(filename.c_str());
+            continue;
+        }
+        RecipeInfo& info = recipes[recipe.path];
+        info.state = recipe.state;
+        info.size = recipe.size;
+        ref(recipe);
+    }
+    closedir(dir);
+
+    int nRemoved = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        char sub[3] = { digits[i >> 4], digits[i & 0x0F], '\0' };
+        string subdir = basedir + "/chunks/" + sub;
+        dir = opendir(subdir.c_str());
+        if (dir == NULL)
+            continue;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+            if (chunks.find(sub + name) == chunks.end())
+            {
+                unlink((subdir + "/" + name).c_str());
+                nRemoved++;
+            }
+        }
+        closedir(dir);
+    }
+    ofslog::info("Chunk store: %d files, %d chunks, %d unreferenced chunks removed",
+                 (int)recipes.size(), (int)chunks.size(), nRemoved);
+}
+
+string ChunkStore::recipeFile(const string& relpath)
+{
+    return basedir + "/recipes/" + ofs_hash(relpath);
+}
+
+string ChunkStore::chunkFile(const string& hash)
+{
+    return basedir + "/chunks/" + hash.substr(0, 2) + "/" + hash.substr(2);
+}
+
+bool ChunkStore::readRecipe(const string& filename, Recipe& recipe)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    RecipeHeader header;
+    bool ok = fstat(fd, &st) == 0
+        && read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+        && memcmp(header.magic, RECIPE_MAGIC, 4) == 0
+        && header.version == RECIPE_FORMAT_VERSION
+        && st.st_size == (off_t)(sizeof(header) + header.pathLength
+                                 + (off_t)header.count * sizeof(RecipeChunk));
+    if (ok)
+    {
+        string data(st.st_size - sizeof(header), '\0');
+        ok = data.empty()
+            || read(fd, &data[0], data.size()) == (ssize_t)data.size();
+        if (ok)
+        {
+            recipe.state = header.state;
+            recipe.size = header.size;
+            recipe.path = data.substr(0, header.pathLength);
+            recipe.chunks.clear();
+            recipe.chunks.reserve(header.count);
+            const char* p = data.data() + header.pathLength;
+            for (uint32_t i = 0; i < header.count; i++, p += sizeof(RecipeChunk))
+            {
+                RecipeChunk chunk;
+                memcpy(&chunk, p, sizeof(chunk));
+                recipe.chunks.push_back(make_pair(string(chunk.hash, 40),
+                                                  (unsigned int)chunk.size));
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/**
+ * Create a temporary file next to filename. Each call gets a name of
+ * its own, so threads storing the same file never write into the same
+ * temporary file.
+ * @param tmpname (out) name of the temporary file
+ * @return file descriptor, -1 on errors
+ */
+static int create_temp(const string& filename, string& tmpname)
+{
+    static const char suffix[] = ".XXXXXX";
+    vector<char> name(filename.begin(), filename.end());
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    int fd = mkstemp(&name[0]);
+    if (fd >= 0)
+        tmpname = &name[0];
+    return fd;
+}
+
+void ChunkStore::writeRecipe(const Recipe& recipe) throw(OFSException)
+{
+    RecipeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECIPE_MAGIC, 4);
+    header.version = RECIPE_FORMAT_VERSION;
+    header.state = recipe.state;
+    header.count = recipe.chunks.size();
+    header.pathLength = recipe.path.length();
+    header.size = recipe.size;
+
+    string data((const char*)&header, sizeof(header));
+    data += recipe.path;
+    for (vector<pair<string, unsigned int> >::const_iterator it = recipe.chunks.begin();
+         it != recipe.chunks.end(); it++)
+    {
+        RecipeChunk chunk;
+        memcpy(chunk.hash, it->first.data(), 40);
+        chunk.size = it->second;
+        data.append((const char*)&chunk, sizeof(chunk));
+    }
+
+    string filename = recipeFile(recipe.path);
+    string tmpname;
+    int fd = create_temp(filename, tmpname);
+    if (fd < 0)
+        throw OFSException(strerror(errno), errno, true);
+    if (write(fd, data.data(), data.size()) != (ssize_t)data.size())
+    {
+        int err = errno ? errno : EIO;
+        close(fd);
+        unlink(tmpname.c_str());
+        throw OFSException(strerror(err), err, true);
+    }
+    close(fd);
+    if (::rename(tmpname.c_str(), filename.c_str()) < 0)
+    {
+        int err = errno;
+        unlink(tmpname.c_str());
+        throw OFSException(strerror(err), err, true);
+    }
+}
+
+void ChunkStore::setState(const string& relpath, char state)
+{
+    int fd = open(recipeFile(relpath).c_str(), O_WRONLY);
+    if (fd < 0)
+        return;
+    uint8_t value = state;
+    pwrite(fd, &value, 1, RECIPE_STATE_OFFSET);
+    close(fd);
+    recipes[relpath].state = state;
+}
+
+/**
+ * Store a chunk unless it exists already and take a reference on it
+ */
+void ChunkStore::storeChunk(const string& hash, const unsigned char* data, size_t len)
+    throw(OFSException)
+{
+    {
+        MutexLocker obtain_lock(storeMutex);
+        map<string, ChunkInfo>::iterator it = chunks.find(hash);
+        if (it != chunks.end() && it->second.refs > 0)
+        {
+            it->second.refs++;
+            return;
+        }
+    }
+
+    string filename = chunkFile(hash);
+    string tmpname;
+    int fd = create_temp(filename, tmpname);
+    if (fd < 0)
+        throw OFSException(strerror(errno), errno, true);
+    if (write(fd, data, len) != (ssize_t)len)
+    {
+        int err = errno ? errno : EIO;
+        close(fd);
+        unlink(tmpname.c_str());
+        throw OFSException(strerror(err), err, true);
+    }
+    close(fd);
+
+    MutexLocker obtain_lock(storeMutex);
+    map<string, ChunkInfo>::iterator it = chunks.find(hash);
+    // another thread stored the same chunk meanwhile
+    if (it != chunks.end() && it->second.refs > 0)
+    {
+        unlink(tmpname.c_str());
+        it->second.refs++;
+        return;
+    }
+    if (::rename(tmpname.c_str(), filename.c_str()) < 0)
+    {
+        int err = errno;
+        unlink(tmpname.c_str());
+        throw OFSException(strerror(err), err, true);
+    }
+    ChunkInfo& chunk = chunks[hash];
+    storedBytes += len;
+    chunk.refs++;
+    chunk.size = len;
+}
+
+void ChunkStore::ref(const Recipe& recipe)
+{
+    for (vector<pair<string, unsigned int> >::const_iterator it = recipe.chunks.begin();
+         it != recipe.chunks.end(); it++)
+    {
+        ChunkInfo& chunk = chunks[it->first];
+        chunk.refs++;
+        chunk.size = it->second;
+    }
+}
+
+void ChunkStore::unref(const Recipe& recipe)
+{
+    for (vector<pair<string, unsigned int> >::const_iterator it = recipe.chunks.begin();
+         it != recipe.chunks.end(); it++)
+    {
+        map<string, ChunkInfo>::iterator chunk = chunks.find(it->first);
+        if (chunk == chunks.end())
+            continue;
+        if (--chunk->second.refs <= 0)
+        {
+            unlink(chunkFile(it->first).c_str());
+            chunks.erase(chunk);
+        }
+    }
+}
+
+/**
+ * Remove the recipe of a path and release its chunks, called locked
+ */
+void ChunkStore::drop(const string& relpath)
+{
+    Recipe recipe;
+    string filename = recipeFile(relpath);
+    if (readRecipe(filename, recipe))
+        unref(recipe);
+    unlink(filename.c_str());
+    recipes.erase(relpath);
+}
+
+bool ChunkStore::import(const string& relpath, const string& source,
+                        const string& cachePath) throw(OFSException)
+{
+    int fd = open(source.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw OFSException(strerror(errno), errno, true);
+
+    Recipe recipe;
+    recipe.state = 'P';
+    recipe.size = 0;
+    recipe.path = relpath;
+    vector<unsigned char> buf(4 * CHUNK_MAX_SIZE);
+    size_t filled = 0;
+    size_t pos = 0;
+    bool eof = false;
+    try
+    {
+        while (true)
+        {
+            if (!eof && filled - pos < CHUNK_MAX_SIZE)
+            {
+                memmove(&buf[0], &buf[pos], filled - pos);
+                filled -= pos;
+                pos = 0;
+                while (!eof && filled < buf.size())
+                {
+                    ssize_t res = read(fd, &buf[filled], buf.size() - filled);
+                    if (res < 0 && errno == EINTR)
+                        continue;
+                    if (res < 0)
+                        throw OFSException(strerror(errno), errno, true);
+                    if (res == 0)
+                        eof = true;
+                    filled += res;
+                }
+            }
+            if (pos == filled)
+                break;
+            size_t len = ofs_chunk_length(&buf[pos], filled - pos,
+                                          CHUNK_MIN_SIZE, CHUNK_MASK, CHUNK_MAX_SIZE);
+            string hash = ofs_sha1_hex(&buf[pos], len);
+            storeChunk(hash, &buf[pos], len);
+            recipe.chunks.push_back(make_pair(hash, (unsigned int)len));
+            recipe.size += len;
+            pos += len;
+        }
+    }
+    catch (OFSException& e)
+    {
+        close(fd);
+        MutexLocker obtain_lock(storeMutex);
+        unref(recipe);
+        throw;
+    }
+    close(fd);
+
+    MutexLocker obtain_lock(storeMutex);
+    map<string, RecipeInfo>::iterator old = recipes.find(relpath);
+    if (old != recipes.end() && old->second.users > 0)
+    {
+        // somebody has the old content open, the caller makes a full copy
+        drop(relpath);
+        unref(recipe);
+        return false;
+    }
+    Recipe previous;
+    bool hadPrevious = readRecipe(recipeFile(relpath), previous);
+    try
+    {
+        writeRecipe(recipe);
+    }
+    catch (OFSException& e)
+    {
+        unref(recipe);
+        throw;
+    }
+    if (hadPrevious)
+        unref(previous);
+    RecipeInfo& info = recipes[relpath];
+    info.state = 'P';
+    info.size = recipe.size;
+    importedBytes += recipe.size;
+
+    // the placeholder: right size, no data
+    unlink(cachePath.c_str());
+    int fdc = open(cachePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    if (fdc < 0 || ftruncate(fdc, recipe.size) < 0)
+    {
+        int err = errno;
+        if (fdc >= 0)
+            close(fdc);
+        drop(relpath);
+        throw OFSException(strerror(err), err, true);
+    }
+    close(fdc);
+    return true;
+}
+
+void ChunkStore::materialize(const string& relpath, const string& cachePath)
+    throw(OFSException)
+{
+    MutexLocker obtain_lock(storeMutex);
+    map<string, RecipeInfo>::iterator info = recipes.find(relpath);
+    if (info == recipes.end())
+        return;
+    info->second.users++;
+    if (info->second.state != 'P')
+        return;
+
+    Recipe recipe;
+    struct stat st;
+    int fd = -1;
+    int err = EIO;
+    if (readRecipe(recipeFile(relpath), recipe)
+        && (fd = open(cachePath.c_str(), O_WRONLY)) >= 0
+        && fstat(fd, &st) == 0)
+    {
+        off_t offset = 0;
+        vector<char> buf(CHUNK_MAX_SIZE);
+        vector<pair<string, unsigned int> >::iterator it;
+        for (it = recipe.chunks.begin(); it != recipe.chunks.end(); it++)
+        {
+            int fdChunk = open(chunkFile(it->first).c_str(), O_RDONLY);
+            if (fdChunk < 0)
+                break;
+            if (buf.size() < it->second)
+                buf.resize(it->second);
+            bool ok = read(fdChunk, &buf[0], it->second) == (ssize_t)it->second
+                && pwrite(fd, &buf[0], it->second, offset) == (ssize_t)it->second;
+            close(fdChunk);
+            if (!ok)
+                break;
+            offset += it->second;
+        }
+        if (it == recipe.chunks.end())
+        {
+            close(fd);
+            // the content has not changed, keep the time stamps
+            struct utimbuf times;
+            times.actime = st.st_atime;
+            times.modtime = st.st_mtime;
+            utime(cachePath.c_str(), &times);
+            setState(relpath, 'M');
+            return;
+        }
+    }
+    else
+        err = errno ? errno : EIO;
+    if (fd >= 0)
+        close(fd);
+    info->second.users--;
+    ofslog::error("Chunk store: cannot rebuild %s", relpath.c_str());
+    throw OFSException(strerror(err), err, true);
+}
+
+void ChunkStore::release(const string& relpath)
+{
+    MutexLocker obtain_lock(storeMutex);
+    map<string, RecipeInfo>::iterator info = recipes.find(relpath);
+    if (info != recipes.end() && info->second.users > 0)
+        info->second.users--;
+}
+
+void ChunkStore::forget(const string& relpath)
+{
+    MutexLocker obtain_lock(storeMutex);
+    if (recipes.find(relpath) != recipes.end())
+        drop(relpath);
+}
+
+void ChunkStore::rename(const string& from, const string& to)
+{
+    MutexLocker obtain_lock(storeMutex);
+    // the target is replaced; siblings like "dir.txt" sort between
+    // "dir" and "dir/", so the children are looked up by their prefix
+    if (recipes.find(to) != recipes.end())
+        drop(to);
+    const string toPrefix = to + "/";
+    map<string, RecipeInfo>::iterator it = recipes.lower_bound(toPrefix);
+    while (it != recipes.end()
+           && it->first.compare(0, toPrefix.length(), toPrefix) == 0)
+    {
+        string path = (it++)->first;
+        drop(path);
+    }
+
+    const string fromPrefix = from + "/";
+    list<string> moved;
+    if (recipes.find(from) != recipes.end())
+        moved.push_back(from);
+    for (it = recipes.lower_bound(fromPrefix); it != recipes.end()
+         && it->first.compare(0, fromPrefix.length(), fromPrefix) == 0;
+         it++)
+        moved.push_back(it->first);
+    for (list<string>::iterator path = moved.begin(); path != moved.end(); path++)
+    {
+        Recipe recipe;
+        string oldFile = recipeFile(*path);
+        if (readRecipe(oldFile, recipe))
+        {
+            recipe.path = to + path->substr(from.length());
+            try
+            {
+                writeRecipe(recipe);
+                recipes[recipe.path] = recipes[*path];
+                unlink(oldFile.c_str());
+                recipes.erase(*path);
+                continue;
+            }
+            catch (OFSException& e)
+            {
+            }
+        }
+        drop(*path);
+    }
+}
+
+void ChunkStore::collectGarbage()
+{
+    MutexLocker obtain_lock(storeMutex);
+    const string shareID = OFSEnvironment::Instance().getShareID();
+    long long logicalBytes = 0;
+    int nDropped = 0;
+    int nEmptied = 0;
+    map<string, RecipeInfo>::iterator it = recipes.begin();
+    while (it != recipes.end())
+    {
+        const string relpath = it->first;
+        RecipeInfo& info = it->second;
+        it++;
+        string cachePath = Filestatusmanager::Instance().give_me_file(relpath).get_cache_path();
+        struct stat st;
+        if (lstat(cachePath.c_str(), &st) < 0 || !S_ISREG(st.st_mode)
+            || st.st_size != info.size)
+        {
+            // removed or replaced without telling us
+            drop(relpath);
+            nDropped++;
+            continue;
+        }
+        logicalBytes += info.size;
+        if (info.state == 'M' && info.users == 0
+            && !SyncLogger::Instance().IsDirty(shareID.c_str(), relpath))
+        {
+            int fd = open(cachePath.c_str(), O_WRONLY);
+            if (fd < 0)
+                continue;
+            if (ftruncate(fd, 0) == 0 && ftruncate(fd, info.size) == 0)
+            {
+                nEmptied++;
+                setState(relpath, 'P');
+            }
+            close(fd);
+            struct utimbuf times;
+            times.actime = st.st_atime;
+            times.modtime = st.st_mtime;
+            utime(cachePath.c_str(), &times);
+        }
+    }
+
+    long long physicalBytes = 0;
+    for (map<string, ChunkInfo>::iterator chunk = chunks.begin();
+         chunk != chunks.end(); chunk++)
+        physicalBytes += chunk->second.size;
+    ofslog::info("Chunk store: %lld bytes in %d files stored in %lld bytes (%d chunks), dedup ratio %.2f",
+                 logicalBytes, (int)recipes.size(), physicalBytes, (int)chunks.size(),
+                 physicalBytes > 0 ? (double)logicalBytes / physicalBytes : 1.0);
+    ofslog::info("Chunk store: imported %lld bytes, %lld bytes of new chunks (ratio %.2f), %d recipes dropped, %d files emptied",
+                 importedBytes, storedBytes,
+                 storedBytes > 0 ? (double)importedBytes / storedBytes : 1.0,
+                 nDropped, nEmptied);
+    importedBytes = 0;
+    storedBytes = 0;
+}
@@ -0,0 +1,159 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "mutexlocker.h"
+#include "ofsexception.h"
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+using namespace std;
+
+/// content-defined chunking parameters, the average chunk is about 80 KiB
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_MASK 0xFFFFULL
+#define CHUNK_MAX_SIZE (256 * 1024)
+
+#define RECIPE_MAGIC "OFSR"
+#define RECIPE_FORMAT_VERSION 1
+
+/**
+ * Deduplicating store for the content of offline files (mount option
+ * "dedup").
+ *
+ * update_cache splits a remote file into content-defined chunks, stores
+ * every chunk it has not seen before under its SHA-1 in
+ * <ofsdir>/<shareid>_chunks/chunks and writes a recipe listing the chunks
+ * of the file. The cache file itself is only a sparse placeholder with
+ * the correct size. When the file is opened, its content is rebuilt from
+ * the chunks; once it is no longer open and has no local modifications,
+ * collectGarbage() turns it back into a placeholder.
+ *
+ * Chunks are reference counted by the recipes using them and deleted as
+ * soon as the last recipe is dropped. The counts are rebuilt from the
+ * recipes on startup, chunks without a reference are removed then.
+ * A file that is modified locally leaves the store (forget()) and is an
+ * ordinary cache file until the next import.
+ */
+class ChunkStore
+{
+public:
+    static ChunkStore& Instance();
+    ~ChunkStore();
+
+    /**
+     * Store the content of a remote file and replace the cache file by
+     * a placeholder
+     * @param relpath path relative to the share root
+     * @param source file to read the content from
+     * @param cachePath cache file to replace
+     * @return false if the old content is still in use, the file has to
+     *         be copied without deduplication then
+     */
+    bool import(const string& relpath, const string& source,
+                const string& cachePath) throw(OFSException);
+    /**
+     * Rebuild the content of the cache file if it is a placeholder and
+     * keep it until release() is called
+     * @param relpath path relative to the share root
+     * @param cachePath cache file of the path
+     */
+    void materialize(const string& relpath, const string& cachePath)
+        throw(OFSException);
+    /**
+     * Counterpart of materialize()
+     * @param relpath path relative to the share root
+     */
+    void release(const string& relpath);
+    /**
+     * The cache file is changed locally, its content is no longer
+     * described by the recipe. The file has to be materialized.
+     * @param relpath path relative to the share root
+     */
+    void forget(const string& relpath);
+    /**
+     * A file or directory has been renamed in the cache
+     * @param from old path relative to the share root
+     * @param to new path relative to the share root
+     */
+    void rename(const string& from, const string& to);
+    /**
+     * Drop recipes of files that have been removed from the cache, turn
+     * unused files back into placeholders, and log the statistics
+     */
+    void collectGarbage();
+
+private:
+    struct Recipe
+    {
+        char state;
+        off_t size;
+        string path;
+        vector<pair<string, unsigned int> > chunks;
+    };
+    struct RecipeInfo
+    {
+        RecipeInfo() : state('P'), size(0), users(0) {}
+        char state;
+        off_t size;
+        /// number of materialize() calls without release()
+        int users;
+    };
+    struct ChunkInfo
+    {
+        ChunkInfo() : refs(0), size(0) {}
+        int refs;
+        unsigned int size;
+    };
+
+    ChunkStore();
+    void load();
+    string recipeFile(const string& relpath);
+    string chunkFile(const string& hash);
+    bool readRecipe(const string& filename, Recipe& recipe);
+    void writeRecipe(const Recipe& recipe) throw(OFSException);
+    void setState(const string& relpath, char state);
+    void storeChunk(const string& hash, const unsigned char* data, size_t len)
+        throw(OFSException);
+    void ref(const Recipe& recipe);
+    void unref(const Recipe& recipe);
+    void drop(const string& relpath);
+
+    string basedir;
+    map<string, RecipeInfo> recipes;
+    map<string, ChunkInfo> chunks;
+    /// bytes passed to import() since the last collectGarbage()
+    long long importedBytes;
+    /// bytes of new chunks written since the last collectGarbage()
+    long long storedBytes;
+
+    static std::auto_ptr<ChunkStore> theChunkStoreInstance;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+    /// protects the recipe and chunk tables
+    Mutex storeMutex;
+};
+
+#endif
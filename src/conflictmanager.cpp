@@ -21,6 +21,9 @@
 #include "conflictpersistence.h"
 #include "file.h"
 #include "filestatusmanager.h"
+#include "filecopy.h"
+#include "chunkstore.h"
+#include "ofsenvironment.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,10 +34,10 @@
 // Initializes the class attributes.
 std::auto_ptr<ConflictManager> ConflictManager::theConflictManagerInstance;
 Mutex ConflictManager::m;
+pthread_once_t ConflictManager::instanceOnce = PTHREAD_ONCE_INIT;
 
 ConflictManager::ConflictManager()
 {
-    reinstate();
 }
 
 
@@ -44,65 +47,47 @@ ConflictManager::~ConflictManager()
 
 ConflictManager& ConflictManager::Instance()
 {
-    MutexLocker obtain_lock(m);
-    if (theConflictManagerInstance.get() == 0) {
-    	theConflictManagerInstance.reset(new ConflictManager());
-    }
+    pthread_once(&instanceOnce, createInstance);
     return *theConflictManagerInstance;
 }
 
+void ConflictManager::createInstance()
+{
+    theConflictManagerInstance.reset(new ConflictManager);
+}
+
 void ConflictManager::addConflictFile(string relativePath)
 {
-    conflictfiles.remove(relativePath);
-    conflictfiles.push_back(relativePath);
-    persist();
+    MutexLocker obtain_lock(m);
+    ConflictPersistence::Instance().add(relativePath);
 }
     
 void ConflictManager::removeConflictFile(string relativePath)
 {
-    conflictfiles.remove(relativePath);
-    persist();
+    MutexLocker obtain_lock(m);
+    ConflictPersistence::Instance().remove(relativePath);
 }
  
-bool ConflictManager::isConflicted(string relativePath)
+bool ConflictManager::isConflicted(const string& relativePath)
 {
-    for( list<string>::iterator iter = conflictfiles.begin();
-        iter != conflictfiles.end(); iter++ )
-    {
-        string filename = *iter;
-        if(relativePath.length() <= filename.length()
-           && filename.substr(0, relativePath.length()) == relativePath
-          )
-        {
-            return true;
-        }
-    }
-    return false;
+    return ConflictPersistence::Instance().anyAtOrBelow(relativePath);
 }
 
 
 void ConflictManager::persist() const
 {
-    ConflictPersistence::Instance().files(conflictfiles);
+    // every change is stored when it is made
 }
 
 void ConflictManager::reinstate()
 {
-    conflictfiles = ConflictPersistence::Instance().files();
+    // the conflicts are looked up in the metadata store, nothing to load
 }
 
 bool ConflictManager::resolve(string relativePath, string direction)
 {
     bool success = false;
-    for(list<string>::iterator iter = conflictfiles.begin();
-        iter != conflictfiles.end(); iter++)
-    {
-        if(*iter == relativePath)
-        {
-            success = true;
-            break;
-        }
-    }
+    success = ConflictPersistence::Instance().contains(relativePath);
     
     if(!success)
         return false;
@@ -132,24 +117,20 @@ bool ConflictManager::resolve(string relativePath, string direction)
             // copy file
             if ( S_ISREG ( localinfo.st_mode ) )
             {
-                    int fdd = open ( fileinfo.get_remote_path().c_str(),
-                                        O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU );
-                    if ( fdd < 0 )
-                            return false;
-                    int fds = open ( fileinfo.get_cache_path().c_str(), O_RDONLY );
-                    if ( fds < 0 )
-                            return false;
-                    char buf[1024];
-                    ssize_t bytesread;
-                    while ( ( bytesread = read ( fds, buf, sizeof ( buf ) ) ) > 0 )
+                    try
                     {
-                            if ( write ( fdd, buf, bytesread ) < 0 )
-                                    return false;
+                            if ( OFSEnvironment::Instance().isDedup() )
+                                ChunkStore::Instance().materialize ( relativePath,
+                                             fileinfo.get_cache_path() );
+                            FileCopy::copy ( fileinfo.get_cache_path(),
+                                             fileinfo.get_remote_path(), S_IRWXU );
+                            if ( OFSEnvironment::Instance().isDedup() )
+                                ChunkStore::Instance().release ( relativePath );
                     }
-                    if ( bytesread < 0 )
+                    catch ( OFSException &e )
+                    {
                             return false;
-                    close ( fds );
-                    close ( fdd );
+                    }
             }
             else if ( S_ISLNK ( localinfo.st_mode ) )
             {
@@ -189,24 +170,17 @@ bool ConflictManager::resolve(string relativePath, string direction)
             // copy file
             if ( S_ISREG ( remoteinfo.st_mode ) )
             {
-                    int fdd = open ( fileinfo.get_cache_path().c_str(),
-                                        O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU );
-                    if ( fdd < 0 )
-                            return false;
-                    int fds = open ( fileinfo.get_remote_path().c_str(), O_RDONLY );
-                    if ( fds < 0 )
-                            return false;
-                    char buf[1024];
-                    ssize_t bytesread;
-                    while ( ( bytesread = read ( fds, buf, sizeof ( buf ) ) ) > 0 )
+                    if ( OFSEnvironment::Instance().isDedup() )
+                        ChunkStore::Instance().forget ( relativePath );
+                    try
                     {
-                            if ( write ( fdd, buf, bytesread ) < 0 )
-                                    return false;
+                            FileCopy::copy ( fileinfo.get_remote_path(),
+                                             fileinfo.get_cache_path(), S_IRWXU );
                     }
-                    if ( bytesread < 0 )
+                    catch ( OFSException &e )
+                    {
                             return false;
-                    close ( fds );
-                    close ( fdd );
+                    }
             }
             else if ( S_ISLNK ( remoteinfo.st_mode ) )
             {
@@ -43,7 +43,11 @@ public:
     
     void removeConflictFile(string relativePath);
     
-    bool isConflicted(string relativePath);
+    /**
+     * Is the path or anything below it in conflict?
+     * @param relativePath path relative to the share root
+     */
+    bool isConflicted(const string& relativePath);
     
     bool resolve(string relativePath, string direction);
 
@@ -60,11 +64,11 @@ protected:
     ConflictManager();
     
 private:
-    list<string> conflictfiles;
-    
     static std::auto_ptr<ConflictManager> 
         theConflictManagerInstance;
     static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 
 };
 
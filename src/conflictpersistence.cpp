@@ -18,11 +18,14 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "conflictpersistence.h"
+#include "metastore.h"
+#include "ofslog.h"
 #include <sstream>
 using namespace std;
 
 std::auto_ptr<ConflictPersistence> ConflictPersistence::theConflictPersistenceInstance;
 Mutex ConflictPersistence::m;
+pthread_once_t ConflictPersistence::instanceOnce = PTHREAD_ONCE_INIT;
 
 ConflictPersistence::ConflictPersistence()
  : PersistenceManager(PERSISTENCE_MODULE_NAME)
@@ -37,14 +40,17 @@ ConflictPersistence::~ConflictPersistence()
 
 ConflictPersistence& ConflictPersistence::Instance()
 {
-    MutexLocker obtain_lock(m);
-    if (theConflictPersistenceInstance.get() == 0) {
-    	theConflictPersistenceInstance.reset(new ConflictPersistence());
-        theConflictPersistenceInstance->init();
-    }
+    // looked up for every conflict check, so it does not lock
+    pthread_once(&instanceOnce, createInstance);
     return *theConflictPersistenceInstance;
 }
 
+void ConflictPersistence::createInstance()
+{
+    theConflictPersistenceInstance.reset(new ConflictPersistence());
+    theConflictPersistenceInstance->init();
+}
+
 cfg_opt_t *ConflictPersistence::init_parser()
 {
 	cfg_opt_t *opts = new cfg_opt_t[2];
@@ -54,21 +60,19 @@ cfg_opt_t *ConflictPersistence::init_parser()
 	return opts;
 }
 
-string ConflictPersistence::get_persistence()
+void ConflictPersistence::get_records(map<string, string>& records)
 {
-	stringstream pers;
-	pers << CONFIGKEY_CFILES << " = {" << endl;
 	list<string>::iterator it;
-	bool first = true;
-	for ( it=conflictfiles.begin() ; it != conflictfiles.end(); it++ ) {
-		if(first)
-			first = false;
-		else
-			pers << "," << endl;
-		pers << "\"" << *it << "\"";
-	}
-	pers << endl << "}" << endl;
-	return pers.str();
+	for ( it=conflictfiles.begin() ; it != conflictfiles.end(); it++ )
+		records[*it] = "";
+}
+
+void ConflictPersistence::set_records(const map<string, string>& records)
+{
+	conflictfiles.clear();
+	map<string, string>::const_iterator it;
+	for ( it=records.begin() ; it != records.end(); it++ )
+		conflictfiles.push_back(it->first);
 }
 
 void ConflictPersistence::read_values()
@@ -92,3 +96,40 @@ list<string> ConflictPersistence::files()
     reload();
     return conflictfiles;
 }
+
+void ConflictPersistence::add(const string& path)
+{
+    MetaStore::Batch batch;
+    batch.put(get_prefix() + path, "");
+    if (!MetaStore::Instance().commit(batch))
+        ofslog::error("Could not store conflict of %s", path.c_str());
+}
+
+void ConflictPersistence::remove(const string& path)
+{
+    MetaStore::Batch batch;
+    batch.remove(get_prefix() + path);
+    if (!MetaStore::Instance().commit(batch))
+        ofslog::error("Could not store resolution of %s", path.c_str());
+}
+
+bool ConflictPersistence::contains(const string& path)
+{
+    string value;
+    return MetaStore::Instance().get(get_prefix() + path, value);
+}
+
+bool ConflictPersistence::anyAtOrBelow(const string& path)
+{
+    if (contains(path))
+        return true;
+
+    // All descendants sort directly behind "<dir>/", so the first key not
+    // less than that prefix decides.
+    string prefix = get_prefix() + path;
+    if (prefix[prefix.length() - 1] != '/')
+        prefix += '/';
+    string key;
+    return MetaStore::Instance().next(prefix, key)
+        && key.compare(0, prefix.length(), prefix) == 0;
+}
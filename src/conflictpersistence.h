@@ -52,12 +52,33 @@ public:
      * @return Conflicted files
      */
     list<string> files();
+    /**
+     * store a single file in conflict
+     * @param path relative path of the file
+     */
+    void add(const string& path);
+    /**
+     * remove a single file in conflict
+     * @param path relative path of the file
+     */
+    void remove(const string& path);
+    /**
+     * Is the file in conflict?
+     * @param path relative path of the file
+     */
+    bool contains(const string& path);
+    /**
+     * Is the path or anything below it in conflict?
+     * @param path relative path of a file or directory
+     */
+    bool anyAtOrBelow(const string& path);
 
 protected:
     ConflictPersistence();
     
     virtual cfg_opt_t *init_parser();
-    virtual string get_persistence();
+    virtual void get_records(map<string, string>& records);
+    virtual void set_records(const map<string, string>& records);
     virtual void read_values();
 
 private:
@@ -66,6 +87,8 @@ private:
     static std::auto_ptr<ConflictPersistence> 
         theConflictPersistenceInstance;
     static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 
 };
 
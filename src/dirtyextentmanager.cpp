@@ -0,0 +1,305 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "dirtyextentmanager.h"
+#include "dirtyextentpersistence.h"
+#include "metastore.h"
+#include "ofslog.h"
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+#define STATE_OPEN "open"
+#define STATE_WHOLE "whole"
+#define STATE_RANGES "ranges"
+/// prefix of the smallest size in the list of ranges
+#define SHRUNK_PREFIX "<"
+
+std::auto_ptr<DirtyExtentManager> DirtyExtentManager::theDirtyExtentManagerInstance;
+Mutex DirtyExtentManager::m;
+pthread_once_t DirtyExtentManager::instanceOnce = PTHREAD_ONCE_INIT;
+
+DirtyExtentManager::DirtyExtentManager()
+{
+    reinstate();
+}
+
+DirtyExtentManager::~DirtyExtentManager()
+{
+}
+
+DirtyExtentManager& DirtyExtentManager::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theDirtyExtentManagerInstance;
+}
+
+void DirtyExtentManager::createInstance()
+{
+    theDirtyExtentManagerInstance.reset(new DirtyExtentManager());
+}
+
+void DirtyExtentManager::open(const string& path, bool known)
+{
+    unsigned long long seq = 0;
+    {
+        MutexLocker obtain_lock(m);
+        map<string, FileExtents>::iterator it = files.find(path);
+        if (it == files.end())
+        {
+            it = files.insert(make_pair(path, FileExtents())).first;
+            it->second.whole = !known;
+        }
+        if (it->second.writers++ == 0)
+            seq = store(path);
+    }
+    synced(path, seq);
+}
+
+void DirtyExtentManager::add(const string& path, off_t offset, off_t length)
+{
+    if (length <= 0)
+        return;
+    MutexLocker obtain_lock(m);
+    map<string, FileExtents>::iterator file = files.find(path);
+    if (file == files.end() || file->second.whole)
+        return;
+    map<off_t, off_t>& ranges = file->second.ranges;
+
+    off_t start = offset - offset % DIRTY_EXTENT_GRANULARITY;
+    off_t end = offset + length;
+    if (end % DIRTY_EXTENT_GRANULARITY)
+        end += DIRTY_EXTENT_GRANULARITY - end % DIRTY_EXTENT_GRANULARITY;
+
+    // merge with all ranges that overlap or touch [start, end)
+    map<off_t, off_t>::iterator it = ranges.upper_bound(start);
+    if (it != ranges.begin())
+    {
+        map<off_t, off_t>::iterator prev = it;
+        prev--;
+        if (prev->second >= start)
+            it = prev;
+    }
+    while (it != ranges.end() && it->first <= end)
+    {
+        if (it->first < start)
+            start = it->first;
+        if (it->second > end)
+            end = it->second;
+        ranges.erase(it++);
+    }
+    ranges[start] = end;
+
+    if (ranges.size() > DIRTY_EXTENT_MAX_RANGES)
+    {
+        ranges.clear();
+        file->second.whole = true;
+    }
+}
+
+void DirtyExtentManager::truncate(const string& path, off_t size)
+{
+    unsigned long long seq = 0;
+    {
+        MutexLocker obtain_lock(m);
+        map<string, FileExtents>::iterator file = files.find(path);
+        if (file == files.end())
+            return;
+        // data behind the new end is gone, growing is done by the final
+        // ftruncate on the remote; a file that grows again reads zeros up
+        // to the smallest size, which the remote only gets by being
+        // truncated to it first
+        if (file->second.shrunk < 0 || size < file->second.shrunk)
+            file->second.shrunk = size;
+        map<off_t, off_t>& ranges = file->second.ranges;
+        map<off_t, off_t>::iterator it = ranges.lower_bound(size);
+        ranges.erase(it, ranges.end());
+        if (!ranges.empty() && ranges.rbegin()->second > size)
+            ranges.rbegin()->second = size;
+        // an open file is reintegrated as a whole after a crash anyway
+        if (file->second.writers == 0)
+            seq = store(path);
+    }
+    synced(path, seq);
+}
+
+void DirtyExtentManager::close(const string& path)
+{
+    unsigned long long seq = 0;
+    {
+        MutexLocker obtain_lock(m);
+        map<string, FileExtents>::iterator file = files.find(path);
+        if (file == files.end() || file->second.writers == 0)
+            return;
+        if (--file->second.writers == 0)
+            seq = store(path);
+    }
+    synced(path, seq);
+}
+
+void DirtyExtentManager::invalidate(const string& path)
+{
+    unsigned long long seq;
+    {
+        MutexLocker obtain_lock(m);
+        // without an entry, open() finds the path in the sync log anyway
+        map<string, FileExtents>::iterator file = files.find(path);
+        if (file == files.end() || file->second.whole)
+            return;
+        file->second.ranges.clear();
+        file->second.whole = true;
+        seq = store(path);
+    }
+    synced(path, seq);
+}
+
+void DirtyExtentManager::remove(const string& path)
+{
+    unsigned long long seq;
+    {
+        MutexLocker obtain_lock(m);
+        map<string, FileExtents>::iterator file = files.find(path);
+        if (file == files.end())
+            return;
+        if (file->second.writers > 0)
+        {
+            // still open: whatever was written during reintegration
+            // may have been missed
+            file->second.ranges.clear();
+            file->second.whole = true;
+        }
+        else
+            files.erase(file);
+        seq = store(path);
+    }
+    synced(path, seq);
+}
+
+bool DirtyExtentManager::getExtents(const string& path, list<pair<off_t, off_t> >& extents,
+                                    off_t& shrunk)
+{
+    MutexLocker obtain_lock(m);
+    map<string, FileExtents>::iterator file = files.find(path);
+    if (file == files.end() || file->second.whole || file->second.writers > 0)
+        return false;
+    extents.clear();
+    shrunk = file->second.shrunk;
+    for (map<off_t, off_t>::iterator it = file->second.ranges.begin();
+         it != file->second.ranges.end(); it++)
+        extents.push_back(make_pair(it->first, it->second - it->first));
+    return true;
+}
+
+/**
+ * Convert the extents of one file to its persistent form
+ */
+static DirtyExtentPersistence::Record toRecord(const string& path, bool whole,
+    int writers, off_t shrunk, const map<off_t, off_t>& fileRanges)
+{
+    DirtyExtentPersistence::Record record;
+    record.path = path;
+    if (whole)
+        record.state = STATE_WHOLE;
+    else if (writers > 0)
+        record.state = STATE_OPEN;
+    else
+        record.state = STATE_RANGES;
+    stringstream ranges;
+    if (shrunk >= 0)
+        ranges << SHRUNK_PREFIX << shrunk;
+    for (map<off_t, off_t>::const_iterator it = fileRanges.begin();
+         it != fileRanges.end(); it++)
+    {
+        if (it != fileRanges.begin() || shrunk >= 0)
+            ranges << " ";
+        ranges << it->first << "-" << it->second;
+    }
+    record.ranges = ranges.str();
+    return record;
+}
+
+/**
+ * Make the extents of one file persistent, the caller holds the mutex
+ */
+/**
+ * Write the record of one path to the metadata store. The caller holds
+ * m, so the records are stored in the order of the changes, and calls
+ * synced() after releasing it.
+ * @return sequence number for synced()
+ */
+unsigned long long DirtyExtentManager::store(const string& path) const
+{
+    map<string, FileExtents>::const_iterator file = files.find(path);
+    if (file == files.end())
+        return DirtyExtentPersistence::Instance().remove(path);
+    return DirtyExtentPersistence::Instance().put(toRecord(path, file->second.whole,
+        file->second.writers, file->second.shrunk, file->second.ranges));
+}
+
+/**
+ * Wait until a record written by store() is on disk
+ * @param seq sequence number returned by store(), 0 for none
+ */
+void DirtyExtentManager::synced(const string& path, unsigned long long seq)
+{
+    if (seq != 0 && !MetaStore::Instance().sync(seq))
+        ofslog::error("Could not store dirty extents of %s", path.c_str());
+}
+
+void DirtyExtentManager::persist() const
+{
+    list<DirtyExtentPersistence::Record> records;
+    for (map<string, FileExtents>::const_iterator file = files.begin();
+         file != files.end(); file++)
+        records.push_back(toRecord(file->first, file->second.whole,
+            file->second.writers, file->second.shrunk, file->second.ranges));
+    DirtyExtentPersistence::Instance().extents(records);
+}
+
+void DirtyExtentManager::reinstate()
+{
+    list<DirtyExtentPersistence::Record> records = DirtyExtentPersistence::Instance().extents();
+    files.clear();
+    for (list<DirtyExtentPersistence::Record>::iterator it = records.begin();
+         it != records.end(); it++)
+    {
+        FileExtents& file = files[it->path];
+        // a file that was open when we went down has unknown changes
+        file.whole = (it->state != STATE_RANGES);
+        if (file.whole)
+            continue;
+        stringstream ranges(it->ranges);
+        string range;
+        while (ranges >> range)
+        {
+            if (range.compare(0, strlen(SHRUNK_PREFIX), SHRUNK_PREFIX) == 0)
+            {
+                file.shrunk = atoll(range.substr(strlen(SHRUNK_PREFIX)).c_str());
+                continue;
+            }
+            string::size_type dash = range.find('-');
+            if (dash == string::npos)
+                continue;
+            off_t start = atoll(range.substr(0, dash).c_str());
+            off_t end = atoll(range.substr(dash + 1).c_str());
+            if (end > start)
+                file.ranges[start] = end;
+        }
+    }
+}
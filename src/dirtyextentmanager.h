@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef DIRTYEXTENTMANAGER_H
+#define DIRTYEXTENTMANAGER_H
+
+#include "persistable.h"
+#include "mutexlocker.h"
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <list>
+#include <map>
+#include <memory>
+using namespace std;
+
+/// extents are widened to this granularity to keep the map small
+#define DIRTY_EXTENT_GRANULARITY 4096
+/// files with more extents are reintegrated as a whole
+#define DIRTY_EXTENT_MAX_RANGES 65536
+
+/**
+ * Remembers which byte ranges of offline files have been changed in the
+ * cache, so reintegration only has to send those ranges to the remote.
+ *
+ * Writes are only collected in memory. The extents are made persistent
+ * when the first writer of a file opens it and when the last one is
+ * released; a file that is still open when the daemon dies is therefore
+ * reintegrated as a whole on the next run, as is every file whose
+ * modifications are not completely known (created, deleted or renamed
+ * files, or files that were already modified before tracking started).
+ */
+class DirtyExtentManager : public persistable
+{
+public:
+    static DirtyExtentManager& Instance();
+    ~DirtyExtentManager();
+
+    /**
+     * A handle starts modifying the file
+     * @param path path relative to the share root
+     * @param known false if the file has earlier modifications that
+     *              are not tracked
+     */
+    void open(const string& path, bool known);
+    /**
+     * Record a changed byte range
+     * @param path path relative to the share root
+     * @param offset start of the range
+     * @param length length of the range
+     */
+    void add(const string& path, off_t offset, off_t length);
+    /**
+     * Record a size change
+     * @param path path relative to the share root
+     * @param size new size of the file
+     */
+    void truncate(const string& path, off_t size);
+    /**
+     * A handle stops modifying the file
+     * @param path path relative to the share root
+     */
+    void close(const string& path);
+    /**
+     * Forget the extents, the file has to be reintegrated as a whole
+     * @param path path relative to the share root
+     */
+    void invalidate(const string& path);
+    /**
+     * The file has been reintegrated
+     * @param path path relative to the share root
+     */
+    void remove(const string& path);
+    /**
+     * Get the changed ranges of a file
+     * @param path path relative to the share root
+     * @param extents (out) receives the ranges as offset and length
+     * @param shrunk (out) smallest size the file has been truncated to,
+     *               -1 if it has not been truncated; data behind it has
+     *               to be cut off the remote before the ranges are copied
+     * @return false if the changes are not known and the whole file has
+     *         to be reintegrated
+     */
+    bool getExtents(const string& path, list<pair<off_t, off_t> >& extents,
+                    off_t& shrunk);
+
+    virtual void persist() const;
+    virtual void reinstate();
+
+protected:
+    DirtyExtentManager();
+
+private:
+    struct FileExtents
+    {
+        FileExtents() : writers(0), whole(false), shrunk(-1) {}
+        /// start -> end of the dirty ranges, never overlapping or touching
+        map<off_t, off_t> ranges;
+        int writers;
+        bool whole;
+        /// smallest size truncated to, -1 if never truncated
+        off_t shrunk;
+    };
+
+    unsigned long long store(const string& path) const;
+    static void synced(const string& path, unsigned long long seq);
+
+    map<string, FileExtents> files;
+    static std::auto_ptr<DirtyExtentManager> theDirtyExtentManagerInstance;
+    /// protects the extents
+    static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+};
+
+#endif
@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "dirtyextentpersistence.h"
+#include "metastore.h"
+#include <sstream>
+using namespace std;
+
+std::auto_ptr<DirtyExtentPersistence> DirtyExtentPersistence::theDirtyExtentPersistenceInstance;
+Mutex DirtyExtentPersistence::m;
+
+DirtyExtentPersistence::DirtyExtentPersistence()
+ : PersistenceManager(PERSISTENCE_MODULE_NAME)
+{
+}
+
+DirtyExtentPersistence::~DirtyExtentPersistence()
+{
+}
+
+DirtyExtentPersistence& DirtyExtentPersistence::Instance()
+{
+    MutexLocker obtain_lock(m);
+    if (theDirtyExtentPersistenceInstance.get() == 0) {
+    	theDirtyExtentPersistenceInstance.reset(new DirtyExtentPersistence());
+        theDirtyExtentPersistenceInstance->init();
+    }
+    return *theDirtyExtentPersistenceInstance;
+}
+
+cfg_opt_t *DirtyExtentPersistence::init_parser()
+{
+	cfg_opt_t *opts = new cfg_opt_t[2];
+	opts[0] = (cfg_opt_t)CFG_STR_LIST(
+		CONFIGKEY_EXTENTS, "{}", CFGF_NONE);
+	opts[1] = (cfg_opt_t)CFG_END();
+	return opts;
+}
+
+void DirtyExtentPersistence::get_records(map<string, string>& values)
+{
+	list<Record>::iterator it;
+	for ( it=records.begin() ; it != records.end(); it++ )
+		values[it->path] = it->state + " " + it->ranges;
+}
+
+void DirtyExtentPersistence::set_records(const map<string, string>& values)
+{
+	records.clear();
+	map<string, string>::const_iterator it;
+	for ( it=values.begin() ; it != values.end(); it++ ) {
+		Record record;
+		record.path = it->first;
+		string::size_type space = it->second.find(' ');
+		record.state = it->second.substr(0, space);
+		if(space != string::npos)
+			record.ranges = it->second.substr(space + 1);
+		records.push_back(record);
+	}
+}
+
+void DirtyExtentPersistence::read_values()
+{
+    records.clear();
+    for(unsigned int i = 0; i + 2 < cfg_size(cfg, CONFIGKEY_EXTENTS); i+=3) {
+        Record record;
+        record.path = string(cfg_getnstr(cfg, CONFIGKEY_EXTENTS, i));
+        record.state = string(cfg_getnstr(cfg, CONFIGKEY_EXTENTS, i+1));
+        record.ranges = string(cfg_getnstr(cfg, CONFIGKEY_EXTENTS, i+2));
+        records.push_back(record);
+    }
+}
+
+void DirtyExtentPersistence::extents(const list<Record>& records)
+{
+    this->records = records;
+    make_persistent();
+}
+
+unsigned long long DirtyExtentPersistence::put(const Record& record)
+{
+    MetaStore::Batch batch;
+    batch.put(get_prefix() + record.path, record.state + " " + record.ranges);
+    return MetaStore::Instance().apply(batch);
+}
+
+unsigned long long DirtyExtentPersistence::remove(const string& path)
+{
+    MetaStore::Batch batch;
+    batch.remove(get_prefix() + path);
+    return MetaStore::Instance().apply(batch);
+}
+
+list<DirtyExtentPersistence::Record> DirtyExtentPersistence::extents()
+{
+    reload();
+    return records;
+}
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef DIRTYEXTENTPERSISTENCE_H
+#define DIRTYEXTENTPERSISTENCE_H
+
+#include "persistencemanager.h"
+#include "mutexlocker.h"
+#include <list>
+#include <memory>
+using namespace std;
+
+#define CONFIGKEY_EXTENTS "extents"
+#define PERSISTENCE_MODULE_NAME "extents"
+
+/**
+ * Stores the dirty extents of modified files. Each file is stored as
+ * three strings: relative path, state and a space separated list of
+ * "start-end" byte ranges.
+ */
+class DirtyExtentPersistence : public PersistenceManager
+{
+public:
+    /**
+     * One file as stored in the persistence file
+     */
+    struct Record
+    {
+        string path;
+        string state;
+        string ranges;
+    };
+
+    ~DirtyExtentPersistence();
+    /**
+     * Get singleton instance
+     * @return singleton instance
+     */
+    static DirtyExtentPersistence& Instance();
+    /**
+     * make dirty extents persistent
+     * @param records dirty extents per file
+     */
+    void extents(const list<Record>& records);
+    /**
+     * make the dirty extents of one file persistent
+     * @param record dirty extents of the file
+     * @return sequence number to wait for with MetaStore::sync()
+     */
+    unsigned long long put(const Record& record);
+    /**
+     * forget the dirty extents of one file
+     * @param path relative path of the file
+     * @return sequence number to wait for with MetaStore::sync()
+     */
+    unsigned long long remove(const string& path);
+    /**
+     * load dirty extents
+     * @return dirty extents per file
+     */
+    list<Record> extents();
+
+protected:
+    DirtyExtentPersistence();
+
+    virtual cfg_opt_t *init_parser();
+    virtual void get_records(map<string, string>& records);
+    virtual void set_records(const map<string, string>& records);
+    virtual void read_values();
+
+private:
+    list<Record> records;
+
+    static std::auto_ptr<DirtyExtentPersistence>
+        theDirtyExtentPersistenceInstance;
+    static Mutex m;
+};
+
+#endif
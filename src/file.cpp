@@ -19,26 +19,25 @@
  ***************************************************************************/
 #include "file.h"
 
+static const string no_remote_path;
+
 File::~File()
 {
+	path->release();
 }
 
-File::File(const bool offline_state, const bool availability,
-		const string relative_path,
-		const string remote_path, const string cache_path) :
-	offline_state(offline_state), availability(availability),
-	relative_path(relative_path),
-	remote_path(remote_path), cache_path(cache_path)
+File::File(const bool availability, ResolvedPath *path) :
+	availability(availability), path(path)
 {}
 
-string File::get_cache_path() const
+const string& File::get_cache_path() const
 {
-	return cache_path;
+	return path->get_cache_path();
 }
 
 bool File::get_offline_state() const
 {
-	return offline_state;
+	return path->get_offline_state();
 }
 
 bool File::get_availability() const
@@ -46,27 +45,31 @@ bool File::get_availability() const
 	return availability;
 }
 
-string File::get_remote_path() const
+const string& File::get_remote_path() const
 {
-	return remote_path;
+	if (!availability)
+		return no_remote_path;
+	return path->get_remote_path();
 }
 
-string File::get_relative_path() const
+const string& File::get_relative_path() const
 {
-	return relative_path;
+	return path->get_relative_path();
 }
 
-File::File(const File &copy)
+File::File(const File &copy) :
+	availability(copy.availability), path(copy.path)
 {
-	operator =(copy);
+	path->acquire();
 }
 
 File & File::operator =(const File &copy)
 {
-	offline_state = copy.offline_state;
+	// acquire first, copy might share the path with this
+	copy.path->acquire();
+	path->release();
 	availability = copy.availability;
-	remote_path = copy.remote_path;
-	cache_path = copy.cache_path;
+	path = copy.path;
 
 	return *this;
-}
\ No newline at end of file
+}
@@ -20,6 +20,7 @@
 #ifndef FILE_H
 #define FILE_H
 #include <string>
+#include "resolvedpath.h"
 
 using namespace std;
 /**
@@ -31,6 +32,8 @@ using namespace std;
 	Most of the methods are called by the ofs_fuse callback functionss
 	
 	Instances are created and filled by the filestatusmanager.
+	The paths are held by a shared #ResolvedPath, so copying a File
+	does not copy any string.
 	
 	Immutable
 */
@@ -38,14 +41,11 @@ class File {
 public:
 	/**
 	 * ctor - initialize the values
-	 * @param offline_state should be available offline
 	 * @param availability  remote share available
-	 * @param relative_path path relative to mountpoint
-	 * @param remote_path absolute path in mountpoint
-	 * @param cache_path absolute path in cache
+	 * @param path resolved paths, the File takes over the
+	 *             caller's reference
 	 */
-	File(bool offline_state, bool availability, string relative_path,
-		string remote_path, string cache_path);
+	File(bool availability, ResolvedPath *path);
 	/**
 	 * copy ctor
 	 * @param copy object to copy
@@ -67,34 +67,31 @@ public:
 	 * @return availability
 	 */
 	bool get_availability() const;
-	/**
-	 * 
-	 * @return 
-	 */
-	bool get_sync_state();
 	/**
 	 * get absolute path in mountpoint
-	 * @return path
+	 * @return path, empty if the remote share is not available
 	 */
-	string get_remote_path() const;
+	const string& get_remote_path() const;
 	/**
 	 * get absolute path in cache
 	 * @return path
 	 */
-	string get_cache_path() const;
+	const string& get_cache_path() const;
         /**
          * get path relative to mountpoint
          * @return path
          */
-        string get_relative_path() const;
+        const string& get_relative_path() const;
+	/**
+	 * get the shared resolved paths, the caller does not get a reference
+	 * @return resolved paths
+	 */
+	inline ResolvedPath *get_resolved_path() const { return path; }
 	~File();
 
 private:
-	bool offline_state;
 	bool availability;
-	string relative_path;
-	string remote_path;
-	string cache_path;
+	ResolvedPath *path;
 };
 
 #endif
@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "filecopy.h"
+#include "writebackthrottle.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstdlib>
+#include <cstring>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+/// copy methods in the order they are tried
+enum {
+    COPY_FILE_RANGE = 0,
+    COPY_SENDFILE,
+    COPY_BUFFER
+};
+
+/// largest chunk handed to the kernel at once
+#define FILECOPY_MAX_CHUNK (1024 * 1024 * 1024)
+
+off_t FileCopy::copy(const string& source, const string& dest, mode_t mode)
+    throw(OFSException)
+{
+    int fds = open(source.c_str(), O_RDONLY);
+    if (fds < 0)
+        throw OFSException(strerror(errno), errno, true);
+    int fdd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fdd < 0)
+    {
+        int err = errno;
+        close(fds);
+        throw OFSException(strerror(err), err, true);
+    }
+    off_t copied;
+    try
+    {
+        copied = copy(fds, fdd);
+    }
+    catch (OFSException& e)
+    {
+        close(fds);
+        close(fdd);
+        throw;
+    }
+    close(fds);
+    if (close(fdd) < 0)
+        throw OFSException(strerror(errno), errno, true);
+    return copied;
+}
+
+off_t FileCopy::copy(int fdSource, int fdDest) throw(OFSException)
+{
+    struct stat st;
+    if (fstat(fdSource, &st) < 0)
+        throw OFSException(strerror(errno), errno, true);
+    if (st.st_size == 0)
+    {
+        if (ftruncate(fdDest, 0) < 0)
+            throw OFSException(strerror(errno), errno, true);
+        return 0;
+    }
+
+    if (clone(fdSource, fdDest))
+        return st.st_size;
+
+    if (ftruncate(fdDest, 0) < 0)
+        throw OFSException(strerror(errno), errno, true);
+    // a file without holes gets its blocks allocated in one go,
+    // a sparse file must not be filled up
+    bool sparse = (off_t)st.st_blocks * 512 < st.st_size;
+#ifdef HAVE_POSIX_FALLOCATE
+    if (!sparse)
+        posix_fallocate(fdDest, 0, st.st_size);
+#endif
+
+    int method = COPY_FILE_RANGE;
+    off_t copied = 0;
+    off_t offset = 0;
+    while (offset < st.st_size)
+    {
+        off_t end = st.st_size;
+#ifdef SEEK_HOLE
+        if (sparse)
+        {
+            off_t data = lseek(fdSource, offset, SEEK_DATA);
+            if (data < 0 && errno == ENXIO)
+                break;  // only a hole is left
+            if (data >= 0)
+            {
+                offset = data;
+                end = lseek(fdSource, offset, SEEK_HOLE);
+                if (end < 0 || end > st.st_size)
+                    end = st.st_size;
+            }
+            // SEEK_DATA not supported: copy everything
+        }
+#endif
+        copyRange(fdSource, fdDest, offset, end - offset, method);
+        copied += end - offset;
+        offset = end;
+    }
+    // restore a hole at the end of the file
+    if (ftruncate(fdDest, st.st_size) < 0)
+        throw OFSException(strerror(errno), errno, true);
+    return copied;
+}
+
+void FileCopy::copyRange(int fdSource, int fdDest, off_t offset, off_t length)
+    throw(OFSException)
+{
+    int method = COPY_FILE_RANGE;
+    copyRange(fdSource, fdDest, offset, length, method);
+}
+
+/**
+ * Share the blocks of the source with the destination
+ * @return false if the filesystem cannot do this
+ */
+bool FileCopy::clone(int fdSource, int fdDest)
+{
+#ifdef FICLONE
+    return ioctl(fdDest, FICLONE, fdSource) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Copy one range of data, switching to the next method if the current
+ * one is not supported for this pair of files
+ */
+void FileCopy::copyRange(int fdSource, int fdDest, off_t offset, off_t length,
+                         int& method)
+{
+    off_t done = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+    while (method == COPY_FILE_RANGE && done < length)
+    {
+        loff_t in = offset + done;
+        loff_t out = offset + done;
+        size_t chunk = WritebackThrottle::pace(
+            length - done > FILECOPY_MAX_CHUNK ? FILECOPY_MAX_CHUNK : length - done);
+        ssize_t res = copy_file_range(fdSource, &in, fdDest, &out, chunk, 0);
+        if (res > 0)
+            done += res;
+        else if (res == 0)
+            method = COPY_BUFFER;  // source shrunk or filesystem gave up
+        else if (errno == EINTR)
+            continue;
+        else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                 || errno == EOPNOTSUPP || errno == EBADF)
+            method = COPY_SENDFILE;
+        else
+            throw OFSException(strerror(errno), errno, true);
+    }
+#endif
+#ifdef HAVE_SENDFILE
+    if (method <= COPY_SENDFILE && done < length)
+    {
+        method = COPY_SENDFILE;
+        if (lseek(fdDest, offset + done, SEEK_SET) < 0)
+            throw OFSException(strerror(errno), errno, true);
+    }
+    while (method == COPY_SENDFILE && done < length)
+    {
+        off_t in = offset + done;
+        size_t chunk = WritebackThrottle::pace(
+            length - done > FILECOPY_MAX_CHUNK ? FILECOPY_MAX_CHUNK : length - done);
+        ssize_t res = sendfile(fdDest, fdSource, &in, chunk);
+        if (res > 0)
+            done += res;
+        else if (res == 0)
+            method = COPY_BUFFER;
+        else if (errno == EINTR)
+            continue;
+        else if (errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)
+            method = COPY_BUFFER;
+        else
+            throw OFSException(strerror(errno), errno, true);
+    }
+#endif
+    if (done >= length)
+        return;
+
+    method = COPY_BUFFER;
+    void* buf;
+    if (posix_memalign(&buf, 4096, FILECOPY_BUFFER_SIZE) != 0)
+        throw OFSException("Out of memory", ENOMEM, true);
+    while (done < length)
+    {
+        size_t chunk = WritebackThrottle::pace(
+            length - done > FILECOPY_BUFFER_SIZE ? FILECOPY_BUFFER_SIZE : length - done);
+        ssize_t nRead = pread(fdSource, buf, chunk, offset + done);
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead <= 0)
+        {
+            int err = nRead < 0 ? errno : EIO;
+            free(buf);
+            throw OFSException(strerror(err), err, true);
+        }
+        ssize_t written = 0;
+        while (written < nRead)
+        {
+            ssize_t res = pwrite(fdDest, (char*)buf + written, nRead - written,
+                                 offset + done + written);
+            if (res < 0 && errno == EINTR)
+                continue;
+            if (res < 0)
+            {
+                int err = errno;
+                free(buf);
+                throw OFSException(strerror(err), err, true);
+            }
+            written += res;
+        }
+        done += nRead;
+    }
+    free(buf);
+}
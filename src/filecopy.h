@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef FILECOPY_H
+#define FILECOPY_H
+
+#include "ofsexception.h"
+#include <sys/types.h>
+#include <string>
+
+using namespace std;
+
+/// size of the buffer used if the kernel cannot copy for us
+#define FILECOPY_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Copies the content of regular files between the cache and the remote
+ * share with as few syscalls and user space copies as possible:
+ *   - a reflink (FICLONE) if both files are on the same filesystem
+ *   - copy_file_range(), which lets the kernel or the filesystem copy
+ *   - sendfile()
+ *   - pread()/pwrite() with a large aligned buffer
+ * Each method falls back to the next one if the kernel or the filesystem
+ * does not support it. Holes in sparse files are skipped using
+ * SEEK_DATA/SEEK_HOLE, the destination of a file without holes is
+ * preallocated.
+ */
+class FileCopy
+{
+public:
+    /**
+     * Copy the whole content of one open file to another, starting at
+     * offset 0. The destination is truncated to the size of the source.
+     * @param fdSource file descriptor to read from
+     * @param fdDest file descriptor to write to
+     * @return number of bytes copied (holes are not counted)
+     */
+    static off_t copy(int fdSource, int fdDest) throw(OFSException);
+    /**
+     * Replace the content of a file by the content of another one
+     * @param source path of the file to read
+     * @param dest path of the file to write, created if necessary
+     * @param mode permissions if the destination is created
+     * @return number of bytes copied (holes are not counted)
+     */
+    static off_t copy(const string& source, const string& dest, mode_t mode)
+        throw(OFSException);
+
+    /**
+     * Copy a byte range to the same offset of another file
+     * @param fdSource file descriptor to read from
+     * @param fdDest file descriptor to write to
+     * @param offset start of the range
+     * @param length length of the range
+     */
+    static void copyRange(int fdSource, int fdDest, off_t offset, off_t length)
+        throw(OFSException);
+
+private:
+    static bool clone(int fdSource, int fdDest);
+    static void copyRange(int fdSource, int fdDest, off_t offset, off_t length,
+                          int& method);
+};
+
+#endif
@@ -27,47 +27,149 @@ using namespace std;
 #include "ofsenvironment.h"
 
 std::auto_ptr<Filestatusmanager> Filestatusmanager::theFilestatusmanagerInstance;
-Mutex Filestatusmanager::m;
-Filestatusmanager::Filestatusmanager(){}
-Filestatusmanager::~Filestatusmanager(){}
+pthread_once_t Filestatusmanager::instanceOnce = PTHREAD_ONCE_INIT;
+Filestatusmanager::Filestatusmanager() : generation(0) {}
+Filestatusmanager::~Filestatusmanager()
+{
+	for (int i = 0; i < RESOLVED_PATH_SHARDS; ++i)
+		for (path_map::iterator it = shards[i].paths.begin();
+		     it != shards[i].paths.end(); ++it)
+			it->second->release();
+}
 Filestatusmanager& Filestatusmanager::Instance()
 {
-    MutexLocker obtain_lock(m);
-    if (theFilestatusmanagerInstance.get() == 0)
-      theFilestatusmanagerInstance.reset(new Filestatusmanager);
+    pthread_once(&instanceOnce, createInstance);
     return *theFilestatusmanagerInstance;
 }
 
+void Filestatusmanager::createInstance()
+{
+    theFilestatusmanagerInstance.reset(new Filestatusmanager);
+}
+
 /**
  * Create a File object, which holds all information about the requested file
+ *
+ * Paths are only resolved on their first use, later calls share the
+ * #ResolvedPath and do not allocate anything.
  * @param Path The file path, relative to the current ofs mountpoint
  * @return Information about the requested file
  */
-File Filestatusmanager::give_me_file(string Path)
+File Filestatusmanager::give_me_file(const char *Path)
+{
+	bool available = FilesystemStatusManager::Instance().isAvailable();
+	Shard &shard = shard_of(Path);
+	unsigned long resolved_generation;
+	{
+		MutexLocker obtain_lock(shard.m);
+		path_map::iterator it = shard.paths.find(Path);
+		if (it != shard.paths.end()) {
+			it->second->acquire();
+			return File(available, it->second);
+		}
+		resolved_generation = generation;
+	}
+
+	// resolve without holding the lock, the BackingtreeManager calls
+	// invalidate() while holding its own one
+	ResolvedPath *resolved = resolve(Path);
+
+	MutexLocker obtain_lock(shard.m);
+	// a path resolved before the backing trees changed is not kept
+	if (resolved_generation == generation) {
+		pair<path_map::iterator, bool> inserted = shard.paths.insert(
+			make_pair(resolved->get_relative_path().c_str(), resolved));
+		if (inserted.second) {
+			resolved->acquire();
+			if (shard.paths.size() > MAX_RESOLVED_PATHS / RESOLVED_PATH_SHARDS)
+				release_unused(shard);
+		} else {
+			// resolved by another thread in the meantime
+			resolved->release();
+			resolved = inserted.first->second;
+			resolved->acquire();
+		}
+	}
+	return File(available, resolved);
+}
+
+/**
+ * Create a File object for a path resolved before, e.g. one kept by
+ * the #NodeTable, with the current availability
+ * @param Resolved resolved paths, the File takes over the caller's reference
+ * @return Information about the file
+ */
+File Filestatusmanager::give_me_file(ResolvedPath *Resolved)
+{
+	return File(FilesystemStatusManager::Instance().isAvailable(), Resolved);
+}
+
+unsigned long Filestatusmanager::get_generation()
+{
+	return generation;
+}
+
+/**
+ * Look up where a path is stored
+ * @param Path The file path, relative to the current ofs mountpoint
+ * @return new resolved path, the caller holds the only reference
+ */
+ResolvedPath *Filestatusmanager::resolve(const char *Path)
+{
+	string relative_path(Path);
+	BackingtreeManager &btm = BackingtreeManager::Instance();
+	string cache_path;
+	bool offline = btm.Search_Backingtree_via_Path(relative_path, cache_path);
+
+	if(!offline) {
+		cache_path = btm.get_Cache_Path()+relative_path; // actually same as above
+	}
+	return new ResolvedPath(relative_path,
+		FilesystemStatusManager::Instance().getRemote(relative_path),
+		cache_path, offline);
+}
+
+void Filestatusmanager::invalidate()
 {
-	bool offline;
-	bool available;
-	string Remote_Path;
-	string Cache_Path;
-	FilesystemStatusManager fssm = FilesystemStatusManager::Instance();
-	BackingtreeManager btm = BackingtreeManager::Instance();
-	
-	Backingtree *back = btm.Search_Backingtree_via_Path(Path);
-	
-	offline = (back != NULL);
-	available = fssm.isAvailable();
-	
-	if(offline) {
-            Cache_Path = back->get_cache_path(Path);
-	} else {
-            Cache_Path = btm.get_Cache_Path()+Path; // actually same as above
+	for (int i = 0; i < RESOLVED_PATH_SHARDS; ++i)
+		shards[i].m.lock();
+	++generation;
+	// Files still using a path keep it alive
+	for (int i = 0; i < RESOLVED_PATH_SHARDS; ++i) {
+		for (path_map::iterator it = shards[i].paths.begin();
+		     it != shards[i].paths.end(); ++it)
+			it->second->release();
+		shards[i].paths.clear();
 	}
-	if(available) {
-		Remote_Path = fssm.getRemote(Path);
-	} else {
-		Remote_Path = "";
+	for (int i = RESOLVED_PATH_SHARDS - 1; i >= 0; --i)
+		shards[i].m.unlock();
+}
+
+/**
+ * Get the shard a path belongs to, so threads working on different
+ * paths do not wait for each other
+ */
+Filestatusmanager::Shard& Filestatusmanager::shard_of(const char *Path)
+{
+	unsigned long hash = 0;
+	for (const char *c = Path; *c != '\0'; ++c)
+		hash = hash * 31 + (unsigned char)*c;
+	return shards[hash % RESOLVED_PATH_SHARDS];
+}
+
+/**
+ * Drop the paths of a shard no File refers to any more, its lock has to
+ * be held
+ */
+void Filestatusmanager::release_unused(Shard &shard)
+{
+	path_map::iterator it = shard.paths.begin();
+	while (it != shard.paths.end()) {
+		if (!it->second->is_shared()) {
+			it->second->release();
+			shard.paths.erase(it++);
+		} else {
+			++it;
+		}
 	}
-	
-	//
-        return File(offline, available, Path, Remote_Path, Cache_Path);
 }
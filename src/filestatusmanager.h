@@ -22,12 +22,18 @@
 #include "file.h"
 #include <string>
 #include <map>
+#include <cstring>
 #include <memory>
 #include "mutex.h"
 #include "mutexlocker.h"
 
 using namespace std;
 
+/// unused resolved paths are dropped when there are more than this
+#define MAX_RESOLVED_PATHS 16384
+/// the resolved paths are split into this many separately locked shards
+#define RESOLVED_PATH_SHARDS 16
+
 /**
 	@author Carsten Kolassa <Carsten@Kolassa.de>, 
 		Tobias Jaehnel <tjaehnel@gmail.com>
@@ -42,7 +48,29 @@ public:
 	 * @param Path The Path to the File as string
 	 * @return File Object that corresponds to the given Path
 	 */
-	File give_me_file(string Path);
+	File give_me_file(const char *Path);
+	/**
+	 * Function to query the status of a File
+	 * @param Path The Path to the File as string
+	 * @return File Object that corresponds to the given Path
+	 */
+	inline File give_me_file(const string &Path) { return give_me_file(Path.c_str()); }
+	/**
+	 * Create a File object for a path resolved before
+	 * @param Resolved resolved paths, the File takes over the
+	 *                 caller's reference
+	 * @return File Object for the resolved paths
+	 */
+	File give_me_file(ResolvedPath *Resolved);
+	/**
+	 * Paths resolved in an older generation are outdated
+	 * @return the number of invalidate() calls so far
+	 */
+	unsigned long get_generation();
+	/**
+	 * Forget all resolved paths, because the backing trees have changed
+	 */
+	void invalidate();
 	/**
 	 * Returns a Pointer to the Instance of the Filestatusmanager
 	 * part of the Singleton Pattern
@@ -57,9 +85,29 @@ protected:
 	Filestatusmanager();
     
 private:
+	struct path_less {
+		bool operator()(const char *a, const char *b) const
+			{ return strcmp(a, b) < 0; }
+	};
+	/// resolved paths, the key points to the relative path of the value
+	typedef map<const char *, ResolvedPath *, path_less> path_map;
+
+	/// part of the resolved paths, selected by a hash of the path
+	struct Shard {
+		Mutex m;
+		path_map paths;
+	};
+
+	ResolvedPath *resolve(const char *Path);
+	Shard& shard_of(const char *Path);
+	void release_unused(Shard &shard);
 
+	Shard shards[RESOLVED_PATH_SHARDS];
+	/// incremented by invalidate() while holding the locks of all shards
+	volatile unsigned long generation;
     static std::auto_ptr<Filestatusmanager> theFilestatusmanagerInstance;
-    static Mutex m; 
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 };
 
 #endif
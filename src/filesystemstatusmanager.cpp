@@ -46,20 +46,31 @@ using namespace std;
 #include "ofshash.h"
 #include "ofslog.h"
 #include "lazywrite.h"
+#include "attrcache.h"
 
 std::auto_ptr<FilesystemStatusManager> FilesystemStatusManager::theFilesystemStatusManagerInstance;
 Mutex FilesystemStatusManager::m;
+pthread_once_t FilesystemStatusManager::instanceOnce = PTHREAD_ONCE_INIT;
 
-FilesystemStatusManager::FilesystemStatusManager() : available(true), sync(true) {}
+FilesystemStatusManager::FilesystemStatusManager() : available(true)
+{
+	memset(&dirty, 0, sizeof(dirty));
+	dirty.sync = true;
+	pthread_mutex_init(&dirtyMutex, NULL);
+	pthread_cond_init(&dirtyChanged, NULL);
+}
 FilesystemStatusManager::~FilesystemStatusManager(){}
 FilesystemStatusManager& FilesystemStatusManager::Instance()
 {
-	MutexLocker obtain_lock(m);
-	if (theFilesystemStatusManagerInstance.get() == 0)
-		theFilesystemStatusManagerInstance.reset(new FilesystemStatusManager);
+	pthread_once(&instanceOnce, createInstance);
 	return *theFilesystemStatusManagerInstance;
 }
 
+void FilesystemStatusManager::createInstance()
+{
+	theFilesystemStatusManagerInstance.reset(new FilesystemStatusManager);
+}
+
 
 
 /*!
@@ -73,7 +84,7 @@ bool FilesystemStatusManager::isAvailable()
 
 bool FilesystemStatusManager::issync()
 {
-	return sync;
+	return dirty.sync;
 }
 
 /*!
@@ -82,6 +93,7 @@ bool FilesystemStatusManager::issync()
 void FilesystemStatusManager::filesystemError()
 {
 	available=false;
+	AttrCache::Instance().invalidateAll();
 }
 
 /*!
@@ -133,6 +145,7 @@ void *FilesystemStatusManager::DbusListenerRun(void *)
 					string Netpath= "/org/freedesktop/NetworkManager/Devices/"+ (*it);
 					if(Netpath==device_obj){
 						FilesystemStatusManager::Instance().available=false;
+						AttrCache::Instance().invalidateAll();
 					}
 				}
 			}
@@ -266,7 +279,7 @@ void FilesystemStatusManager::unmountfs()
 	if (status == -1)
 	{
 		ofslog::error("Unable to unmount the remote file system!");
-		ofslog::error(strerror(errno));
+		ofslog::error("%s", strerror(errno));
 	}
 	else
 	{
@@ -289,7 +302,7 @@ void FilesystemStatusManager::unmountfs()
 	if(WIFEXITED(status) && exitstatus) {
 		ofslog::error("Unable to unmount the remote file system!");
 // FIXME: umount return codes are not errno values?
-		ofslog::error(strerror(exitstatus));
+		ofslog::error("%s", strerror(exitstatus));
 		errno = 0;
 	}
 	else
@@ -312,15 +325,131 @@ void FilesystemStatusManager::setAvailability(bool value)
 			SynchronizationManager::Instance().ReintegrateAll(
 					OFSEnvironment::Instance().getShareID().c_str());
             //Remote==Cache
-            sync=true;
+            setsync(true);
 		}
 		else
 		{ // unmount fs
 			unmountfs();
 		}
+		// attributes are read from the other tree now
+		AttrCache::Instance().invalidateAll();
 	}
 }
 void FilesystemStatusManager::setsync(bool value)
 {
-	sync=value;
+	pthread_mutex_lock(&dirtyMutex);
+	if (value)
+	{
+		unsigned int events = dirty.events;
+		unsigned int changes = dirty.changes;
+		memset(&dirty, 0, sizeof(dirty));
+		dirty.sync = true;
+		dirty.events = events;
+		dirty.changes = changes;
+	}
+	else
+		markdirty();
+	pthread_mutex_unlock(&dirtyMutex);
+}
+
+void FilesystemStatusManager::adddirty(off_t bytes)
+{
+	long long limit = OFSEnvironment::Instance().getLazywriteDirtyBytes() * 1024LL;
+	pthread_mutex_lock(&dirtyMutex);
+	markdirty();
+	bool crossed = dirty.bytes < limit && dirty.bytes + bytes >= limit;
+	dirty.bytes += bytes;
+	if (crossed)
+		notify();
+	pthread_mutex_unlock(&dirtyMutex);
+}
+
+void FilesystemStatusManager::setdirtyentries(int entries)
+{
+	int limit = OFSEnvironment::Instance().getLazywriteDirtyEntries();
+	pthread_mutex_lock(&dirtyMutex);
+	// the write-back only removes entries
+	if (entries > dirty.entries)
+		markdirty();
+	bool crossed = dirty.entries < limit && entries >= limit;
+	dirty.entries = entries;
+	if (crossed)
+		notify();
+	pthread_mutex_unlock(&dirtyMutex);
+}
+
+void FilesystemStatusManager::deferdirty()
+{
+	pthread_mutex_lock(&dirtyMutex);
+	if (!dirty.sync)
+		dirty.since = time(NULL);
+	dirty.bytes = 0;
+	pthread_mutex_unlock(&dirtyMutex);
+}
+
+bool FilesystemStatusManager::cleardirty(const DirtyState& seen)
+{
+	pthread_mutex_lock(&dirtyMutex);
+	// a change during the write-back may not have its entry yet
+	bool clean = dirty.entries == 0 && dirty.changes == seen.changes;
+	if (clean)
+	{
+		dirty.sync = true;
+		dirty.since = 0;
+	}
+	else if (!dirty.sync)
+		dirty.since = time(NULL);
+	dirty.bytes = 0;
+	pthread_mutex_unlock(&dirtyMutex);
+	return clean;
+}
+
+DirtyState FilesystemStatusManager::getdirty()
+{
+	pthread_mutex_lock(&dirtyMutex);
+	DirtyState state = dirty;
+	pthread_mutex_unlock(&dirtyMutex);
+	return state;
+}
+
+void FilesystemStatusManager::waitdirty(const DirtyState& seen, int seconds)
+{
+	struct timespec timeout;
+	timeout.tv_sec = time(NULL) + seconds;
+	timeout.tv_nsec = 0;
+	pthread_mutex_lock(&dirtyMutex);
+	int res = 0;
+	while (dirty.events == seen.events && res != ETIMEDOUT)
+	{
+		if (seconds > 0)
+			res = pthread_cond_timedwait(&dirtyChanged, &dirtyMutex, &timeout);
+		else
+			pthread_cond_wait(&dirtyChanged, &dirtyMutex);
+	}
+	pthread_mutex_unlock(&dirtyMutex);
+}
+
+/**
+ * Count a change, the first one starts the age of the changes. The caller
+ * holds dirtyMutex.
+ */
+void FilesystemStatusManager::markdirty()
+{
+	dirty.changes++;
+	if (dirty.sync)
+	{
+		// the lazy write thread starts counting the age
+		dirty.sync = false;
+		dirty.since = time(NULL);
+		notify();
+	}
+}
+
+/**
+ * Wake the lazy write thread, the caller holds dirtyMutex
+ */
+void FilesystemStatusManager::notify()
+{
+	dirty.events++;
+	pthread_cond_signal(&dirtyChanged);
 }
@@ -26,10 +26,31 @@
 //#include "filesystem.h"
 #include <string>
 #include <memory>
+#include <pthread.h>
+#include <time.h>
 
 #define TESTING_REMOTE_PATH "/usr/bin"
 #define TESTING_BACKING_PATH "/tmp/ofsbacking"
 
+/**
+ * Changes that have not been written back to the remote share yet
+ */
+struct DirtyState
+{
+    /// nothing to write back
+    bool sync;
+    /// time of the first change since the last write-back, 0 if clean
+    time_t since;
+    /// bytes written to the cache only since the last write-back
+    long long bytes;
+    /// pending sync log entries
+    int entries;
+    /// counts the changes that may trigger the write-back
+    unsigned int events;
+    /// counts all changes
+    unsigned int changes;
+};
+
 /**
 	@author Carsten Kolassa <Carsten@Kolassa.de>,
 		Tobias Jaehnel <tjaehnel@gmail.com>
@@ -85,6 +106,40 @@ public:
     void mountfs();
     void setsync(bool value);
     bool issync();
+    /**
+     * Count bytes that were written to the cache only
+     * @param bytes number of bytes
+     */
+    void adddirty(off_t bytes);
+    /**
+     * Set the number of pending sync log entries
+     * @param entries number of entries
+     */
+    void setdirtyentries(int entries);
+    /**
+     * Start counting the age and the bytes of the changes a write-back
+     * left over anew, so they are retried when they expire again
+     */
+    void deferdirty();
+    /**
+     * Mark the changes as written back unless there are pending entries
+     * or new changes, otherwise defer them like deferdirty()
+     * @param seen state returned by getdirty() before the write-back
+     * @return true if nothing is left to write back
+     */
+    bool cleardirty(const DirtyState& seen);
+    /**
+     * @return the changes that have not been written back
+     */
+    DirtyState getdirty();
+    /**
+     * Wait until there are new changes or the number of dirty bytes or
+     * entries crosses the lazywrite threshold
+     * @param seen state returned by getdirty(), returns at once if
+     *        there were such changes since
+     * @param seconds most seconds to wait, 0 to wait without limit
+     */
+    void waitdirty(const DirtyState& seen, int seconds);
 protected:
     FilesystemStatusManager();
   private:
@@ -92,7 +147,17 @@ protected:
 		theFilesystemStatusManagerInstance;
 
 protected:
-    bool available, sync;
+    /// read without locking by every file system operation
+    volatile bool available;
+    DirtyState dirty;
+    /// protects dirty
+    pthread_mutex_t dirtyMutex;
+    /// signaled when dirty may trigger the write-back
+    pthread_cond_t dirtyChanged;
+    void notify();
+    void markdirty();
     static Mutex m; 
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 };
 #endif
@@ -0,0 +1,380 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "journal.h"
+#include "ofshash.h"
+#include "ofslog.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// records larger than this are considered garbage
+#define JOURNAL_MAX_RECORD (64 * 1024 * 1024)
+
+struct JournalFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t reserved;
+};
+
+struct JournalRecordHeader
+{
+    uint32_t length;
+    uint32_t type;
+    uint32_t crc;
+};
+
+static uint32_t record_crc(uint32_t type, uint32_t length, const char* payload)
+{
+    uint32_t crc = ofs_crc32(0, &type, sizeof(type));
+    crc = ofs_crc32(crc, &length, sizeof(length));
+    return ofs_crc32(crc, payload, length);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CONSTRUCTION/ DESTRUCTION
+//////////////////////////////////////////////////////////////////////////////
+
+Journal::Journal(const string& filename) : filename(filename), fd(-1),
+    tail(0), broken(false), flushing(false), enqueuedSeq(0), writtenSeq(0),
+    durableSeq(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&flushed, NULL);
+}
+
+Journal::~Journal()
+{
+    close();
+    pthread_cond_destroy(&flushed);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool Journal::open()
+{
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0)
+    {
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        ofslog::error("Could not open journal %s: %s", filename.c_str(), strerror(errno));
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    JournalFileHeader header;
+    ssize_t nRead = pread(fd, &header, sizeof(header), 0);
+    if (nRead == 0)
+    {
+        // new journal
+        if (!write_header(fd) || fdatasync(fd) < 0)
+        {
+            ofslog::error("Could not initialize journal %s: %s", filename.c_str(), strerror(errno));
+            ::close(fd);
+            fd = -1;
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        tail = sizeof(header);
+    }
+    else if (nRead != sizeof(header)
+             || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0
+             || header.version != JOURNAL_FORMAT_VERSION)
+    {
+        ofslog::error("Journal %s has an unknown format", filename.c_str());
+        ::close(fd);
+        fd = -1;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    else
+    {
+        tail = lseek(fd, 0, SEEK_END);
+    }
+    broken = false;
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void Journal::close()
+{
+    sync(enqueuedSeq);
+    pthread_mutex_lock(&mutex);
+    while (flushing)
+        pthread_cond_wait(&flushed, &mutex);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    pthread_mutex_unlock(&mutex);
+}
+
+bool Journal::exists() const
+{
+    struct stat fileinfo;
+    return lstat(filename.c_str(), &fileinfo) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// READING
+//////////////////////////////////////////////////////////////////////////////
+
+bool Journal::replay(Visitor& visitor)
+{
+    pthread_mutex_lock(&mutex);
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    off_t offset = sizeof(JournalFileHeader);
+    off_t end = lseek(fd, 0, SEEK_END);
+    string payload;
+    while (offset < end)
+    {
+        JournalRecordHeader header;
+        if (end - offset < (off_t)sizeof(header)
+            || pread(fd, &header, sizeof(header), offset) != sizeof(header)
+            || header.length > JOURNAL_MAX_RECORD
+            || end - offset - (off_t)sizeof(header) < (off_t)header.length)
+            break;
+        payload.resize(header.length);
+        if (header.length > 0
+            && pread(fd, &payload[0], header.length, offset + sizeof(header))
+               != (ssize_t)header.length)
+            break;
+        if (record_crc(header.type, header.length, payload.data()) != header.crc)
+            break;
+        visitor.record(header.type, payload);
+        offset += sizeof(header) + header.length;
+    }
+    if (offset < end)
+    {
+        // torn or damaged tail, drop it so new records follow valid ones
+        ofslog::warning("Dropping %ld damaged bytes at the end of journal %s",
+            (long)(end - offset), filename.c_str());
+        if (ftruncate(fd, offset) < 0)
+            ofslog::error("Could not truncate journal %s: %s", filename.c_str(), strerror(errno));
+    }
+    tail = offset;
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WRITING
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned long long Journal::enqueue(const list<Record>& records)
+{
+    pthread_mutex_lock(&mutex);
+    for (list<Record>::const_iterator it = records.begin(); it != records.end(); ++it)
+        encode(pending, it->first, it->second);
+    unsigned long long seq = ++enqueuedSeq;
+    pthread_mutex_unlock(&mutex);
+    return seq;
+}
+
+bool Journal::sync(unsigned long long seq)
+{
+    pthread_mutex_lock(&mutex);
+    while (durableSeq < seq && !broken && fd >= 0)
+    {
+        if (flushing)
+        {
+            // somebody else writes the current batch, ours may be in it
+            pthread_cond_wait(&flushed, &mutex);
+            continue;
+        }
+        flush_locked(true);
+    }
+    bool bOK = durableSeq >= seq;
+    pthread_mutex_unlock(&mutex);
+    return bOK;
+}
+
+bool Journal::write(unsigned long long seq)
+{
+    pthread_mutex_lock(&mutex);
+    while (writtenSeq < seq && !broken && fd >= 0)
+    {
+        if (flushing)
+        {
+            pthread_cond_wait(&flushed, &mutex);
+            continue;
+        }
+        flush_locked(false);
+    }
+    bool bOK = writtenSeq >= seq;
+    pthread_mutex_unlock(&mutex);
+    return bOK;
+}
+
+bool Journal::append(unsigned int type, const string& payload)
+{
+    list<Record> records;
+    records.push_back(Record(type, payload));
+    return sync(enqueue(records));
+}
+
+/**
+ * Write all pending records as one batch. Must be called with the mutex
+ * held and no other flush running, the mutex is released during I/O.
+ * @param durable wait until the batch and everything written before is
+ *        on disk
+ */
+bool Journal::flush_locked(bool durable)
+{
+    flushing = true;
+    string batch;
+    batch.swap(pending);
+    unsigned long long batchSeq = enqueuedSeq;
+    off_t start = tail;
+    int batchfd = fd;
+    pthread_mutex_unlock(&mutex);
+
+    bool bOK = write_all(batchfd, batch.data(), batch.size())
+               && (!durable || fdatasync(batchfd) == 0);
+    int nErr = errno;
+
+    pthread_mutex_lock(&mutex);
+    if (bOK)
+    {
+        tail = start + batch.size();
+        writtenSeq = batchSeq;
+        if (durable)
+            durableSeq = batchSeq;
+    }
+    else
+    {
+        ofslog::error("Could not write journal %s: %s", filename.c_str(), strerror(nErr));
+        // remove the partial batch so the file stays replayable
+        if (ftruncate(batchfd, start) < 0)
+            ofslog::error("Could not truncate journal %s: %s", filename.c_str(), strerror(errno));
+        broken = true;
+    }
+    flushing = false;
+    pthread_cond_broadcast(&flushed);
+    return bOK;
+}
+
+bool Journal::rewrite(const list<Record>& records)
+{
+    pthread_mutex_lock(&mutex);
+    while (flushing)
+        pthread_cond_wait(&flushed, &mutex);
+
+    string content;
+    for (list<Record>::const_iterator it = records.begin(); it != records.end(); ++it)
+        encode(content, it->first, it->second);
+
+    string tmpname = filename + ".tmp";
+    int tmpfd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    bool bOK = tmpfd >= 0 && write_header(tmpfd)
+               && write_all(tmpfd, content.data(), content.size())
+               && fdatasync(tmpfd) == 0;
+    if (tmpfd >= 0)
+        ::close(tmpfd);
+    if (bOK)
+        bOK = rename(tmpname.c_str(), filename.c_str()) == 0;
+    if (!bOK)
+    {
+        ofslog::error("Could not rewrite journal %s: %s", filename.c_str(), strerror(errno));
+        unlink(tmpname.c_str());
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    // make the rename itself durable
+    string dirname = filename.substr(0, filename.find_last_of('/') + 1);
+    int dirfd = ::open(dirname.length() ? dirname.c_str() : ".", O_RDONLY);
+    if (dirfd >= 0)
+    {
+        fsync(dirfd);
+        ::close(dirfd);
+    }
+
+    if (fd >= 0)
+        ::close(fd);
+    fd = ::open(filename.c_str(), O_RDWR | O_APPEND);
+    tail = sizeof(JournalFileHeader) + content.size();
+    // the new content supersedes everything queued so far
+    pending.clear();
+    writtenSeq = enqueuedSeq;
+    durableSeq = enqueuedSeq;
+    broken = fd < 0;
+    pthread_mutex_unlock(&mutex);
+    return !broken;
+}
+
+off_t Journal::size()
+{
+    pthread_mutex_lock(&mutex);
+    off_t nSize = tail;
+    pthread_mutex_unlock(&mutex);
+    return nSize;
+}
+
+void Journal::encode(string& buf, unsigned int type, const string& payload)
+{
+    JournalRecordHeader header;
+    header.length = payload.size();
+    header.type = type;
+    header.crc = record_crc(header.type, header.length, payload.data());
+    buf.append((const char*)&header, sizeof(header));
+    buf.append(payload);
+}
+
+bool Journal::write_header(int fd)
+{
+    JournalFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_FORMAT_VERSION;
+    header.headerSize = sizeof(header);
+    return write_all(fd, (const char*)&header, sizeof(header));
+}
+
+bool Journal::write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t nWritten = ::write(fd, data, len);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += nWritten;
+        len -= nWritten;
+    }
+    return true;
+}
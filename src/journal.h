@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include <list>
+#include <utility>
+
+using namespace std;
+
+#define JOURNAL_MAGIC "OFSJ"
+#define JOURNAL_FORMAT_VERSION 1
+
+/**
+ * Append-only, checksummed record file with group commit.
+ *
+ * File layout (native byte order):
+ *   file header: magic "OFSJ", format version, header size, reserved
+ *   records:     fixed size record header (payload length, record type,
+ *                CRC-32 over type, length and payload) followed by the payload
+ *
+ * The journal does not interpret payloads, the record type is owned by the
+ * user of the journal. Replay stops at the first record that is truncated
+ * or fails its checksum and cuts the file there, so a crash in the middle of
+ * a write only loses the batch that was being written.
+ *
+ * Appends from concurrent threads are collected in memory. The first thread
+ * that has to wait for durability writes everything collected so far with a
+ * single write() and fdatasync(), all other threads of that batch just wait
+ * for it to finish. Users that can lose the last records in a system crash
+ * write() them instead and sync() now and then.
+ */
+class Journal
+{
+public:
+    typedef pair<unsigned int, string> Record;
+
+    /**
+     * Receives the records of the journal during replay
+     */
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() {}
+        virtual void record(unsigned int type, const string& payload) = 0;
+    };
+
+    explicit Journal(const string& filename);
+    ~Journal();
+
+    /**
+     * Open the journal, create it if it does not exist
+     * @return false if the file could not be opened or has another format
+     */
+    bool open();
+    /**
+     * Close the journal, pending records are written first
+     */
+    void close();
+    /**
+     * Check if the journal file exists on disk
+     * @return true if the file exists
+     */
+    bool exists() const;
+    /**
+     * Pass all valid records to the visitor in the order they were written.
+     * A damaged tail is removed from the file.
+     * @param visitor receives the records
+     * @return false if the journal could not be read
+     */
+    bool replay(Visitor& visitor);
+    /**
+     * Queue records for writing without waiting for them
+     * @param records records to append as one unit
+     * @return sequence number to pass to sync()
+     */
+    unsigned long long enqueue(const list<Record>& records);
+    /**
+     * Wait until all records up to the given sequence number are on disk
+     * @param seq sequence number returned by enqueue()
+     * @return false if writing the records failed
+     */
+    bool sync(unsigned long long seq);
+    /**
+     * Write all records up to the given sequence number to the file
+     * without waiting for the disk, so they survive a crash of the
+     * process but not of the system. A later sync() makes them durable.
+     * @param seq sequence number returned by enqueue()
+     * @return false if writing the records failed
+     */
+    bool write(unsigned long long seq);
+    /**
+     * Append records and wait until they are on disk
+     * @param type record type
+     * @param payload record data
+     * @return false if writing the record failed
+     */
+    bool append(unsigned int type, const string& payload);
+    /**
+     * Atomically replace the content of the journal by the given records.
+     * The new content is written to a temporary file which is renamed over
+     * the journal, so a crash leaves either the old or the new journal.
+     * @param records complete new content
+     * @return false if the journal could not be rewritten
+     */
+    bool rewrite(const list<Record>& records);
+    /**
+     * @return size of the journal file in bytes
+     */
+    off_t size();
+
+private:
+    static void encode(string& buf, unsigned int type, const string& payload);
+    static bool write_all(int fd, const char* data, size_t len);
+    bool write_header(int fd);
+    bool flush_locked(bool durable);
+
+    string filename;
+    int fd;
+    off_t tail;
+    bool broken;
+    /// records written by nobody yet
+    string pending;
+    bool flushing;
+    unsigned long long enqueuedSeq;
+    unsigned long long writtenSeq;
+    unsigned long long durableSeq;
+    pthread_mutex_t mutex;
+    pthread_cond_t flushed;
+
+    Journal(const Journal&);
+    Journal& operator=(const Journal&);
+};
+
+#endif
@@ -23,6 +23,11 @@
 #include "ofslog.h"
 #include "filesystemstatusmanager.h"
 #include "ofsenvironment.h"
+#include "loadsampler.h"
+#include "writebackthrottle.h"
+#include "synclogger.h"
+#include "ofsstats.h"
+#include <algorithm>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -30,9 +35,9 @@
  * on Shutdown or Log-off the reintegration will start in fuse_destroy
  *
 */
-Lazywrite::Lazywrite(int i)
+Lazywrite::Lazywrite(int i) : leftover(0), lastRun(0)
 {
-
+	LoadSampler::Instance().start();
 }
 
 Lazywrite::~Lazywrite()
@@ -42,86 +47,114 @@ Lazywrite::~Lazywrite()
 
 bool Lazywrite::loadnetwork()
 {
-	FILE *fpipe;
-	const char *command = "grep eth0 /proc/net/dev | awk -F: \'{print  $2}\' | awk \'{print $9}\'";
-	char line[255];
-	long int is=0, old = 0;
-	long int diff=0;
-
 	//re-integration per Load Network
-	//get the Different for the next 5 Minutes of the Transmitted Byte from /proc/net/dev
+	//less than 10 Mbyte sent by others in the last 5 Minutes
+	return LoadSampler::Instance().getForeignAverage() * LOAD_LONG_WINDOW
+		< LAZYWRITE_MAX_TRAFFIC;
+}
 
-	for(int x=0;x<30;x++)
-	{
-	fpipe=(FILE*)popen(command,"r");
-	fgets(line, sizeof line, fpipe);
-	is=(atol(line))/1024; //byte->Kbyte
-	if(is>old && old!=0)
+bool Lazywrite::loadcpu()
+{
+	// re-integration per Load CPU
+	return LoadSampler::Instance().getLoad() < LAZYWRITE_MAX_LOAD;
+}
+const char* Lazywrite::trigger(int& wait)
+{
+	FilesystemStatusManager& fsm = FilesystemStatusManager::Instance();
+	OFSEnvironment& env = OFSEnvironment::Instance();
+	DirtyState dirty = fsm.getdirty();
+	wait = 0;
+	if (dirty.sync)
+		return NULL;
+	// reconnecting writes everything back anyway
+	if (!fsm.isAvailable())
 	{
-	  diff = diff + (is - old);
+		wait = LAZYWRITE_RECHECK;
+		return NULL;
 	}
-	old = is;
-	sleep(10);
-	pclose(fpipe);
+	// like dirty_background_bytes, too much to wait for a quiet moment
+	if (dirty.bytes >= env.getLazywriteDirtyBytes() * 1024LL)
+		return "dirty bytes";
+	// entries the last write-back failed on wait for their expiry
+	if (dirty.entries - leftover >= env.getLazywriteDirtyEntries())
+		return "dirty entries";
+
+	int age = time(NULL) - dirty.since;
+	int expire = env.getLazywriteExpire();
+	//hard sync after LAZYWRITE_HARD_EXPIRE times lwexpire, whatever the load
+	if (age >= expire * LAZYWRITE_HARD_EXPIRE)
+		return "expired";
+	// an operation may end between the two reads
+	unsigned long long lastActive = OFSStats::getLastActive();
+	unsigned long long now = OFSStats::now();
+	int idle = now > lastActive ? (now - lastActive) / 1000000000ULL : 0;
+	int idleLimit = env.getLazywriteIdle();
+	bool expired = age >= expire;
+	bool isIdle = idleLimit > 0 && idle >= idleLimit;
+	// the entries the last write-back left are retried on idle only
+	// after new activity or LAZYWRITE_RECHECK seconds
+	int retry = 0;
+	if (isIdle && leftover > 0 && lastActive <= lastRun)
+	{
+		retry = LAZYWRITE_RECHECK - (int)((now - lastRun) / 1000000000ULL);
+		isIdle = retry <= 0;
 	}
-	diff=diff/1024; //Kbyte->Mbyte
-	if(diff<10) //if the different smaller then 10 Mbyte
+	if (expired || isIdle)
 	{
-		 return true;
+		bool tosync = true;
+		switch(env.getlwoption())
+		{
+		case 'c':
+			tosync=loadcpu();
+			break;
+		case 'n':
+			tosync=loadnetwork();
+			break;
+		}
+		if (tosync)
+			return expired ? "expired" : "idle";
+		wait = LAZYWRITE_RECHECK;
+		return NULL;
 	}
-	else return false;
+	wait = expire - age;
+	if (retry > 0)
+		wait = min(wait, retry);
+	else if (idleLimit > 0)
+		wait = min(wait, idleLimit - idle);
+	return NULL;
 }
 
-bool Lazywrite::loadcpu()
+void Lazywrite::finished(const DirtyState& seen)
 {
-	FILE *fpipe;
-	const char *command = "grep -o \'[0-9]\\+\\.[0-9]\\+*\' /proc/loadavg | sed -n \"3p\"";
-	char line[10];
-	int is, max = 5;
-	// re-integration per Load CPU
-	fpipe=(FILE*)popen(command,"r");
-	fgets(line, sizeof line, fpipe);
-	is=atol(line);
-	pclose(fpipe);
-	if(is<max)
-	{
-		 return true;
-	}
-	else return false;
+	// changes made meanwhile keep the state dirty
+	leftover = FilesystemStatusManager::Instance().cleardirty(seen)
+		? 0 : FilesystemStatusManager::Instance().getdirty().entries;
+	lastRun = OFSStats::now();
 }
+
+/* Sleeps until the changes cross a threshold, get too old or the file
+ * system is idle, see trigger()
+ */
 void Lazywrite::startLazywrite()
 {
 	ofslog::info("Lazy write activated");
-	int sec = 300, timer = 0;
-	bool tosync=false;
+	FilesystemStatusManager& fsm = FilesystemStatusManager::Instance();
+	const string shareID = OFSEnvironment::Instance().getShareID();
+	// changes left over by the last run
+	fsm.setdirtyentries(SyncLogger::Instance().GetEntryCount(shareID.c_str()));
 
 	while (true) {
-		if (!(FilesystemStatusManager::Instance().issync()) && FilesystemStatusManager::Instance().isAvailable()) {
-
-			timer++;
-			switch(OFSEnvironment::Instance().getlwoption())
-			{
-			case 'c':
-				tosync=loadcpu();
-				break;
-			case 'n':
-				tosync=loadnetwork();
-				break;
-			case 't':
-				tosync=true; //Sync ever x Minutes
-				break;
-			}
-			if (timer<5) tosync=true; //hard sync after timer*sec (default max 25 Minutes between two sync)
-			if (tosync){
-			ofslog::info("Start Write back");
-			SynchronizationManager::Instance().ReintegrateAll(OFSEnvironment::Instance().getShareID().c_str());
-			FilesystemStatusManager::Instance().setsync(true);
-			timer=0;
-			}
-		}
-		else {
-			ofslog::info("No Changes");
-			}
-		sleep(sec);
+		DirtyState seen = fsm.getdirty();
+		int wait;
+		const char* reason = trigger(wait);
+		if (reason == NULL) {
+			fsm.waitdirty(seen, wait);
+			continue;
 		}
+		ofslog::info("Start Write back (%s, %d entries, %lld KiB) at %.1f KiB/s",
+			reason, seen.entries, seen.bytes / 1024,
+			WritebackThrottle::Instance().getRate() / 1024);
+		SynchronizationManager::Instance().ReintegrateAll(shareID.c_str(), true);
+		finished(seen);
+	}
 }
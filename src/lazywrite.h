@@ -25,6 +25,20 @@
 #include <stdlib.h>
 using namespace std;
 
+struct DirtyState;
+
+/// the network counts as idle below this many bytes sent by others
+/// in LOAD_LONG_WINDOW
+#define LAZYWRITE_MAX_TRAFFIC (10 * 1024 * 1024)
+/// the cpu counts as idle below this 15 minute load average
+#define LAZYWRITE_MAX_LOAD 5
+/// seconds until a write-back held back by the load or the network
+/// connection, or one that left entries, is considered again
+#define LAZYWRITE_RECHECK 30
+/// changes this many times older than lwexpire are written back
+/// whatever the load
+#define LAZYWRITE_HARD_EXPIRE 5
+
 
 /**
 	@author
@@ -38,9 +52,25 @@ public:
 	private:
     bool loadnetwork();
     bool loadcpu();
+    /// entries left in the sync log by the last write-back
+    int leftover;
+    /// monotonic time in nanoseconds the last write-back ended
+    unsigned long long lastRun;
 
     public:
 	void startLazywrite();
+    /**
+     * Decide if the changes are written back now
+     * @param wait (out) seconds until the decision may change, 0 if only
+     *        a new change can change it
+     * @return the reason to write back, NULL to wait
+     */
+    const char* trigger(int& wait);
+    /**
+     * Note the end of a write-back
+     * @param seen state the write-back started with
+     */
+    void finished(const DirtyState& seen);
 };
 
 #endif /* LAZYWRITE_H_ */
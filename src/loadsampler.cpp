@@ -0,0 +1,230 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "loadsampler.h"
+#include "ofsenvironment.h"
+#include "ofslog.h"
+#include "ofsstats.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+std::auto_ptr<LoadSampler> LoadSampler::theLoadSamplerInstance;
+pthread_once_t LoadSampler::instanceOnce = PTHREAD_ONCE_INIT;
+
+LoadSampler::LoadSampler()
+    : excluded(0), lastExcluded(0), lastSample(0), samples(0),
+      foreignRate(0), foreignAverage(0), peakRate(0), load(0), running(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+LoadSampler& LoadSampler::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theLoadSamplerInstance;
+}
+
+void LoadSampler::createInstance()
+{
+    theLoadSamplerInstance.reset(new LoadSampler());
+}
+
+void LoadSampler::start()
+{
+    pthread_mutex_lock(&mutex);
+    bool start = !running;
+    if (start)
+    {
+        running = true;
+        devices = OFSEnvironment::Instance().getLazywriteDevices();
+    }
+    pthread_mutex_unlock(&mutex);
+    if (!start)
+        return;
+    // the first sample only sets the counters the next ones are
+    // compared to
+    sample();
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, LoadSampler::run, this) != 0)
+    {
+        ofslog::error("Could not start load sampling: %s", strerror(errno));
+        pthread_mutex_lock(&mutex);
+        running = false;
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void* LoadSampler::run(void* sampler)
+{
+    while (true)
+    {
+        sleep(LOAD_SAMPLE_INTERVAL);
+        ((LoadSampler *)sampler)->sample();
+    }
+    return NULL;
+}
+
+void LoadSampler::exclude(unsigned long long bytes)
+{
+    __sync_fetch_and_add(&excluded, bytes);
+}
+
+/**
+ * Read the counters and update the averages
+ */
+void LoadSampler::sample()
+{
+    unsigned long long now = OFSStats::now();
+    unsigned long long bytes = 0;
+    bool network = readTransmitted(bytes);
+    unsigned long long own = __sync_fetch_and_add(&excluded, 0);
+    double loadavg[3];
+    int nLoad = 0;
+    FILE *fp = fopen("/proc/loadavg", "r");
+    if (fp != NULL)
+    {
+        nLoad = fscanf(fp, "%lf %lf %lf", &loadavg[0], &loadavg[1], &loadavg[2]);
+        fclose(fp);
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (nLoad == 3)
+        load = loadavg[2];
+    if (network && samples > 0 && now > lastSample)
+    {
+        double seconds = (now - lastSample) / 1e9;
+        double rate = bytes / seconds;
+        // the writeback bytes are counted when they are handed to the
+        // kernel, which may be a bit earlier than they are sent
+        double foreign = max(0.0, (bytes - (double)(own - lastExcluded)) / seconds);
+        double shortWeight = 1 - exp(-seconds / LOAD_SHORT_WINDOW);
+        double longWeight = 1 - exp(-seconds / LOAD_LONG_WINDOW);
+        // start from the first rate instead of zero, a busy link must
+        // not look idle for the first minutes
+        if (samples == 1)
+            foreignRate = foreignAverage = foreign;
+        else
+        {
+            foreignRate += shortWeight * (foreign - foreignRate);
+            foreignAverage += longWeight * (foreign - foreignAverage);
+        }
+        peakRate = max(peakRate * LOAD_PEAK_DECAY, rate);
+    }
+    if (network)
+    {
+        samples++;
+        lastSample = now;
+        lastExcluded = own;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Sum up the bytes the counted interfaces have sent since the last
+ * sample. The caller must not hold the mutex.
+ * @param bytes (out) bytes sent
+ * @return false if /proc/net/dev can not be read
+ */
+bool LoadSampler::readTransmitted(unsigned long long& bytes)
+{
+    FILE *fp = fopen("/proc/net/dev", "r");
+    if (fp == NULL)
+        return false;
+    char line[512];
+    bytes = 0;
+    pthread_mutex_lock(&mutex);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        // the two header lines have no colon
+        char *colon = strchr(line, ':');
+        if (colon == NULL)
+            continue;
+        *colon = '\0';
+        char *name = line;
+        while (*name == ' ')
+            name++;
+        if (!counted(name))
+            continue;
+        // receive: bytes packets errs drop fifo frame compressed multicast,
+        // then transmit bytes
+        unsigned long long field[9];
+        if (sscanf(colon + 1, "%llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &field[0], &field[1], &field[2], &field[3], &field[4],
+                   &field[5], &field[6], &field[7], &field[8]) != 9)
+            continue;
+        map<string, unsigned long long>::iterator it = transmitted.find(name);
+        // a new interface or one whose counter was reset only counts
+        // from now on
+        if (it != transmitted.end() && field[8] >= it->second)
+            bytes += field[8] - it->second;
+        transmitted[name] = field[8];
+    }
+    pthread_mutex_unlock(&mutex);
+    fclose(fp);
+    return true;
+}
+
+/**
+ * Should the traffic of an interface be counted? The caller holds the
+ * mutex.
+ */
+bool LoadSampler::counted(const string& device)
+{
+    if (devices.empty())
+        return device != "lo";
+    return find(devices.begin(), devices.end(), device) != devices.end();
+}
+
+double LoadSampler::getForeignRate()
+{
+    pthread_mutex_lock(&mutex);
+    double rate = foreignRate;
+    pthread_mutex_unlock(&mutex);
+    return rate;
+}
+
+double LoadSampler::getForeignAverage()
+{
+    pthread_mutex_lock(&mutex);
+    double rate = foreignAverage;
+    pthread_mutex_unlock(&mutex);
+    return rate;
+}
+
+double LoadSampler::getPeakRate()
+{
+    pthread_mutex_lock(&mutex);
+    double rate = peakRate;
+    pthread_mutex_unlock(&mutex);
+    return rate;
+}
+
+double LoadSampler::getLoad()
+{
+    pthread_mutex_lock(&mutex);
+    double value = load;
+    pthread_mutex_unlock(&mutex);
+    return value;
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef LOADSAMPLER_H
+#define LOADSAMPLER_H
+
+#include <pthread.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+using namespace std;
+
+/// seconds between two samples
+#define LOAD_SAMPLE_INTERVAL 2
+/// time constant in seconds of the averages the writeback is paced by
+#define LOAD_SHORT_WINDOW 10
+/// time constant in seconds of the averages lazy write decides by
+#define LOAD_LONG_WINDOW 300
+/// the peak transmit rate shrinks by this factor every sample, so it
+/// follows a link that got slower within a few minutes
+#define LOAD_PEAK_DECAY 0.99
+
+/**
+ * Samples the network traffic from /proc/net/dev and the system load
+ * from /proc/loadavg on its own thread, so lazy write and the writeback
+ * pacing can ask for the current load without waiting for it.
+ *
+ * Only the interfaces given by the lwdevices mount option are counted,
+ * all interfaces but the loopback device if there are none. Bytes that
+ * the writeback itself sends are reported by exclude() and are left out
+ * of the foreign rates, so the writeback does not hold itself back.
+ */
+class LoadSampler
+{
+public:
+    static LoadSampler& Instance();
+    /**
+     * Start sampling, does nothing if it is running already
+     */
+    void start();
+    /**
+     * Report bytes sent to the remote by the writeback
+     */
+    void exclude(unsigned long long bytes);
+    /**
+     * @return bytes per second sent by others than the writeback,
+     *         averaged over LOAD_SHORT_WINDOW
+     */
+    double getForeignRate();
+    /**
+     * @return bytes per second sent by others than the writeback,
+     *         averaged over LOAD_LONG_WINDOW
+     */
+    double getForeignAverage();
+    /**
+     * @return highest rate in bytes per second all traffic including
+     *         the writeback has been sent with lately
+     */
+    double getPeakRate();
+    /**
+     * @return system load averaged over 15 minutes
+     */
+    double getLoad();
+
+private:
+    LoadSampler();
+    static void createInstance();
+    static void* run(void* sampler);
+    void sample();
+    bool readTransmitted(unsigned long long& bytes);
+    bool counted(const string& device);
+
+    /// interfaces to count, empty for all but the loopback device
+    list<string> devices;
+    /// last transmit counter of every interface
+    map<string, unsigned long long> transmitted;
+    unsigned long long excluded;
+    unsigned long long lastExcluded;
+    unsigned long long lastSample;
+    int samples;
+    double foreignRate;
+    double foreignAverage;
+    double peakRate;
+    double load;
+    bool running;
+    pthread_mutex_t mutex;
+
+    static std::auto_ptr<LoadSampler> theLoadSamplerInstance;
+    static pthread_once_t instanceOnce;
+};
+
+#endif
@@ -0,0 +1,303 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "manifest.h"
+#include "ofsenvironment.h"
+#include "ofshash.h"
+#include "ofslog.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * Split a path into its parent directory and its last component
+ * @return position of the last component
+ */
+static size_t name_start(const char* path, size_t length)
+{
+    for (size_t i = length; i > 0; i--)
+        if (path[i - 1] == '/')
+            return i;
+    return 0;
+}
+
+/**
+ * Order of the records: by parent directory, then by name
+ */
+static int compare_paths(const char* a, size_t aLength, size_t aName,
+                         const char* b, size_t bLength, size_t bName)
+{
+    // the parent does not include the slash in front of the name
+    size_t aParent = aName > 0 ? aName - 1 : 0;
+    size_t bParent = bName > 0 ? bName - 1 : 0;
+    int res = memcmp(a, b, min(aParent, bParent));
+    if (res != 0)
+        return res;
+    if (aParent != bParent)
+        return aParent < bParent ? -1 : 1;
+    res = memcmp(a + aName, b + bName, min(aLength - aName, bLength - bName));
+    if (res != 0)
+        return res;
+    if (aLength - aName != bLength - bName)
+        return aLength - aName < bLength - bName ? -1 : 1;
+    return 0;
+}
+
+bool Manifest::EntryLess::operator()(const Entry& a, const Entry& b) const
+{
+    return compare_paths(a.path.data(), a.path.length(), a.record.nameStart,
+                         b.path.data(), b.path.length(), b.record.nameStart) < 0;
+}
+
+Manifest::Manifest(const string& treePath)
+    : mapping(NULL), mappingSize(0), records(NULL), count(0), strings(NULL),
+      stringsSize(0)
+{
+    string dir = OFSEnvironment::Instance().getOfsDir() + "/"
+        + OFSEnvironment::Instance().getShareID() + "_manifests";
+    mkdir(dir.c_str(), S_IRWXU);
+    filename = dir + "/" + ofs_hash(treePath);
+}
+
+Manifest::~Manifest()
+{
+    if (mapping != NULL)
+        munmap(mapping, mappingSize);
+}
+
+bool Manifest::load()
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const Header* header = static_cast<const Header*>(map);
+    if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0
+        || header->version != MANIFEST_FORMAT_VERSION
+        || (off_t)(sizeof(Header) + (off_t)header->count * sizeof(Record)
+                   + header->stringsSize) != st.st_size)
+    {
+        ofslog::warning("Ignoring invalid manifest %s", filename.c_str());
+        munmap(map, st.st_size);
+        return false;
+    }
+    mapping = map;
+    mappingSize = st.st_size;
+    count = header->count;
+    stringsSize = header->stringsSize;
+    records = reinterpret_cast<const Record*>(header + 1);
+    strings = reinterpret_cast<const char*>(records + count);
+    ofslog::debug("Mapped manifest %s with %u entries", filename.c_str(), count);
+    return true;
+}
+
+const Manifest::Record* Manifest::find(const string& path) const
+{
+    size_t name = name_start(path.data(), path.length());
+    uint32_t first = 0, last = count;
+    while (first < last)
+    {
+        uint32_t middle = first + (last - first) / 2;
+        const Record& record = records[middle];
+        if (!valid(record))
+            return NULL;
+        int res = compare_paths(pathOf(record), record.pathLength, record.nameStart,
+                                path.data(), path.length(), name);
+        if (res == 0)
+            return &record;
+        if (res < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return NULL;
+}
+
+bool Manifest::unchanged(const string& path, const struct stat& st) const
+{
+    const Record* record = find(path);
+    if (record == NULL)
+        return false;
+    Record current;
+    fill(current, st);
+    return record->ino == current.ino && record->mtime == current.mtime
+        && record->ctime == current.ctime && record->size == current.size
+        && record->mode == current.mode;
+}
+
+void Manifest::listDirectory(const string& path, list<string>& subdirs,
+                             list<string>& files) const
+{
+    const Record* dir = find(path);
+    if (dir == NULL || dir->firstChild > count || dir->childCount > count - dir->firstChild)
+        return;
+    for (uint32_t i = dir->firstChild; i < dir->firstChild + dir->childCount; i++)
+    {
+        if (!valid(records[i]))
+            return;
+        string child(pathOf(records[i]), records[i].pathLength);
+        if (S_ISDIR(records[i].mode))
+            subdirs.push_back(child);
+        else
+            files.push_back(child);
+    }
+}
+
+/**
+ * Does the record only refer to the string table? The mapped file is
+ * never checked as a whole, that would read all of it.
+ */
+bool Manifest::valid(const Record& record) const
+{
+    return record.pathOffset <= stringsSize
+        && record.pathLength <= stringsSize - record.pathOffset
+        && record.nameStart <= record.pathLength;
+}
+
+void Manifest::fill(Record& record, const struct stat& st)
+{
+    memset(&record, 0, sizeof(record));
+    record.ino = st.st_ino;
+    record.mtime = st.st_mtime;
+    record.ctime = st.st_ctime;
+    record.size = st.st_size;
+    record.mode = st.st_mode;
+}
+
+void Manifest::add(const string& path, const struct stat& st)
+{
+    Entry entry;
+    entry.path = path;
+    fill(entry.record, st);
+    entry.record.nameStart = name_start(path.data(), path.length());
+    MutexLocker obtain_lock(m);
+    entries.push_back(entry);
+}
+
+void Manifest::carryOver(const string& path)
+{
+    const Record* dir = find(path);
+    if (dir == NULL || dir->firstChild > count || dir->childCount > count - dir->firstChild)
+        return;
+    MutexLocker obtain_lock(m);
+    for (uint32_t i = dir->firstChild; i < dir->firstChild + dir->childCount; i++)
+    {
+        if (!valid(records[i]))
+            return;
+        if (S_ISDIR(records[i].mode))
+            continue;
+        Entry entry;
+        entry.path.assign(pathOf(records[i]), records[i].pathLength);
+        entry.record = records[i];
+        entries.push_back(entry);
+    }
+}
+
+bool Manifest::save()
+{
+    MutexLocker obtain_lock(m);
+    sort(entries.begin(), entries.end(), EntryLess());
+
+    // lay out the string table and link every directory to the
+    // adjacent records of its entries
+    string table;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Record& record = entries[i].record;
+        record.pathOffset = table.length();
+        record.pathLength = entries[i].path.length();
+        record.firstChild = 0;
+        record.childCount = 0;
+        table += entries[i].path;
+    }
+    size_t i = 0;
+    while (i < entries.size())
+    {
+        const Entry& first = entries[i];
+        size_t parentLength = first.record.nameStart > 0 ? first.record.nameStart - 1 : 0;
+        size_t end = i + 1;
+        while (end < entries.size()
+               && entries[end].record.nameStart == first.record.nameStart
+               && entries[end].path.compare(0, parentLength, first.path, 0, parentLength) == 0)
+            end++;
+        Entry parent;
+        parent.path = first.path.substr(0, parentLength);
+        parent.record.nameStart = name_start(parent.path.data(), parent.path.length());
+        vector<Entry>::iterator it = lower_bound(entries.begin(), entries.end(),
+                                                 parent, EntryLess());
+        if (it != entries.end() && it->path == parent.path)
+        {
+            it->record.firstChild = i;
+            it->record.childCount = end - i;
+        }
+        i = end;
+    }
+
+    Header header;
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_FORMAT_VERSION;
+    header.count = entries.size();
+    header.stringsSize = table.length();
+
+    string tmpname = filename + ".new";
+    int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        ofslog::error("Could not write manifest %s: %s", tmpname.c_str(), strerror(errno));
+        return false;
+    }
+    vector<Record> layout;
+    layout.reserve(entries.size());
+    for (vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        layout.push_back(it->record);
+    size_t layoutSize = layout.size() * sizeof(Record);
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header);
+    ok = ok && (layoutSize == 0 || write(fd, &layout[0], layoutSize) == (ssize_t)layoutSize);
+    ok = ok && write(fd, table.data(), table.length()) == (ssize_t)table.length();
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmpname.c_str(), filename.c_str()) < 0)
+    {
+        ofslog::error("Could not write manifest %s: %s", filename.c_str(), strerror(errno));
+        unlink(tmpname.c_str());
+        return false;
+    }
+    ofslog::debug("Wrote manifest %s with %lu entries", filename.c_str(),
+                  (unsigned long)entries.size());
+    return true;
+}
+
+void Manifest::discard()
+{
+    unlink(filename.c_str());
+}
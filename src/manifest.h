@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "mutexlocker.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+
+using namespace std;
+
+#define MANIFEST_MAGIC "OFSM"
+#define MANIFEST_FORMAT_VERSION 1
+
+/**
+ * Attributes of all directories and files of a backing tree as of the
+ * last complete cache update (mount option "manifest").
+ *
+ * If the attributes of a remote directory have not changed since then,
+ * no entry has been added, removed or renamed in it, so the cache update
+ * takes the names of its entries from the manifest instead of listing
+ * and comparing the directory, and only looks at the sub-directories.
+ * Files changed in place do not change their directory; they are found
+ * when they are opened while the share is available.
+ *
+ * The manifest of the last update is mapped read-only from
+ * <ofsdir>/<shareid>_manifests/<hash of the tree path> and never parsed:
+ * the records are sorted by parent directory and name, so a path is
+ * found by binary search and the entries of a directory are adjacent.
+ * The manifest of the running update is collected in memory and
+ * replaces the file when the update has finished.
+ */
+class Manifest
+{
+public:
+    /**
+     * @param treePath relative path of the backing tree
+     */
+    explicit Manifest(const string& treePath);
+    ~Manifest();
+
+    /**
+     * Map the manifest of the last update
+     * @return false if there is none or it is not usable
+     */
+    bool load();
+    /**
+     * Are the recorded attributes of a path equal to these?
+     * @param path path relative to the share root
+     * @param st current attributes of the remote path
+     */
+    bool unchanged(const string& path, const struct stat& st) const;
+    /**
+     * Get the recorded entries of a directory
+     * @param path path relative to the share root
+     * @param subdirs (out) receives the paths of the sub-directories
+     * @param files (out) receives the paths of the other entries
+     */
+    void listDirectory(const string& path, list<string>& subdirs,
+                       list<string>& files) const;
+
+    /**
+     * Record the attributes of a path for the next manifest, may be
+     * called concurrently
+     * @param path path relative to the share root
+     * @param st attributes of the remote path
+     */
+    void add(const string& path, const struct stat& st);
+    /**
+     * Record the entries of an unchanged directory, except the
+     * sub-directories, as they are in the loaded manifest
+     * @param path path relative to the share root
+     */
+    void carryOver(const string& path);
+    /**
+     * Replace the manifest file by the recorded one
+     * @return false if it could not be written
+     */
+    bool save();
+    /**
+     * Remove the manifest file, the next update has to compare everything
+     */
+    void discard();
+
+private:
+    /// one path, stored in the file as it is
+    struct Record
+    {
+        uint64_t ino;
+        int64_t mtime;
+        int64_t ctime;
+        int64_t size;
+        uint32_t mode;
+        /// position of the path in the string table
+        uint32_t pathOffset;
+        uint32_t pathLength;
+        /// position of the last component within the path
+        uint32_t nameStart;
+        /// the entries of a directory are records [firstChild, firstChild + childCount)
+        uint32_t firstChild;
+        uint32_t childCount;
+    };
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t count;
+        uint32_t stringsSize;
+    };
+
+    /// a record of the manifest being built
+    struct Entry
+    {
+        string path;
+        Record record;
+    };
+    struct EntryLess
+    {
+        bool operator()(const Entry& a, const Entry& b) const;
+    };
+
+    static void fill(Record& record, const struct stat& st);
+    const Record* find(const string& path) const;
+    bool valid(const Record& record) const;
+    inline const char* pathOf(const Record& record) const
+        { return strings + record.pathOffset; };
+
+    string filename;
+    /// the mapped manifest of the last update
+    void* mapping;
+    size_t mappingSize;
+    const Record* records;
+    uint32_t count;
+    const char* strings;
+    uint32_t stringsSize;
+    /// the manifest of the running update
+    vector<Entry> entries;
+    Mutex m;
+
+    Manifest(const Manifest&);
+    Manifest& operator=(const Manifest&);
+};
+
+#endif
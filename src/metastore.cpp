@@ -0,0 +1,856 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "metastore.h"
+#include "journal.h"
+#include "ofsenvironment.h"
+#include "ofshash.h"
+#include "ofslog.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Record type of the journal, one record per batch.
+#define METASTORE_RECORD_BATCH 1
+
+// The table file is written in chunks of this size.
+#define METASTORE_WRITE_CHUNK (1024 * 1024)
+
+// The table starts with the header, followed by the entries in key order,
+// padding to 8 bytes and the index: the offset of every entry and the end
+// of the last one. The checksum covers the index.
+struct MetaStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t crc;
+    uint64_t count;
+    uint64_t indexOffset;
+};
+
+// tables of version 1 have no index, the checksum covers all entries
+struct MetaStoreHeaderV1
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t crc;
+    uint64_t count;
+};
+
+struct MetaStoreEntry
+{
+    uint32_t keylen;
+    uint32_t vallen;
+};
+
+// innermost transaction of the calling thread
+static __thread MetaStore::Transaction* currentTransaction = NULL;
+
+// batch record: per change present flag (uint8), key length (uint32), key,
+// and for present keys value length (uint32) and value
+static void append_string(string& buf, const string& s)
+{
+    uint32_t len = s.size();
+    buf.append((const char*)&len, sizeof(len));
+    buf.append(s);
+}
+
+static void encode_batch(const map<string, pair<bool, string> >& changes,
+                         string& payload)
+{
+    for (map<string, pair<bool, string> >::const_iterator it = changes.begin();
+         it != changes.end(); ++it)
+    {
+        payload += (char)(it->second.first ? 1 : 0);
+        append_string(payload, it->first);
+        if (it->second.first)
+            append_string(payload, it->second.second);
+    }
+}
+
+static bool read_string(const string& buf, size_t& pos, string& s)
+{
+    uint32_t len;
+    if (buf.size() - pos < sizeof(len))
+        return false;
+    memcpy(&len, buf.data() + pos, sizeof(len));
+    pos += sizeof(len);
+    if (buf.size() - pos < len)
+        return false;
+    s.assign(buf, pos, len);
+    pos += len;
+    return true;
+}
+
+static bool write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t nWritten = ::write(fd, data, len);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += nWritten;
+        len -= nWritten;
+    }
+    return true;
+}
+
+/**
+ * Applies the batches of the journal to the memtable.
+ */
+class MetaStoreReplay : public Journal::Visitor
+{
+public:
+    explicit MetaStoreReplay(map<string, pair<bool, string> >& memtable)
+        : memtable(memtable), batches(0) {}
+    virtual void record(unsigned int type, const string& payload)
+    {
+        if (type != METASTORE_RECORD_BATCH)
+            return;
+        // decode completely first, a batch is applied as a whole
+        map<string, pair<bool, string> > changes;
+        size_t pos = 0;
+        while (pos < payload.size())
+        {
+            bool present = payload[pos++] != 0;
+            string key, value;
+            if (!read_string(payload, pos, key)
+                || (present && !read_string(payload, pos, value)))
+            {
+                ofslog::error("Skipping malformed metadata batch");
+                return;
+            }
+            changes[key] = pair<bool, string>(present, value);
+        }
+        for (map<string, pair<bool, string> >::iterator it = changes.begin();
+             it != changes.end(); ++it)
+            memtable[it->first] = it->second;
+        batches++;
+    }
+    map<string, pair<bool, string> >& memtable;
+    int batches;
+};
+
+std::auto_ptr<MetaStore> MetaStore::theMetaStoreInstance;
+pthread_once_t MetaStore::instanceOnce = PTHREAD_ONCE_INIT;
+
+//////////////////////////////////////////////////////////////////////////////
+// BATCHES AND TRANSACTIONS
+//////////////////////////////////////////////////////////////////////////////
+
+void MetaStore::Batch::put(const string& key, const string& value)
+{
+    changes[key] = pair<bool, string>(true, value);
+}
+
+void MetaStore::Batch::remove(const string& key)
+{
+    changes[key] = pair<bool, string>(false, string());
+}
+
+MetaStore::Transaction::Transaction() : outer(currentTransaction)
+{
+    currentTransaction = this;
+}
+
+MetaStore::Transaction::~Transaction()
+{
+    // the changes are already visible in the managers, so they are written
+    // even if the transaction is left by an exception
+    if (!commit())
+        ofslog::error("Could not commit metadata transaction");
+    currentTransaction = outer;
+}
+
+bool MetaStore::Transaction::commit()
+{
+    if (batch.empty())
+        return true;
+    MetaStore& store = MetaStore::Instance();
+    // hands the batch to the enclosing transaction or the store
+    currentTransaction = outer;
+    unsigned long long seq = store.apply(batch);
+    currentTransaction = this;
+    batch.changes.clear();
+    return outer != NULL || store.sync(seq);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CONSTRUCTION/ DESTRUCTION
+//////////////////////////////////////////////////////////////////////////////
+
+MetaStore::MetaStore() : journal(NULL), lastCheckpoint(time(NULL)),
+    mergerRunning(false), mergeRequested(false), merging(false),
+    mergeStop(false), table(NULL), tableSize(0), tableIndex(NULL),
+    tableCount(0)
+{
+    OFSEnvironment& env = OFSEnvironment::Instance();
+    filename = env.getOfsDir() + "/" + env.getShareID() + "_metadata";
+    pthread_mutex_init(&writeMutex, NULL);
+    pthread_rwlock_init(&lock, NULL);
+    pthread_mutex_init(&mergeMutex, NULL);
+    pthread_cond_init(&mergeChanged, NULL);
+}
+
+MetaStore::~MetaStore()
+{
+    if (mergerRunning)
+    {
+        pthread_mutex_lock(&mergeMutex);
+        mergeStop = true;
+        pthread_cond_broadcast(&mergeChanged);
+        pthread_mutex_unlock(&mergeMutex);
+        pthread_join(merger, NULL);
+    }
+    delete journal;
+    unmap_table();
+    pthread_cond_destroy(&mergeChanged);
+    pthread_mutex_destroy(&mergeMutex);
+    pthread_rwlock_destroy(&lock);
+    pthread_mutex_destroy(&writeMutex);
+}
+
+MetaStore& MetaStore::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theMetaStoreInstance;
+}
+
+void MetaStore::createInstance()
+{
+    theMetaStoreInstance.reset(new MetaStore);
+    theMetaStoreInstance->open();
+}
+
+void MetaStore::open()
+{
+    if (!map_table())
+    {
+        // keep the damaged file, the next checkpoint would overwrite it
+        string corrupt = filename + ".corrupt";
+        rename(filename.c_str(), corrupt.c_str());
+        ofslog::error("Metadata table %s is damaged, moved to %s",
+                      filename.c_str(), corrupt.c_str());
+    }
+    journal = new Journal(filename + ".journal");
+    if (!journal->open())
+    {
+        ofslog::error("Metadata changes of this session will not be persistent");
+        delete journal;
+        journal = NULL;
+        return;
+    }
+    MetaStoreReplay replay(memtable);
+    if (!journal->replay(replay))
+        ofslog::error("Could not replay metadata journal of %s", filename.c_str());
+    ofslog::debug("Metadata store: %lu keys in table, %d batches replayed",
+                  (unsigned long)tableCount, replay.batches);
+    // without the thread apply() does not merge, checkpoint() still does
+    mergerRunning = pthread_create(&merger, NULL, MetaStore::mergeRun, this) == 0;
+    if (!mergerRunning)
+        ofslog::error("Could not start merging metadata: %s", strerror(errno));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// UPDATES
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned long long MetaStore::apply(const Batch& batch)
+{
+    if (currentTransaction != NULL)
+    {
+        Memtable& collected = currentTransaction->batch.changes;
+        for (Memtable::const_iterator it = batch.changes.begin();
+             it != batch.changes.end(); ++it)
+            collected[it->first] = it->second;
+        return 0;
+    }
+    if (batch.empty())
+        return 0;
+
+    string payload;
+    encode_batch(batch.changes, payload);
+    list<Journal::Record> records;
+    records.push_back(Journal::Record(METASTORE_RECORD_BATCH, payload));
+
+    // the journal has to receive the batches in the order of the memtable
+    pthread_mutex_lock(&writeMutex);
+    pthread_rwlock_wrlock(&lock);
+    for (Memtable::const_iterator it = batch.changes.begin();
+         it != batch.changes.end(); ++it)
+        memtable[it->first] = it->second;
+    pthread_rwlock_unlock(&lock);
+    unsigned long long seq = journal != NULL ? journal->enqueue(records) : 0;
+    bool bMerge = journal != NULL && (memtable.size() > METASTORE_MEMTABLE_MAX
+                                      || journal->size() > METASTORE_JOURNAL_MAX
+                                      || time(NULL) - lastCheckpoint >= METASTORE_CHECKPOINT_INTERVAL);
+    pthread_mutex_unlock(&writeMutex);
+    if (bMerge)
+        request_merge();
+    return seq;
+}
+
+bool MetaStore::sync(unsigned long long seq)
+{
+    return journal != NULL && (seq == 0 || journal->sync(seq));
+}
+
+bool MetaStore::write(unsigned long long seq)
+{
+    return journal != NULL && (seq == 0 || journal->write(seq));
+}
+
+bool MetaStore::commit(const Batch& batch)
+{
+    return sync(apply(batch));
+}
+
+bool MetaStore::checkpoint()
+{
+    if (journal == NULL)
+        return false;
+    pthread_mutex_lock(&mergeMutex);
+    while (merging)
+        pthread_cond_wait(&mergeChanged, &mergeMutex);
+    merging = true;
+    pthread_mutex_unlock(&mergeMutex);
+
+    bool bOK = merge();
+
+    pthread_mutex_lock(&mergeMutex);
+    merging = false;
+    pthread_cond_broadcast(&mergeChanged);
+    pthread_mutex_unlock(&mergeMutex);
+    return bOK;
+}
+
+/**
+ * Wake the merger unless it is busy anyway
+ */
+void MetaStore::request_merge()
+{
+    pthread_mutex_lock(&mergeMutex);
+    if (!mergeRequested && !merging)
+    {
+        mergeRequested = true;
+        pthread_cond_broadcast(&mergeChanged);
+    }
+    pthread_mutex_unlock(&mergeMutex);
+}
+
+void* MetaStore::mergeRun(void* arg)
+{
+    MetaStore* store = (MetaStore *)arg;
+    pthread_mutex_lock(&store->mergeMutex);
+    while (true)
+    {
+        while (!store->mergeStop && (!store->mergeRequested || store->merging))
+            pthread_cond_wait(&store->mergeChanged, &store->mergeMutex);
+        if (store->mergeStop)
+            break;
+        store->mergeRequested = false;
+        store->merging = true;
+        pthread_mutex_unlock(&store->mergeMutex);
+
+        store->merge();
+
+        pthread_mutex_lock(&store->mergeMutex);
+        store->merging = false;
+        pthread_cond_broadcast(&store->mergeChanged);
+    }
+    pthread_mutex_unlock(&store->mergeMutex);
+    return NULL;
+}
+
+/**
+ * Freeze the memtable, write the union of table and frozen changes to a
+ * new table file and replace the journal by the changes made meanwhile.
+ * Writers are only held while the levels are switched, readers go on
+ * with the old table until the new one is complete. Must only be called
+ * by the thread that set merging.
+ */
+bool MetaStore::merge()
+{
+    pthread_mutex_lock(&writeMutex);
+    pthread_rwlock_wrlock(&lock);
+    // the changes of a failed merge are merged again with the newer ones
+    if (frozen.empty())
+        frozen.swap(memtable);
+    else
+    {
+        for (Memtable::const_iterator it = memtable.begin(); it != memtable.end(); ++it)
+            frozen[it->first] = it->second;
+        memtable.clear();
+    }
+    pthread_rwlock_unlock(&lock);
+    lastCheckpoint = time(NULL);
+    pthread_mutex_unlock(&writeMutex);
+    if (frozen.empty() && builtIndex.empty())
+        return true;	// the table is current
+
+    string tmpname = filename + ".tmp";
+    int fd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        ofslog::error("Could not create %s: %s", tmpname.c_str(), strerror(errno));
+        return false;
+    }
+
+    MetaStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, METASTORE_MAGIC, sizeof(header.magic));
+    header.version = METASTORE_FORMAT_VERSION;
+    bool bOK = write_all(fd, (const char*)&header, sizeof(header));
+
+    vector<uint64_t> index;
+    uint64_t offset = sizeof(header);
+    string chunk;
+    size_t i = 0;
+    Memtable::const_iterator it = frozen.begin();
+    while (bOK && (i < tableCount || it != frozen.end()))
+    {
+        int cmp;
+        if (i == tableCount)
+            cmp = 1;
+        else if (it == frozen.end())
+            cmp = -1;
+        else
+            cmp = table_compare(i, it->first);
+
+        const char* key;
+        const char* value;
+        uint32_t keylen, vallen;
+        if (cmp < 0)
+        {
+            // damaged entries of the old table are dropped
+            if (!table_entry(i++, key, keylen, value, vallen))
+                continue;
+        }
+        else
+        {
+            if (cmp == 0)
+                i++;
+            bool present = it->second.first;
+            key = it->first.data();
+            keylen = it->first.size();
+            value = it->second.second.data();
+            vallen = it->second.second.size();
+            ++it;
+            if (!present)
+                continue;
+        }
+
+        MetaStoreEntry entry;
+        entry.keylen = keylen;
+        entry.vallen = vallen;
+        index.push_back(offset);
+        chunk.append((const char*)&entry, sizeof(entry));
+        chunk.append(key, keylen);
+        chunk.append(value, vallen);
+        offset += sizeof(entry) + keylen + vallen;
+        if (chunk.size() >= METASTORE_WRITE_CHUNK)
+        {
+            bOK = write_all(fd, chunk.data(), chunk.size());
+            chunk.clear();
+        }
+    }
+    index.push_back(offset);
+    chunk.append((8 - offset % 8) % 8, '\0');
+
+    header.count = index.size() - 1;
+    header.indexOffset = offset + (8 - offset % 8) % 8;
+    header.crc = ofs_crc32(0, &index[0], index.size() * sizeof(uint64_t));
+    bOK = bOK && write_all(fd, chunk.data(), chunk.size())
+          && write_all(fd, (const char*)&index[0], index.size() * sizeof(uint64_t))
+          && pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+          && fdatasync(fd) == 0;
+    ::close(fd);
+    if (bOK)
+        bOK = rename(tmpname.c_str(), filename.c_str()) == 0;
+    if (!bOK)
+    {
+        ofslog::error("Could not write metadata table %s: %s", filename.c_str(), strerror(errno));
+        unlink(tmpname.c_str());
+        return false;
+    }
+
+    // make the rename durable before the journal is emptied
+    string dirname = filename.substr(0, filename.find_last_of('/') + 1);
+    int dirfd = ::open(dirname.length() ? dirname.c_str() : ".", O_RDONLY);
+    if (dirfd >= 0)
+    {
+        fsync(dirfd);
+        ::close(dirfd);
+    }
+
+    pthread_mutex_lock(&writeMutex);
+    pthread_rwlock_wrlock(&lock);
+    unmap_table();
+    frozen.clear();
+    if (!map_table())
+        ofslog::error("Could not map new metadata table %s", filename.c_str());
+    pthread_rwlock_unlock(&lock);
+    // the table holds everything frozen, the memtable everything queued
+    // since, a crash before the journal is replaced just replays the same
+    // changes again
+    list<Journal::Record> records;
+    if (!memtable.empty())
+    {
+        string payload;
+        encode_batch(memtable, payload);
+        records.push_back(Journal::Record(METASTORE_RECORD_BATCH, payload));
+    }
+    bOK = journal->rewrite(records);
+    pthread_mutex_unlock(&writeMutex);
+    return bOK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// QUERIES
+//////////////////////////////////////////////////////////////////////////////
+
+bool MetaStore::get(const string& key, string& value)
+{
+    for (Transaction* txn = currentTransaction; txn != NULL; txn = txn->outer)
+    {
+        Memtable::const_iterator found = txn->batch.changes.find(key);
+        if (found != txn->batch.changes.end())
+        {
+            value = found->second.second;
+            return found->second.first;
+        }
+    }
+
+    pthread_rwlock_rdlock(&lock);
+    bool bFound = false;
+    // the newest level that knows the key decides
+    const pair<bool, string>* change = NULL;
+    Memtable::const_iterator found = memtable.find(key);
+    if (found != memtable.end())
+        change = &found->second;
+    else if ((found = frozen.find(key)) != frozen.end())
+        change = &found->second;
+    if (change != NULL)
+    {
+        bFound = change->first;
+        value = change->second;
+    }
+    else
+    {
+        size_t i = table_lower_bound(key);
+        const char* tableKey;
+        const char* tableValue;
+        uint32_t keylen, vallen;
+        if (i < tableCount && table_compare(i, key) == 0
+            && table_entry(i, tableKey, keylen, tableValue, vallen))
+        {
+            value.assign(tableValue, vallen);
+            bFound = true;
+        }
+    }
+    pthread_rwlock_unlock(&lock);
+    return bFound;
+}
+
+bool MetaStore::next(const string& from, string& key)
+{
+    vector<Transaction*> txns;
+    for (Transaction* txn = currentTransaction; txn != NULL; txn = txn->outer)
+        txns.push_back(txn);
+
+    pthread_rwlock_rdlock(&lock);
+    string candidate = from;
+    bool bFound = false;
+    for (;;)
+    {
+        // the smallest key of all levels, removed keys are skipped
+        bool bAny = false;
+        size_t i = table_lower_bound(candidate);
+        const char* tableKey;
+        const char* value;
+        uint32_t keylen, vallen;
+        while (i < tableCount && !table_entry(i, tableKey, keylen, value, vallen))
+            i++;
+        if (i < tableCount)
+        {
+            key.assign(tableKey, keylen);
+            bAny = true;
+        }
+        Memtable::const_iterator it = memtable.lower_bound(candidate);
+        if (it != memtable.end() && (!bAny || it->first < key))
+        {
+            key = it->first;
+            bAny = true;
+        }
+        it = frozen.lower_bound(candidate);
+        if (it != frozen.end() && (!bAny || it->first < key))
+        {
+            key = it->first;
+            bAny = true;
+        }
+        for (size_t t = 0; t < txns.size(); t++)
+        {
+            it = txns[t]->batch.changes.lower_bound(candidate);
+            if (it != txns[t]->batch.changes.end() && (!bAny || it->first < key))
+            {
+                key = it->first;
+                bAny = true;
+            }
+        }
+        if (!bAny)
+            break;
+
+        // the newest level that knows the key decides
+        bool bPresent = true;
+        bool bDecided = false;
+        for (size_t t = 0; t < txns.size() && !bDecided; t++)
+        {
+            it = txns[t]->batch.changes.find(key);
+            if (it != txns[t]->batch.changes.end())
+            {
+                bPresent = it->second.first;
+                bDecided = true;
+            }
+        }
+        if (!bDecided)
+        {
+            it = memtable.find(key);
+            if (it != memtable.end())
+                bPresent = it->second.first;
+            else if ((it = frozen.find(key)) != frozen.end())
+                bPresent = it->second.first;
+        }
+        if (bPresent)
+        {
+            bFound = true;
+            break;
+        }
+        candidate = key + '\0';
+    }
+    pthread_rwlock_unlock(&lock);
+    return bFound;
+}
+
+void MetaStore::scan(const string& prefix, map<string, string>& values)
+{
+    values.clear();
+    pthread_rwlock_rdlock(&lock);
+    const char* key;
+    const char* value;
+    uint32_t keylen, vallen;
+    for (size_t i = table_lower_bound(prefix); i < tableCount; i++)
+    {
+        if (!table_entry(i, key, keylen, value, vallen))
+            continue;
+        if (keylen < prefix.size() || memcmp(key, prefix.data(), prefix.size()) != 0)
+            break;
+        values.insert(values.end(), pair<string, string>(
+            string(key + prefix.size(), keylen - prefix.size()),
+            string(value, vallen)));
+    }
+    overlay(frozen, prefix, values);
+    overlay(memtable, prefix, values);
+    pthread_rwlock_unlock(&lock);
+
+    // changes of the open transactions, the innermost last
+    vector<Transaction*> txns;
+    for (Transaction* txn = currentTransaction; txn != NULL; txn = txn->outer)
+        txns.push_back(txn);
+    for (vector<Transaction*>::reverse_iterator txn = txns.rbegin();
+         txn != txns.rend(); ++txn)
+        overlay((*txn)->batch.changes, prefix, values);
+}
+
+void MetaStore::overlay(const Memtable& changes, const string& prefix,
+                        map<string, string>& values)
+{
+    for (Memtable::const_iterator it = changes.lower_bound(prefix);
+         it != changes.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it)
+    {
+        if (it->second.first)
+            values[it->first.substr(prefix.size())] = it->second.second;
+        else
+            values.erase(it->first.substr(prefix.size()));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// TABLE FILE
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Map the table file and check its index
+ * @return false if the file exists but is damaged
+ */
+bool MetaStore::map_table()
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT;
+    struct stat fileinfo;
+    if (fstat(fd, &fileinfo) < 0 || fileinfo.st_size < (off_t)sizeof(MetaStoreHeaderV1))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(NULL, fileinfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    table = (const char*)addr;
+    tableSize = fileinfo.st_size;
+
+    MetaStoreHeaderV1 headerV1;
+    memcpy(&headerV1, table, sizeof(headerV1));
+    bool bOK = memcmp(headerV1.magic, METASTORE_MAGIC, sizeof(headerV1.magic)) == 0;
+    if (bOK && headerV1.version == 1)
+    {
+        bOK = ofs_crc32(0, table + sizeof(headerV1), tableSize - sizeof(headerV1)) == headerV1.crc
+              && index_table(sizeof(headerV1), headerV1.count);
+    }
+    else if (bOK && headerV1.version == METASTORE_FORMAT_VERSION
+             && tableSize >= sizeof(MetaStoreHeader))
+    {
+        MetaStoreHeader header;
+        memcpy(&header, table, sizeof(header));
+        bOK = header.indexOffset % sizeof(uint64_t) == 0
+              && header.indexOffset >= sizeof(header)
+              && header.indexOffset <= tableSize
+              && (tableSize - header.indexOffset) / sizeof(uint64_t) == header.count + 1
+              && (tableSize - header.indexOffset) % sizeof(uint64_t) == 0;
+        if (bOK)
+        {
+            tableIndex = (const uint64_t*)(table + header.indexOffset);
+            tableCount = header.count;
+            bOK = ofs_crc32(0, tableIndex, (tableCount + 1) * sizeof(uint64_t)) == header.crc
+                  && tableIndex[0] >= sizeof(header)
+                  && tableIndex[tableCount] <= header.indexOffset;
+            for (size_t i = 0; bOK && i < tableCount; i++)
+                bOK = tableIndex[i] <= tableIndex[i + 1];
+        }
+    }
+    else
+    {
+        bOK = false;
+    }
+    if (!bOK)
+        unmap_table();
+    return bOK;
+}
+
+/**
+ * Build the index of a table without one
+ */
+bool MetaStore::index_table(size_t start, uint64_t count)
+{
+    builtIndex.reserve(count + 1);
+    size_t pos = start;
+    while (pos < tableSize)
+    {
+        MetaStoreEntry entry;
+        if (tableSize - pos < sizeof(entry))
+            break;
+        memcpy(&entry, table + pos, sizeof(entry));
+        if (tableSize - pos - sizeof(entry) < (size_t)entry.keylen + entry.vallen)
+            break;
+        builtIndex.push_back(pos);
+        pos += sizeof(entry) + entry.keylen + entry.vallen;
+    }
+    if (pos != tableSize || builtIndex.size() != count)
+        return false;
+    builtIndex.push_back(pos);
+    tableIndex = &builtIndex[0];
+    tableCount = count;
+    return true;
+}
+
+void MetaStore::unmap_table()
+{
+    if (table != NULL)
+        munmap((void*)table, tableSize);
+    table = NULL;
+    tableSize = 0;
+    tableIndex = NULL;
+    tableCount = 0;
+    builtIndex.clear();
+}
+
+/**
+ * Get an entry of the table
+ * @return false if the entry does not fit in its place of the index
+ */
+bool MetaStore::table_entry(size_t index, const char*& key, uint32_t& keylen,
+                            const char*& value, uint32_t& vallen) const
+{
+    uint64_t start = tableIndex[index];
+    uint64_t end = tableIndex[index + 1];
+    MetaStoreEntry entry;
+    if (end - start < sizeof(entry))
+        return false;
+    memcpy(&entry, table + start, sizeof(entry));
+    if (end - start - sizeof(entry) != (uint64_t)entry.keylen + entry.vallen)
+        return false;
+    key = table + start + sizeof(entry);
+    keylen = entry.keylen;
+    value = key + keylen;
+    vallen = entry.vallen;
+    return true;
+}
+
+int MetaStore::table_compare(size_t index, const string& key) const
+{
+    const char* tableKey;
+    const char* value;
+    uint32_t keylen, vallen;
+    // a damaged entry sorts first and is never found
+    if (!table_entry(index, tableKey, keylen, value, vallen))
+        return -1;
+    size_t len = keylen < key.size() ? keylen : key.size();
+    int cmp = memcmp(tableKey, key.data(), len);
+    if (cmp != 0)
+        return cmp;
+    if (keylen == key.size())
+        return 0;
+    return keylen < key.size() ? -1 : 1;
+}
+
+size_t MetaStore::table_lower_bound(const string& key) const
+{
+    size_t low = 0, high = tableCount;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (table_compare(mid, key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
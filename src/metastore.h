@@ -0,0 +1,222 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef METASTORE_H
+#define METASTORE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+class Journal;
+
+#define METASTORE_MAGIC "OFSMETA1"
+#define METASTORE_FORMAT_VERSION 2
+
+// The memory table is merged into the table file once it holds this many
+// keys or the journal has grown beyond this many bytes, and with the first
+// change after this many seconds.
+#define METASTORE_MEMTABLE_MAX 8192
+#define METASTORE_JOURNAL_MAX (8 * 1024 * 1024)
+#define METASTORE_CHECKPOINT_INTERVAL 600
+
+/**
+ * Crash-safe key/value store for all metadata of a share.
+ *
+ * The store is a small LSM tree with three levels:
+ *   table:    sorted file <ofsdir>/<shareid>_metadata with an offset index
+ *             at its end, mapped into memory and searched in place, so
+ *             opening it only reads the index
+ *   frozen:   changes that are being merged into the table
+ *   memtable: recent changes in memory, including removals that hide keys
+ *             of the lower levels
+ * Both levels in memory are backed by the journal
+ * <ofsdir>/<shareid>_metadata.journal.
+ *
+ * Every batch becomes a single checksummed journal record, so it is
+ * replayed completely or not at all. When the memtable gets too large it
+ * is frozen and a background thread merges it with the table into a new
+ * file, which replaces the old one by rename, while writers go on with a
+ * new memtable. The journal is then replaced by the changes made during
+ * the merge. This also happens periodically and with checkpoint() on
+ * unmount, so a start only replays the changes since.
+ *
+ * Keys are "<module>/<name>", each module reads its part with scan().
+ *
+ * A Transaction collects all batches applied by the current thread until
+ * it ends and commits them as one, so changes of several modules become
+ * durable together.
+ */
+class MetaStore
+{
+public:
+    /**
+     * Set of changes that is applied atomically
+     */
+    class Batch
+    {
+    public:
+        void put(const string& key, const string& value);
+        void remove(const string& key);
+        bool empty() const { return changes.empty(); }
+        size_t size() const { return changes.size(); }
+    private:
+        friend class MetaStore;
+        /// new value per key, a missing value removes the key
+        map<string, pair<bool, string> > changes;
+    };
+
+    /**
+     * Commits everything applied by this thread while it is alive with a
+     * single durable write
+     */
+    class Transaction
+    {
+    public:
+        Transaction();
+        ~Transaction();
+        /**
+         * Commit the changes collected so far, the transaction stays open
+         * @return false if they could not be written
+         */
+        bool commit();
+    private:
+        friend class MetaStore;
+        Batch batch;
+        Transaction* outer;
+
+        Transaction(const Transaction&);
+        Transaction& operator=(const Transaction&);
+    };
+
+    static MetaStore& Instance();
+    ~MetaStore();
+
+    /**
+     * Apply changes in memory and queue them for the journal. Inside a
+     * transaction they are only collected.
+     * @return sequence number for sync() and write()
+     */
+    unsigned long long apply(const Batch& batch);
+    /**
+     * Wait until the applied changes are on disk
+     * @param seq sequence number returned by apply()
+     * @return false if they could not be written
+     */
+    bool sync(unsigned long long seq);
+    /**
+     * Write the applied changes to the page cache only, a later sync()
+     * makes them durable
+     * @param seq sequence number returned by apply()
+     * @return false if they could not be written
+     */
+    bool write(unsigned long long seq);
+    /**
+     * Apply changes and wait until they are on disk
+     * @return false if they could not be written
+     */
+    bool commit(const Batch& batch);
+    /**
+     * Read a single value
+     * @return false if the key does not exist
+     */
+    bool get(const string& key, string& value);
+    /**
+     * Find the first key that is not less than the given one
+     * @param from key to start at
+     * @param key receives the key that has been found
+     * @return false if there is no such key
+     */
+    bool next(const string& from, string& key);
+    /**
+     * Read all keys with the given prefix
+     * @param prefix key prefix, e.g. "<module>/"
+     * @param values receives the values by key without the prefix
+     */
+    void scan(const string& prefix, map<string, string>& values);
+    /**
+     * Merge the memtable into the table file and empty the journal, waits
+     * for a merge in the background to finish first
+     * @return false if the table could not be written
+     */
+    bool checkpoint();
+
+protected:
+    MetaStore();
+
+private:
+    typedef map<string, pair<bool, string> > Memtable;
+
+    void open();
+    bool map_table();
+    bool index_table(size_t start, uint64_t count);
+    void unmap_table();
+    bool table_entry(size_t index, const char*& key, uint32_t& keylen,
+                     const char*& value, uint32_t& vallen) const;
+    int table_compare(size_t index, const string& key) const;
+    size_t table_lower_bound(const string& key) const;
+    bool merge();
+    void request_merge();
+    static void* mergeRun(void* arg);
+    static void overlay(const Memtable& changes, const string& prefix,
+                        map<string, string>& values);
+
+    string filename;
+    Journal* journal;
+    /// serializes the writers and the journal
+    pthread_mutex_t writeMutex;
+    /// readers of the levels, taken exclusively to change them
+    pthread_rwlock_t lock;
+    Memtable memtable;
+    /// immutable while it is merged, only merge() changes it
+    Memtable frozen;
+    time_t lastCheckpoint;
+    /// protects the merge state below
+    pthread_mutex_t mergeMutex;
+    pthread_cond_t mergeChanged;
+    pthread_t merger;
+    bool mergerRunning;
+    bool mergeRequested;
+    bool merging;
+    bool mergeStop;
+    /// mapped table file
+    const char* table;
+    size_t tableSize;
+    /// offset of each entry in key order, the end of the entries last
+    const uint64_t* tableIndex;
+    size_t tableCount;
+    /// index built in memory for tables without one
+    vector<uint64_t> builtIndex;
+
+    static std::auto_ptr<MetaStore> theMetaStoreInstance;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+
+    MetaStore(const MetaStore&);
+    MetaStore& operator=(const MetaStore&);
+};
+
+#endif
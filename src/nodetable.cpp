@@ -0,0 +1,255 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "nodetable.h"
+#include "filestatusmanager.h"
+#include "ofsfile.h"
+
+std::auto_ptr<NodeTable> NodeTable::theNodeTableInstance;
+Mutex NodeTable::m;
+pthread_once_t NodeTable::instanceOnce = PTHREAD_ONCE_INIT;
+
+NodeTable::NodeTable() : nextGeneration(0)
+{
+    Node *root = new Node;
+    root->path = "/";
+    root->nlookup = 1;
+    root->generation = 0;
+    root->resolved = NULL;
+    root->resolvedGeneration = 0;
+    root->linked = true;
+    nodes.push_back(root);
+    byPath[root->path] = NODE_ROOT_ID;
+}
+
+NodeTable::~NodeTable()
+{
+    for (vector<Node *>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+        if (*it == NULL)
+            continue;
+        if ((*it)->resolved != NULL)
+            (*it)->resolved->release();
+        delete *it;
+    }
+}
+
+NodeTable& NodeTable::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theNodeTableInstance;
+}
+
+void NodeTable::createInstance()
+{
+    theNodeTableInstance.reset(new NodeTable);
+}
+
+bool NodeTable::child(unsigned long parent, const char *name, string& path)
+{
+    MutexLocker obtain_lock(m);
+    Node *node = get(parent);
+    if (node == NULL)
+        return false;
+    path = join(node->path, name);
+    return true;
+}
+
+bool NodeTable::path(unsigned long ino, string& path)
+{
+    MutexLocker obtain_lock(m);
+    Node *node = get(ino);
+    if (node == NULL)
+        return false;
+    path = node->path;
+    return true;
+}
+
+OFSFile *NodeTable::file(unsigned long ino)
+{
+    Filestatusmanager &fsm = Filestatusmanager::Instance();
+    // read before resolving, a path resolved while the backing trees
+    // change is resolved again on the next call
+    unsigned long fsmGeneration = fsm.get_generation();
+    ResolvedPath *resolved = NULL;
+    string nodePath;
+    {
+        MutexLocker obtain_lock(m);
+        Node *node = get(ino);
+        if (node == NULL)
+            return NULL;
+        if (node->resolved != NULL
+            && node->resolvedGeneration == fsmGeneration) {
+            resolved = node->resolved;
+            resolved->acquire();
+        } else {
+            nodePath = node->path;
+        }
+    }
+    if (resolved != NULL)
+        return new OFSFile(fsm.give_me_file(resolved));
+
+    OFSFile *file = new OFSFile(nodePath);
+    MutexLocker obtain_lock(m);
+    Node *node = get(ino);
+    // the node might have been renamed in the meantime
+    if (node != NULL && node->path == nodePath)
+        remember(node, file->get_fileinfo(), fsmGeneration);
+    return file;
+}
+
+unsigned long NodeTable::lookup(const string& path, unsigned long *generation)
+{
+    MutexLocker obtain_lock(m);
+    unsigned long ino;
+    Node *node;
+    map<string, unsigned long>::iterator it = byPath.find(path);
+    if (it != byPath.end()) {
+        ino = it->second;
+        node = nodes[ino - 1];
+    } else {
+        node = new Node;
+        node->path = path;
+        node->nlookup = 0;
+        node->resolved = NULL;
+        node->resolvedGeneration = 0;
+        node->linked = true;
+        if (freeIds.empty()) {
+            nodes.push_back(node);
+            ino = nodes.size();
+            node->generation = 0;
+        } else {
+            // the kernel must be able to tell the new node from the old one
+            ino = freeIds.back();
+            freeIds.pop_back();
+            nodes[ino - 1] = node;
+            node->generation = ++nextGeneration;
+        }
+        byPath[path] = ino;
+    }
+    ++node->nlookup;
+    *generation = node->generation;
+    return ino;
+}
+
+void NodeTable::forget(unsigned long ino, unsigned long nlookup)
+{
+    MutexLocker obtain_lock(m);
+    Node *node = get(ino);
+    if (node == NULL || ino == NODE_ROOT_ID)
+        return;
+    if (nlookup < node->nlookup) {
+        node->nlookup -= nlookup;
+        return;
+    }
+    unlink(node);
+    if (node->resolved != NULL)
+        node->resolved->release();
+    delete node;
+    nodes[ino - 1] = NULL;
+    freeIds.push_back(ino);
+}
+
+void NodeTable::rename(const string& from, const string& to)
+{
+    MutexLocker obtain_lock(m);
+    // a replaced target keeps its node id until it is forgotten
+    map<string, unsigned long>::iterator it = byPath.find(to);
+    if (it != byPath.end())
+        unlink(nodes[it->second - 1]);
+
+    vector<unsigned long> moved;
+    it = byPath.find(from);
+    if (it != byPath.end()) {
+        moved.push_back(it->second);
+        byPath.erase(it);
+    }
+    string prefix = from + "/";
+    it = byPath.lower_bound(prefix);
+    while (it != byPath.end()
+           && it->first.compare(0, prefix.size(), prefix) == 0) {
+        moved.push_back(it->second);
+        byPath.erase(it++);
+    }
+
+    for (vector<unsigned long>::iterator id = moved.begin();
+         id != moved.end(); ++id) {
+        Node *node = nodes[*id - 1];
+        node->path = to + node->path.substr(from.size());
+        if (node->resolved != NULL) {
+            node->resolved->release();
+            node->resolved = NULL;
+        }
+        it = byPath.find(node->path);
+        if (it != byPath.end())
+            unlink(nodes[it->second - 1]);
+        byPath[node->path] = *id;
+    }
+}
+
+void NodeTable::remove(const string& path)
+{
+    MutexLocker obtain_lock(m);
+    map<string, unsigned long>::iterator it = byPath.find(path);
+    if (it != byPath.end() && it->second != NODE_ROOT_ID)
+        unlink(nodes[it->second - 1]);
+}
+
+size_t NodeTable::size()
+{
+    MutexLocker obtain_lock(m);
+    return nodes.size() - freeIds.size();
+}
+
+NodeTable::Node *NodeTable::get(unsigned long ino)
+{
+    if (ino == 0 || ino > nodes.size())
+        return NULL;
+    return nodes[ino - 1];
+}
+
+/**
+ * Remove a node from the path index, it stays valid until it is forgotten
+ */
+void NodeTable::unlink(Node *node)
+{
+    if (!node->linked)
+        return;
+    byPath.erase(node->path);
+    node->linked = false;
+}
+
+/**
+ * Keep the resolved path of a file for later operations on the node
+ */
+void NodeTable::remember(Node *node, const File& file,
+                         unsigned long fsmGeneration)
+{
+    if (node->resolved != NULL)
+        node->resolved->release();
+    node->resolved = file.get_resolved_path();
+    node->resolved->acquire();
+    node->resolvedGeneration = fsmGeneration;
+}
+
+string NodeTable::join(const string& parent, const char *name)
+{
+    if (parent == "/")
+        return parent + name;
+    return parent + "/" + name;
+}
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef NODETABLE_H
+#define NODETABLE_H
+
+#include "file.h"
+#include "mutexlocker.h"
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+using namespace std;
+
+class OFSFile;
+
+/// node id of the root directory, as defined by FUSE
+#define NODE_ROOT_ID 1
+
+/**
+ * Maps the node ids handed out by the low-level FUSE backend
+ * (lowlevel mount option) to paths of the share.
+ *
+ * A node id is handed out for a path by every successful lookup, create,
+ * mknod, mkdir, symlink and link, and stays valid until the kernel has
+ * forgotten as many lookups as it was handed out. The same path gets the
+ * same node id as long as the node is known. Free node ids are reused
+ * with a new generation number.
+ *
+ * Each node keeps the resolved path it was looked up with, so operations
+ * on a node id do not resolve the path again until the backing trees
+ * change (Filestatusmanager::get_generation()). Renames move the node
+ * and all nodes below it; a removed node keeps its path until it is
+ * forgotten, but the path is free for a new node.
+ */
+class NodeTable
+{
+public:
+    static NodeTable& Instance();
+    ~NodeTable();
+
+    /**
+     * Get the path of an entry of a directory
+     * @param parent node id of the directory
+     * @param name name of the entry
+     * @param path (out) path relative to the share root
+     * @return false if the node id is not known
+     */
+    bool child(unsigned long parent, const char *name, string& path);
+    /**
+     * Get the path of a node
+     * @param ino node id
+     * @param path (out) path relative to the share root
+     * @return false if the node id is not known
+     */
+    bool path(unsigned long ino, string& path);
+    /**
+     * Get the file of a node
+     * @param ino node id
+     * @return new file object, to be deleted by the caller, NULL if the
+     *         node id is not known
+     */
+    OFSFile *file(unsigned long ino);
+    /**
+     * Count a lookup of a path, handing out a node id if necessary
+     * @param path path relative to the share root
+     * @param generation (out) generation number of the node id
+     * @return node id
+     */
+    unsigned long lookup(const string& path, unsigned long *generation);
+    /**
+     * Forget lookups of a node, the node id is freed with the last one
+     * @param ino node id
+     * @param nlookup number of lookups to forget
+     */
+    void forget(unsigned long ino, unsigned long nlookup);
+    /**
+     * A path has been renamed, move its node and all nodes below it
+     * @param from old path relative to the share root
+     * @param to new path relative to the share root
+     */
+    void rename(const string& from, const string& to);
+    /**
+     * A path has been removed, it gets a new node id when it is created
+     * again
+     * @param path path relative to the share root
+     */
+    void remove(const string& path);
+    /**
+     * @return number of known nodes
+     */
+    size_t size();
+
+protected:
+    NodeTable();
+
+private:
+    struct Node
+    {
+        string path;
+        /// lookups not forgotten yet
+        unsigned long nlookup;
+        /// generation number of the node id
+        unsigned long generation;
+        /// shared resolved path, NULL if it has to be resolved again
+        ResolvedPath *resolved;
+        /// Filestatusmanager generation the path has been resolved in
+        unsigned long resolvedGeneration;
+        /// the path maps to this node
+        bool linked;
+    };
+
+    Node *get(unsigned long ino);
+    void unlink(Node *node);
+    void remember(Node *node, const File& file, unsigned long fsmGeneration);
+    static string join(const string& parent, const char *name);
+
+    /// nodes indexed by node id - 1, NULL for free node ids
+    vector<Node *> nodes;
+    /// free node ids
+    vector<unsigned long> freeIds;
+    /// node ids of the linked nodes
+    map<string, unsigned long> byPath;
+    /// generation number for the next reused node id
+    unsigned long nextGeneration;
+    static std::auto_ptr<NodeTable> theNodeTableInstance;
+    /// protects the table
+    static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+};
+
+#endif
@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include "ofs_fuse.h"
+#include "ofs_fuse_ll.h"
 #include "backingtreepersistence.h"
 #include "filesystemstatusmanager.h"
 #include "ofsconf.h"
@@ -130,5 +131,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (env.isLowLevel())
+		return ofs_fuse_ll::main(fuse_arguments.argc, fuse_arguments.argv);
 	return my_ofs.main(fuse_arguments.argc, fuse_arguments.argv, NULL, &my_ofs);
 }
@@ -45,6 +45,11 @@
 #include "ofsenvironment.h"
 #include "offlinerecognizer.h"
 #include "lazywrite.h"
+#include "synclogger.h"
+#include "attrcache.h"
+#include "placeholdermanager.h"
+#include "ofsstats.h"
+#include "metastore.h"
 
 using namespace std;
 
@@ -89,8 +94,9 @@ ofs_fuse::ofs_fuse () {
  */
 int ofs_fuse::fuse_getattr(const char *path, struct stat *stbuf)
 {
+	OpTimer timer(OFSStats::OP_GETATTR);
 	ofslog::debug("Enter fuse_getattr");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_getattr(stbuf);
@@ -114,6 +120,7 @@ int ofs_fuse::fuse_getattr(const char *path, struct stat *stbuf)
 int ofs_fuse::fuse_fgetattr(const char *path, struct stat *stbuf,
                         struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_FGETATTR);
 	ofslog::debug("Enter fuse_fgetattr");
 	int res;
 	(void) path;
@@ -143,6 +150,7 @@ int ofs_fuse::fuse_fgetattr(const char *path, struct stat *stbuf,
  */
 int ofs_fuse::fuse_access(const char *path, int mask)
 {
+	OpTimer timer(OFSStats::OP_ACCESS);
 	ofslog::debug("Enter fuse_access");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -166,6 +174,7 @@ int ofs_fuse::fuse_access(const char *path, int mask)
  */
 int ofs_fuse::fuse_readlink(const char *path, char *buf, size_t size)
 {
+	OpTimer timer(OFSStats::OP_READLINK);
 	ofslog::debug("Enter fuse_readlink");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -185,6 +194,7 @@ int ofs_fuse::fuse_readlink(const char *path, char *buf, size_t size)
  */
 int ofs_fuse::fuse_opendir(const char *path, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_OPENDIR);
 	ofslog::debug("Enter fuse_opendir");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -224,6 +234,7 @@ int ofs_fuse::fuse_opendir(const char *path, struct fuse_file_info *fi)
 int ofs_fuse::fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                        off_t offset, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_READDIR);
 	ofslog::debug("Enter fuse_readdir");
 	(void) path;
 	int res;
@@ -246,6 +257,7 @@ int ofs_fuse::fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
  */
 int ofs_fuse::fuse_releasedir(const char *path, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_RELEASEDIR);
 	ofslog::debug("Enter fuse_releasedir");
 	(void) path;
 	int res;
@@ -275,6 +287,7 @@ int ofs_fuse::fuse_releasedir(const char *path, struct fuse_file_info *fi)
  */
 int ofs_fuse::fuse_mknod(const char *path, mode_t mode, dev_t rdev)
 {
+	OpTimer timer(OFSStats::OP_MKNOD);
 	ofslog::debug("Enter fuse_mknod");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -292,6 +305,7 @@ int ofs_fuse::fuse_mknod(const char *path, mode_t mode, dev_t rdev)
  */
 int ofs_fuse::fuse_mkdir(const char *path, mode_t mode)
 {
+	OpTimer timer(OFSStats::OP_MKDIR);
 	ofslog::debug("Enter fuse_mkdir");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -308,8 +322,9 @@ int ofs_fuse::fuse_mkdir(const char *path, mode_t mode)
  */
 int ofs_fuse::fuse_unlink(const char *path)
 {
+	OpTimer timer(OFSStats::OP_UNLINK);
 	ofslog::debug("Enter fuse_unlink");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_unlink();
@@ -325,6 +340,7 @@ int ofs_fuse::fuse_unlink(const char *path)
  */
 int ofs_fuse::fuse_rmdir(const char *path)
 {
+	OpTimer timer(OFSStats::OP_RMDIR);
 	ofslog::debug("Enter fuse_rmdir");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -345,6 +361,7 @@ int ofs_fuse::fuse_rmdir(const char *path)
  */
 int ofs_fuse::fuse_symlink(const char *from, const char *to)
 {
+	OpTimer timer(OFSStats::OP_SYMLINK);
 	ofslog::debug("Enter fuse_symlink");
 	int res;
 	OFSFile *file_to = new OFSFile(to);
@@ -362,9 +379,10 @@ int ofs_fuse::fuse_symlink(const char *from, const char *to)
  */
 int ofs_fuse::fuse_rename(const char *from, const char *to)
 {
+	OpTimer timer(OFSStats::OP_RENAME);
 	ofslog::debug("Enter fuse_rename");
-	ofslog::debug((string("from: ")+string(from)).c_str());
-	ofslog::debug((string("to: ")+string(to)).c_str());
+	ofslog::debug("from: %s", from);
+	ofslog::debug("to: %s", to);
 	int res;
 	OFSFile *file_from = new OFSFile(from);
 	OFSFile *file_to = new OFSFile(to);
@@ -383,6 +401,7 @@ int ofs_fuse::fuse_rename(const char *from, const char *to)
  */
 int ofs_fuse::fuse_link(const char *from, const char *to)
 {
+	OpTimer timer(OFSStats::OP_LINK);
 	ofslog::debug("Enter fuse_link");
 	int res;
 	OFSFile *file_from = new OFSFile(from);
@@ -402,8 +421,9 @@ int ofs_fuse::fuse_link(const char *from, const char *to)
  */
 int ofs_fuse::fuse_chmod(const char *path, mode_t mode)
 {
+	OpTimer timer(OFSStats::OP_CHMOD);
 	ofslog::debug("Enter fuse_chmod");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_chmod(mode);
@@ -421,8 +441,9 @@ int ofs_fuse::fuse_chmod(const char *path, mode_t mode)
  */
 int ofs_fuse::fuse_chown(const char *path, uid_t uid, gid_t gid)
 {
+	OpTimer timer(OFSStats::OP_CHOWN);
 	ofslog::debug("Enter fuse_chown");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_chown(uid, gid);
@@ -439,8 +460,9 @@ int ofs_fuse::fuse_chown(const char *path, uid_t uid, gid_t gid)
  */
 int ofs_fuse::fuse_truncate(const char *path, off_t size)
 {
+	OpTimer timer(OFSStats::OP_TRUNCATE);
 	ofslog::debug("Enter fuse_truncate");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_truncate(size);
@@ -465,6 +487,7 @@ int ofs_fuse::fuse_truncate(const char *path, off_t size)
 int ofs_fuse::fuse_ftruncate(const char *path, off_t size,
                          struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_FTRUNCATE);
 	ofslog::debug("Enter fuse_ftruncate");
 	int res;
 
@@ -489,6 +512,7 @@ int ofs_fuse::fuse_ftruncate(const char *path, off_t size,
  */
 int ofs_fuse::fuse_utimens(const char *path, const struct timespec ts[2])
 {
+	OpTimer timer(OFSStats::OP_UTIMENS);
 	ofslog::debug("Enter fuse_utimens");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -514,8 +538,9 @@ int ofs_fuse::fuse_utimens(const char *path, const struct timespec ts[2])
 int ofs_fuse::fuse_create(const char *path, mode_t mode,
 	struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_CREATE);
 	ofslog::debug("Enter fuse_create");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_create(mode);
@@ -541,8 +566,9 @@ int ofs_fuse::fuse_create(const char *path, mode_t mode,
  */
 int ofs_fuse::fuse_open(const char *path, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_OPEN);
 	ofslog::debug("Enter fuse_open");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	OFSFile *file = new OFSFile(path);
 	res = file->op_open(fi->flags);
@@ -572,8 +598,9 @@ int ofs_fuse::fuse_open(const char *path, struct fuse_file_info *fi)
 int ofs_fuse::fuse_read(const char *path, char *buf, size_t size, off_t offset,
                     struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_READ);
 	ofslog::debug("Enter fuse_read");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	(void) path;
 	OFSFile *file = (OFSFile *)fi->fh;
@@ -605,6 +632,7 @@ int ofs_fuse::fuse_read(const char *path, char *buf, size_t size, off_t offset,
 int ofs_fuse::fuse_write(const char *path, const char *buf, size_t size,
                      off_t offset, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_WRITE);
 	ofslog::debug("Enter fuse_write");
 	int res;
 	(void) path;
@@ -630,6 +658,7 @@ int ofs_fuse::fuse_write(const char *path, const char *buf, size_t size,
  */
 int ofs_fuse::fuse_statfs(const char *path, struct statvfs *stbuf)
 {
+	OpTimer timer(OFSStats::OP_STATFS);
 	ofslog::debug("Enter fuse_statfs");
 	int res;
 	OFSFile *file = new OFSFile(path);
@@ -664,6 +693,7 @@ int ofs_fuse::fuse_statfs(const char *path, struct statvfs *stbuf)
  */
 int ofs_fuse::fuse_flush(const char *path, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_FLUSH);
 	// TODO: Implement this
 //	int res;
 //	openfile_info *fileinfo = (openfile_info *)fi->fh;
@@ -702,8 +732,9 @@ int ofs_fuse::fuse_flush(const char *path, struct fuse_file_info *fi)
  */
 int ofs_fuse::fuse_release(const char *path, struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_RELEASE);
 	ofslog::debug("Enter fuse_release");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res;
 	(void) path;
 	OFSFile *file = (OFSFile *)fi->fh;
@@ -734,8 +765,9 @@ int ofs_fuse::fuse_release(const char *path, struct fuse_file_info *fi)
 int ofs_fuse::fuse_fsync(const char *path, int isdatasync,
                      struct fuse_file_info *fi)
 {
+	OpTimer timer(OFSStats::OP_FSYNC);
 	ofslog::debug("Enter fuse_fsync");
-	ofslog::debug(path);
+	ofslog::debug("%s", path);
 	int res=0;
 	(void) path;
 	OFSFile *file = (OFSFile *)fi->fh;
@@ -779,9 +811,10 @@ int ofs_fuse::fuse_setxattr(const char *path, const char *name,
 			    const char *value, size_t size, int flags)
 #endif
 {
+	OpTimer timer(OFSStats::OP_SETXATTR);
 	ofslog::debug("Enter fuse_setxattr");
-	ofslog::debug(path);
-	ofslog::debug((string("Name: ")+string(name)).c_str());
+	ofslog::debug("%s", path);
+	ofslog::debug("Name: %s", name);
 	int res = 0;
 	OFSFile file(path);
 	ofslog::debug("Leave fuse_setxattr");
@@ -813,9 +846,10 @@ int ofs_fuse::fuse_getxattr(const char *path, const char *name, char *value,
 			    size_t size)
 #endif
 {
+	OpTimer timer(OFSStats::OP_GETXATTR);
 	ofslog::debug("Enter fuse_getxattr");
-	ofslog::debug(path);
-	ofslog::debug((string("Name: ")+string(name)).c_str());
+	ofslog::debug("%s", path);
+	ofslog::debug("Name: %s", name);
 	int ret;
 	OFSFile file(path);
 #ifdef FUSE_XATTR_ADD_OPT
@@ -839,6 +873,7 @@ int ofs_fuse::fuse_getxattr(const char *path, const char *name, char *value,
  */
 int ofs_fuse::fuse_listxattr(const char *path, char *list, size_t size)
 {
+	OpTimer timer(OFSStats::OP_LISTXATTR);
 	ofslog::debug("Enter fuse_listxattr");
 	OFSFile file(path);
 	ofslog::debug("Leave fuse_listxattr");
@@ -857,6 +892,7 @@ int ofs_fuse::fuse_listxattr(const char *path, char *list, size_t size)
  */
 int ofs_fuse::fuse_removexattr(const char *path, const char *name)
 {
+	OpTimer timer(OFSStats::OP_REMOVEXATTR);
 	ofslog::debug("Enter fuse_removexattr");
 	int res = 0;
 	OFSFile file(path);
@@ -926,10 +962,16 @@ void *ofs_fuse::fuse_init (struct fuse_conn_info *conn) {
 /*	pthread_t *thread = new pthread_t();
 	if (!pthread_create(thread, NULL, ofs_daemon::start_daemon, (void *)self))
 		perror(strerror(errno));*/
+	// the daemon has forked, the drain thread survives from here on
+	ofslog::startAsync();
 	FilesystemStatusManager::Instance().startDbusListener();
 	BackingtreeManager &btm = BackingtreeManager::Instance();
 //	btm.set_Cache_Path("/tmp/ofscache/");
 	btm.reinstate();
+	// load the sync log once, all further dirty checks are served from memory
+	SyncLogger::Instance().LoadIndex(OFSEnvironment::Instance().getShareID().c_str());
+	// placeholders left from the last run
+	PlaceholderManager::Instance().startFetching();
 
 	//if (argv[5]) {
 	pthread_t thread;
@@ -951,8 +993,13 @@ void *ofs_fuse::fuse_init (struct fuse_conn_info *conn) {
  */
 void ofs_fuse::fuse_destroy(void *)
 {
-    if(!OFSEnvironment::Instance().isUnmount())
+    AttrCache::Instance().logStatistics();
+    if(!OFSEnvironment::Instance().isUnmount()) {
+        // the next start only maps the table, there is no journal to replay
+        MetaStore::Instance().checkpoint();
+        ofslog::stopAsync();
         return;
+    }
 	if(OFSEnvironment::Instance().getlazywrite() && !(FilesystemStatusManager::Instance().issync()))
 	{
 	ofslog::info("Write back Changes");
@@ -960,4 +1007,6 @@ void ofs_fuse::fuse_destroy(void *)
 	FilesystemStatusManager::Instance().setsync(true);
 	}
     FilesystemStatusManager::Instance().unmountfs();
+    MetaStore::Instance().checkpoint();
+    ofslog::stopAsync();
 }
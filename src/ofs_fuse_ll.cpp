@@ -0,0 +1,718 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ofs_fuse_ll.h"
+#include "ofs_fuse.h"
+#include "ofsfile.h"
+#include "nodetable.h"
+#include "ofslog.h"
+#include "ofsstats.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <errno.h>
+#include <limits.h>
+#include <sys/time.h>
+
+using namespace std;
+
+struct fuse_lowlevel_ops ofs_fuse_ll::operations;
+
+/**
+ * A readdir reply being filled by OFSFile::op_readdir
+ */
+struct DirBuffer
+{
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+};
+
+int ofs_fuse_ll::main(int argc, char *argv[])
+{
+    memset(&operations, 0, sizeof(operations));
+    operations.init = ll_init;
+    operations.destroy = ll_destroy;
+    operations.lookup = ll_lookup;
+    operations.forget = ll_forget;
+    operations.getattr = ll_getattr;
+    operations.setattr = ll_setattr;
+    operations.readlink = ll_readlink;
+    operations.mknod = ll_mknod;
+    operations.mkdir = ll_mkdir;
+    operations.unlink = ll_unlink;
+    operations.rmdir = ll_rmdir;
+    operations.symlink = ll_symlink;
+    operations.rename = ll_rename;
+    operations.link = ll_link;
+    operations.open = ll_open;
+    operations.read = ll_read;
+    operations.write = ll_write;
+    operations.flush = ll_flush;
+    operations.release = ll_release;
+    operations.fsync = ll_fsync;
+    operations.opendir = ll_opendir;
+    operations.readdir = ll_readdir;
+    operations.releasedir = ll_releasedir;
+    operations.statfs = ll_statfs;
+#ifdef HAVE_SETXATTR
+    operations.setxattr = ll_setxattr;
+    operations.getxattr = ll_getxattr;
+    operations.listxattr = ll_listxattr;
+    operations.removexattr = ll_removexattr;
+#endif
+    operations.access = ll_access;
+    operations.create = ll_create;
+
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char *mountpoint;
+    int multithreaded;
+    int foreground;
+    int err = -1;
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+                           &foreground) == -1)
+        return 1;
+
+    ofslog::info("Starting FUSE (low-level)");
+    struct fuse_chan *ch = fuse_mount(mountpoint, &args);
+    if (ch != NULL) {
+        struct fuse_session *se = fuse_lowlevel_new(&args, &operations,
+            sizeof(operations), NULL);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                if (fuse_daemonize(foreground) != -1)
+                    err = multithreaded ? fuse_session_loop_mt(se)
+                                        : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+    fuse_opt_free_args(&args);
+    return err ? 1 : 0;
+}
+
+void ofs_fuse_ll::ll_init(void * /*userdata*/, struct fuse_conn_info *conn)
+{
+    ofs_fuse::fuse_init(conn);
+}
+
+void ofs_fuse_ll::ll_destroy(void *userdata)
+{
+    ofslog::info("%lu nodes known at unmount",
+                 (unsigned long)NodeTable::Instance().size());
+    ofs_fuse::fuse_destroy(userdata);
+}
+
+/**
+ * Reply with the node of a file that has been looked up or created, the
+ * lookup is counted in the #NodeTable
+ * @param file the file, deleted here unless it has been opened (fi)
+ * @param fi open file for create, NULL otherwise
+ */
+void ofs_fuse_ll::reply_entry(fuse_req_t req, OFSFile *file,
+                              struct fuse_file_info *fi)
+{
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    int res = fi ? file->op_fgetattr(&e.attr) : file->op_getattr(&e.attr);
+    if (res < 0) {
+        if (fi)
+            file->op_release();
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    NodeTable &table = NodeTable::Instance();
+    e.ino = table.lookup(file->get_relative_path(), &e.generation);
+    e.attr.st_ino = e.ino;
+    e.attr_timeout = LL_ATTR_TIMEOUT;
+    e.entry_timeout = LL_ENTRY_TIMEOUT;
+    if (fi) {
+        fi->fh = (unsigned long)file;
+        if (fuse_reply_create(req, &e, fi) != 0) {
+            // the request has been interrupted, the kernel does not know
+            // about the node or the open file
+            table.forget(e.ino, 1);
+            file->op_release();
+            delete file;
+        }
+    } else {
+        if (fuse_reply_entry(req, &e) != 0)
+            table.forget(e.ino, 1);
+        delete file;
+    }
+}
+
+void ofs_fuse_ll::ll_lookup(fuse_req_t req, fuse_ino_t parent,
+                            const char *name)
+{
+    OpTimer timer(OFSStats::OP_LOOKUP);
+    string path;
+    if (!NodeTable::Instance().child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    reply_entry(req, new OFSFile(path), NULL);
+}
+
+void ofs_fuse_ll::ll_forget(fuse_req_t req, fuse_ino_t ino,
+                            unsigned long nlookup)
+{
+    OpTimer timer(OFSStats::OP_FORGET);
+    NodeTable::Instance().forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+void ofs_fuse_ll::ll_getattr(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info * /*fi*/)
+{
+    OpTimer timer(OFSStats::OP_GETATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    struct stat st;
+    int res = file->op_getattr(&st);
+    delete file;
+    if (res < 0) {
+        fuse_reply_err(req, -res);
+        return;
+    }
+    st.st_ino = ino;
+    fuse_reply_attr(req, &st, LL_ATTR_TIMEOUT);
+}
+
+/**
+ * Change the attributes given by to_set, one after the other as the
+ * high-level library does
+ */
+void ofs_fuse_ll::ll_setattr(fuse_req_t req, fuse_ino_t ino,
+                             struct stat *attr, int to_set,
+                             struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_SETATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *open = fi ? (OFSFile *)fi->fh : NULL;
+    int res = 0;
+    if (to_set & FUSE_SET_ATTR_MODE)
+        res = file->op_chmod(attr->st_mode);
+    if (res == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+        res = file->op_chown(
+            (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1,
+            (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1);
+    if (res == 0 && (to_set & FUSE_SET_ATTR_SIZE))
+        res = open ? open->op_ftruncate(attr->st_size)
+                   : file->op_truncate(attr->st_size);
+    if (res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        // op_utimens sets both times, keep the one not to be changed
+        struct stat st;
+        res = file->op_getattr(&st);
+        if (res == 0) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec ts[2];
+            ts[0] = st.st_atim;
+            ts[1] = st.st_mtim;
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+                ts[0].tv_sec = now.tv_sec;
+                ts[0].tv_nsec = now.tv_usec * 1000;
+            } else if (to_set & FUSE_SET_ATTR_ATIME) {
+                ts[0] = attr->st_atim;
+            }
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+                ts[1].tv_sec = now.tv_sec;
+                ts[1].tv_nsec = now.tv_usec * 1000;
+            } else if (to_set & FUSE_SET_ATTR_MTIME) {
+                ts[1] = attr->st_mtim;
+            }
+            res = file->op_utimens(ts);
+        }
+    }
+    struct stat st;
+    if (res == 0)
+        res = open ? open->op_fgetattr(&st) : file->op_getattr(&st);
+    delete file;
+    if (res < 0) {
+        fuse_reply_err(req, -res);
+        return;
+    }
+    st.st_ino = ino;
+    fuse_reply_attr(req, &st, LL_ATTR_TIMEOUT);
+}
+
+void ofs_fuse_ll::ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    OpTimer timer(OFSStats::OP_READLINK);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    char buf[PATH_MAX + 1];
+    int res = file->op_readlink(buf, sizeof(buf));
+    delete file;
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_readlink(req, buf);
+}
+
+void ofs_fuse_ll::ll_mknod(fuse_req_t req, fuse_ino_t parent,
+                           const char *name, mode_t mode, dev_t rdev)
+{
+    OpTimer timer(OFSStats::OP_MKNOD);
+    string path;
+    if (!NodeTable::Instance().child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *file = new OFSFile(path);
+    int res = file->op_mknod(mode, rdev);
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    reply_entry(req, file, NULL);
+}
+
+void ofs_fuse_ll::ll_mkdir(fuse_req_t req, fuse_ino_t parent,
+                           const char *name, mode_t mode)
+{
+    OpTimer timer(OFSStats::OP_MKDIR);
+    string path;
+    if (!NodeTable::Instance().child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *file = new OFSFile(path);
+    int res = file->op_mkdir(mode);
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    reply_entry(req, file, NULL);
+}
+
+void ofs_fuse_ll::ll_unlink(fuse_req_t req, fuse_ino_t parent,
+                            const char *name)
+{
+    OpTimer timer(OFSStats::OP_UNLINK);
+    NodeTable &table = NodeTable::Instance();
+    string path;
+    if (!table.child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile file(path);
+    int res = file.op_unlink();
+    if (res == 0)
+        table.remove(path);
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_rmdir(fuse_req_t req, fuse_ino_t parent,
+                           const char *name)
+{
+    OpTimer timer(OFSStats::OP_RMDIR);
+    NodeTable &table = NodeTable::Instance();
+    string path;
+    if (!table.child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile file(path);
+    int res = file.op_rmdir();
+    if (res == 0)
+        table.remove(path);
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_symlink(fuse_req_t req, const char *link,
+                             fuse_ino_t parent, const char *name)
+{
+    OpTimer timer(OFSStats::OP_SYMLINK);
+    string path;
+    if (!NodeTable::Instance().child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *file = new OFSFile(path);
+    int res = file->op_symlink(link);
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    reply_entry(req, file, NULL);
+}
+
+void ofs_fuse_ll::ll_rename(fuse_req_t req, fuse_ino_t parent,
+                            const char *name, fuse_ino_t newparent,
+                            const char *newname)
+{
+    OpTimer timer(OFSStats::OP_RENAME);
+    NodeTable &table = NodeTable::Instance();
+    string from, to;
+    if (!table.child(parent, name, from)
+        || !table.child(newparent, newname, to)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile file_from(from);
+    OFSFile file_to(to);
+    int res = file_from.op_rename(&file_to);
+    if (res == 0)
+        table.rename(from, to);
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_link(fuse_req_t req, fuse_ino_t ino,
+                          fuse_ino_t newparent, const char *newname)
+{
+    OpTimer timer(OFSStats::OP_LINK);
+    NodeTable &table = NodeTable::Instance();
+    string to;
+    OFSFile *file_from = table.file(ino);
+    if (file_from == NULL || !table.child(newparent, newname, to)) {
+        delete file_from;
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *file_to = new OFSFile(to);
+    int res = file_from->op_link(file_to);
+    delete file_from;
+    if (res < 0) {
+        delete file_to;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    reply_entry(req, file_to, NULL);
+}
+
+void ofs_fuse_ll::ll_open(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_OPEN);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int res = file->op_open(fi->flags);
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    fi->fh = (unsigned long)file;
+    if (fuse_reply_open(req, fi) != 0) {
+        file->op_release();
+        delete file;
+    }
+}
+
+void ofs_fuse_ll::ll_read(fuse_req_t req, fuse_ino_t /*ino*/, size_t size,
+                          off_t off, struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_READ);
+    OFSFile *file = (OFSFile *)fi->fh;
+    vector<char> buf(size);
+    int res = file->op_read(size ? &buf[0] : NULL, size, off);
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_buf(req, size ? &buf[0] : NULL, res);
+}
+
+void ofs_fuse_ll::ll_write(fuse_req_t req, fuse_ino_t /*ino*/, const char *buf,
+                           size_t size, off_t off, struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_WRITE);
+    OFSFile *file = (OFSFile *)fi->fh;
+    int res = file->op_write(buf, size, off);
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_write(req, res);
+}
+
+/**
+ * Nothing to do, see ofs_fuse::fuse_flush
+ */
+void ofs_fuse_ll::ll_flush(fuse_req_t req, fuse_ino_t /*ino*/,
+                           struct fuse_file_info * /*fi*/)
+{
+    OpTimer timer(OFSStats::OP_FLUSH);
+    fuse_reply_err(req, 0);
+}
+
+void ofs_fuse_ll::ll_release(fuse_req_t req, fuse_ino_t /*ino*/,
+                             struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_RELEASE);
+    OFSFile *file = (OFSFile *)fi->fh;
+    int res = file->op_release();
+    delete file;
+    fi->fh = 0;
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_fsync(fuse_req_t req, fuse_ino_t /*ino*/, int datasync,
+                           struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_FSYNC);
+    OFSFile *file = (OFSFile *)fi->fh;
+    fuse_reply_err(req, -file->op_fsync(datasync));
+}
+
+void ofs_fuse_ll::ll_opendir(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_OPENDIR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int res = file->op_opendir();
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    fi->fh = (unsigned long)file;
+    if (fuse_reply_open(req, fi) != 0) {
+        file->op_releasedir();
+        delete file;
+    }
+}
+
+/**
+ * Filler for OFSFile::op_readdir, adds an entry to a #DirBuffer
+ * @return 1 if the reply is full
+ */
+int ofs_fuse_ll::fill_dir(void *buf, const char *name,
+                          const struct stat *stbuf, off_t off)
+{
+    DirBuffer *dir = (DirBuffer *)buf;
+    size_t left = dir->size - dir->used;
+    size_t len = fuse_add_direntry(dir->req, dir->buf + dir->used, left,
+                                   name, stbuf, off);
+    if (len > left)
+        return 1;
+    dir->used += len;
+    return 0;
+}
+
+/**
+ * Read directory
+ *
+ * OFSFile::op_readdir passes the position after each entry as its
+ * offset, so every reply continues where the last one ended and no
+ * listing is kept between the calls.
+ */
+void ofs_fuse_ll::ll_readdir(fuse_req_t req, fuse_ino_t /*ino*/, size_t size,
+                             off_t off, struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_READDIR);
+    OFSFile *file = (OFSFile *)fi->fh;
+    vector<char> buf(size);
+    DirBuffer dir;
+    dir.req = req;
+    dir.buf = size ? &buf[0] : NULL;
+    dir.size = size;
+    dir.used = 0;
+    int res = file->op_readdir(&dir, fill_dir, off);
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_buf(req, dir.buf, dir.used);
+}
+
+void ofs_fuse_ll::ll_releasedir(fuse_req_t req, fuse_ino_t /*ino*/,
+                                struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_RELEASEDIR);
+    OFSFile *file = (OFSFile *)fi->fh;
+    int res = file->op_releasedir();
+    delete file;
+    fi->fh = 0;
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_statfs(fuse_req_t req, fuse_ino_t /*ino*/)
+{
+    OpTimer timer(OFSStats::OP_STATFS);
+    OFSFile file("/");
+    struct statvfs st;
+    int res = file.op_statfs(&st);
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_statfs(req, &st);
+}
+
+#ifdef HAVE_SETXATTR
+#ifdef FUSE_XATTR_ADD_OPT
+void ofs_fuse_ll::ll_setxattr(fuse_req_t req, fuse_ino_t ino,
+                              const char *name, const char *value,
+                              size_t size, int flags, uint32_t position)
+#else
+void ofs_fuse_ll::ll_setxattr(fuse_req_t req, fuse_ino_t ino,
+                              const char *name, const char *value,
+                              size_t size, int flags)
+#endif
+{
+    OpTimer timer(OFSStats::OP_SETXATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+#ifdef FUSE_XATTR_ADD_OPT
+    int res = file->op_setxattr(name, value, size, flags, position);
+#else
+    int res = file->op_setxattr(name, value, size, flags);
+#endif
+    delete file;
+    fuse_reply_err(req, -res);
+}
+
+/**
+ * Fetch an extended attribute, with size 0 only its size is replied
+ */
+#ifdef FUSE_XATTR_ADD_OPT
+void ofs_fuse_ll::ll_getxattr(fuse_req_t req, fuse_ino_t ino,
+                              const char *name, size_t size,
+                              uint32_t position)
+#else
+void ofs_fuse_ll::ll_getxattr(fuse_req_t req, fuse_ino_t ino,
+                              const char *name, size_t size)
+#endif
+{
+    OpTimer timer(OFSStats::OP_GETXATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    vector<char> buf(size);
+#ifdef FUSE_XATTR_ADD_OPT
+    int res = file->op_getxattr(name, size ? &buf[0] : NULL, size, position);
+#else
+    int res = file->op_getxattr(name, size ? &buf[0] : NULL, size);
+#endif
+    delete file;
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else if (size == 0)
+        fuse_reply_xattr(req, res);
+    else
+        fuse_reply_buf(req, &buf[0], res);
+}
+
+/**
+ * List the extended attributes, with size 0 only the size of the list
+ * is replied
+ */
+void ofs_fuse_ll::ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    OpTimer timer(OFSStats::OP_LISTXATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    vector<char> buf(size);
+    int res = file->op_listxattr(size ? &buf[0] : NULL, size);
+    delete file;
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else if (size == 0)
+        fuse_reply_xattr(req, res);
+    else
+        fuse_reply_buf(req, &buf[0], res);
+}
+
+void ofs_fuse_ll::ll_removexattr(fuse_req_t req, fuse_ino_t ino,
+                                 const char *name)
+{
+    OpTimer timer(OFSStats::OP_REMOVEXATTR);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int res = file->op_removexattr(name);
+    delete file;
+    fuse_reply_err(req, -res);
+}
+#endif /* HAVE_SETXATTR */
+
+void ofs_fuse_ll::ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+    OpTimer timer(OFSStats::OP_ACCESS);
+    OFSFile *file = NodeTable::Instance().file(ino);
+    if (file == NULL) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int res = file->op_access(mask);
+    delete file;
+    fuse_reply_err(req, -res);
+}
+
+void ofs_fuse_ll::ll_create(fuse_req_t req, fuse_ino_t parent,
+                            const char *name, mode_t mode,
+                            struct fuse_file_info *fi)
+{
+    OpTimer timer(OFSStats::OP_CREATE);
+    string path;
+    if (!NodeTable::Instance().child(parent, name, path)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    OFSFile *file = new OFSFile(path);
+    int res = file->op_create(mode);
+    if (res < 0) {
+        delete file;
+        fuse_reply_err(req, -res);
+        return;
+    }
+    reply_entry(req, file, fi);
+}
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef OFS_FUSE_LL_H
+#define OFS_FUSE_LL_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fusexx.hpp>
+#include <fuse_lowlevel.h>
+
+class OFSFile;
+
+/// seconds the kernel may keep the attributes and entries it got
+#define LL_ATTR_TIMEOUT 1.0
+#define LL_ENTRY_TIMEOUT 1.0
+
+/**
+ * Backend on the low-level FUSE API, selected by the lowlevel mount
+ * option as an alternative to #ofs_fuse.
+ *
+ * The kernel addresses files by node id here, the #NodeTable maps them
+ * to paths. Every operation works on the same #OFSFile objects as the
+ * high-level backend, the open ones are kept in fuse_file_info::fh.
+ */
+class ofs_fuse_ll
+{
+public:
+    /**
+     * Mount the file system and process requests until it is unmounted
+     * @param argc argument counter, as for fuse_main
+     * @param argv argument vector, as for fuse_main
+     * @return 0 on success, nonzero on failure
+     */
+    static int main(int argc, char *argv[]);
+
+    static void ll_init(void *userdata, struct fuse_conn_info *conn);
+    static void ll_destroy(void *userdata);
+    static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+    static void ll_forget(fuse_req_t req, fuse_ino_t ino,
+        unsigned long nlookup);
+    static void ll_getattr(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+        int to_set, struct fuse_file_info *fi);
+    static void ll_readlink(fuse_req_t req, fuse_ino_t ino);
+    static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+        mode_t mode, dev_t rdev);
+    static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+        mode_t mode);
+    static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name);
+    static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name);
+    static void ll_symlink(fuse_req_t req, const char *link,
+        fuse_ino_t parent, const char *name);
+    static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+        fuse_ino_t newparent, const char *newname);
+    static void ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+        const char *newname);
+    static void ll_open(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi);
+    static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+        size_t size, off_t off, struct fuse_file_info *fi);
+    static void ll_flush(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_release(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+        struct fuse_file_info *fi);
+    static void ll_opendir(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi);
+    static void ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi);
+    static void ll_statfs(fuse_req_t req, fuse_ino_t ino);
+#ifdef HAVE_SETXATTR
+#ifdef FUSE_XATTR_ADD_OPT
+    static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+        const char *value, size_t size, int flags, uint32_t position);
+    static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+        size_t size, uint32_t position);
+#else
+    static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+        const char *value, size_t size, int flags);
+    static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+        size_t size);
+#endif
+    static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size);
+    static void ll_removexattr(fuse_req_t req, fuse_ino_t ino,
+        const char *name);
+#endif
+    static void ll_access(fuse_req_t req, fuse_ino_t ino, int mask);
+    static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+        mode_t mode, struct fuse_file_info *fi);
+
+private:
+    static void reply_entry(fuse_req_t req, OFSFile *file,
+        struct fuse_file_info *fi);
+    static int fill_dir(void *buf, const char *name,
+        const struct stat *stbuf, off_t off);
+
+    static struct fuse_lowlevel_ops operations;
+};
+
+#endif
@@ -132,7 +132,7 @@ void OFSBroadcast::SendSignal(const char* pszSignal,const char* pszValue,int nVa
  */
 void OFSBroadcast::SendInfo(const char* pszSignal,const char* pszValue,const char* pszDesc,int nValue)
 {
-    ofslog::info(pszDesc);
+    ofslog::info("%s", pszDesc);
     SendSignal(pszSignal,pszValue,nValue);
 }
 
@@ -141,7 +141,7 @@ void OFSBroadcast::SendInfo(const char* pszSignal,const char* pszValue,const cha
  */
 void OFSBroadcast::SendError(const char* pszSignal,const char* pszValue,const char* pszDesc,int nValue)
 {
-    ofslog::error(pszDesc);
+    ofslog::error("%s", pszDesc);
     SendSignal(pszSignal,pszValue,nValue);
 }
 
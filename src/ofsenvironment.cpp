@@ -38,8 +38,8 @@
 #include <grp.h>
 
 std::auto_ptr<OFSEnvironment> OFSEnvironment::theOFSEnvironmentInstance;
-Mutex OFSEnvironment::m;
 Mutex OFSEnvironment::initm;
+pthread_once_t OFSEnvironment::instanceOnce = PTHREAD_ONCE_INIT;
 bool OFSEnvironment::initialized = false;
 
 OFSEnvironment& OFSEnvironment::Instance()
@@ -47,12 +47,15 @@ OFSEnvironment& OFSEnvironment::Instance()
 	if(!initialized) {
 		throw new OFSException("OFS Environment not initialized", 1,true);
 	}
-	MutexLocker obtain_lock(m);
-	if (theOFSEnvironmentInstance.get() == 0)
-		theOFSEnvironmentInstance.reset(new OFSEnvironment());
+	pthread_once(&instanceOnce, createInstance);
 	return *theOFSEnvironmentInstance;
 }
 
+void OFSEnvironment::createInstance()
+{
+	theOFSEnvironmentInstance.reset(new OFSEnvironment());
+}
+
 OFSEnvironment::OFSEnvironment()
 {
 }
@@ -90,6 +93,20 @@ void OFSEnvironment::init(int argc, char *argv[]) throw(OFSException)
 	env.lazywrite=false;
 	// TODO: use enumeration for lazy write parameter!
 	env.lwoption='n';  //c=CPU n=Network t=Timer
+	env.syncthreads = 4;
+	env.dedup = false;
+	env.attrcache = 5;
+	env.cachethreads = 4;
+	env.manifest = false;
+	env.lazypin = false;
+	env.blockfetch = false;
+	env.readahead = 1024;
+	env.lowlevel = false;
+	env.lwbandwidth = 0;
+	env.lwexpire = 300;
+	env.lwidle = 30;
+	env.lwdirtybytes = 64 * 1024;
+	env.lwdirtyentries = 1000;
 
 	// TODO: cache-and remote path have to be custom for each share
 	int nextopt;
@@ -133,7 +150,24 @@ void OFSEnvironment::init(int argc, char *argv[]) throw(OFSException)
 		USER_OPT,
 		UID_OPT,
 		GROUP_OPT,
-		GID_OPT
+		GID_OPT,
+		SYNC_THREADS_OPT,
+		DEDUP_OPT,
+		ATTR_CACHE_OPT,
+		CACHE_THREADS_OPT,
+		MANIFEST_OPT,
+		LAZY_PIN_OPT,
+		BLOCK_FETCH_OPT,
+		READ_AHEAD_OPT,
+		LOW_LEVEL_OPT,
+		STATE_DIR_OPT,
+		LW_DEVICES_OPT,
+		LW_BANDWIDTH_OPT,
+		LW_EXPIRE_OPT,
+		LW_IDLE_OPT,
+		LW_DIRTY_BYTES_OPT,
+		LW_DIRTY_ENTRIES_OPT,
+		LOG_LEVEL_OPT
 	};
 
 	char * const mount_option_names[] = {
@@ -151,6 +185,23 @@ void OFSEnvironment::init(int argc, char *argv[]) throw(OFSException)
 			"uid",
 			"group",
 			"gid",
+			"syncthreads",
+			"dedup",
+			"attrcache",
+			"cachethreads",
+			"manifest",
+			"lazypin",
+			"blockfetch",
+			"readahead",
+			"lowlevel",
+			"statedir",
+			"lwdevices",
+			"lwbandwidth",
+			"lwexpire",
+			"lwidle",
+			"lwdirtybytes",
+			"lwdirtyentries",
+			"loglevel",
 			NULL
 	};
 
@@ -232,6 +283,7 @@ void OFSEnvironment::init(int argc, char *argv[]) throw(OFSException)
 					// TODO: check if value == NULL
 					env.lazywrite = true;
 					env.lwoption = value[0];
+					break;
 				case USER_OPT:
 					if (l_uid != -1) {
 						cerr << "User id already set" << endl;
@@ -272,6 +324,89 @@ void OFSEnvironment::init(int argc, char *argv[]) throw(OFSException)
 					}
 					l_gid = static_cast<gid_t>(atol(value));
 					break;
+				case SYNC_THREADS_OPT:
+					if (value == NULL || atoi(value) < 1)
+						throw OFSException("syncthreads needs a positive number", 1, true);
+					env.syncthreads = atoi(value);
+					break;
+				case DEDUP_OPT:
+					env.dedup = true;
+					break;
+				case ATTR_CACHE_OPT:
+					if (value == NULL || atoi(value) < 0)
+						throw OFSException("attrcache needs a number of seconds", 1, true);
+					env.attrcache = atoi(value);
+					break;
+				case CACHE_THREADS_OPT:
+					if (value == NULL || atoi(value) < 1)
+						throw OFSException("cachethreads needs a positive number", 1, true);
+					env.cachethreads = atoi(value);
+					break;
+				case MANIFEST_OPT:
+					env.manifest = true;
+					break;
+				case LAZY_PIN_OPT:
+					env.lazypin = true;
+					break;
+				case BLOCK_FETCH_OPT:
+					env.blockfetch = true;
+					break;
+				case READ_AHEAD_OPT:
+					if (value == NULL || atoi(value) < 0)
+						throw OFSException("readahead needs a number of KiB", 1, true);
+					env.readahead = atoi(value);
+					break;
+				case LOW_LEVEL_OPT:
+					env.lowlevel = true;
+					break;
+				case STATE_DIR_OPT:
+					if (value == NULL || value[0] != '/')
+						throw OFSException("statedir needs an absolute path", 1, true);
+					env.ofsdir = value;
+					break;
+				case LW_DEVICES_OPT:
+					if (value == NULL)
+						throw OFSException("lwdevices needs a list of network interfaces", 1, true);
+					char *savelw;
+					char *strlw;
+					strlw = strtok_r(value, ":", &savelw);
+					env.lwdevices.clear();
+					while(strlw != NULL) {
+						env.lwdevices.push_back(strlw);
+						strlw = strtok_r(NULL, ":", &savelw);
+					}
+					break;
+				case LW_BANDWIDTH_OPT:
+					if (value == NULL || atoi(value) < 0)
+						throw OFSException("lwbandwidth needs a number of KiB/s", 1, true);
+					env.lwbandwidth = atoi(value);
+					break;
+				case LW_EXPIRE_OPT:
+					if (value == NULL || atoi(value) < 1)
+						throw OFSException("lwexpire needs a positive number of seconds", 1, true);
+					env.lwexpire = atoi(value);
+					break;
+				case LW_IDLE_OPT:
+					if (value == NULL || atoi(value) < 0)
+						throw OFSException("lwidle needs a number of seconds", 1, true);
+					env.lwidle = atoi(value);
+					break;
+				case LW_DIRTY_BYTES_OPT:
+					if (value == NULL || atoi(value) < 1)
+						throw OFSException("lwdirtybytes needs a positive number of KiB", 1, true);
+					env.lwdirtybytes = atoi(value);
+					break;
+				case LW_DIRTY_ENTRIES_OPT:
+					if (value == NULL || atoi(value) < 1)
+						throw OFSException("lwdirtyentries needs a positive number", 1, true);
+					env.lwdirtyentries = atoi(value);
+					break;
+				case LOG_LEVEL_OPT:
+					if (value == NULL || atoi(value) < LOG_EMERG || atoi(value) > LOG_DEBUG)
+						throw OFSException("loglevel needs a syslog level from 0 to 7", 1, true);
+					// overrides ofs.conf, which ofslog::init() has read
+					ofslog::setLevel(atoi(value));
+					break;
 				default: // unknown option (ignore)
 					// FIXME: deal with unknown options
 					break;
@@ -156,13 +156,100 @@ public:
     /**
      * Return which Syncmodus is selected
      */
+
+    /**
+     * Get the number of files that are reintegrated concurrently
+     * @return number of reintegration threads
+     */
+    inline int getSyncThreads() { return syncthreads; };
+    /**
+     * Should the content of offline files be stored deduplicated
+     * in the chunk store?
+     * @return dedup flag
+     */
+    inline bool isDedup() { return dedup; };
+    /**
+     * Get the number of seconds file attributes are cached
+     * @return attribute cache timeout, 0 if disabled
+     */
+    inline int getAttrCacheTimeout() { return attrcache; };
+    /**
+     * Get the number of threads that update the cache of a backing tree
+     * @return number of cache update threads
+     */
+    inline int getCacheThreads() { return cachethreads; };
+    /**
+     * Should cache updates skip directories that have not changed
+     * since the last update?
+     * @return manifest flag
+     */
+    inline bool isManifest() { return manifest; };
+    /**
+     * Should cache updates only create placeholders for files and
+     * fetch their content on first open or in the background?
+     * @return lazy pin flag
+     */
+    inline bool isLazyPin() { return lazypin; };
+    /**
+     * Should large files be fetched in blocks when they are read
+     * instead of being copied when they are opened?
+     * @return block fetch flag
+     */
+    inline bool isBlockFetch() { return blockfetch; };
+    /**
+     * Get the most KiB read ahead of sequential reads from the remote
+     * file system, 0 if read-ahead is disabled
+     * @return read-ahead window
+     */
+    inline int getReadAhead() { return readahead; };
+    /**
+     * Should the file system be served through the low-level FUSE API?
+     * @return low-level flag
+     */
+    inline bool isLowLevel() { return lowlevel; };
+    /**
+     * Get the network interfaces whose traffic lazy write watches
+     * @return interface names, empty for all but the loopback device
+     */
+    inline list<string> getLazywriteDevices() { return lwdevices; };
+    /**
+     * Get the capacity of the link to the remote file system in KiB/s
+     * the writeback of lazy write is paced by
+     * @return capacity, 0 if it is estimated from the traffic
+     */
+    inline int getLazywriteBandwidth() { return lwbandwidth; };
+    /**
+     * Get the number of seconds after which changes are written back
+     * by lazy write
+     * @return maximum age of a change
+     */
+    inline int getLazywriteExpire() { return lwexpire; };
+    /**
+     * Get the number of seconds without file system operations after
+     * which lazy write writes changes back
+     * @return idle time, 0 if idleness does not start the write-back
+     */
+    inline int getLazywriteIdle() { return lwidle; };
+    /**
+     * Get the KiB written to the cache only that start the write-back
+     * of lazy write at once
+     * @return dirty KiB threshold
+     */
+    inline int getLazywriteDirtyBytes() { return lwdirtybytes; };
+    /**
+     * Get the number of pending sync log entries that start the
+     * write-back of lazy write at once
+     * @return dirty entry threshold
+     */
+    inline int getLazywriteDirtyEntries() { return lwdirtyentries; };
     static string getUsageString(string executable="ofs");
 protected:
     OFSEnvironment();
 private:
     static std::auto_ptr<OFSEnvironment> theOFSEnvironmentInstance;
-    static Mutex m;
     static Mutex initm;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
     string remotePath;
     string cachePath;
     string mountPoint;
@@ -176,6 +263,21 @@ private:
     bool usefscache;
     bool lazywrite;
     int lwoption;  //c=CPU n=Network t=Timer
+    int syncthreads;
+    bool dedup;
+    int attrcache;
+    int cachethreads;
+    bool manifest;
+    bool lazypin;
+    bool blockfetch;
+    int readahead;
+    bool lowlevel;
+    list<string> lwdevices;
+    int lwbandwidth;
+    int lwexpire;
+    int lwidle;
+    int lwdirtybytes;
+    int lwdirtyentries;
     string ofsdir;
     uid_t uid;
     gid_t gid;
@@ -22,7 +22,7 @@
 
 OFSException::OFSException(string message, int posixerrno,bool syslogentry)
 {
-	if(syslogentry) ofslog::error(message.c_str());
+	if(syslogentry) ofslog::error("%s", message.c_str());
 	this->message = message;
 	this->posixerrno = posixerrno;
 }
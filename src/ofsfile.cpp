@@ -23,6 +23,11 @@
 
 #include "ofsfile.h"
 #include "synclogger.h"
+#include "filecopy.h"
+#include "dirtyextentmanager.h"
+#include "chunkstore.h"
+#include "attrcache.h"
+#include "placeholdermanager.h"
 #include "filestatusmanager.h"
 #include "filesystemstatusmanager.h"
 #include "backingtreemanager.h"
@@ -30,6 +35,7 @@
 #include "ofsenvironment.h"
 #include "synchronizationmanager.h"
 #include "conflictmanager.h"
+#include "ofsstats.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -39,7 +45,9 @@
 #include <sstream>
 #include <utime.h>
 #include <cstring>
+#include <algorithm>
 #include <sys/types.h>
+#include <fcntl.h>
 #ifdef HAVE_SYS_XATTR_H
 #include <sys/xattr.h>
 #endif
@@ -47,19 +55,73 @@
 #include <attr/xattr.h>
 #endif
 
-OFSFile::OFSFile ( const string path ) : dh_cache ( NULL ), dh_remote ( NULL ),
-		fd_cache ( 0 ), fd_remote ( 0 ),
-		fileinfo ( Filestatusmanager::Instance().give_me_file ( path.c_str() ) )
+OFSFile::OFSFile ( const string path ) :
+		fileinfo ( Filestatusmanager::Instance().give_me_file ( path ) ),
+		dh_cache ( NULL ), dh_remote ( NULL ),
+		fd_cache ( 0 ), fd_remote ( 0 ), dirty ( false ), materialized ( false ),
+		partial ( false ), next_read ( 0 ), sequential ( 0 ), readahead ( NULL )
 {}
 
-OFSFile::OFSFile ( const char *path ) : dh_cache ( NULL ), dh_remote ( NULL ),
-		fd_cache ( 0 ), fd_remote ( 0 ),
-		fileinfo ( Filestatusmanager::Instance().give_me_file ( path ) )
+OFSFile::OFSFile ( const char *path ) :
+		fileinfo ( Filestatusmanager::Instance().give_me_file ( path ) ),
+		dh_cache ( NULL ), dh_remote ( NULL ),
+		fd_cache ( 0 ), fd_remote ( 0 ), dirty ( false ), materialized ( false ),
+		partial ( false ), next_read ( 0 ), sequential ( 0 ), readahead ( NULL )
+{}
+
+OFSFile::OFSFile ( const File& file ) :
+		fileinfo ( file ),
+		dh_cache ( NULL ), dh_remote ( NULL ),
+		fd_cache ( 0 ), fd_remote ( 0 ), dirty ( false ), materialized ( false ),
+		partial ( false ), next_read ( 0 ), sequential ( 0 ), readahead ( NULL )
 {}
 
 
 OFSFile::~OFSFile()
 {
+	delete readahead;
+}
+
+/**
+ * Decide an access() call from cached attributes, the way the kernel
+ * would decide it for the daemon's credentials
+ *
+ * Write access is never decided here (the file system might be mounted
+ * read-only), neither is anything depending on supplementary groups.
+ * @param st attributes of the file
+ * @param mask access mode as passed to access()
+ * @return 0 if permitted, -EACCES if not, 1 if undecided
+ */
+static int access_from_attributes ( const struct stat *st, int mask )
+{
+	if ( mask & W_OK )
+		return 1;
+	if ( mask == F_OK )
+		return 0;
+	mode_t wanted = 0;
+	if ( mask & R_OK )
+		wanted |= S_IROTH;
+	if ( mask & X_OK )
+		wanted |= S_IXOTH;
+	uid_t uid = geteuid();
+	if ( uid == 0 )
+	{
+		// root may execute if anybody may, and read everything
+		if ( ( mask & X_OK ) && !S_ISDIR ( st->st_mode )
+		     && !( st->st_mode & ( S_IXUSR | S_IXGRP | S_IXOTH ) ) )
+			return -EACCES;
+		return 0;
+	}
+	if ( st->st_uid == uid )
+		return ( ( st->st_mode >> 6 ) & wanted ) == wanted ? 0 : -EACCES;
+	if ( st->st_gid == getegid() )
+		return ( ( st->st_mode >> 3 ) & wanted ) == wanted ? 0 : -EACCES;
+	// everybody else, but the group bits apply instead if one of the
+	// supplementary groups matches
+	if ( ( st->st_mode & wanted ) == wanted
+	     && ( ( st->st_mode >> 3 ) & wanted ) == wanted )
+		return 0;
+	return 1;
 }
 
 /**
@@ -76,8 +138,15 @@ OFSFile::~OFSFile()
 int OFSFile::op_access ( int mask )
 {
 	int res;
+	struct stat st;
+	if ( AttrCache::Instance().lookup ( get_relative_path(), &st ) )
+	{
+		res = access_from_attributes ( &st, mask );
+		if ( res <= 0 )
+			return res;
+	}
 	if ( get_availability() && filesync())
-		res = access ( get_remote_path().c_str(), mask );
+		res = OFSStats::remote ( access ( get_remote_path().c_str(), mask ) );
 	else
 		res = access ( get_cache_path().c_str(), mask );
 	if ( res == -1 )
@@ -93,6 +162,7 @@ int OFSFile::op_access ( int mask )
  */
 int OFSFile::op_chmod ( mode_t mode )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int res;
 	try
 	{
@@ -103,7 +173,7 @@ int OFSFile::op_chmod ( mode_t mode )
 			FilesystemStatusManager::Instance().setsync(false);
 		}
 		else
-			res = chmod ( get_remote_path().c_str(), mode );
+			res = OFSStats::remote ( chmod ( get_remote_path().c_str(), mode ) );
 		if ( res == -1 )return -errno;
 
 	}
@@ -127,17 +197,27 @@ int OFSFile::op_chmod ( mode_t mode )
 int OFSFile::op_getattr ( struct stat *stbuf )
 {
 	int res;
+	AttrCache &attrcache = AttrCache::Instance();
+	if ( attrcache.lookup ( get_relative_path(), stbuf ) )
+	{
+		OFSStats::count ( OFSStats::GETATTR_ATTRCACHE );
+		return 0;
+	}
+	unsigned long generation = attrcache.getGeneration();
 
 	if ( get_availability() && filesync() )
 	{
-		res = lstat ( get_remote_path().c_str(), stbuf );
+		OFSStats::count ( OFSStats::GETATTR_REMOTE );
+		res = OFSStats::remote ( lstat ( get_remote_path().c_str(), stbuf ) );
 	}
 	else
 	{
+		OFSStats::count ( OFSStats::GETATTR_CACHE );
 		res = lstat ( get_cache_path().c_str(), stbuf );
 	}
 	if ( res == -1 )
 		return -errno;
+	attrcache.insert ( get_relative_path(), stbuf, generation );
 	return 0;
 }
 
@@ -166,7 +246,7 @@ int OFSFile::op_readlink ( char *buf, size_t size )
 		update_cache();
 
 		if ( get_availability() && filesync())
-			res = readlink ( get_remote_path().c_str(), buf, size - 1 );
+			res = OFSStats::remote ( readlink ( get_remote_path().c_str(), buf, size - 1 ) );
 		else
 			res = readlink ( get_cache_path().c_str(), buf, size - 1 );
 		if ( res == -1 )
@@ -194,6 +274,7 @@ int OFSFile::op_readlink ( char *buf, size_t size )
  */
 int OFSFile::op_chown ( uid_t uid, gid_t gid )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int res = 0;
 	try
 	{
@@ -204,7 +285,7 @@ int OFSFile::op_chown ( uid_t uid, gid_t gid )
 			FilesystemStatusManager::Instance().setsync(false);
 		}
 		else
-			res = lchown ( get_remote_path().c_str(), uid, gid );
+			res = OFSStats::remote ( lchown ( get_remote_path().c_str(), uid, gid ) );
 		if ( res == -1 )
 			res = -errno;
 
@@ -229,6 +310,7 @@ int OFSFile::op_chown ( uid_t uid, gid_t gid )
  */
 int OFSFile::op_create ( mode_t mode )
 {
+    AttrCacheInvalidator invalidator ( get_relative_path(), true );
     int fdr=0, fdc=0, nRet = 0;
     try
     {
@@ -245,6 +327,7 @@ int OFSFile::op_create ( mode_t mode )
 				"File error: Could not create file on cache.", -errno );
                 nRet =-errno;
             } else {
+                PlaceholderManager::Instance().remove ( get_relative_path() );
                 SyncLogger::Instance().AddEntry ( OFSEnvironment::Instance().getShareID().c_str(),
                     get_relative_path().c_str(), 'c' );
                 FilesystemStatusManager::Instance().setsync(false);
@@ -253,7 +336,7 @@ int OFSFile::op_create ( mode_t mode )
         }
 	else
         {
-            fdr = creat ( get_remote_path().c_str(), mode );
+            fdr = OFSStats::remote ( creat ( get_remote_path().c_str(), mode ) );
             if ( fdr == -1 )
             {
                 close ( fdc );
@@ -291,7 +374,7 @@ int OFSFile::op_fgetattr ( struct stat *stbuf )
 {
 	int res;
 	if ( get_availability() && filesync())
-		res = fstat ( fd_remote, stbuf );
+		res = OFSStats::remote ( fstat ( fd_remote, stbuf ) );
 	else
 		res = fstat ( fd_cache, stbuf );
 	if ( res == -1 )
@@ -337,18 +420,18 @@ int OFSFile::op_flush()
  */
 int OFSFile::op_fsync ( int isdatasync )
 {
-	/*	int res;
-	#ifndef HAVE_FDATASYNC
-		(void) isdatasync;
-	#else
-		if (isdatasync)
-			res = fdatasync(fd_cache);
+	int res = 0;
+	int fd = fd_cache ? fd_cache : fd_remote;
+	if ( fd )
+	{
+		if ( isdatasync )
+			res = fdatasync ( fd );
 		else
-	#endif
-			res = fsync(fd_cache);
-		if (res == -1)
-			return -errno;
-		return 0;*/
+			res = fsync ( fd );
+	}
+	if ( res == -1 )
+		return -errno;
+	finalize_dirty();
 	return 0;
 }
 
@@ -359,6 +442,7 @@ int OFSFile::op_fsync ( int isdatasync )
  */
 int OFSFile::op_mkdir ( mode_t mode )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
 	int res;
 	try
 	{
@@ -381,7 +465,7 @@ int OFSFile::op_mkdir ( mode_t mode )
 		}
 		else
 		{
-			res = mkdir ( get_remote_path().c_str(), mode );
+			res = OFSStats::remote ( mkdir ( get_remote_path().c_str(), mode ) );
 			if ( res == -1 )
 		{
 				// Sends a signal: Couldn't create folder on remote share.
@@ -411,6 +495,7 @@ int OFSFile::op_mkdir ( mode_t mode )
  */
 int OFSFile::op_mknod ( mode_t mode, dev_t rdev )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
 	int res;
 	try
 	{
@@ -483,6 +568,19 @@ int OFSFile::op_open ( int flags )
 	{
 		update_cache();
 
+		// the content of a placeholder has not been fetched (completely)
+		if ( get_offline_state() && PlaceholderManager::Instance().isPlaceholder ( get_relative_path() ) )
+		{
+			if ( flags & O_TRUNC )
+				PlaceholderManager::Instance().remove ( get_relative_path() );
+			else if ( ( flags & O_ACCMODE ) != O_RDONLY )
+			{
+				if ( !fetch_content() )
+					return -EIO;
+			}
+			else
+				partial = true;
+		}
 		if ( get_offline_state() )
 		{
 			fdc = open ( get_cache_path().c_str(), flags );
@@ -491,15 +589,40 @@ int OFSFile::op_open ( int flags )
 		}
 		if ( get_availability() && filesync())
 		{
-			fdr = open ( get_remote_path().c_str(), flags );
+			fdr = OFSStats::remote ( open ( get_remote_path().c_str(), flags ) );
 			if ( fdr == -1 )
 			{
 				close ( fdc );
 				return -errno;
 			}
 		}
+		// (with O_TRUNC the content is gone anyway and mark_dirty drops the chunks)
+		if ( fdc && !( flags & O_TRUNC ) && OFSEnvironment::Instance().isDedup() )
+		{
+			try
+			{
+				ChunkStore::Instance().materialize ( get_relative_path(), get_cache_path() );
+			}
+			catch ( OFSException &e )
+			{
+				close ( fdc );
+				if ( fdr )
+					close ( fdr );
+				throw;
+			}
+			materialized = true;
+		}
 		fd_remote = fdr;
 		fd_cache = fdc;
+		if ( fdr && OFSEnvironment::Instance().getReadAhead() > 0 )
+			readahead = new ReadAhead ( fdr, OFSEnvironment::Instance().getReadAhead() * 1024 );
+		// the cache has been emptied by open, the remote by reintegration
+		if ( fdc && ( flags & O_TRUNC ) )
+		{
+			AttrCache::Instance().invalidate ( get_relative_path() );
+			mark_dirty();
+			DirtyExtentManager::Instance().truncate ( get_relative_path(), 0 );
+		}
 
 		return 0;
 	}
@@ -520,9 +643,9 @@ int OFSFile::op_opendir()
 	try
 	{
 		update_cache();
-		if ( get_availability() && filesync())
+		if ( get_availability() && subtreesync())
 		{
-			dh_remote = opendir ( get_remote_path().c_str() );
+			dh_remote = OFSStats::remote ( opendir ( get_remote_path().c_str() ) );
 			if ( dh_remote == NULL )
 				return -errno;
 		}
@@ -561,10 +684,22 @@ int OFSFile::op_opendir()
 int OFSFile::op_read ( char *buf, size_t size, off_t offset )
 {
 	int res=0;
-	if ( fd_remote && SynchronizationManager::Instance().has_been_modified ( fileinfo ) == not_changed )
-		res = pread ( fd_remote, buf, size, offset );
+	if ( partial )
+	{
+		OFSStats::count ( OFSStats::READ_PARTIAL );
+		return read_partial ( buf, size, offset );
+	}
+	// once written through this handle, the cache holds the current content
+	if ( fd_remote && !dirty && SynchronizationManager::Instance().has_been_modified ( fileinfo ) == not_changed )
+	{
+		OFSStats::count ( OFSStats::READ_REMOTE );
+		res = readahead ? readahead->read ( buf, size, offset ) : OFSStats::remote ( pread ( fd_remote, buf, size, offset ) );
+	}
 	else
+	{
+		OFSStats::count ( OFSStats::READ_CACHE );
 		res = pread ( fd_cache, buf, size, offset );
+	}
 	if ( res == -1 )
 		res = -errno;
 	return res;
@@ -598,7 +733,7 @@ int OFSFile::op_readdir ( void *buf, fuse_fill_dir_t filler, off_t offset )
 	bool cache;
 	long loc;
 
-	if ( dh_remote && filesync())
+	if ( dh_remote )
 		cache = false;
 	else if ( dh_cache )
 		cache = true;
@@ -608,6 +743,16 @@ int OFSFile::op_readdir ( void *buf, fuse_fill_dir_t filler, off_t offset )
 		return -errno;
 	}
 
+	// the remote file system has usually fetched the attributes of all
+	// entries while listing the directory, so the attribute cache can be
+	// filled without further round trips
+	AttrCache &attrcache = AttrCache::Instance();
+	bool fill = attrcache.isEnabled();
+	unsigned long generation = fill ? attrcache.getGeneration() : 0;
+	string prefix = get_relative_path();
+	if ( prefix != "/" )
+		prefix += "/";
+
 	struct dirent *de;
 	if ( cache )
 	{
@@ -617,7 +762,7 @@ int OFSFile::op_readdir ( void *buf, fuse_fill_dir_t filler, off_t offset )
 	else
 	{
 		seekdir ( dh_remote, offset );
-		de = readdir ( dh_remote );
+		de = OFSStats::remote ( readdir ( dh_remote ) );
 	}
 	while ( de != NULL )
 	{
@@ -629,16 +774,40 @@ int OFSFile::op_readdir ( void *buf, fuse_fill_dir_t filler, off_t offset )
 			loc = telldir ( dh_cache );
 		else
 			loc = telldir ( dh_remote );
+		if ( fill && strcmp ( de->d_name, "." ) && strcmp ( de->d_name, ".." ) )
+			fill_attrcache ( cache ? dh_cache : dh_remote, !cache,
+			                 prefix + de->d_name, de->d_name, generation );
 		if ( filler ( buf, de->d_name, &st, loc ) )
 			break;
 		if ( cache )
 			de = readdir ( dh_cache );
 		else
-			de = readdir ( dh_remote );
+			de = OFSStats::remote ( readdir ( dh_remote ) );
 	}
 	return 0;
 }
 
+/**
+ * Store the attributes of a directory entry in the attribute cache, if
+ * op_getattr would read them from the same tree
+ * @param dh directory being listed
+ * @param remote the directory is the remote one
+ * @param path path of the entry relative to the share root
+ * @param name name of the entry
+ * @param generation attribute cache generation from before the listing
+ */
+void OFSFile::fill_attrcache ( DIR *dh, bool remote, const string& path,
+                               const char *name, unsigned long generation )
+{
+	bool getattr_remote = get_availability() && !SyncLogger::Instance().IsDirty (
+		OFSEnvironment::Instance().getShareID().c_str(), path );
+	if ( getattr_remote != remote )
+		return;
+	struct stat st;
+	if ( fstatat ( dirfd ( dh ), name, &st, AT_SYMLINK_NOFOLLOW ) == 0 )
+		AttrCache::Instance().insert ( path, &st, generation );
+}
+
 /**
  * Release an open file
  *
@@ -660,8 +829,11 @@ int OFSFile::op_release()
 		errno = EBADF;
 		return -errno;
 	}
+	// stops reading ahead before the file is closed
+	delete readahead;
+	readahead = NULL;
 	if ( fd_remote )
-		if ( close ( fd_remote ) < 0 )
+		if ( OFSStats::remote ( close ( fd_remote ) ) < 0 )
 			return -errno;
 	if ( fd_cache )
 		if ( close ( fd_cache ) < 0 )
@@ -669,6 +841,13 @@ int OFSFile::op_release()
 
 	fd_remote = 0;
 	fd_cache = 0;
+	finalize_dirty();
+	if ( dirty )
+		DirtyExtentManager::Instance().close ( get_relative_path() );
+	dirty = false;
+	if ( materialized )
+		ChunkStore::Instance().release ( get_relative_path() );
+	materialized = false;
 	update_amtime();
 
 	return 0;
@@ -686,7 +865,7 @@ int OFSFile::op_releasedir()
 		return -errno;
 	}
 	if ( dh_remote )
-		if ( closedir ( dh_remote ) )
+		if ( OFSStats::remote ( closedir ( dh_remote ) ) )
 			return -errno;
 	if ( dh_cache )
 		if ( closedir ( dh_cache ) )
@@ -702,6 +881,7 @@ int OFSFile::op_releasedir()
  */
 int OFSFile::op_rmdir()
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
 	int res, nRet = 0;
 	try
 	{
@@ -724,7 +904,7 @@ int OFSFile::op_rmdir()
 		}
 		else
 		{
-			res = rmdir ( get_remote_path().c_str() );
+			res = OFSStats::remote ( rmdir ( get_remote_path().c_str() ) );
 			if ( res == -1 )
 		{
 				nRet = -errno;
@@ -756,7 +936,7 @@ int OFSFile::op_statfs ( struct statvfs *stbuf )
 	if ( get_offline_state() )
 		res = statvfs ( get_cache_path().c_str(), stbuf );
 	else
-		res = statvfs ( get_remote_path().c_str(), stbuf );
+		res = OFSStats::remote ( statvfs ( get_remote_path().c_str(), stbuf ) );
 	if ( res == -1 )
 		return -errno;
 	return 0;
@@ -770,6 +950,7 @@ int OFSFile::op_statfs ( struct statvfs *stbuf )
  */
 int OFSFile::op_truncate ( off_t size )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int res;
 	try
 	{
@@ -777,13 +958,35 @@ int OFSFile::op_truncate ( off_t size )
 
 		if ( get_offline_state() )
 		{
+			// without its content a placeholder can only be emptied
+			bool placeholder = PlaceholderManager::Instance().isPlaceholder ( get_relative_path() );
+			if ( placeholder && size > 0 && !fetch_content() )
+				return -EIO;
+			if ( !get_availability() )
+				savemtime();
+			DirtyExtentManager::Instance().open ( get_relative_path(),
+				!SyncLogger::Instance().IsDirty ( OFSEnvironment::Instance().getShareID().c_str(), get_relative_path() ) );
+			if ( OFSEnvironment::Instance().isDedup() )
+			{
+				ChunkStore::Instance().materialize ( get_relative_path(), get_cache_path() );
+				ChunkStore::Instance().forget ( get_relative_path() );
+			}
 			res = truncate ( get_cache_path().c_str(), size );
+			if ( res == 0 && placeholder )
+				PlaceholderManager::Instance().remove ( get_relative_path() );
+			if ( res == 0 )
+			{
+				DirtyExtentManager::Instance().truncate ( get_relative_path(), size );
+				SyncLogger::Instance().AddEntry ( OFSEnvironment::Instance().getShareID().c_str(), get_relative_path().c_str(), 'm' );
+			}
+			DirtyExtentManager::Instance().close ( get_relative_path() );
 			if ( res == -1 )
 				return -errno;
+			FilesystemStatusManager::Instance().setsync(false);
 		}
 		else
 		{
-			res = truncate ( get_remote_path().c_str(), size );
+			res = OFSStats::remote ( truncate ( get_remote_path().c_str(), size ) );
 			if ( res == -1 )
 				return -errno;
 		}
@@ -804,6 +1007,7 @@ int OFSFile::op_truncate ( off_t size )
  */
 int OFSFile::op_ftruncate ( off_t size )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int res;
 
 	if ( !fd_remote && !fd_cache )
@@ -812,16 +1016,28 @@ int OFSFile::op_ftruncate ( off_t size )
 		return -errno;
 	}
 
-	if ( fd_remote )
+	if ( readahead )
+		readahead->invalidate();
+	if ( fd_remote && !(get_offline_state()) )
 	{
-		res = ftruncate ( fd_remote, size );
+		res = OFSStats::remote ( ftruncate ( fd_remote, size ) );
+		if ( res == -1 )
+			return -errno;
 	}
-	else
+	if ( fd_cache )
 	{
+		if ( !dirty && get_offline_state() && !get_availability() )
+			savemtime();
 		res = ftruncate ( fd_cache, size );
-	}
 		if ( res == -1 )
 			return -errno;
+		// the remote is changed by reintegration
+		if ( get_offline_state() )
+		{
+			mark_dirty();
+			DirtyExtentManager::Instance().truncate ( get_relative_path(), size );
+		}
+	}
 	return 0;
 }
 
@@ -831,6 +1047,7 @@ int OFSFile::op_ftruncate ( off_t size )
  */
 int OFSFile::op_unlink()
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
 	int res, nRet = 0;
 	try
 	{
@@ -842,6 +1059,10 @@ int OFSFile::op_unlink()
 		if (get_offline_state() )
 			{
 			res = unlink ( get_cache_path().c_str() );
+			if ( res == 0 )
+				PlaceholderManager::Instance().remove ( get_relative_path() );
+			if ( res == 0 && OFSEnvironment::Instance().isDedup() )
+				ChunkStore::Instance().forget ( get_relative_path() );
 			if ( res == -1 )
 			{
 				// Sends a signal: Couldn't delete file from cache.
@@ -854,7 +1075,7 @@ int OFSFile::op_unlink()
 		}
 		else
 		{
-			res = unlink ( get_remote_path().c_str() );
+			res = OFSStats::remote ( unlink ( get_remote_path().c_str() ) );
 			if ( res == -1 )
 		{
 				nRet = -errno;
@@ -884,6 +1105,7 @@ int OFSFile::op_unlink()
  */
 int OFSFile::op_utimens ( const struct timespec ts[2] )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int result_offline = 0;
 	int result_available = 0;
 
@@ -910,7 +1132,7 @@ int OFSFile::op_utimens ( const struct timespec ts[2] )
 		}
 		if (get_availability())
 		{
-			result_available = utimes ( get_remote_path().c_str(), times );
+			result_available = OFSStats::remote ( utimes ( get_remote_path().c_str(), times ) );
 		}
 		// TODO: Reconsider error handling
 			if ( result_offline == -1 && result_available == -1 )
@@ -938,12 +1160,10 @@ int OFSFile::op_utimens ( const struct timespec ts[2] )
  */
 int OFSFile::op_write ( const char *buf, size_t size, off_t offset )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path() );
 	int res;
 	int nNumberOfWrittenBytes = -1;
 
-        if ( get_offline_state() && !get_availability() )
-            savemtime();
-
 	if ( !fd_remote && !fd_cache )
 	{
 		errno = EBADF;
@@ -952,9 +1172,11 @@ int OFSFile::op_write ( const char *buf, size_t size, off_t offset )
 		  "NeitherRemoteNorCacheAvailable","File error: Could not write file due to missing network connection.",-EBADF );
 		return -errno;
 	}
+	if ( readahead )
+		readahead->invalidate();
 	if ( fd_remote && !(get_offline_state()))
 	{
-		nNumberOfWrittenBytes = res = pwrite ( fd_remote, buf, size, offset );
+		nNumberOfWrittenBytes = res = OFSStats::remote ( pwrite ( fd_remote, buf, size, offset ) );
 		if ( res == -1 )
 		{
 			res = -errno;
@@ -965,10 +1187,10 @@ int OFSFile::op_write ( const char *buf, size_t size, off_t offset )
 	}
 	if ( fd_cache )
 	{
+		// the modification time has to be saved before the cache file changes
+		if ( !dirty && get_offline_state() && !get_availability() )
+			savemtime();
 		res = pwrite ( fd_cache, buf, size, offset );
-		// Inserts a sync log entry if a file was successfully written to the cache but not or incompletely written to the remote.
-		if ( nNumberOfWrittenBytes != size - offset && res == size - offset )
-			SyncLogger::Instance().AddEntry ( OFSEnvironment::Instance().getShareID().c_str(), get_relative_path().c_str(), 'm' );
 		if ( res == -1 )
 		{
 			res = -errno;
@@ -976,6 +1198,13 @@ int OFSFile::op_write ( const char *buf, size_t size, off_t offset )
 			OFSBroadcast::Instance().SendError( "FileError", "CacheNotWritable",
 				       "File error: Could not write file to cache.",res );
 		}
+		// Inserts a sync log entry if a file was successfully written to the cache but not or incompletely written to the remote.
+		else if ( nNumberOfWrittenBytes != res )
+		{
+			mark_dirty();
+			DirtyExtentManager::Instance().add ( get_relative_path(), offset, res );
+			FilesystemStatusManager::Instance().adddirty ( res );
+		}
 	}
 	return res;
 }
@@ -990,6 +1219,7 @@ int OFSFile::op_write ( const char *buf, size_t size, off_t offset )
  */
 int OFSFile::op_symlink ( const char* from )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
 	int res;
 
 	if ( get_offline_state() )
@@ -998,7 +1228,7 @@ int OFSFile::op_symlink ( const char* from )
 	}
 	else
 	{
-		res = symlink ( from, get_remote_path().c_str() );
+		res = OFSStats::remote ( symlink ( from, get_remote_path().c_str() ) );
 	}
 		if ( res == -1 )
 			return -errno;
@@ -1013,6 +1243,8 @@ int OFSFile::op_symlink ( const char* from )
  */
 int OFSFile::op_rename ( OFSFile *to )
 {
+	AttrCacheInvalidator invalidator ( get_relative_path(), true );
+	AttrCacheInvalidator invalidator_to ( to->get_relative_path(), true );
 	int res, nRet = 0;
 	try
 	{
@@ -1024,6 +1256,10 @@ int OFSFile::op_rename ( OFSFile *to )
 		if ( get_offline_state() )
 		{
 			res = rename ( get_cache_path().c_str(),to->get_cache_path().c_str() );
+			if ( res == 0 )
+				PlaceholderManager::Instance().rename ( get_relative_path(), to->get_relative_path() );
+			if ( res == 0 && OFSEnvironment::Instance().isDedup() )
+				ChunkStore::Instance().rename ( get_relative_path(), to->get_relative_path() );
 			if ( res == -1 )
 			{
 				// Sends a signal: Couldn't rename file on cache.
@@ -1041,8 +1277,8 @@ int OFSFile::op_rename ( OFSFile *to )
 		}
 		else
 		{
-			res = rename ( get_remote_path().c_str(),
-			               to->get_remote_path().c_str() );
+			res = OFSStats::remote ( rename ( get_remote_path().c_str(),
+			               to->get_remote_path().c_str() ) );
 			if ( res == -1 )
 			{
 				nRet = -errno;
@@ -1070,6 +1306,9 @@ int OFSFile::op_rename ( OFSFile *to )
  */
 int OFSFile::op_link ( OFSFile *to )
 {
+	// the link count of the old name changes as well
+	AttrCacheInvalidator invalidator ( get_relative_path() );
+	AttrCacheInvalidator invalidator_to ( to->get_relative_path(), true );
 	int res, nRet = 0;
 	try
 	{
@@ -1077,6 +1316,14 @@ int OFSFile::op_link ( OFSFile *to )
 
 		if (get_offline_state() )
 		{
+			// both names share the content, which has to be real
+			if ( !fetch_content() )
+				return -EIO;
+			if ( OFSEnvironment::Instance().isDedup() )
+			{
+				ChunkStore::Instance().materialize ( get_relative_path(), get_cache_path() );
+				ChunkStore::Instance().forget ( get_relative_path() );
+			}
 			res = link ( get_cache_path().c_str(),to->get_cache_path().c_str() );
 			if ( res == -1 )
 			{
@@ -1090,7 +1337,7 @@ int OFSFile::op_link ( OFSFile *to )
 		}
 		else
 		{
-			res = link ( get_remote_path().c_str(),to->get_remote_path().c_str() );
+			res = OFSStats::remote ( link ( get_remote_path().c_str(),to->get_remote_path().c_str() ) );
 			if ( res == -1 )
 		{
 				nRet = -errno;
@@ -1117,17 +1364,22 @@ int OFSFile::op_link ( OFSFile *to )
  *  and has changed, update it
  *  TODO: attributes (ctime, atime etc.) have to be set
  *        on the cache file and all directories in path
+ *  \param lazy with the lazypin mount option, regular files only get
+ *        a placeholder whose content is fetched later. With blockfetch
+ *        large files always get a placeholder.
  *  \fn OFSFile::update_local()
  */
-void OFSFile::update_cache()
+void OFSFile::update_cache ( bool lazy )
 {
 	struct stat fileinfo_cache;
 	struct stat fileinfo_remote;
 	bool file_exists = true;
 	bool isdir = false;
+	bool placeholder = false;
+	bool outdated;
 	int ret;
 
-	ret = lstat ( get_remote_path().c_str(), &fileinfo_remote );
+	ret = OFSStats::remote ( lstat ( get_remote_path().c_str(), &fileinfo_remote ) );
 	if(ret >= 0 && S_ISDIR(fileinfo_remote.st_mode))
 	   isdir = true;
     // only update if:
@@ -1139,7 +1391,7 @@ void OFSFile::update_cache()
 	   )
 	{
 		// get info of remote file
-		ret = lstat ( get_remote_path().c_str(), &fileinfo_remote );
+		ret = OFSStats::remote ( lstat ( get_remote_path().c_str(), &fileinfo_remote ) );
 		if ( ret < 0 && errno == ENOENT )
 		{
 			errno = 0;
@@ -1173,7 +1425,14 @@ void OFSFile::update_cache()
 		// we have to copy it to the cache
 		// TODO: If the file gets opened for overwriting, we may skip copying it from
 		// the remote location
-		if ( !file_exists || fileinfo_remote.st_mtime > fileinfo_cache.st_mtime )
+		outdated = !file_exists || fileinfo_remote.st_mtime > fileinfo_cache.st_mtime;
+		// a placeholder is always older than the remote file
+		if ( file_exists && S_ISREG ( fileinfo_remote.st_mode ) )
+			placeholder = PlaceholderManager::Instance().isPlaceholder ( get_relative_path() );
+		// with blockfetch the content of a placeholder is fetched when it is read
+		if ( placeholder && ( lazy || OFSEnvironment::Instance().isBlockFetch() ) )
+			outdated = !PlaceholderManager::Instance().isCurrent ( get_relative_path(), fileinfo_remote );
+		if ( outdated )
 		{
                         ///\todo What to do if types of remote and local files are different?
 			// if this is a directory, we only create it in the cache if necessary
@@ -1182,27 +1441,41 @@ void OFSFile::update_cache()
 				if ( mkdir ( get_cache_path().c_str(),S_IRWXU ) < 0 )
 					throw OFSException ( strerror ( errno ), errno,true );
 			}
+			else if ( S_ISREG ( fileinfo_remote.st_mode )
+			          && ( ( lazy && OFSEnvironment::Instance().isLazyPin() )
+			               || ( OFSEnvironment::Instance().isBlockFetch()
+			                    && fileinfo_remote.st_size > BLOCK_FETCH_SIZE ) ) )
+			{
+				// the content is fetched on open, on read or in the background
+				if ( OFSEnvironment::Instance().isDedup() )
+					ChunkStore::Instance().forget ( get_relative_path() );
+				PlaceholderManager::Instance().create ( get_relative_path(),
+				        get_cache_path(), fileinfo_remote );
+			}
 			else if ( S_ISREG ( fileinfo_remote.st_mode ) )
 			{
-				unlink(get_cache_path().c_str());
-				int fdl = open ( get_cache_path().c_str(),
-				                 O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU );
-				if ( fdl < 0 )
-					throw OFSException ( strerror ( errno ), errno,true );
-				int fdr = open ( get_remote_path().c_str(), O_RDONLY );
-				if ( fdr < 0 )
-					throw OFSException ( strerror ( errno ), errno ,true );
-				char buf[1024];
-				ssize_t bytesread;
-				while ( ( bytesread = read ( fdr, buf, sizeof ( buf ) ) ) > 0 )
+				// another thread may be fetching the same placeholder
+				if ( placeholder && !PlaceholderManager::Instance().beginFetch ( get_relative_path() ) )
+					return;
+				try
 				{
-					if ( write ( fdl, buf, bytesread ) < 0 )
-						throw OFSException ( strerror ( errno ), errno,true );
+					if ( !OFSEnvironment::Instance().isDedup()
+					     || !ChunkStore::Instance().import ( get_relative_path(),
+					            get_remote_path(), get_cache_path() ) )
+					{
+						unlink(get_cache_path().c_str());
+						OFSStats::count ( OFSStats::CACHE_BYTES,
+						        FileCopy::copy ( get_remote_path(), get_cache_path(), S_IRWXU ) );
+					}
 				}
-				if ( bytesread < 0 )
-					throw new OFSException ( strerror ( errno ), errno ,true );
-				close ( fdr );
-				close ( fdl );
+				catch ( OFSException &e )
+				{
+					if ( placeholder )
+						PlaceholderManager::Instance().endFetch ( get_relative_path(), false );
+					throw;
+				}
+				if ( placeholder )
+					PlaceholderManager::Instance().endFetch ( get_relative_path(), true );
 			}
 			else if ( S_ISLNK ( fileinfo_remote.st_mode ) )
 			{
@@ -1212,7 +1485,7 @@ void OFSFile::update_cache()
 				unlink ( get_cache_path().c_str() );
 				errno = 0;
 				// create the new link
-				len = readlink ( get_remote_path().c_str(), buf, sizeof ( buf )-1 );
+				len = OFSStats::remote ( readlink ( get_remote_path().c_str(), buf, sizeof ( buf )-1 ) );
 				if ( len < 0 )
 					throw OFSException ( strerror ( errno ), errno ,true);
 				buf[len] = '\0';
@@ -1227,6 +1500,56 @@ void OFSFile::update_cache()
 }
 
 
+/**
+ * Fetch the missing content of a placeholder, it is about to be changed
+ * or shared
+ * @return false if the remote file system is not available
+ */
+bool OFSFile::fetch_content()
+{
+	if ( !PlaceholderManager::Instance().isPlaceholder ( get_relative_path() ) )
+		return true;
+	if ( !get_availability() )
+		return false;
+	PlaceholderManager::Instance().fetchContent ( get_relative_path(),
+	        get_remote_path(), get_cache_path() );
+	return true;
+}
+
+/**
+ * Read from a cache file whose blocks are fetched on demand. Every read
+ * that continues where the last one ended doubles the number of blocks
+ * fetched ahead, up to BLOCK_FETCH_MAX_AHEAD.
+ */
+int OFSFile::read_partial ( char *buf, size_t size, off_t offset )
+{
+	PlaceholderManager &placeholders = PlaceholderManager::Instance();
+	if ( offset == next_read )
+		sequential = min ( sequential + 1, 16 );
+	else
+		sequential = 0;
+	next_read = offset + size;
+	off_t ahead = sequential > 0 ? min ( 1L << ( sequential - 1 ), ( long ) BLOCK_FETCH_MAX_AHEAD ) : 0;
+	try
+	{
+		if ( !placeholders.hasBlocks ( get_relative_path(), offset, size ) )
+		{
+			if ( !get_availability() )
+				return -EIO;
+			placeholders.fetchBlocks ( get_relative_path(), get_remote_path(), get_cache_path(),
+			        offset, size + ahead * BLOCK_FETCH_SIZE );
+		}
+	}
+	catch ( OFSException &e )
+	{
+		return -e.get_posixerrno();
+	}
+	int res = pread ( fd_cache, buf, size, offset );
+	if ( res == -1 )
+		res = -errno;
+	return res;
+}
+
 /*!
     \fn OFSFile::get_parent_directory()
 	Get the File object for the parent directory
@@ -1256,7 +1579,7 @@ void OFSFile::update_amtime()
         struct stat fileinfo_remote;
         struct utimbuf times;
 
-        if ( lstat ( get_remote_path().c_str(), &fileinfo_remote ) < 0 )
+        if ( OFSStats::remote ( lstat ( get_remote_path().c_str(), &fileinfo_remote ) ) < 0 )
 	{
 	    // it may happen that a file disappears before updating the times.
             // e.g. this happens while a file is closed which has been deleted prior to closing
@@ -1363,13 +1686,34 @@ int OFSFile::op_getxattr ( const char *name, char *value,
 			}
 		}
         }
+	else if ( strcmp ( name, OFS_ATTRIBUTE_STATS ) == 0
+	          && get_relative_path() == "/" )
+	{
+		string stats = OFSStats::format();
+		if ( size == 0 )
+		{
+			// operations seen for the first time add lines until the
+			// value is read
+			res = stats.size() + OFS_STATS_XATTR_SLACK;
+		}
+		else if ( size < stats.size() )
+		{
+			res = -1;
+			errno = ERANGE;
+		}
+		else
+		{
+			res = stats.size();
+			memcpy ( value, stats.data(), res );
+		}
+	}
 	else   // TODO: By now this is only for remote files
 	{
 #ifdef XATTR_ADD_OPT
-	  res = getxattr(get_remote_path().c_str(), name, value, size, position, XATTR_NOFOLLOW);
+	  res = OFSStats::remote ( getxattr(get_remote_path().c_str(), name, value, size, position, XATTR_NOFOLLOW) );
 #else
-		res = lgetxattr ( get_remote_path().c_str(),
-		                  name, value, size );
+		res = OFSStats::remote ( lgetxattr ( get_remote_path().c_str(),
+		                  name, value, size ) );
 #endif
 		// do not return "unsupported" but "unknown attribute"
 		if ( errno == ENOTSUP )
@@ -1446,15 +1790,22 @@ int OFSFile::op_setxattr ( const char *name, const char *value, size_t size, int
                 errno = EACCES;
             }
 	}
+	else if ( strcmp ( name, OFS_ATTRIBUTE_STATS ) == 0
+	          && get_relative_path() == "/" )
+	{
+		// readonly -> error
+		res = -1;
+		errno = EACCES;
+	}
 	else   // other attribute - delegate to underlying filesystem
 	{
 #ifdef XATTR_ADD_OPT
-		res = setxattr ( get_remote_path().c_str(), name,
-				 value, size, position, flags | XATTR_NOFOLLOW );
+		res = OFSStats::remote ( setxattr ( get_remote_path().c_str(), name,
+				 value, size, position, flags | XATTR_NOFOLLOW ) );
 		// TODO: check if XATTR_NOFOLLOW is set by default!
 #else
-		res = lsetxattr ( get_remote_path().c_str(), name,
-		                  value, size, flags );
+		res = OFSStats::remote ( lsetxattr ( get_remote_path().c_str(), name,
+		                  value, size, flags ) );
 #endif
 	}
 	if ( res == -1 )
@@ -1473,9 +1824,9 @@ int OFSFile::op_listxattr ( char *list, size_t size )
 	// This of course fails for most ofs attributes
 	// not listing them makes them invisible for the application
 #ifdef XATTR_ADD_OPT
-  return listxattr ( get_remote_path().c_str(), list, size, XATTR_NOFOLLOW );
+  return OFSStats::remote ( listxattr ( get_remote_path().c_str(), list, size, XATTR_NOFOLLOW ) );
 #else
- 	return llistxattr ( get_remote_path().c_str(), list, 0 ); // works
+ 	return OFSStats::remote ( llistxattr ( get_remote_path().c_str(), list, 0 ) ); // works
 #endif
 
 /*	int res = 0;
@@ -1551,12 +1902,19 @@ int OFSFile::op_removexattr ( const char *name )
 		res = -1;
 	 	errno = EACCES;
         }
+	else if ( strcmp ( name, OFS_ATTRIBUTE_STATS ) == 0
+	          && get_relative_path() == "/" )
+	{
+		// readonly -> error
+		res = -1;
+		errno = EACCES;
+	}
 	else
 	{
 #ifdef XATTR_ADD_OPT
-	  res = removexattr ( get_remote_path().c_str(), name, XATTR_NOFOLLOW );
+	  res = OFSStats::remote ( removexattr ( get_remote_path().c_str(), name, XATTR_NOFOLLOW ) );
 #else
-	  res = lremovexattr ( get_remote_path().c_str(), name );
+	  res = OFSStats::remote ( lremovexattr ( get_remote_path().c_str(), name ) );
 #endif
 	}
 	if ( res == -1 )
@@ -1565,6 +1923,43 @@ int OFSFile::op_removexattr ( const char *name )
 }
 
 
+/**
+ * \brief Record the modification of this handle in the sync log.
+ *
+ * Only the first write through a handle adds a sync log entry, all
+ * further writes are covered by it until the handle is released.
+ */
+void OFSFile::mark_dirty()
+{
+	const string shareID = OFSEnvironment::Instance().getShareID();
+	// the entry may have been reintegrated while the handle is open
+	if ( dirty && SyncLogger::Instance().IsDirty ( shareID.c_str(), get_relative_path() ) )
+		return;
+	if ( !dirty )
+	{
+		DirtyExtentManager::Instance().open ( get_relative_path(),
+			!SyncLogger::Instance().IsDirty ( shareID.c_str(), get_relative_path() ) );
+		// the cache file no longer matches its chunks
+		if ( OFSEnvironment::Instance().isDedup() )
+			ChunkStore::Instance().forget ( get_relative_path() );
+	}
+	SyncLogger::Instance().AddEntry ( shareID.c_str(), get_relative_path().c_str(), 'm' );
+	dirty = true;
+}
+
+/**
+ * \brief Finish the modification recorded by mark_dirty().
+ *
+ * Called on fsync and release, tells the write-back that there is
+ * something to reintegrate.
+ */
+void OFSFile::finalize_dirty()
+{
+	if ( !dirty )
+		return;
+	FilesystemStatusManager::Instance().setsync(false);
+}
+
 /**
  * \brief Save the modification time of the local file via Synchronization manager
  */
@@ -1581,17 +1976,18 @@ void OFSFile::savemtime()
  */
 bool OFSFile::filesync()
 {
-	list<SyncLogEntry> listOfEntries = SyncLogger::Instance().GetEntries(OFSEnvironment::Instance().getShareID().c_str(),get_cache_path());
-	if(listOfEntries.size())return false;
-
+	return !SyncLogger::Instance().IsDirty(
+		OFSEnvironment::Instance().getShareID().c_str(), get_relative_path());
+}
 
-	/*for (list<SyncLogEntry>::iterator it = listOfEntries.begin();it != listOfEntries.end(); it++)
-	{
-		SyncLogEntry& sle = *it;
-		if (sle == get_cache_path())
-		{
-			return false;
-		}
-	}*/
-	return true;
+/*
+ * Check if neither the directory nor anything below it has pending
+ * modifications. Directories outside of a backing tree are always in sync.
+ */
+bool OFSFile::subtreesync()
+{
+	if ( !get_offline_state() )
+		return true;
+	return !SyncLogger::Instance().HasDirtyBelow(
+		OFSEnvironment::Instance().getShareID().c_str(), get_relative_path());
 }
@@ -22,6 +22,7 @@
 
 #include "file.h"
 #include "conflictmanager.h"
+#include "readahead.h"
 #include <string>
 #include <fusexx.hpp>
 #include <dirent.h>
@@ -32,6 +33,11 @@
 #define OFS_ATTRIBUTE_AVAILABLE "ofs.available"
 #define OFS_ATTRIBUTE_STATE "ofs.offlinestate"
 #define OFS_ATTRIBUTE_CONFLICT "ofs.conflict"
+// operation statistics, only on the mount root
+#define OFS_ATTRIBUTE_STATS "ofs.stats"
+// added to the size reported for the statistics, which grow between the
+// call asking for the size and the call reading the value
+#define OFS_STATS_XATTR_SLACK 4096
 #define OFS_ATTRIBUTE_VALUE_YES "yes"
 #define OFS_ATTRIBUTE_VALUE_NO "no"
 #define OFS_ATTRIBUTE_VALUE_CURRENT "current"
@@ -52,6 +58,7 @@ class OFSFile{
 public:
     explicit OFSFile(const string path);
     explicit OFSFile(const char *path);
+    explicit OFSFile(const File& file);
     int op_access(int mask);
     int op_getattr(struct stat *stbuf);
     int op_readlink(char *buf, size_t size);
@@ -79,7 +86,7 @@ public:
     int op_rename(OFSFile *to);
     int op_link(OFSFile *from);
     int op_symlink(const char* from);
-    void update_cache();
+    void update_cache(bool lazy = false);
     OFSFile * get_parent_directory();
     void update_amtime();
 #ifdef FUSE_XATTR_ADD_OPT
@@ -93,23 +100,44 @@ public:
     int op_setxattr(const char *name, const char *value, size_t size, int flags);
 #endif
     ~OFSFile();
-    inline string get_remote_path() { return fileinfo.get_remote_path(); }
-    inline string get_cache_path() { return fileinfo.get_cache_path(); }
+    inline const string& get_remote_path() { return fileinfo.get_remote_path(); }
+    inline const string& get_cache_path() { return fileinfo.get_cache_path(); }
     inline bool get_availability() { return fileinfo.get_availability(); }
     inline bool get_offline_state() { return fileinfo.get_offline_state(); }
-    inline string get_relative_path() { return fileinfo.get_relative_path(); }
+    inline const string& get_relative_path() { return fileinfo.get_relative_path(); }
+    inline const File& get_fileinfo() { return fileinfo; }
     inline bool isConflictPath() { return
          ConflictManager::Instance().isConflicted(get_relative_path()); };
     int op_removexattr(const char *name);
     int op_listxattr(char *list, size_t size);
     void savemtime();
     bool filesync();
+    bool subtreesync();
 private:
+    void mark_dirty();
+    void finalize_dirty();
+    void fill_attrcache(DIR *dh, bool remote, const string& path,
+                        const char *name, unsigned long generation);
+    bool fetch_content();
+    int read_partial(char *buf, size_t size, off_t offset);
     File fileinfo;
     DIR *dh_cache;
     DIR *dh_remote;
     int fd_cache;
     int fd_remote;
+    /// the cache file has been modified through this handle and the
+    /// modification is recorded in the sync log
+    bool dirty;
+    /// the cache file has been rebuilt from the chunk store for this handle
+    bool materialized;
+    /// the cache file is a placeholder, reads fetch the missing blocks
+    bool partial;
+    /// end of the last read through this handle
+    off_t next_read;
+    /// number of reads that continued where the last one ended
+    int sequential;
+    /// reads the remote file ahead, NULL if it is not read remotely
+    ReadAhead *readahead;
 };
 
 #endif
@@ -21,10 +21,98 @@
 #include <syslog.h>
 #include <cstdio>
 #include <cstdarg>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include "ofslog.h"
 #include "ofsconf.h"
 
-#define MAX_LOGENTRY_LEN        1024
+/**
+ * Messages of one thread, written by the thread and read by the drain
+ * thread without locking
+ */
+struct LogRing
+{
+    struct Entry
+    {
+        int level;
+        struct timeval time;
+        char message[MAX_LOGENTRY_LEN];
+    };
+    Entry entries[LOG_RING_SLOTS];
+    /// number of messages written, only changed by the owning thread
+    volatile unsigned long head;
+    /// number of messages read, only changed by the drain thread
+    volatile unsigned long tail;
+    /// only changed by the owning thread
+    volatile unsigned long long dropped;
+    /// the owning thread has exited
+    volatile bool orphaned;
+    LogRing *next;
+};
+
+int ofslog::mask = LOG_UPTO(LOG_DEBUG);
+volatile bool ofslog::async = false;
+
+/// file to log to instead of syslog, NULL for syslog
+static FILE *logfile = NULL;
+/// all rings, guarded by ringMutex
+static LogRing *rings = NULL;
+static pthread_mutex_t ringMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+static __thread LogRing *threadRing = NULL;
+/// messages dropped by threads that have exited
+static unsigned long long orphanDropped = 0;
+/// dropped messages that have been reported in the log
+static unsigned long long reportedDropped = 0;
+static pthread_t drainer;
+static pthread_mutex_t drainMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainWake = PTHREAD_COND_INITIALIZER;
+static bool drainRunning = false;
+/// threads that may be queueing a message, stopAsync() waits for them
+static volatile int asyncWriters = 0;
+
+/**
+ * Get the ring of the calling thread, creating it on first use
+ */
+static LogRing *
+ownRing()
+{
+    LogRing *ring = threadRing;
+    if (ring != NULL)
+        return ring;
+    ring = new LogRing;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->orphaned = false;
+    pthread_mutex_lock(&ringMutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&ringMutex);
+    pthread_setspecific(ringKey, ring);
+    threadRing = ring;
+    return ring;
+}
+
+/**
+ * The owner of a ring has exited, the drain thread deletes the ring
+ * once it is empty
+ */
+static void
+releaseRing(void *ring)
+{
+    ((LogRing *)ring)->orphaned = true;
+}
+
+static void
+createRingKey()
+{
+    pthread_key_create(&ringKey, releaseRing);
+}
 
 /*!
     \fn ofslog::init() 
@@ -36,23 +124,206 @@ ofslog::init()
     openlog("ofs", LOG_PID|LOG_CONS|LOG_NDELAY, LOG_USER);
 
     OFSConf &ofsconf = OFSConf::Instance();
-    int loglvl = ofsconf.GetLogLevel();
-    int mask = LOG_UPTO(loglvl);
-    setlogmask(mask);
+    setLevel(ofsconf.GetLogLevel());
+
+    string path = ofsconf.GetLogFile();
+    if (!path.empty()) {
+        logfile = fopen(path.c_str(), "a");
+        if (logfile == NULL)
+            initok = false;
+    }
     
     return initok;
 }
 
+/*!
+    \fn ofslog::setLevel()
+ */
+void
+ofslog::setLevel(int loglvl)
+{
+    mask = LOG_UPTO(loglvl);
+    setlogmask(mask);
+}
+
+/*!
+    \fn ofslog::startAsync()
+ */
+void
+ofslog::startAsync()
+{
+    pthread_mutex_lock(&drainMutex);
+    if (!drainRunning) {
+        pthread_once(&ringKeyOnce, createRingKey);
+        drainRunning = pthread_create(&drainer, NULL, drainThread, NULL) == 0;
+        async = drainRunning;
+    }
+    pthread_mutex_unlock(&drainMutex);
+}
+
+/*!
+    \fn ofslog::stopAsync()
+ */
+void
+ofslog::stopAsync()
+{
+    pthread_mutex_lock(&drainMutex);
+    if (!drainRunning) {
+        pthread_mutex_unlock(&drainMutex);
+        return;
+    }
+    async = false;
+    __sync_synchronize();
+    drainRunning = false;
+    pthread_cond_signal(&drainWake);
+    pthread_mutex_unlock(&drainMutex);
+    pthread_join(drainer, NULL);
+    // messages of threads that were logging while the thread stopped, new
+    // messages are written at once
+    while (asyncWriters > 0)
+        sched_yield();
+    drain();
+}
+
+unsigned long long
+ofslog::getDropped()
+{
+    pthread_mutex_lock(&ringMutex);
+    unsigned long long dropped = orphanDropped;
+    for (LogRing *ring = rings; ring != NULL; ring = ring->next)
+        dropped += ring->dropped;
+    pthread_mutex_unlock(&ringMutex);
+    return dropped;
+}
+
 /*!
     \fn ofslog::log(int loglvl,const char *fmt,va_list ap)
  */
 void 
 ofslog::log(int loglvl,const char *fmt,va_list ap)
 {
+    if (async) {
+        __sync_fetch_and_add(&asyncWriters, 1);
+        // stopAsync() may have started meanwhile
+        bool queued = async && enqueue(loglvl, fmt, ap);
+        __sync_fetch_and_sub(&asyncWriters, 1);
+        if (queued)
+            return;
+    }
     char buf[MAX_LOGENTRY_LEN];
-    int len = vsnprintf(buf,MAX_LOGENTRY_LEN,fmt,ap);
-    
-    syslog(loglvl,"%s",buf);
+    vsnprintf(buf,MAX_LOGENTRY_LEN,fmt,ap);
+    write(loglvl, time(NULL), buf);
+}
+
+/**
+ * Queue a message in the ring of the calling thread
+ * @return false if the ring is full and the message is an error, which
+ *         the caller writes at once
+ */
+bool
+ofslog::enqueue(int loglvl, const char *fmt, va_list ap)
+{
+    LogRing *ring = ownRing();
+    unsigned long head = ring->head;
+    if (head - ring->tail >= LOG_RING_SLOTS) {
+        if (loglvl <= LOG_ERR)
+            return false;
+        ring->dropped = ring->dropped + 1;
+        return true;
+    }
+    LogRing::Entry &entry = ring->entries[head % LOG_RING_SLOTS];
+    entry.level = loglvl;
+    gettimeofday(&entry.time, NULL);
+    vsnprintf(entry.message, MAX_LOGENTRY_LEN, fmt, ap);
+    // the entry is complete before the drain thread can see it
+    __sync_synchronize();
+    ring->head = head + 1;
+    // do not wait for the interval to end before the ring is full
+    if (head - ring->tail == LOG_RING_SLOTS / 2)
+        pthread_cond_signal(&drainWake);
+    return true;
+}
+
+void *
+ofslog::drainThread(void *)
+{
+    pthread_mutex_lock(&drainMutex);
+    while (drainRunning) {
+        pthread_mutex_unlock(&drainMutex);
+        drain();
+        pthread_mutex_lock(&drainMutex);
+        if (!drainRunning)
+            break;
+        struct timeval now;
+        struct timespec timeout;
+        gettimeofday(&now, NULL);
+        long usec = now.tv_usec + LOG_DRAIN_INTERVAL * 1000L;
+        timeout.tv_sec = now.tv_sec + usec / 1000000;
+        timeout.tv_nsec = (usec % 1000000) * 1000;
+        pthread_cond_timedwait(&drainWake, &drainMutex, &timeout);
+    }
+    pthread_mutex_unlock(&drainMutex);
+    drain();
+    return NULL;
+}
+
+/**
+ * Write the messages of all rings
+ */
+void
+ofslog::drain()
+{
+    pthread_mutex_lock(&ringMutex);
+    unsigned long long dropped = orphanDropped;
+    for (LogRing **it = &rings; *it != NULL; ) {
+        LogRing *ring = *it;
+        unsigned long head = ring->head;
+        __sync_synchronize();
+        for (unsigned long tail = ring->tail; tail != head; ++tail) {
+            LogRing::Entry &entry = ring->entries[tail % LOG_RING_SLOTS];
+            write(entry.level, entry.time.tv_sec, entry.message);
+            // the slot is written to only after it has been read
+            __sync_synchronize();
+            ring->tail = tail + 1;
+        }
+        dropped += ring->dropped;
+        if (ring->orphaned && ring->tail == ring->head) {
+            orphanDropped += ring->dropped;
+            *it = ring->next;
+            delete ring;
+        } else {
+            it = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&ringMutex);
+    if (logfile != NULL)
+        fflush(logfile);
+    if (dropped > reportedDropped) {
+        char buf[MAX_LOGENTRY_LEN];
+        snprintf(buf, MAX_LOGENTRY_LEN, "%llu log messages dropped",
+                 dropped - reportedDropped);
+        reportedDropped = dropped;
+        write(LOG_WARNING, time(NULL), buf);
+    }
+}
+
+/**
+ * Write a formatted message to the log file or syslog
+ */
+void
+ofslog::write(int loglvl, time_t time, const char *msg)
+{
+    if (logfile == NULL) {
+        syslog(loglvl,"%s",msg);
+        return;
+    }
+    char stamp[32];
+    struct tm tm;
+    strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S",
+             localtime_r(&time, &tm));
+    fprintf(logfile, "%s ofs[%d]: %s\n", stamp, (int)getpid(), msg);
+    if (!async)
+        fflush(logfile);
 }
 
 /*!
@@ -61,6 +332,8 @@ ofslog::log(int loglvl,const char *fmt,va_list ap)
 void 
 ofslog::info(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_INFO))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_INFO,fmt,args);
@@ -73,6 +346,8 @@ ofslog::info(const char *fmt, ...)
 void 
 ofslog::debug(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_DEBUG))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_DEBUG,fmt,args);
@@ -85,6 +360,8 @@ ofslog::debug(const char *fmt, ...)
 void 
 ofslog::error(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_ERR))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_ERR,fmt,args);
@@ -97,6 +374,8 @@ ofslog::error(const char *fmt, ...)
 void 
 ofslog::warning(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_WARNING))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_WARNING,fmt,args);
@@ -109,6 +388,8 @@ ofslog::warning(const char *fmt, ...)
 void 
 ofslog::notice(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_NOTICE))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_NOTICE,fmt,args);
@@ -121,10 +402,11 @@ ofslog::notice(const char *fmt, ...)
 void 
 ofslog::critical(const char *fmt, ...)
 {
+    if (!isEnabled(LOG_CRIT))
+        return;
     va_list args;
     va_start(args, fmt);
     log(LOG_CRIT,fmt,args);
     va_end(args);
 }
 
-
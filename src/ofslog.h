@@ -21,9 +21,26 @@
 #define OFSLOG_H
 
 #include <cstdarg>
+#include <syslog.h>
+#include <ctime>
+
+/// longer messages are truncated
+#define MAX_LOGENTRY_LEN        1024
+/// messages a thread can log before they are written by the drain thread,
+/// further messages are dropped, errors are written at once
+#define LOG_RING_SLOTS          64
+/// milliseconds between two runs of the drain thread, it runs earlier
+/// once a thread has filled half of its ring
+#define LOG_DRAIN_INTERVAL      50
 
 /**
 	@author Matthias Petri <Matthias.Petri@gmail.com>
+
+	Messages below the log level configured in ofs.conf are discarded
+	before they are formatted. Once startAsync() has been called the
+	other messages are formatted into a buffer of the calling thread and
+	written to syslog, or to the logfile configured in ofs.conf, by a
+	background thread; the messages of one thread stay in order.
 */
 class ofslog {
 public:
@@ -32,6 +49,32 @@ public:
      * @return logging system successfully initialised?
      */
     static bool init();
+    /**
+     * Log the messages up to the given level from now on instead of
+     * the level configured in ofs.conf
+     * @param loglvl syslog level
+     */
+    static void setLevel(int loglvl);
+    /**
+     * Write messages in the background from now on. Has to be called
+     * after the daemon has forked.
+     */
+    static void startAsync();
+    /**
+     * Write the buffered messages and log synchronously again
+     */
+    static void stopAsync();
+    /**
+     * Would a message of the given level be logged?
+     * @param loglvl syslog level
+     */
+    static inline bool isEnabled(int loglvl)
+        { return (mask & LOG_MASK(loglvl)) != 0; }
+    /**
+     * @return number of messages dropped because a thread logged faster
+     *         than they could be written
+     */
+    static unsigned long long getDropped();
     /**
      * info log msg
      * @param log msg
@@ -67,7 +110,16 @@ public:
      * @param log msg
      */    
     static void log(int loglvl,const char *fmt,va_list ap);
+private:
+    static bool enqueue(int loglvl, const char *fmt, va_list ap);
+    static void *drainThread(void *);
+    static void drain();
+    static void write(int loglvl, time_t time, const char *msg);
+
+    /// syslog mask of the levels to log
+    static int mask;
+    /// messages are written by the drain thread
+    static volatile bool async;
 };
 
 #endif
-
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "ofsstats.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+__thread OFSStats::ThreadStats *OFSStats::threadStats = NULL;
+volatile unsigned long long OFSStats::lastActive = 0;
+OFSStats::ThreadStats *OFSStats::threads = NULL;
+OFSStats::ThreadStats OFSStats::retired;
+pthread_mutex_t OFSStats::mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t OFSStats::key;
+pthread_once_t OFSStats::keyOnce = PTHREAD_ONCE_INIT;
+
+/// names of the operations in the output, in the order of OFSStats::Op
+static const char *op_names[] = {
+    "getattr", "fgetattr", "access", "readlink", "opendir", "readdir",
+    "releasedir", "mknod", "mkdir", "unlink", "rmdir", "symlink", "rename",
+    "link", "chmod", "chown", "truncate", "ftruncate", "utimens", "create",
+    "open", "read", "write", "statfs", "flush", "release", "fsync",
+    "setxattr", "getxattr", "listxattr", "removexattr", "lookup", "forget",
+    "setattr"
+};
+
+/// upper bounds of the exported histogram buckets in nanoseconds
+static const unsigned long long export_limits[] = {
+    1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL
+};
+static const char *export_labels[] = {
+    "1e-06", "1e-05", "0.0001", "0.001", "0.01", "0.1", "1", "10"
+};
+#define EXPORT_BUCKETS (sizeof(export_limits) / sizeof(export_limits[0]))
+
+static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *percentile_labels[] = { "0.5", "0.9", "0.99", "0.999" };
+#define PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+void OFSStats::record(Op op, unsigned long long ns)
+{
+    ThreadStats *stats = own();
+    stats->calls[op]++;
+    stats->total[op] += ns;
+    stats->buckets[op][bucket(ns)]++;
+}
+
+unsigned long long OFSStats::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Create the statistics of the calling thread
+ */
+OFSStats::ThreadStats *OFSStats::create()
+{
+    pthread_once(&keyOnce, createKey);
+    ThreadStats *stats = new ThreadStats;
+    memset(stats, 0, sizeof(ThreadStats));
+    pthread_mutex_lock(&mutex);
+    stats->next = threads;
+    threads = stats;
+    pthread_mutex_unlock(&mutex);
+    pthread_setspecific(key, stats);
+    threadStats = stats;
+    return stats;
+}
+
+void OFSStats::createKey()
+{
+    pthread_key_create(&key, retire);
+}
+
+/**
+ * Move the statistics of an exiting thread to the retired ones
+ */
+void OFSStats::retire(void *stats)
+{
+    ThreadStats *dead = (ThreadStats *)stats;
+    pthread_mutex_lock(&mutex);
+    for (ThreadStats **it = &threads; *it != NULL; it = &(*it)->next) {
+        if (*it == dead) {
+            *it = dead->next;
+            break;
+        }
+    }
+    add(retired, *dead);
+    pthread_mutex_unlock(&mutex);
+    delete dead;
+}
+
+void OFSStats::add(ThreadStats& sum, const ThreadStats& stats)
+{
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+        sum.counters[c] += stats.counters[c];
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (stats.calls[op] == 0)
+            continue;
+        sum.calls[op] += stats.calls[op];
+        sum.total[op] += stats.total[op];
+        for (int b = 0; b < STATS_BUCKETS; ++b)
+            sum.buckets[op][b] += stats.buckets[op][b];
+    }
+}
+
+/**
+ * Index of the histogram bucket of a latency
+ */
+int OFSStats::bucket(unsigned long long ns)
+{
+    if (ns < STATS_SUB_BUCKETS)
+        return ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    if (exponent >= STATS_MAX_EXPONENT)
+        return STATS_BUCKETS - 1;
+    return (exponent - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS
+           + ((ns >> (exponent - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * Smallest latency of a bucket, the limit of the previous one
+ */
+unsigned long long OFSStats::bucketLimit(int bucket)
+{
+    if (bucket < STATS_SUB_BUCKETS)
+        return bucket;
+    int exponent = bucket / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+    return (unsigned long long)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS)
+           << (exponent - STATS_SUB_BITS);
+}
+
+/**
+ * Upper limit of the bucket holding the given fraction of the calls
+ */
+unsigned long long OFSStats::percentile(const unsigned long long *buckets,
+                                        unsigned long long calls,
+                                        double fraction)
+{
+    unsigned long long rank = (unsigned long long)(fraction * calls);
+    if (rank < calls)
+        ++rank;
+    unsigned long long seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= rank)
+            return bucketLimit(b + 1);
+    }
+    return bucketLimit(STATS_BUCKETS);
+}
+
+string OFSStats::format()
+{
+    ThreadStats *sum = new ThreadStats;
+    memset(sum, 0, sizeof(ThreadStats));
+    pthread_mutex_lock(&mutex);
+    add(*sum, retired);
+    for (ThreadStats *stats = threads; stats != NULL; stats = stats->next)
+        add(*sum, *stats);
+    pthread_mutex_unlock(&mutex);
+
+    string out;
+    char line[256];
+    const unsigned long long *c = sum->counters;
+    snprintf(line, sizeof(line),
+        "# TYPE ofs_reads_total counter\n"
+        "ofs_reads_total{source=\"cache\"} %llu\n"
+        "ofs_reads_total{source=\"remote\"} %llu\n"
+        "ofs_reads_total{source=\"placeholder\"} %llu\n",
+        c[READ_CACHE], c[READ_REMOTE], c[READ_PARTIAL]);
+    out += line;
+    snprintf(line, sizeof(line),
+        "# TYPE ofs_getattrs_total counter\n"
+        "ofs_getattrs_total{source=\"attrcache\"} %llu\n"
+        "ofs_getattrs_total{source=\"cache\"} %llu\n"
+        "ofs_getattrs_total{source=\"remote\"} %llu\n",
+        c[GETATTR_ATTRCACHE], c[GETATTR_CACHE], c[GETATTR_REMOTE]);
+    out += line;
+    snprintf(line, sizeof(line),
+        "# TYPE ofs_remote_calls_total counter\n"
+        "ofs_remote_calls_total %llu\n"
+        "# TYPE ofs_cache_fill_bytes_total counter\n"
+        "ofs_cache_fill_bytes_total %llu\n"
+        "# TYPE ofs_synclog_appends_total counter\n"
+        "ofs_synclog_appends_total %llu\n",
+        c[REMOTE_CALLS], c[CACHE_BYTES], c[SYNCLOG_APPENDS]);
+    out += line;
+
+    out += "# TYPE ofs_op_duration_seconds histogram\n";
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (sum->calls[op] == 0)
+            continue;
+        unsigned long long cumulative = 0;
+        int b = 0;
+        for (unsigned int e = 0; e < EXPORT_BUCKETS; ++e) {
+            for (; b < STATS_BUCKETS && bucketLimit(b + 1) <= export_limits[e]; ++b)
+                cumulative += sum->buckets[op][b];
+            // the share of a fine bucket the limit falls into is
+            // interpolated
+            unsigned long long share = 0;
+            if (b < STATS_BUCKETS && bucketLimit(b) < export_limits[e])
+                share = (unsigned long long)((double)sum->buckets[op][b]
+                    * (export_limits[e] - bucketLimit(b))
+                    / (bucketLimit(b + 1) - bucketLimit(b)));
+            snprintf(line, sizeof(line),
+                "ofs_op_duration_seconds_bucket{op=\"%s\",le=\"%s\"} %llu\n",
+                op_names[op], export_labels[e], cumulative + share);
+            out += line;
+        }
+        snprintf(line, sizeof(line),
+            "ofs_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n"
+            "ofs_op_duration_seconds_sum{op=\"%s\"} %.9f\n"
+            "ofs_op_duration_seconds_count{op=\"%s\"} %llu\n",
+            op_names[op], sum->calls[op], op_names[op],
+            sum->total[op] / 1e9, op_names[op], sum->calls[op]);
+        out += line;
+    }
+
+    out += "# TYPE ofs_op_latency_seconds gauge\n";
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (sum->calls[op] == 0)
+            continue;
+        for (unsigned int p = 0; p < PERCENTILES; ++p) {
+            snprintf(line, sizeof(line),
+                "ofs_op_latency_seconds{op=\"%s\",quantile=\"%s\"} %.9f\n",
+                op_names[op], percentile_labels[p],
+                percentile(sum->buckets[op], sum->calls[op],
+                           percentiles[p]) / 1e9);
+            out += line;
+        }
+    }
+    delete sum;
+    return out;
+}
@@ -0,0 +1,206 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef OFSSTATS_H
+#define OFSSTATS_H
+
+#include <pthread.h>
+#include <string>
+
+using namespace std;
+
+/// latencies below 2^STATS_SUB_BITS ns get a bucket each, above that
+/// every power of two is split into 2^STATS_SUB_BITS buckets
+#define STATS_SUB_BITS          3
+#define STATS_SUB_BUCKETS       (1 << STATS_SUB_BITS)
+/// latencies from 2^STATS_MAX_EXPONENT ns (about 68 s) on share the last
+/// bucket
+#define STATS_MAX_EXPONENT      36
+#define STATS_BUCKETS \
+    ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/**
+ * Operation counters and latency histograms of the daemon, readable as
+ * the ofs.stats extended attribute of the mount root in the Prometheus
+ * text format.
+ *
+ * Every thread updates its own counters without locking or atomic
+ * instructions; they are only summed up when they are read. The
+ * latency histograms keep three significant bits of every value, which
+ * bounds the error of a percentile to 12.5%.
+ */
+class OFSStats
+{
+public:
+    /// FUSE operations with a latency histogram
+    enum Op
+    {
+        OP_GETATTR,
+        OP_FGETATTR,
+        OP_ACCESS,
+        OP_READLINK,
+        OP_OPENDIR,
+        OP_READDIR,
+        OP_RELEASEDIR,
+        OP_MKNOD,
+        OP_MKDIR,
+        OP_UNLINK,
+        OP_RMDIR,
+        OP_SYMLINK,
+        OP_RENAME,
+        OP_LINK,
+        OP_CHMOD,
+        OP_CHOWN,
+        OP_TRUNCATE,
+        OP_FTRUNCATE,
+        OP_UTIMENS,
+        OP_CREATE,
+        OP_OPEN,
+        OP_READ,
+        OP_WRITE,
+        OP_STATFS,
+        OP_FLUSH,
+        OP_RELEASE,
+        OP_FSYNC,
+        OP_SETXATTR,
+        OP_GETXATTR,
+        OP_LISTXATTR,
+        OP_REMOVEXATTR,
+        /// only used by the low-level backend
+        OP_LOOKUP,
+        OP_FORGET,
+        OP_SETATTR,
+        OP_COUNT
+    };
+    /// plain event counters
+    enum Counter
+    {
+        /// op_read served from the cache
+        READ_CACHE,
+        /// op_read served from the remote share
+        READ_REMOTE,
+        /// op_read of a placeholder, fetching missing blocks
+        READ_PARTIAL,
+        /// op_getattr answered by the attribute cache
+        GETATTR_ATTRCACHE,
+        /// op_getattr read from the cache
+        GETATTR_CACHE,
+        /// op_getattr read from the remote share
+        GETATTR_REMOTE,
+        /// system calls on files of the remote share
+        REMOTE_CALLS,
+        /// bytes copied from the remote share by update_cache
+        CACHE_BYTES,
+        /// entries appended to the sync log
+        SYNCLOG_APPENDS,
+        COUNTER_COUNT
+    };
+
+    /**
+     * Add to a counter of the calling thread
+     */
+    static inline void count(Counter counter, unsigned long long n = 1)
+        { own()->counters[counter] += n; }
+    /**
+     * Count a system call on the remote share and pass its result on,
+     * so it can wrap the call in any expression
+     */
+    template <class T> static inline T remote(T result)
+        { count(REMOTE_CALLS); return result; }
+    /**
+     * Record an operation of the calling thread
+     * @param op operation
+     * @param ns duration in nanoseconds
+     */
+    static void record(Op op, unsigned long long ns);
+    /**
+     * Monotonic clock in nanoseconds
+     */
+    static unsigned long long now();
+    /**
+     * Note the end of an operation. The time is only stored when it is
+     * a second later than the last one, so the threads hardly ever write
+     * to the shared cache line.
+     * @param end monotonic time in nanoseconds
+     */
+    static inline void active(unsigned long long end)
+        { if (end - lastActive >= 1000000000ULL) lastActive = end; }
+    /**
+     * Monotonic time in nanoseconds an operation ended last, to a second
+     */
+    static inline unsigned long long getLastActive() { return lastActive; }
+    /**
+     * Sum up the counters of all threads
+     * @return the statistics in the Prometheus text format
+     */
+    static string format();
+
+private:
+    struct ThreadStats
+    {
+        unsigned long long counters[COUNTER_COUNT];
+        unsigned long long calls[OP_COUNT];
+        unsigned long long total[OP_COUNT];
+        unsigned long long buckets[OP_COUNT][STATS_BUCKETS];
+        ThreadStats *next;
+    };
+
+    static inline ThreadStats *own()
+        { return threadStats ? threadStats : create(); }
+    static ThreadStats *create();
+    static void retire(void *stats);
+    static void createKey();
+    static void add(ThreadStats& sum, const ThreadStats& stats);
+    static int bucket(unsigned long long ns);
+    static unsigned long long bucketLimit(int bucket);
+    static unsigned long long percentile(const unsigned long long *buckets,
+                                         unsigned long long calls,
+                                         double fraction);
+
+    static __thread ThreadStats *threadStats;
+    static volatile unsigned long long lastActive;
+    /// statistics of all running threads
+    static ThreadStats *threads;
+    /// sum of the statistics of the threads that have exited
+    static ThreadStats retired;
+    static pthread_mutex_t mutex;
+    static pthread_key_t key;
+    static pthread_once_t keyOnce;
+};
+
+/**
+ * Records the latency of an operation when it goes out of scope and
+ * notes that the file system is in use
+ */
+class OpTimer
+{
+public:
+    OpTimer(OFSStats::Op op) : op(op), start(OFSStats::now()) {}
+    ~OpTimer()
+    {
+        unsigned long long end = OFSStats::now();
+        OFSStats::record(op, end - start);
+        OFSStats::active(end);
+    }
+private:
+    OFSStats::Op op;
+    unsigned long long start;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Index of values attached to paths, one trie node per path component.
+ *
+ * Lookups follow the components of the looked up path, so they take
+ * time proportional to the depth of the path, not to the number of
+ * entries, and do not allocate memory. "/a/b" is the parent of
+ * "/a/b/c" but not of "/a/bc"; empty components are ignored, so
+ * "/a//b/" is the same path as "/a/b", and "/" (or "") is the root.
+ *
+ * Not synchronized, the owner has to lock.
+ */
+template <class T>
+class PathTrie
+{
+public:
+    PathTrie() : root(new Node(NULL, 0)) {}
+    ~PathTrie() { delete root; }
+
+    /**
+     * Attach a value to a path, replacing the one already attached
+     * @return true if the path had no value before
+     */
+    bool insert(const string& path, const T& value)
+    {
+        vector<Node*> trail;
+        Node *node = root;
+        trail.push_back(node);
+        string::size_type pos = 0, start, length;
+        while (nextComponent(path, pos, start, length))
+        {
+            typename vector<Node*>::iterator it =
+                lowerBound(node, path.data() + start, length);
+            if (it == node->children.end()
+                || (*it)->name.compare(0, string::npos, path.data() + start, length) != 0)
+                it = node->children.insert(it, new Node(path.data() + start, length));
+            node = *it;
+            trail.push_back(node);
+        }
+        node->value = value;
+        if (node->hasValue)
+            return false;
+        node->hasValue = true;
+        for (typename vector<Node*>::iterator it = trail.begin(); it != trail.end(); ++it)
+            ++(*it)->below;
+        return true;
+    }
+
+    /**
+     * Remove the value of a path
+     * @return true if there was one
+     */
+    bool erase(const string& path)
+    {
+        vector<Node*> trail;
+        Node *node = root;
+        trail.push_back(node);
+        string::size_type pos = 0, start, length;
+        while (nextComponent(path, pos, start, length))
+        {
+            node = child(node, path.data() + start, length);
+            if (node == NULL)
+                return false;
+            trail.push_back(node);
+        }
+        if (!node->hasValue)
+            return false;
+        node->hasValue = false;
+        node->value = T();
+        for (typename vector<Node*>::iterator it = trail.begin(); it != trail.end(); ++it)
+            --(*it)->below;
+        // drop the nodes nothing is attached to any more
+        for (size_t i = trail.size() - 1; i > 0 && trail[i]->below == 0; --i)
+        {
+            Node *parent = trail[i - 1];
+            parent->children.erase(std::find(parent->children.begin(),
+                                             parent->children.end(), trail[i]));
+            delete trail[i];
+        }
+        return true;
+    }
+
+    /**
+     * Get the value attached to exactly this path
+     * @return pointer to the value or NULL
+     */
+    const T* find(const string& path) const
+    {
+        const Node *node = walk(path);
+        return node != NULL && node->hasValue ? &node->value : NULL;
+    }
+
+    /**
+     * Get the value of the deepest path that is the path itself or one
+     * of its parents
+     * @return pointer to the value or NULL
+     */
+    const T* longestPrefix(const string& path) const
+    {
+        const Node *node = root;
+        const Node *found = root->hasValue ? root : NULL;
+        string::size_type pos = 0, start, length;
+        while (nextComponent(path, pos, start, length))
+        {
+            node = child(node, path.data() + start, length);
+            if (node == NULL)
+                break;
+            if (node->hasValue)
+                found = node;
+        }
+        return found != NULL ? &found->value : NULL;
+    }
+
+    /**
+     * Is a value attached to the path or to anything below it?
+     */
+    bool anyAtOrBelow(const string& path) const
+    {
+        const Node *node = walk(path);
+        return node != NULL && node->below > 0;
+    }
+
+    /**
+     * Get the values attached to the path and to everything below it
+     * @param values (out) the values are appended
+     */
+    void collectAtOrBelow(const string& path, list<T>& values) const
+    {
+        const Node *node = walk(path);
+        if (node != NULL)
+            collect(node, values);
+    }
+
+    void clear()
+    {
+        delete root;
+        root = new Node(NULL, 0);
+    }
+
+    /**
+     * @return number of paths with a value
+     */
+    size_t size() const { return root->below; }
+
+private:
+    struct Node
+    {
+        Node(const char *name, size_t length) :
+            name(name != NULL ? string(name, length) : string()),
+            hasValue(false), value(), below(0) {}
+        ~Node()
+        {
+            for (typename vector<Node*>::iterator it = children.begin();
+                 it != children.end(); ++it)
+                delete *it;
+        }
+        string name;
+        /// sorted by name
+        vector<Node*> children;
+        bool hasValue;
+        T value;
+        /// number of values attached to this node and its descendants
+        size_t below;
+    };
+
+    /**
+     * Find the next non-empty component of path starting at pos
+     */
+    static bool nextComponent(const string& path, string::size_type& pos,
+                              string::size_type& start, string::size_type& length)
+    {
+        while (pos < path.length() && path[pos] == '/')
+            ++pos;
+        if (pos >= path.length())
+            return false;
+        start = pos;
+        pos = path.find('/', pos);
+        if (pos == string::npos)
+            pos = path.length();
+        length = pos - start;
+        return true;
+    }
+
+    static typename vector<Node*>::iterator lowerBound(Node *node,
+                                                       const char *name, size_t length)
+    {
+        typename vector<Node*>::iterator first = node->children.begin();
+        typename vector<Node*>::difference_type count = node->children.size();
+        while (count > 0)
+        {
+            typename vector<Node*>::difference_type step = count / 2;
+            typename vector<Node*>::iterator middle = first + step;
+            if ((*middle)->name.compare(0, string::npos, name, length) < 0)
+            {
+                first = middle + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    static Node* child(const Node *node, const char *name, size_t length)
+    {
+        typename vector<Node*>::iterator it =
+            lowerBound(const_cast<Node*>(node), name, length);
+        if (it == node->children.end()
+            || (*it)->name.compare(0, string::npos, name, length) != 0)
+            return NULL;
+        return *it;
+    }
+
+    const Node* walk(const string& path) const
+    {
+        const Node *node = root;
+        string::size_type pos = 0, start, length;
+        while (node != NULL && nextComponent(path, pos, start, length))
+            node = child(node, path.data() + start, length);
+        return node;
+    }
+
+    static void collect(const Node *node, list<T>& values)
+    {
+        if (node->hasValue)
+            values.push_back(node->value);
+        for (typename vector<Node*>::const_iterator it = node->children.begin();
+             it != node->children.end(); ++it)
+            collect(*it, values);
+    }
+
+    PathTrie(const PathTrie&);
+    PathTrie& operator=(const PathTrie&);
+
+    Node *root;
+};
+
+#endif
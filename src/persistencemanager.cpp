@@ -19,19 +19,20 @@
  ***************************************************************************/
 #include "persistencemanager.h"
 #include "ofsenvironment.h"
-#include "ofshash.h"
-#include <iostream>
-#include <fstream>
+#include "metastore.h"
+#include "ofslog.h"
 #include <sstream>
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <sys/stat.h>
 using namespace std;
 
 PersistenceManager::PersistenceManager(string modname)
 {
 	stringstream str;
-	unsigned char sha1hash[20];
-	string hash;
-	
+
 	cfg=NULL;
 	opts=NULL;
 	this->modname = modname;	
@@ -43,24 +44,46 @@ PersistenceManager::PersistenceManager(string modname)
 
 PersistenceManager::~PersistenceManager()
 {
-	cfg_free(cfg);
+	if(cfg != NULL)
+		cfg_free(cfg);
 	delete [] opts;
 }
 
 void PersistenceManager::reload()
 {
-	if(cfg_parse(cfg, get_filename().c_str()) == CFG_PARSE_ERROR) {
-		cfg_parse_buf(cfg, "");
-	}
-	read_values();
+	map<string, string> records;
+	MetaStore::Instance().scan(get_prefix(), records);
+	set_records(records);
 }
 
 void PersistenceManager::make_persistent()
 {
-	ofstream persfile(get_filename().c_str(), ios::out | ios::trunc);
-	persfile << get_persistence();
-	persfile << endl;
-	persfile.close();
+	MetaStore& store = MetaStore::Instance();
+	map<string, string> records;
+	map<string, string> stored;
+	get_records(records);
+	store.scan(get_prefix(), stored);
+
+	// both maps are sorted, one pass finds the differences
+	MetaStore::Batch batch;
+	map<string, string>::iterator it = records.begin();
+	map<string, string>::iterator old = stored.begin();
+	while(it != records.end() || old != stored.end()) {
+		if(old == stored.end() || (it != records.end() && it->first < old->first)) {
+			batch.put(get_prefix() + it->first, it->second);
+			it++;
+		} else if(it == records.end() || old->first < it->first) {
+			batch.remove(get_prefix() + old->first);
+			old++;
+		} else {
+			if(it->second != old->second)
+				batch.put(get_prefix() + it->first, it->second);
+			it++;
+			old++;
+		}
+	}
+	if(!batch.empty() && !store.commit(batch))
+		ofslog::error("Could not store %s", modname.c_str());
 }
 
 string PersistenceManager::get_filename()
@@ -68,11 +91,42 @@ string PersistenceManager::get_filename()
 	return filename;
 }
 
+string PersistenceManager::get_prefix()
+{
+	return modname + "/";
+}
+
 void PersistenceManager::init()
+{
+	struct stat fileinfo;
+	if(lstat(get_filename().c_str(), &fileinfo) == 0)
+		migrate();
+}
+
+/**
+ * Move the content of the libconfuse file of older versions into the
+ * metadata store. The file is renamed afterwards, if that fails the
+ * migration is simply repeated on the next start.
+ */
+void PersistenceManager::migrate()
 {
 	opts = init_parser();
 	cfg = cfg_init(opts, CFGF_NONE);
-	reload();
+	if(cfg_parse(cfg, get_filename().c_str()) == CFG_PARSE_ERROR) {
+		ofslog::error("Could not parse %s for migration", get_filename().c_str());
+		return;
+	}
+	read_values();
+	make_persistent();
+	cfg_free(cfg);
+	cfg = NULL;
+
+	// Keeps the old file for reference, it is not read anymore.
+	string migrated = get_filename() + ".migrated";
+	if(rename(get_filename().c_str(), migrated.c_str()) < 0)
+		ofslog::warning("Could not rename migrated file %s: %s",
+			get_filename().c_str(), strerror(errno));
+	ofslog::info("Migrated %s to the metadata store", get_filename().c_str());
 }
 
 string PersistenceManager::get_modname()
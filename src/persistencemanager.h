@@ -22,25 +22,27 @@
 
 #include <confuse.h>
 #include <string>
+#include <map>
 using namespace std;
 
 /**
 	@author Tobias Jaehnel <tjaehnel@gmail.com>
 
-	Manages files, which hold persisent data.
-	Each subclass gets its own file to store the data
-	and is identified by
+	Manages persistent data of a module in the metadata store.
+	Each subclass owns the keys "<modname>/..." and converts its
+	state to one record per key, only changed records are written.
+	The libconfuse file of older versions is migrated on init.
 */
 class PersistenceManager{
 public:
 
     virtual ~PersistenceManager();
     /**
-     * write persistence file
+     * write the changed records to the metadata store
      */
     void make_persistent();
     /**
-     * Reload the persistence file
+     * Reload the records from the metadata store
      */
     void reload();
     /**
@@ -52,28 +54,38 @@ public:
 protected:
     /**
      * ctor
-     * @param modname Name of the module - is used for the filename
+     * @param modname Name of the module - is used for the keys
      */
     explicit PersistenceManager(string modname);
     /**
-     * Set the parser options
+     * Set the parser options of the old persistence file
      * @return array of parser options
      */
     virtual cfg_opt_t *init_parser() = 0;
     /**
-     * get the string which has to be written to the persistence file
-     * @return persistence content
+     * read the config values of the old persistence file
      */
-    virtual string get_persistence() = 0;
+    virtual void read_values() = 0;
     /**
-     * read the config values
+     * get the records which have to be stored
+     * @param records receives the value per key
      */
-    virtual void read_values() = 0;
+    virtual void get_records(map<string, string>& records) = 0;
+    /**
+     * set the state from the stored records
+     * @param records value per key
+     */
+    virtual void set_records(const map<string, string>& records) = 0;
     /**
-     * get the filename of the persistence file
+     * get the filename of the old persistence file
      * @return the filename
      */
     string get_filename();
+    /**
+     * get the key prefix of the module in the metadata store
+     * @return "<modname>/"
+     */
+    string get_prefix();
     /**
      * This method has to be called by each subclass on initialization.
      * Reason: Methods, called in the constructor are not called polymorph
@@ -85,6 +97,8 @@ protected:
     cfg_t *cfg;
 
 private:
+    void migrate();
+
     string filename;
     string modname;
 
@@ -0,0 +1,675 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "placeholdermanager.h"
+#include "placeholderpersistence.h"
+#include "metastore.h"
+#include "filesystemstatusmanager.h"
+#include "ofsenvironment.h"
+#include "ofsfile.h"
+#include "ofshash.h"
+#include "ofslog.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <errno.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <list>
+
+#define BLOCK_FILE_MAGIC "OFSB"
+#define BLOCK_FILE_VERSION 1
+
+/**
+ * Header of a stored bitmap, followed by one bit per block
+ */
+struct BlockFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    int64_t mtime;
+    int64_t size;
+    uint32_t blockSize;
+    uint32_t reserved;
+};
+
+std::auto_ptr<PlaceholderManager> PlaceholderManager::thePlaceholderManagerInstance;
+pthread_once_t PlaceholderManager::instanceOnce = PTHREAD_ONCE_INIT;
+
+PlaceholderManager::PlaceholderManager() : fetcherRunning(false)
+{
+    blockDir = OFSEnvironment::Instance().getOfsDir() + "/"
+        + OFSEnvironment::Instance().getShareID() + "_blocks";
+    mkdir(blockDir.c_str(), S_IRWXU);
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&fetched, NULL);
+    reinstate();
+}
+
+PlaceholderManager::~PlaceholderManager()
+{
+    pthread_cond_destroy(&fetched);
+    pthread_mutex_destroy(&mutex);
+}
+
+PlaceholderManager& PlaceholderManager::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *thePlaceholderManagerInstance;
+}
+
+void PlaceholderManager::createInstance()
+{
+    thePlaceholderManagerInstance.reset(new PlaceholderManager());
+}
+
+void PlaceholderManager::create(const string& path, const string& cachePath,
+    const struct stat& remote) throw(OFSException)
+{
+    Placeholder placeholder;
+    placeholder.mtime = remote.st_mtime;
+    placeholder.size = remote.st_size;
+    placeholder.loaded = true;
+    // known before the file exists, so nobody mistakes it for content,
+    // not even after a crash
+    pthread_mutex_lock(&mutex);
+    placeholders[path] = placeholder;
+    unsigned long long seq = store(path);
+    pthread_mutex_unlock(&mutex);
+    if (!MetaStore::Instance().sync(seq))
+        throw OFSException("Could not store the placeholder", EIO, true);
+    unlink(blockFile(path).c_str());
+
+    // a handle that is still open keeps the old content
+    unlink(cachePath.c_str());
+    int fd = open(cachePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    if (fd < 0)
+        throw OFSException(strerror(errno), errno, true);
+    if (ftruncate(fd, remote.st_size) < 0)
+    {
+        int error = errno;
+        close(fd);
+        throw OFSException(strerror(error), error, true);
+    }
+    close(fd);
+    struct utimbuf times;
+    times.actime = remote.st_mtime - 1;
+    times.modtime = remote.st_mtime - 1;
+    if (utime(cachePath.c_str(), &times) < 0)
+        throw OFSException(strerror(errno), errno, true);
+}
+
+bool PlaceholderManager::isPlaceholder(const string& path)
+{
+    pthread_mutex_lock(&mutex);
+    bool found = placeholders.find(path) != placeholders.end();
+    pthread_mutex_unlock(&mutex);
+    return found;
+}
+
+bool PlaceholderManager::isCurrent(const string& path, const struct stat& remote)
+{
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.find(path);
+    bool current = it != placeholders.end() && it->second.mtime == remote.st_mtime
+        && it->second.size == remote.st_size;
+    pthread_mutex_unlock(&mutex);
+    return current;
+}
+
+bool PlaceholderManager::beginFetch(const string& path)
+{
+    pthread_mutex_lock(&mutex);
+    while (fetching.find(path) != fetching.end())
+        pthread_cond_wait(&fetched, &mutex);
+    bool placeholder = placeholders.find(path) != placeholders.end();
+    if (placeholder)
+        fetching.insert(path);
+    pthread_mutex_unlock(&mutex);
+    return placeholder;
+}
+
+void PlaceholderManager::endFetch(const string& path, bool done)
+{
+    unsigned long long seq = 0;
+    pthread_mutex_lock(&mutex);
+    fetching.erase(path);
+    if (done && placeholders.erase(path) > 0)
+    {
+        unlink(blockFile(path).c_str());
+        seq = store(path);
+    }
+    pthread_cond_broadcast(&fetched);
+    pthread_mutex_unlock(&mutex);
+    if (seq != 0 && !MetaStore::Instance().sync(seq))
+        ofslog::error("Could not store that %s has been fetched", path.c_str());
+}
+
+void PlaceholderManager::remove(const string& path)
+{
+    unsigned long long seq = 0;
+    pthread_mutex_lock(&mutex);
+    // the file is about to get other content
+    if (placeholders.erase(path) > 0)
+    {
+        unlink(blockFile(path).c_str());
+        seq = store(path);
+    }
+    pthread_mutex_unlock(&mutex);
+    if (seq != 0 && !MetaStore::Instance().sync(seq))
+        ofslog::error("Could not store the removal of placeholder %s", path.c_str());
+}
+
+void PlaceholderManager::rename(const string& from, const string& to)
+{
+    // every path that enters or leaves the placeholder state
+    list<string> changed;
+    pthread_mutex_lock(&mutex);
+    // whatever was at the new path has been replaced
+    if (placeholders.erase(to) > 0)
+    {
+        unlink(blockFile(to).c_str());
+        changed.push_back(to);
+    }
+    const string toPrefix = to + "/";
+    map<string, Placeholder>::iterator it = placeholders.lower_bound(toPrefix);
+    while (it != placeholders.end() && it->first.compare(0, toPrefix.length(), toPrefix) == 0)
+    {
+        unlink(blockFile(it->first).c_str());
+        changed.push_back(it->first);
+        placeholders.erase(it++);
+    }
+    list<pair<string, Placeholder> > moved;
+    // the path itself and everything below it
+    it = placeholders.find(from);
+    if (it != placeholders.end())
+    {
+        ::rename(blockFile(from).c_str(), blockFile(to).c_str());
+        moved.push_back(make_pair(to, it->second));
+        changed.push_back(from);
+        placeholders.erase(it);
+    }
+    const string prefix = from + "/";
+    it = placeholders.lower_bound(prefix);
+    while (it != placeholders.end() && it->first.compare(0, prefix.length(), prefix) == 0)
+    {
+        const string moveTo = to + it->first.substr(from.length());
+        ::rename(blockFile(it->first).c_str(), blockFile(moveTo).c_str());
+        moved.push_back(make_pair(moveTo, it->second));
+        changed.push_back(it->first);
+        placeholders.erase(it++);
+    }
+    for (list<pair<string, Placeholder> >::iterator entry = moved.begin();
+         entry != moved.end(); entry++)
+    {
+        placeholders[entry->first] = entry->second;
+        changed.push_back(entry->first);
+    }
+    unsigned long long seq = 0;
+    for (list<string>::iterator path = changed.begin(); path != changed.end(); path++)
+        seq = store(*path);
+    pthread_mutex_unlock(&mutex);
+    // the renamed cache files must not be taken for content
+    if (seq != 0 && !MetaStore::Instance().sync(seq))
+        ofslog::error("Could not store the placeholders renamed from %s", from.c_str());
+}
+
+long PlaceholderManager::blockCount(off_t size)
+{
+    return (size + BLOCK_FETCH_SIZE - 1) / BLOCK_FETCH_SIZE;
+}
+
+bool PlaceholderManager::hasBlock(const Placeholder& placeholder, long block)
+{
+    return !placeholder.blocks.empty()
+        && (placeholder.blocks[block / 8] & (1 << (block % 8))) != 0;
+}
+
+string PlaceholderManager::blockFile(const string& path)
+{
+    return blockDir + "/" + ofs_hash(path);
+}
+
+/**
+ * Read the stored bitmap of a placeholder, the caller holds the mutex
+ */
+void PlaceholderManager::loadBlocks(const string& path, Placeholder& placeholder)
+{
+    if (placeholder.loaded)
+        return;
+    placeholder.loaded = true;
+    int fd = open(blockFile(path).c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    BlockFileHeader header;
+    vector<unsigned char> blocks((blockCount(placeholder.size) + 7) / 8);
+    bool ok = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+        && memcmp(header.magic, BLOCK_FILE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == BLOCK_FILE_VERSION
+        && header.mtime == placeholder.mtime && header.size == placeholder.size
+        && header.blockSize == BLOCK_FETCH_SIZE
+        && (blocks.empty() || read(fd, &blocks[0], blocks.size()) == (ssize_t)blocks.size());
+    close(fd);
+    // left from another version of the remote file
+    if (!ok)
+        return;
+    placeholder.blocks.swap(blocks);
+    placeholder.present = 0;
+    for (long block = 0; block < blockCount(placeholder.size); block++)
+        if (hasBlock(placeholder, block))
+            placeholder.present++;
+}
+
+/**
+ * Store the bitmap of a placeholder, the caller is fetching the path
+ * and has synced the cache file
+ */
+void PlaceholderManager::saveBlocks(const string& path)
+{
+    BlockFileHeader header;
+    vector<unsigned char> blocks;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BLOCK_FILE_MAGIC, sizeof(header.magic));
+    header.version = BLOCK_FILE_VERSION;
+    header.blockSize = BLOCK_FETCH_SIZE;
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.find(path);
+    if (it != placeholders.end())
+    {
+        header.mtime = it->second.mtime;
+        header.size = it->second.size;
+        blocks = it->second.blocks;
+        it->second.unsavedBlocks = 0;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (blocks.empty())
+        return;
+
+    string filename = blockFile(path);
+    string tmpname = filename + ".tmp";
+    int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        ofslog::warning("Could not store the blocks of %s: %s", path.c_str(), strerror(errno));
+        return;
+    }
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+        && write(fd, &blocks[0], blocks.size()) == (ssize_t)blocks.size();
+    close(fd);
+    if (!ok || ::rename(tmpname.c_str(), filename.c_str()) < 0)
+    {
+        ofslog::warning("Could not store the blocks of %s", path.c_str());
+        unlink(tmpname.c_str());
+    }
+}
+
+bool PlaceholderManager::hasBlocks(const string& path, off_t offset, off_t length)
+{
+    bool present = true;
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.find(path);
+    if (it != placeholders.end())
+    {
+        loadBlocks(path, it->second);
+        long last = min(blockCount(it->second.size), blockCount(offset + length));
+        for (long block = offset / BLOCK_FETCH_SIZE; present && block < last; block++)
+            present = hasBlock(it->second, block);
+    }
+    pthread_mutex_unlock(&mutex);
+    return present;
+}
+
+/**
+ * pread until the buffer is full
+ * @return false on errors and at the end of the file
+ */
+static bool read_fully(int fd, char *buf, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t res = pread(fd, buf, size, offset);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        buf += res;
+        size -= res;
+        offset += res;
+    }
+    return true;
+}
+
+/**
+ * pwrite the whole buffer
+ * @return false on errors
+ */
+static bool write_fully(int fd, const char *buf, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t res = pwrite(fd, buf, size, offset);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            return false;
+        buf += res;
+        size -= res;
+        offset += res;
+    }
+    return true;
+}
+
+void PlaceholderManager::fetchBlocks(const string& path, const string& remotePath,
+    const string& cachePath, off_t offset, off_t length) throw(OFSException)
+{
+    if (!beginFetch(path))
+        return;
+    list<long> missing;
+    time_t mtime = 0;
+    off_t size = 0;
+    long nBlocks = 0;
+    bool complete = false;
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.find(path);
+    if (it != placeholders.end())
+    {
+        loadBlocks(path, it->second);
+        mtime = it->second.mtime;
+        size = it->second.size;
+        nBlocks = blockCount(size);
+        long last = min(nBlocks, blockCount(offset + length));
+        for (long block = offset / BLOCK_FETCH_SIZE; block < last; block++)
+            if (!hasBlock(it->second, block))
+                missing.push_back(block);
+        complete = it->second.present == nBlocks;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    int fdr = -1;
+    int fdc = -1;
+    try
+    {
+        if (!missing.empty())
+        {
+            struct stat remote;
+            fdr = open(remotePath.c_str(), O_RDONLY);
+            if (fdr < 0 || fstat(fdr, &remote) < 0)
+                throw OFSException(strerror(errno), errno, true);
+            // the next update_cache makes a new placeholder
+            if (remote.st_mtime != mtime || remote.st_size != size)
+                throw OFSException("The remote file has changed", EIO, true);
+            fdc = open(cachePath.c_str(), O_WRONLY);
+            if (fdc < 0)
+                throw OFSException(strerror(errno), errno, true);
+        }
+        vector<char> buffer(missing.empty() ? 0 : BLOCK_FETCH_SIZE);
+        for (list<long>::iterator block = missing.begin(); block != missing.end(); block++)
+        {
+            off_t start = (off_t)*block * BLOCK_FETCH_SIZE;
+            size_t count = min((off_t)BLOCK_FETCH_SIZE, size - start);
+            if (!read_fully(fdr, &buffer[0], count, start))
+                throw OFSException("The remote file has changed", EIO, true);
+            if (!write_fully(fdc, &buffer[0], count, start))
+                throw OFSException(strerror(errno), errno, true);
+
+            bool save = false;
+            pthread_mutex_lock(&mutex);
+            it = placeholders.find(path);
+            if (it != placeholders.end())
+            {
+                if (it->second.blocks.empty())
+                    it->second.blocks.resize((nBlocks + 7) / 8);
+                it->second.blocks[*block / 8] |= 1 << (*block % 8);
+                it->second.present++;
+                complete = it->second.present == nBlocks;
+                save = ++it->second.unsavedBlocks >= BLOCK_FETCH_PERSIST_INTERVAL;
+            }
+            pthread_mutex_unlock(&mutex);
+            // blocks are only recorded once they are on disk
+            if (save && !complete && fdatasync(fdc) == 0)
+                saveBlocks(path);
+        }
+    }
+    catch (OFSException &e)
+    {
+        if (fdr >= 0)
+            close(fdr);
+        if (fdc >= 0)
+            close(fdc);
+        endFetch(path, false);
+        throw;
+    }
+    if (fdr >= 0)
+        close(fdr);
+    if (fdc >= 0)
+        close(fdc);
+    // newer than the remote file, so update_cache keeps the content
+    if (complete)
+        utime(cachePath.c_str(), NULL);
+    endFetch(path, complete);
+}
+
+void PlaceholderManager::fetchContent(const string& path, const string& remotePath,
+    const string& cachePath) throw(OFSException)
+{
+    fetchBlocks(path, remotePath, cachePath, 0, max((off_t)0, sizeOf(path)));
+}
+
+/**
+ * Size of the remote file of a placeholder
+ * @return -1 if the path is no placeholder
+ */
+off_t PlaceholderManager::sizeOf(const string& path)
+{
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.find(path);
+    off_t size = it != placeholders.end() ? it->second.size : -1;
+    pthread_mutex_unlock(&mutex);
+    return size;
+}
+
+/**
+ * Count a change, the caller holds the mutex
+ */
+/**
+ * Write the record of one path to the metadata store, the caller holds
+ * the mutex so the records are stored in the order of the changes
+ * @return sequence number to wait for with MetaStore::sync()
+ */
+unsigned long long PlaceholderManager::store(const string& path) const
+{
+    map<string, Placeholder>::const_iterator it = placeholders.find(path);
+    if (it == placeholders.end())
+        return PlaceholderPersistence::Instance().remove(path);
+    PlaceholderPersistence::Record record;
+    record.path = path;
+    stringstream mtime, size;
+    mtime << it->second.mtime;
+    size << it->second.size;
+    record.mtime = mtime.str();
+    record.size = size.str();
+    return PlaceholderPersistence::Instance().put(record);
+}
+
+void PlaceholderManager::startFetching()
+{
+    pthread_mutex_lock(&mutex);
+    bool start = !fetcherRunning && !placeholders.empty();
+    if (start)
+        fetcherRunning = true;
+    pthread_mutex_unlock(&mutex);
+    if (!start)
+        return;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, PlaceholderManager::trickleRun, this) != 0)
+    {
+        ofslog::error("Could not start fetching placeholders: %s", strerror(errno));
+        pthread_mutex_lock(&mutex);
+        fetcherRunning = false;
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void* PlaceholderManager::trickleRun(void* arg)
+{
+    ((PlaceholderManager *)arg)->trickle();
+    return NULL;
+}
+
+/**
+ * Find the placeholder following path
+ * @param path (in/out) the last placeholder, empty to start over
+ * @return false if there is none
+ */
+bool PlaceholderManager::next(string& path)
+{
+    pthread_mutex_lock(&mutex);
+    map<string, Placeholder>::iterator it = placeholders.upper_bound(path);
+    bool found = it != placeholders.end();
+    if (found)
+        path = it->first;
+    pthread_mutex_unlock(&mutex);
+    return found;
+}
+
+/**
+ * Fetch placeholders one after another in path order until there are
+ * none left. After each file, or each BLOCK_FETCH_MAX_AHEAD blocks with
+ * blockfetch, the thread sleeps as long as fetching took, so it never
+ * takes more than half of the connection from the files that are read
+ * meanwhile.
+ */
+void PlaceholderManager::trickle()
+{
+    ofslog::info("Fetching placeholders in the background");
+    string path;
+    bool progress = false;
+    long nFetched = 0;
+    while (true)
+    {
+        if (!next(path))
+        {
+            pthread_mutex_lock(&mutex);
+            bool done = placeholders.empty();
+            if (done)
+                fetcherRunning = false;
+            pthread_mutex_unlock(&mutex);
+            if (done)
+                break;
+            // the rest can not be fetched right now
+            if (!progress)
+                sleep(PLACEHOLDER_RETRY_INTERVAL);
+            progress = false;
+            path.clear();
+            continue;
+        }
+        if (!FilesystemStatusManager::Instance().isAvailable())
+            continue;
+
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        try
+        {
+            OFSFile file(path);
+            struct stat fileinfo;
+            // no longer available offline or removed from the remote,
+            // the next cache update removes the cache file
+            if (!file.get_offline_state()
+                || (lstat(file.get_remote_path().c_str(), &fileinfo) < 0 && errno == ENOENT))
+                remove(path);
+            else
+                file.update_cache();
+            // with blockfetch update_cache leaves the content to the reads
+            for (off_t offset = 0; OFSEnvironment::Instance().isBlockFetch()
+                 && offset <= sizeOf(path) && FilesystemStatusManager::Instance().isAvailable();
+                 offset += BLOCK_FETCH_SIZE * BLOCK_FETCH_MAX_AHEAD)
+            {
+                fetchBlocks(path, file.get_remote_path(), file.get_cache_path(),
+                    offset, BLOCK_FETCH_SIZE * BLOCK_FETCH_MAX_AHEAD);
+                pause(start);
+            }
+        }
+        catch (OFSException &e)
+        {
+            ofslog::warning("Could not fetch %s: %s (%d)", path.c_str(),
+                e.what(), e.get_posixerrno());
+        }
+        if (!isPlaceholder(path))
+        {
+            progress = true;
+            nFetched++;
+        }
+        pause(start);
+    }
+    ofslog::info("Fetched %ld placeholders", nFetched);
+}
+
+/**
+ * Sleep as long as the time since start, then restart the clock
+ */
+void PlaceholderManager::pause(struct timeval& start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    long duration = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+    sleep(duration / 1000000);
+    usleep(duration % 1000000);
+    gettimeofday(&start, NULL);
+}
+
+void PlaceholderManager::persist() const
+{
+    list<PlaceholderPersistence::Record> records;
+    for (map<string, Placeholder>::const_iterator it = placeholders.begin();
+         it != placeholders.end(); it++)
+    {
+        PlaceholderPersistence::Record record;
+        record.path = it->first;
+        stringstream mtime, size;
+        mtime << it->second.mtime;
+        size << it->second.size;
+        record.mtime = mtime.str();
+        record.size = size.str();
+        records.push_back(record);
+    }
+    PlaceholderPersistence::Instance().placeholders(records);
+}
+
+void PlaceholderManager::reinstate()
+{
+    list<PlaceholderPersistence::Record> records =
+        PlaceholderPersistence::Instance().placeholders();
+    pthread_mutex_lock(&mutex);
+    placeholders.clear();
+    for (list<PlaceholderPersistence::Record>::iterator it = records.begin();
+         it != records.end(); it++)
+    {
+        Placeholder placeholder;
+        placeholder.mtime = atol(it->mtime.c_str());
+        placeholder.size = atoll(it->size.c_str());
+        placeholders[it->path] = placeholder;
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,196 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef PLACEHOLDERMANAGER_H
+#define PLACEHOLDERMANAGER_H
+
+#include "persistable.h"
+#include "mutexlocker.h"
+#include "ofsexception.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+using namespace std;
+
+/// seconds to wait after a round in which nothing could be fetched
+#define PLACEHOLDER_RETRY_INTERVAL 60
+/// the content of placeholders is fetched in blocks of this size
+#define BLOCK_FETCH_SIZE (256 * 1024)
+/// the most blocks fetched at once, ahead of sequential reads or
+/// in the background
+#define BLOCK_FETCH_MAX_AHEAD 32
+/// the fetched blocks are made persistent after this many blocks
+#define BLOCK_FETCH_PERSIST_INTERVAL 64
+
+/**
+ * Keeps track of the cache files that are only placeholders of remote
+ * files (lazypin mount option). A placeholder has the size of the
+ * remote file but no content, the content is fetched when the file is
+ * opened or by a background thread that works through all placeholders
+ * while the remote file system is available.
+ *
+ * With the blockfetch mount option, placeholders are also created for
+ * large files when they are opened, and their content is fetched in
+ * blocks of BLOCK_FETCH_SIZE when it is read. Which blocks are already
+ * in the cache file is kept in a bitmap per placeholder, stored in
+ * <ofsdir>/<shareid>_blocks/<hash of the path>.
+ *
+ * The modification time of a placeholder is set to just before the one
+ * of the remote file, so the content is fetched by OFSFile::update_cache
+ * even if the placeholder is not known here. The record of a path is
+ * made persistent whenever the path becomes or stops being a
+ * placeholder, a new placeholder before its cache file is truncated.
+ * Only the bitmaps are batched, they are made persistent every
+ * BLOCK_FETCH_PERSIST_INTERVAL fetched blocks, after the cache file has
+ * been synced. Blocks fetched since then are fetched again after a
+ * crash.
+ */
+class PlaceholderManager : public persistable
+{
+public:
+    static PlaceholderManager& Instance();
+    ~PlaceholderManager();
+
+    /**
+     * Replace the cache file by a placeholder of the remote file
+     * @param path path relative to the share root
+     * @param cachePath cache file of the path
+     * @param remote attributes of the remote file
+     */
+    void create(const string& path, const string& cachePath,
+                const struct stat& remote) throw(OFSException);
+    /**
+     * Is the content of the cache file still missing?
+     * @param path path relative to the share root
+     */
+    bool isPlaceholder(const string& path);
+    /**
+     * Is the cache file a placeholder of this version of the remote file?
+     * @param path path relative to the share root
+     * @param remote attributes of the remote file
+     */
+    bool isCurrent(const string& path, const struct stat& remote);
+    /**
+     * Wait until no other thread is fetching the content of the path.
+     * If it returns true, endFetch() has to be called.
+     * @param path path relative to the share root
+     * @return false if the path is no placeholder (any more)
+     */
+    bool beginFetch(const string& path);
+    /**
+     * Counterpart of beginFetch()
+     * @param path path relative to the share root
+     * @param fetched the content has been fetched
+     */
+    void endFetch(const string& path, bool fetched);
+    /**
+     * Is the range in the cache file? Always true for files that are
+     * no placeholders.
+     * @param path path relative to the share root
+     * @param offset start of the range
+     * @param length length of the range
+     */
+    bool hasBlocks(const string& path, off_t offset, off_t length);
+    /**
+     * Fetch the missing blocks of a range from the remote file. Once
+     * all blocks are there, the file is no placeholder any more.
+     * @param path path relative to the share root
+     * @param remotePath remote file of the path
+     * @param cachePath cache file of the path
+     * @param offset start of the range
+     * @param length length of the range
+     */
+    void fetchBlocks(const string& path, const string& remotePath,
+                     const string& cachePath, off_t offset, off_t length)
+        throw(OFSException);
+    /**
+     * Fetch all missing blocks, see fetchBlocks()
+     */
+    void fetchContent(const string& path, const string& remotePath,
+                      const string& cachePath) throw(OFSException);
+    /**
+     * The cache file has been removed or truncated, there is nothing
+     * to fetch any more
+     * @param path path relative to the share root
+     */
+    void remove(const string& path);
+    /**
+     * A file or directory has been renamed in the cache
+     * @param from old path relative to the share root
+     * @param to new path relative to the share root
+     */
+    void rename(const string& from, const string& to);
+    /**
+     * Start fetching the content of all placeholders in the background,
+     * does nothing if the fetch is already running
+     */
+    void startFetching();
+    virtual void persist() const;
+    virtual void reinstate();
+
+protected:
+    PlaceholderManager();
+
+private:
+    struct Placeholder
+    {
+        Placeholder() : loaded(false), present(0), unsavedBlocks(0) {}
+        time_t mtime;
+        off_t size;
+        /// one bit per block that is in the cache file, empty until a
+        /// block has been fetched
+        vector<unsigned char> blocks;
+        /// the bitmap has been looked for on disk
+        bool loaded;
+        long present;
+        int unsavedBlocks;
+    };
+
+    unsigned long long store(const string& path) const;
+    bool next(string& path);
+    void trickle();
+    static void* trickleRun(void* arg);
+    static void pause(struct timeval& start);
+    string blockFile(const string& path);
+    void loadBlocks(const string& path, Placeholder& placeholder);
+    void saveBlocks(const string& path);
+    off_t sizeOf(const string& path);
+    static long blockCount(off_t size);
+    static bool hasBlock(const Placeholder& placeholder, long block);
+
+    map<string, Placeholder> placeholders;
+    /// paths whose content is being fetched
+    set<string> fetching;
+    bool fetcherRunning;
+    string blockDir;
+    pthread_mutex_t mutex;
+    pthread_cond_t fetched;
+
+    static std::auto_ptr<PlaceholderManager> thePlaceholderManagerInstance;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+};
+
+#endif
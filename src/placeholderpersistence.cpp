@@ -0,0 +1,115 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "placeholderpersistence.h"
+#include "metastore.h"
+#include <sstream>
+using namespace std;
+
+std::auto_ptr<PlaceholderPersistence> PlaceholderPersistence::thePlaceholderPersistenceInstance;
+Mutex PlaceholderPersistence::m;
+
+PlaceholderPersistence::PlaceholderPersistence()
+ : PersistenceManager(PERSISTENCE_MODULE_NAME)
+{
+}
+
+PlaceholderPersistence::~PlaceholderPersistence()
+{
+}
+
+PlaceholderPersistence& PlaceholderPersistence::Instance()
+{
+    MutexLocker obtain_lock(m);
+    if (thePlaceholderPersistenceInstance.get() == 0) {
+    	thePlaceholderPersistenceInstance.reset(new PlaceholderPersistence());
+        thePlaceholderPersistenceInstance->init();
+    }
+    return *thePlaceholderPersistenceInstance;
+}
+
+cfg_opt_t *PlaceholderPersistence::init_parser()
+{
+	cfg_opt_t *opts = new cfg_opt_t[2];
+	opts[0] = (cfg_opt_t)CFG_STR_LIST(
+		CONFIGKEY_PLACEHOLDERS, "{}", CFGF_NONE);
+	opts[1] = (cfg_opt_t)CFG_END();
+	return opts;
+}
+
+void PlaceholderPersistence::get_records(map<string, string>& values)
+{
+	list<Record>::iterator it;
+	for ( it=records.begin() ; it != records.end(); it++ )
+		values[it->path] = it->mtime + " " + it->size;
+}
+
+void PlaceholderPersistence::set_records(const map<string, string>& values)
+{
+	records.clear();
+	map<string, string>::const_iterator it;
+	for ( it=values.begin() ; it != values.end(); it++ ) {
+		string::size_type space = it->second.find(' ');
+		if(space == string::npos)
+			continue;
+		Record record;
+		record.path = it->first;
+		record.mtime = it->second.substr(0, space);
+		record.size = it->second.substr(space + 1);
+		records.push_back(record);
+	}
+}
+
+void PlaceholderPersistence::read_values()
+{
+    records.clear();
+    for(unsigned int i = 0; i + 2 < cfg_size(cfg, CONFIGKEY_PLACEHOLDERS); i+=3) {
+        Record record;
+        record.path = string(cfg_getnstr(cfg, CONFIGKEY_PLACEHOLDERS, i));
+        record.mtime = string(cfg_getnstr(cfg, CONFIGKEY_PLACEHOLDERS, i+1));
+        record.size = string(cfg_getnstr(cfg, CONFIGKEY_PLACEHOLDERS, i+2));
+        records.push_back(record);
+    }
+}
+
+void PlaceholderPersistence::placeholders(const list<Record>& records)
+{
+    this->records = records;
+    make_persistent();
+}
+
+unsigned long long PlaceholderPersistence::put(const Record& record)
+{
+    MetaStore::Batch batch;
+    batch.put(get_prefix() + record.path, record.mtime + " " + record.size);
+    return MetaStore::Instance().apply(batch);
+}
+
+unsigned long long PlaceholderPersistence::remove(const string& path)
+{
+    MetaStore::Batch batch;
+    batch.remove(get_prefix() + path);
+    return MetaStore::Instance().apply(batch);
+}
+
+list<PlaceholderPersistence::Record> PlaceholderPersistence::placeholders()
+{
+    reload();
+    return records;
+}
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef PLACEHOLDERPERSISTENCE_H
+#define PLACEHOLDERPERSISTENCE_H
+
+#include "persistencemanager.h"
+#include "mutexlocker.h"
+#include <list>
+#include <memory>
+using namespace std;
+
+#define CONFIGKEY_PLACEHOLDERS "placeholders"
+#define PERSISTENCE_MODULE_NAME "placeholders"
+
+/**
+ * Stores the placeholders in the cache whose content has not been
+ * fetched yet. Each placeholder is stored as three strings: relative
+ * path, modification time and size of the remote file.
+ */
+class PlaceholderPersistence : public PersistenceManager
+{
+public:
+    /**
+     * One placeholder as stored in the persistence file
+     */
+    struct Record
+    {
+        string path;
+        string mtime;
+        string size;
+    };
+
+    ~PlaceholderPersistence();
+    /**
+     * Get singleton instance
+     * @return singleton instance
+     */
+    static PlaceholderPersistence& Instance();
+    /**
+     * make placeholders persistent
+     * @param records placeholders
+     */
+    void placeholders(const list<Record>& records);
+    /**
+     * make one placeholder persistent
+     * @param record placeholder
+     * @return sequence number to wait for with MetaStore::sync()
+     */
+    unsigned long long put(const Record& record);
+    /**
+     * forget one placeholder
+     * @param path relative path of the placeholder
+     * @return sequence number to wait for with MetaStore::sync()
+     */
+    unsigned long long remove(const string& path);
+    /**
+     * load placeholders
+     * @return placeholders
+     */
+    list<Record> placeholders();
+
+protected:
+    PlaceholderPersistence();
+
+    virtual cfg_opt_t *init_parser();
+    virtual void get_records(map<string, string>& records);
+    virtual void set_records(const map<string, string>& records);
+    virtual void read_values();
+
+private:
+    list<Record> records;
+
+    static std::auto_ptr<PlaceholderPersistence>
+        thePlaceholderPersistenceInstance;
+    static Mutex m;
+};
+
+#endif
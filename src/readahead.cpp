@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "readahead.h"
+#include "ofslog.h"
+#include "ofsstats.h"
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+std::auto_ptr<PrefetchPool> PrefetchPool::thePrefetchPoolInstance;
+pthread_once_t PrefetchPool::instanceOnce = PTHREAD_ONCE_INIT;
+
+PrefetchPool::PrefetchPool() : started(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&queued, NULL);
+}
+
+PrefetchPool& PrefetchPool::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *thePrefetchPoolInstance;
+}
+
+void PrefetchPool::createInstance()
+{
+    thePrefetchPoolInstance.reset(new PrefetchPool());
+}
+
+void PrefetchPool::submit(void (*task)(void*), void* arg)
+{
+    pthread_mutex_lock(&mutex);
+    if (!started)
+    {
+        started = true;
+        for (int i = 0; i < READ_AHEAD_THREADS; i++)
+        {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, PrefetchPool::run, this) == 0)
+                pthread_detach(thread);
+            else
+                ofslog::error("Could not start read-ahead thread: %s", strerror(errno));
+        }
+    }
+    tasks.push_back(make_pair(task, arg));
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&mutex);
+}
+
+void* PrefetchPool::run(void* arg)
+{
+    PrefetchPool* pool = (PrefetchPool*)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->tasks.empty())
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+        pair<void (*)(void*), void*> task = pool->tasks.front();
+        pool->tasks.pop_front();
+        pthread_mutex_unlock(&pool->mutex);
+        task.first(task.second);
+    }
+    return NULL;
+}
+
+ReadAhead::ReadAhead(int fd, size_t maxWindow)
+    : fd(fd), maxWindow(maxWindow), window(0), nextOffset(0), scheduledEnd(0),
+      generation(0), pending(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&finished, NULL);
+}
+
+ReadAhead::~ReadAhead()
+{
+    pthread_mutex_lock(&mutex);
+    while (pending > 0)
+        pthread_cond_wait(&finished, &mutex);
+    pthread_mutex_unlock(&mutex);
+    for (list<Segment*>::iterator it = segments.begin(); it != segments.end(); it++)
+        delete *it;
+    pthread_cond_destroy(&finished);
+    pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * Segment of the current generation containing offset, the caller
+ * holds the mutex
+ */
+ReadAhead::Segment* ReadAhead::find(off_t offset)
+{
+    for (list<Segment*>::iterator it = segments.begin(); it != segments.end(); it++)
+        if ((*it)->generation == generation && offset >= (*it)->offset
+            && offset < (*it)->offset + (off_t)(*it)->data.size())
+            return *it;
+    return NULL;
+}
+
+/**
+ * Delete finished segments that end before the offset or are of an
+ * old generation, the caller holds the mutex
+ */
+void ReadAhead::drop(off_t before)
+{
+    list<Segment*>::iterator it = segments.begin();
+    while (it != segments.end())
+    {
+        Segment* segment = *it;
+        if (segment->done && (segment->generation != generation
+                || segment->offset + (off_t)segment->data.size() <= before))
+        {
+            delete segment;
+            it = segments.erase(it);
+        }
+        else
+            it++;
+    }
+}
+
+/**
+ * Request segments until the window ahead of end is covered, the
+ * caller holds the mutex
+ */
+void ReadAhead::schedule(off_t end)
+{
+    if (scheduledEnd < end)
+        scheduledEnd = end;
+    size_t maxSegments = maxWindow / READ_AHEAD_SEGMENT + 1;
+    while (scheduledEnd < end + (off_t)window && segments.size() < maxSegments)
+    {
+        Segment* segment = new Segment();
+        segment->owner = this;
+        segment->offset = scheduledEnd;
+        segment->data.resize(READ_AHEAD_SEGMENT);
+        segment->length = 0;
+        segment->done = false;
+        segment->error = 0;
+        segment->generation = generation;
+        segments.push_back(segment);
+        pending++;
+        scheduledEnd += READ_AHEAD_SEGMENT;
+        PrefetchPool::Instance().submit(ReadAhead::fetch, segment);
+    }
+}
+
+void ReadAhead::fetch(void* arg)
+{
+    Segment* segment = (Segment*)arg;
+    size_t length = 0;
+    int error = 0;
+    while (length < segment->data.size())
+    {
+        ssize_t res = OFSStats::remote(pread(segment->owner->fd,
+            &segment->data[length], segment->data.size() - length,
+            segment->offset + length));
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            error = errno;
+        if (res <= 0)
+            break;
+        length += res;
+    }
+    ReadAhead* owner = segment->owner;
+    pthread_mutex_lock(&owner->mutex);
+    segment->length = length;
+    segment->error = error;
+    segment->done = true;
+    owner->pending--;
+    pthread_cond_broadcast(&owner->finished);
+    pthread_mutex_unlock(&owner->mutex);
+}
+
+ssize_t ReadAhead::read(char* buf, size_t size, off_t offset)
+{
+    size_t copied = 0;
+    bool eof = false;
+    pthread_mutex_lock(&mutex);
+    Segment* segment = find(offset);
+    // a read that is not in a segment is a new stream or random access
+    if (offset == nextOffset || segment != NULL)
+        window = min(maxWindow, window == 0
+            ? max((size_t)READ_AHEAD_MIN_WINDOW, 2 * size) : 2 * window);
+    else if (window > 0)
+    {
+        // what has been read ahead is of no use any more
+        window = 0;
+        scheduledEnd = 0;
+        generation++;
+    }
+    nextOffset = offset + size;
+    drop(offset);
+
+    while (segment != NULL && !eof && copied < size)
+    {
+        while (!segment->done)
+            pthread_cond_wait(&finished, &mutex);
+        off_t position = offset + copied;
+        if (segment->error != 0 || position >= segment->offset + (off_t)segment->length)
+        {
+            // a short segment ends at the end of the file
+            eof = segment->error == 0;
+            break;
+        }
+        size_t count = min(size - copied,
+            (size_t)(segment->offset + segment->length - position));
+        memcpy(buf + copied, &segment->data[position - segment->offset], count);
+        copied += count;
+        eof = segment->length < segment->data.size()
+            && position + (off_t)count == segment->offset + (off_t)segment->length;
+        segment = find(offset + copied);
+    }
+    if (window > 0)
+        schedule(offset + size);
+    pthread_mutex_unlock(&mutex);
+
+    if (copied < size && !eof)
+    {
+        ssize_t res = OFSStats::remote(pread(fd, buf + copied, size - copied,
+                                             offset + copied));
+        if (res < 0)
+            return copied > 0 ? (ssize_t)copied : -1;
+        copied += res;
+    }
+    return copied;
+}
+
+void ReadAhead::invalidate()
+{
+    pthread_mutex_lock(&mutex);
+    generation++;
+    window = 0;
+    scheduledEnd = 0;
+    drop(0);
+    pthread_mutex_unlock(&mutex);
+}
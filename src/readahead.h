@@ -0,0 +1,137 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "mutexlocker.h"
+#include <sys/types.h>
+#include <pthread.h>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+using namespace std;
+
+/// the remote file is read ahead in segments of this size
+#define READ_AHEAD_SEGMENT (256 * 1024)
+/// the first window of a sequential stream
+#define READ_AHEAD_MIN_WINDOW (128 * 1024)
+/// number of threads that read ahead for all handles
+#define READ_AHEAD_THREADS 4
+
+/**
+ * Runs the read-ahead of all handles on a few shared threads
+ */
+class PrefetchPool
+{
+public:
+    static PrefetchPool& Instance();
+    /**
+     * Run a task on one of the threads
+     * @param task function to call
+     * @param arg argument of the function
+     */
+    void submit(void (*task)(void*), void* arg);
+
+private:
+    PrefetchPool();
+    static void* run(void* pool);
+
+    deque<pair<void (*)(void*), void*> > tasks;
+    bool started;
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;
+
+    static std::auto_ptr<PrefetchPool> thePrefetchPoolInstance;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+};
+
+/**
+ * Reads a remote file ahead of a handle that reads it sequentially.
+ *
+ * Every read that continues a stream doubles the window, up to the
+ * maximum, and keeps that much of the file requested ahead of the
+ * reader in segments of READ_AHEAD_SEGMENT, which are read in parallel
+ * by the PrefetchPool. Reads are served from the segments when they
+ * are there. A read that is neither the continuation of the last one
+ * nor in a segment turns read-ahead off until the next stream starts.
+ *
+ * Data read ahead is as fresh as the moment it was read; writes
+ * through the same handle drop it.
+ */
+class ReadAhead
+{
+public:
+    /**
+     * @param fd remote file, must stay open until the object is deleted
+     * @param maxWindow most bytes read ahead
+     */
+    ReadAhead(int fd, size_t maxWindow);
+    /**
+     * Waits until the segments being read are finished
+     */
+    ~ReadAhead();
+    /**
+     * Read like pread
+     * @return number of bytes read, -1 with errno set on errors
+     */
+    ssize_t read(char* buf, size_t size, off_t offset);
+    /**
+     * The file has been changed through the handle, forget what has
+     * been read ahead
+     */
+    void invalidate();
+
+private:
+    struct Segment
+    {
+        ReadAhead* owner;
+        off_t offset;
+        vector<char> data;
+        /// bytes read, less than the size of data at the end of the file
+        size_t length;
+        bool done;
+        int error;
+        unsigned long generation;
+    };
+
+    Segment* find(off_t offset);
+    void drop(off_t before);
+    void schedule(off_t end);
+    static void fetch(void* segment);
+
+    int fd;
+    size_t maxWindow;
+    size_t window;
+    off_t nextOffset;
+    /// end of the last segment requested
+    off_t scheduledEnd;
+    unsigned long generation;
+    list<Segment*> segments;
+    int pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+
+    ReadAhead(const ReadAhead&);
+    ReadAhead& operator=(const ReadAhead&);
+};
+
+#endif
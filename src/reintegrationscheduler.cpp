@@ -0,0 +1,191 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "reintegrationscheduler.h"
+#include "ofslog.h"
+#include <map>
+
+ReintegrationScheduler::ReintegrationScheduler(const list<SyncLogEntry>& entries)
+    : executor(NULL), nUnfinished(0), nRunning(0),
+      nExecuted(0), nFailed(0), nSkipped(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+
+    multimap<string, int> byPath;
+    map<string, int> lastOfPath;
+    nodes.reserve(entries.size());
+    for (list<SyncLogEntry>::const_iterator it = entries.begin();
+         it != entries.end(); it++)
+    {
+        nodes.push_back(Node(*it));
+        byPath.insert(make_pair(it->GetFilePath(), (int)nodes.size() - 1));
+    }
+
+    for (int i = 0; i < (int)nodes.size(); i++)
+    {
+        const string path = nodes[i].entry.GetFilePath();
+
+        // entries of the same path in log order
+        map<string, int>::iterator last = lastOfPath.find(path);
+        if (last != lastOfPath.end())
+            addDependency(i, last->second);
+        lastOfPath[path] = i;
+
+        if (nodes[i].entry.GetModType() == 'd')
+        {
+            // a directory is deleted after everything below it
+            const string prefix = path + "/";
+            for (multimap<string, int>::iterator it = byPath.lower_bound(prefix);
+                 it != byPath.end() && it->first.compare(0, prefix.length(), prefix) == 0;
+                 it++)
+                addDependency(i, it->second);
+        }
+        else
+        {
+            // parent directories are created first
+            string parent = path;
+            string::size_type pos;
+            while ((pos = parent.rfind('/')) != string::npos && pos > 0)
+            {
+                parent.erase(pos);
+                pair<multimap<string, int>::iterator, multimap<string, int>::iterator>
+                    range = byPath.equal_range(parent);
+                for (multimap<string, int>::iterator it = range.first;
+                     it != range.second; it++)
+                    if (nodes[it->second].entry.GetModType() == 'c')
+                        addDependency(i, it->second);
+            }
+        }
+    }
+}
+
+ReintegrationScheduler::~ReintegrationScheduler()
+{
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+void ReintegrationScheduler::addDependency(int node, int dependency)
+{
+    nodes[node].pending++;
+    nodes[dependency].dependents.push_back(node);
+}
+
+void ReintegrationScheduler::enqueue(int node)
+{
+    nodes[node].queued = true;
+    ready.push_back(node);
+}
+
+/**
+ * Called when nothing is ready although entries are left. This can only
+ * happen if the log contains contradicting entries, e.g. a path that has
+ * been deleted and created again. Continue with the oldest entry left.
+ */
+void ReintegrationScheduler::breakCycle()
+{
+    for (int i = 0; i < (int)nodes.size(); i++)
+    {
+        if (!nodes[i].queued)
+        {
+            ofslog::warning("Reintegration: circular dependency at %s",
+                            nodes[i].entry.GetFilePath().c_str());
+            enqueue(i);
+            return;
+        }
+    }
+}
+
+void ReintegrationScheduler::run(Executor& executor, int nThreads)
+{
+    this->executor = &executor;
+    nUnfinished = nodes.size();
+    for (int i = 0; i < (int)nodes.size(); i++)
+        if (nodes[i].pending == 0)
+            enqueue(i);
+
+    if (nThreads > (int)nodes.size())
+        nThreads = nodes.size();
+    vector<pthread_t> threads;
+    for (int i = 1; i < nThreads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, ReintegrationScheduler::workerRun, this) != 0)
+        {
+            ofslog::warning("Reintegration: could only start %d workers", i);
+            break;
+        }
+        threads.push_back(thread);
+    }
+    work();
+    for (vector<pthread_t>::iterator it = threads.begin(); it != threads.end(); it++)
+        pthread_join(*it, NULL);
+}
+
+void* ReintegrationScheduler::workerRun(void* scheduler)
+{
+    static_cast<ReintegrationScheduler*>(scheduler)->work();
+    return NULL;
+}
+
+void ReintegrationScheduler::work()
+{
+    pthread_mutex_lock(&mutex);
+    while (true)
+    {
+        while (ready.empty() && nUnfinished > 0)
+        {
+            if (nRunning == 0)
+                breakCycle();
+            else
+                pthread_cond_wait(&changed, &mutex);
+        }
+        if (ready.empty())
+            break;
+
+        int node = ready.front();
+        ready.pop_front();
+        bool skip = nodes[node].skip;
+        nRunning++;
+        pthread_mutex_unlock(&mutex);
+
+        bool ok = !skip && executor->execute(nodes[node].entry);
+
+        pthread_mutex_lock(&mutex);
+        nRunning--;
+        nUnfinished--;
+        if (skip)
+            nSkipped++;
+        else if (ok)
+            nExecuted++;
+        else
+            nFailed++;
+        for (list<int>::iterator it = nodes[node].dependents.begin();
+             it != nodes[node].dependents.end(); it++)
+        {
+            if (!ok)
+                nodes[*it].skip = true;
+            if (--nodes[*it].pending == 0 && !nodes[*it].queued)
+                enqueue(*it);
+        }
+        pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&mutex);
+}
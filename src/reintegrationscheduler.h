@@ -0,0 +1,115 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef REINTEGRATIONSCHEDULER_H
+#define REINTEGRATIONSCHEDULER_H
+
+#include "synclogentry.h"
+#include <pthread.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+/**
+ * Runs the entries of a sync log on a pool of worker threads.
+ *
+ * The entries are ordered by a dependency graph instead of the plain log
+ * order, so independent files can be reintegrated concurrently:
+ *   - an entry waits for the creation of all of its parent directories
+ *   - the deletion of a directory waits for all entries below it
+ *   - entries of the same path keep their log order
+ * If an entry fails, everything that depends on it is skipped and stays in
+ * the sync log for the next run.
+ */
+class ReintegrationScheduler
+{
+public:
+    /**
+     * Performs a single entry, called concurrently from the workers
+     */
+    class Executor
+    {
+    public:
+        virtual ~Executor() {}
+        /**
+         * @param sle entry to reintegrate
+         * @return false if the entry could not be reintegrated
+         */
+        virtual bool execute(SyncLogEntry& sle) = 0;
+    };
+
+    /**
+     * Build the dependency graph
+     * @param entries sync log entries in log order
+     */
+    explicit ReintegrationScheduler(const list<SyncLogEntry>& entries);
+    ~ReintegrationScheduler();
+
+    /**
+     * Run all entries and wait for them to finish. The calling thread
+     * takes part in the work, so one thread means serial execution.
+     * @param executor performs the entries
+     * @param nThreads maximum number of concurrent entries
+     */
+    void run(Executor& executor, int nThreads);
+
+    inline int getExecuted() const { return nExecuted; };
+    inline int getFailed() const { return nFailed; };
+    inline int getSkipped() const { return nSkipped; };
+
+private:
+    struct Node
+    {
+        explicit Node(const SyncLogEntry& sle)
+            : entry(sle), pending(0), queued(false), skip(false) {}
+        SyncLogEntry entry;
+        /// number of entries this one still waits for
+        int pending;
+        /// entries waiting for this one
+        list<int> dependents;
+        bool queued;
+        /// an entry this one depends on has failed
+        bool skip;
+    };
+
+    void addDependency(int node, int dependency);
+    void enqueue(int node);
+    void breakCycle();
+    void work();
+    static void* workerRun(void* scheduler);
+
+    vector<Node> nodes;
+    deque<int> ready;
+    Executor* executor;
+    int nUnfinished;
+    int nRunning;
+    int nExecuted;
+    int nFailed;
+    int nSkipped;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    ReintegrationScheduler(const ReintegrationScheduler&);
+    ReintegrationScheduler& operator=(const ReintegrationScheduler&);
+};
+
+#endif
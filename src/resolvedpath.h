@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RESOLVEDPATH_H
+#define RESOLVEDPATH_H
+#include <string>
+
+using namespace std;
+
+/**
+ * The location of one path of the share in the remote file system and
+ * in the cache, as resolved by the #Filestatusmanager.
+ *
+ * Instances are shared between all #File objects of the same path and
+ * between threads, so they are immutable and reference counted. The
+ * creator holds the first reference.
+ */
+class ResolvedPath {
+public:
+	/**
+	 * @param relative_path path relative to mountpoint
+	 * @param remote_path absolute path in mountpoint
+	 * @param cache_path absolute path in cache
+	 * @param offline_state should be available offline
+	 */
+	ResolvedPath(const string& relative_path, const string& remote_path,
+		const string& cache_path, bool offline_state) :
+		relative_path(relative_path), remote_path(remote_path),
+		cache_path(cache_path), offline_state(offline_state), refcount(1) {}
+
+	inline const string& get_relative_path() const { return relative_path; }
+	inline const string& get_remote_path() const { return remote_path; }
+	inline const string& get_cache_path() const { return cache_path; }
+	inline bool get_offline_state() const { return offline_state; }
+
+	/**
+	 * take another reference
+	 */
+	inline void acquire() { __sync_add_and_fetch(&refcount, 1); }
+	/**
+	 * drop a reference, the object is deleted with the last one
+	 */
+	inline void release()
+	{
+		if (__sync_sub_and_fetch(&refcount, 1) == 0)
+			delete this;
+	}
+	/**
+	 * is there any other reference than the caller's?
+	 */
+	inline bool is_shared() const { return refcount > 1; }
+
+private:
+	~ResolvedPath() {}
+	ResolvedPath(const ResolvedPath &);
+	ResolvedPath& operator =(const ResolvedPath &);
+
+	const string relative_path;
+	const string remote_path;
+	const string cache_path;
+	const bool offline_state;
+	volatile int refcount;
+};
+
+#endif
@@ -26,8 +26,16 @@
 #include "conflictmanager.h"
 #include "ofsenvironment.h"
 #include "synchronizationpersistence.h"
+#include "metastore.h"
 #include "ofsfile.h"
+#include "ofslog.h"
+#include "reintegrationscheduler.h"
+#include "filecopy.h"
+#include "dirtyextentmanager.h"
+#include "attrcache.h"
+#include "writebackthrottle.h"
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -39,6 +47,27 @@
 // Initializes the class attributes.
 std::auto_ptr<SynchronizationManager> SynchronizationManager::theSynchronizationManagerInstance;
 Mutex SynchronizationManager::m_mutex;
+pthread_once_t SynchronizationManager::instanceOnce = PTHREAD_ONCE_INIT;
+Mutex SynchronizationManager::m_reintegrationMutex;
+
+/**
+ * Passes the entries of the scheduler to ReintegrateEntry
+ */
+class EntryReintegrator : public ReintegrationScheduler::Executor
+{
+public:
+    EntryReintegrator(const char* pszHash, ReintegrationStats& stats, bool paced)
+        : m_pszHash(pszHash), m_stats(stats), m_paced(paced) {}
+    virtual bool execute(SyncLogEntry& sle)
+    {
+        WritebackThrottle::Scope pacing(m_paced);
+        return SynchronizationManager::Instance().ReintegrateEntry(m_pszHash, sle, m_stats);
+    }
+private:
+    const char* m_pszHash;
+    ReintegrationStats& m_stats;
+    bool m_paced;
+};
 
 //////////////////////////////////////////////////////////////////////////////
 // CONSTRUCTION/ DESTRUCTION
@@ -46,7 +75,7 @@ Mutex SynchronizationManager::m_mutex;
 
 SynchronizationManager::SynchronizationManager()
 {
-    reinstate();
+    memset(&lastStats, 0, sizeof(lastStats));
 }
 
 SynchronizationManager::~SynchronizationManager()
@@ -55,15 +84,15 @@ SynchronizationManager::~SynchronizationManager()
 
 SynchronizationManager& SynchronizationManager::Instance()
 {
-    MutexLocker obtainLock(m_mutex);
-    if (theSynchronizationManagerInstance.get() == 0)
-    {
-        theSynchronizationManagerInstance.reset(new SynchronizationManager);
-    }
-
+    pthread_once(&instanceOnce, createInstance);
     return *theSynchronizationManagerInstance;
 }
 
+void SynchronizationManager::createInstance()
+{
+    theSynchronizationManagerInstance.reset(new SynchronizationManager);
+}
+
 //syncstate SynchronizationManager::has_been_modified(string path)
 syncstate SynchronizationManager::has_been_modified(const File& fileInfo)
 {
@@ -121,12 +150,12 @@ syncstate SynchronizationManager::has_been_deleted(const File& fileInfo)
 
 void SynchronizationManager::persist() const
 {
-    SynchronizationPersistence::Instance().mtimes(mtimes);
+    SynchronizationPersistence::Instance().flush();
 }
 
 void SynchronizationManager::reinstate()
 {
-    mtimes = SynchronizationPersistence::Instance().mtimes();
+    // the times are looked up in the metadata store, nothing to load
 }
 
 
@@ -135,50 +164,113 @@ void SynchronizationManager::ReintegrateFile(const char* pszHash, const string&
 	ReintegrateFiles(pszHash, SyncLogger::Instance().GetEntries(pszHash, strFilePath));
 }
 
-void SynchronizationManager::ReintegrateAll(const char* pszHash)
+void SynchronizationManager::ReintegrateAll(const char* pszHash, bool paced)
+{
+	ReintegrateFiles(pszHash, SyncLogger::Instance().GetEntries(pszHash, ""), paced);
+}
+
+void SynchronizationManager::ReintegrateFiles(const char* pszHash, list<SyncLogEntry> listOfEntries,
+	bool paced)
 {
-	ReintegrateFiles(pszHash, SyncLogger::Instance().GetEntries(pszHash, ""));
+	if (listOfEntries.empty())
+		return;
+	MutexLocker obtainLock(m_reintegrationMutex);
+
+	ReintegrationStats stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.entries = listOfEntries.size();
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	ReintegrationScheduler scheduler(listOfEntries);
+	EntryReintegrator reintegrator(pszHash, stats, paced);
+	scheduler.run(reintegrator, OFSEnvironment::Instance().getSyncThreads());
+
+	gettimeofday(&end, NULL);
+	stats.seconds = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1000000.0;
+	stats.reintegrated = scheduler.getExecuted();
+	stats.failed = scheduler.getFailed() + scheduler.getSkipped();
+	double seconds = stats.seconds > 0 ? stats.seconds : 1e-6;
+	ofslog::info("Reintegrated %d of %d entries in %.2fs (%.1f files/s, %.1f KiB/s), %d conflicts, %d failed",
+		stats.reintegrated, stats.entries, stats.seconds,
+		stats.reintegrated / seconds, stats.bytes / 1024.0 / seconds,
+		stats.conflicts, stats.failed);
+
+	MutexLocker obtainStatsLock(m_mutex);
+	lastStats = stats;
 }
 
-void SynchronizationManager::ReintegrateFiles(const char* pszHash, list<SyncLogEntry> listOfEntries)
+bool SynchronizationManager::ReintegrateEntry(const char* pszHash, SyncLogEntry& sle, ReintegrationStats& stats)
 {
-	bool bOK;
-	for (list<SyncLogEntry>::iterator it = listOfEntries.begin();
-	   it != listOfEntries.end(); it++)
-//	const int nCount = (int)listOfEntries.size();
-//	for (int i = 0; i < nCount; i++)
+	File fileInfo ( Filestatusmanager::Instance()
+	                  .give_me_file(sle.GetFilePath().c_str())
+                      );
+	bool bConflict = false;
+	off_t nBytes = 0;
+	int nRet;
+	try
 	{
-		// TODO: Reintegrate the file.
-		SyncLogEntry& sle = *it;
-//		OFSFile file(sle.GetFilePath());
-		File fileInfo ( Filestatusmanager::Instance()
-		                  .give_me_file(sle.GetFilePath().c_str())
-                              );
 		switch (sle.GetModType())
 		{
 		case 'c':
-			CreateFile(fileInfo);
-			bOK = true; ///\todo What's that?
+			bConflict = (CreateFile(fileInfo, &nBytes) == 1);
 			break;
 		case 'm':
-			ModifyFile(fileInfo);
-			bOK = true; ///\todo What's that?
+			nRet = ModifyFile(fileInfo, &nBytes);
+			bConflict = (nRet == 1 || nRet == 2);
 			break;
 		case 'd':
-			DeleteFile(fileInfo);
-			bOK = true; ///\todo What's that?
+			nRet = DeleteFile(fileInfo);
+			if (nRet < 0)
+			{
+				// keep the entry, the entries depending on it wait as well
+				ofslog::error("Reintegration of %s failed: %s",
+					sle.GetFilePath().c_str(), strerror(-nRet));
+				return false;
+			}
+			bConflict = (nRet == 1);
 			break;
-		}
-		if (bOK)
-		{
-                    removemtime(fileInfo.get_relative_path());
-                    SyncLogger::Instance().RemoveEntry(pszHash, sle);
+		default:
+			ofslog::error("Unknown modification type '%c' for %s",
+				sle.GetModType(), sle.GetFilePath().c_str());
+			return false;
 		}
 	}
+	catch (OFSException& e)
+	{
+		ofslog::error("Reintegration of %s failed: %s",
+			sle.GetFilePath().c_str(), e.what());
+		return false;
+	}
+	if (bConflict)
+		__sync_fetch_and_add(&stats.conflicts, 1);
+	__sync_fetch_and_add(&stats.bytes, (long long)nBytes);
+
+	{
+		// the entry, its mtime and its dirty extents go away together, a
+		// crash can not leave a stale mtime for a reintegrated file
+		MetaStore::Transaction transaction;
+		DirtyExtentManager::Instance().remove(fileInfo.get_relative_path());
+		removemtime(fileInfo.get_relative_path());
+		SyncLogger::Instance().RemoveEntry(pszHash, sle);
+		if (!transaction.commit())
+			ofslog::error("Could not store reintegration of %s",
+				sle.GetFilePath().c_str());
+	}
+	// getattr reads the remote file from now on
+	AttrCache::Instance().invalidateTree(fileInfo.get_relative_path());
+	return true;
+}
+
+ReintegrationStats SynchronizationManager::getLastReintegrationStats()
+{
+	MutexLocker obtainLock(m_mutex);
+	return lastStats;
 }
 
 // TODO: return an enumeration type
-int SynchronizationManager::CreateFile(const File& fileInfo)
+int SynchronizationManager::CreateFile(const File& fileInfo, off_t* pBytesCopied)
 {
 	if (!fileInfo.get_availability() || !fileInfo.get_offline_state())
 		return 0;	// Nothing to do
@@ -211,11 +303,10 @@ int SynchronizationManager::CreateFile(const File& fileInfo)
             }
             else if (S_ISREG(fsCache.st_mode))
             {
-                int fdr = open(fileInfo.get_remote_path().c_str(),
-                    O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
-                if (fdr < 0)
-                    throw OFSException(strerror(errno), errno,true);
-                close(fdr);
+                off_t nBytes = FileCopy::copy(fileInfo.get_cache_path(),
+                    fileInfo.get_remote_path(), S_IRWXU);
+                if (pBytesCopied)
+                    *pBytesCopied = nBytes;
             }
             else if (S_ISLNK(fsCache.st_mode))
             {
@@ -255,7 +346,7 @@ int SynchronizationManager::CreateFile(const File& fileInfo)
 }
 
 // TODO: return an enumeration type
-int SynchronizationManager::ModifyFile(const File& fileInfo)
+int SynchronizationManager::ModifyFile(const File& fileInfo, off_t* pBytesCopied)
 {
 	if (!fileInfo.get_availability() || !fileInfo.get_offline_state())
 		return 0;	// Nothing to do
@@ -306,26 +397,55 @@ int SynchronizationManager::ModifyFile(const File& fileInfo)
 			}
 			else if (S_ISREG(fsCache.st_mode))
 			{
-				int fdr = open(fileInfo.get_remote_path().c_str(),
-					O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
-				if (fdr < 0)
-					throw OFSException(strerror(errno), errno,true);
-				int fdl = open(fileInfo.get_cache_path().c_str(),
-				 O_RDONLY);
-				if (fdl < 0)
-					throw OFSException(strerror(errno), errno,true);
-				char szBuf[1024];
-				ssize_t nBytesRead;
-				while((nBytesRead = read(fdl, szBuf, sizeof(szBuf))) > 0)
+				off_t nBytes = 0;
+				list<pair<off_t, off_t> > extents;
+				off_t shrunk;
+				if (S_ISREG(fsRemote.st_mode)
+				    && DirtyExtentManager::Instance().getExtents(fileInfo.get_relative_path(), extents, shrunk))
 				{
-					if (write(fdr, szBuf, nBytesRead) < 0)
-						throw OFSException(strerror(errno),
-						errno,true);
+					// only the changed ranges and the new size
+					int fdl = open(fileInfo.get_cache_path().c_str(), O_RDONLY);
+					if (fdl < 0)
+						throw OFSException(strerror(errno), errno,true);
+					int fdr = open(fileInfo.get_remote_path().c_str(), O_WRONLY);
+					if (fdr < 0)
+					{
+						int err = errno;
+						close(fdl);
+						throw OFSException(strerror(err), err,true);
+					}
+					try
+					{
+						// the cache reads zeros from there on unless a range says otherwise
+						if (shrunk >= 0 && shrunk < fsRemote.st_size
+						    && ftruncate(fdr, shrunk) < 0)
+							throw OFSException(strerror(errno), errno,true);
+						for (list<pair<off_t, off_t> >::iterator it = extents.begin();
+						     it != extents.end() && it->first < fsCache.st_size; it++)
+						{
+							off_t length = it->second;
+							if (it->first + length > fsCache.st_size)
+								length = fsCache.st_size - it->first;
+							FileCopy::copyRange(fdl, fdr, it->first, length);
+							nBytes += length;
+						}
+						if (ftruncate(fdr, fsCache.st_size) < 0)
+							throw OFSException(strerror(errno), errno,true);
+					}
+					catch (OFSException& e)
+					{
+						close(fdl);
+						close(fdr);
+						throw;
+					}
+					close(fdl);
+					if (close(fdr) < 0)
+						throw OFSException(strerror(errno), errno,true);
 				}
-				if (nBytesRead < 0)
-					throw new OFSException(strerror(errno), errno,true);
-				close(fdl);
-				close(fdr);
+				else
+					nBytes = FileCopy::copy(fileInfo.get_cache_path(), fileInfo.get_remote_path(), S_IRWXU);
+				if (pBytesCopied)
+					*pBytesCopied = nBytes;
 			}
 			else if (S_ISLNK(fsCache.st_mode))
 			{
@@ -404,27 +524,26 @@ int SynchronizationManager::DeleteFile(const File& fileInfo)
 
 void SynchronizationManager::addmtime(string path, time_t mtime)
 {
-    if(getmtime(path) == 0)
-        mtimes[path] = mtime;
-    persist();
+    MutexLocker obtainLock(m_mutex);
+    // the first time stays, there is nothing to write
+    if(getmtime(path) != 0)
+        return;
+    SynchronizationPersistence::Instance().add(path, mtime);
 }
 
 time_t SynchronizationManager::getmtime(string path)
 {
-    map<string, time_t>::iterator iter = mtimes.find(path);
-    if(iter == mtimes.end())
+    time_t mtime;
+    if(!SynchronizationPersistence::Instance().get(path, mtime))
         return 0;
-    return iter->second;
+    return mtime;
 }
 
 void SynchronizationManager::removemtime(string path)
 {
-    map<string, time_t>::iterator iter = mtimes.find(path);
-    if(iter != mtimes.end())
-    {
-        mtimes.erase(iter);
-        persist();
-    }
+    MutexLocker obtainLock(m_mutex);
+    if(getmtime(path) != 0)
+        SynchronizationPersistence::Instance().remove(path);
 }
 
 char * SynchronizationManager::readlink_alloc_buffer(const char * path) {
@@ -28,10 +28,30 @@
 #include <map>
 #include <string>
 #include <list>
+#include <sys/types.h>
 using namespace std;
 
 class SyncLogEntry;
 
+/**
+ * Statistics of one reintegration run
+ */
+struct ReintegrationStats
+{
+    /// number of sync log entries the run started with
+    int entries;
+    /// entries written back to the remote
+    int reintegrated;
+    /// entries that ended in a conflict
+    int conflicts;
+    /// entries that failed or were skipped and remain in the log
+    int failed;
+    /// bytes of file content copied to the remote
+    long long bytes;
+    /// duration of the run in seconds
+    double seconds;
+};
+
 /**
 	@author Carsten Kolassa <Carsten@Kolassa.de>,Frank Gsellmann <frank.gsellmann@gmx.de>
 */
@@ -60,11 +80,13 @@ public:
     syncstate store_state(string path);
     ~SynchronizationManager();
     /**
-     * Writes the local states to the disk
+     * Writes the local states to the disk. They are stored by addmtime()
+     * and removemtime() already, this only waits until they are durable.
      */
     virtual void persist() const;
     /**
-     * Reads the local states from the disk
+     * Reads the local states from the disk. The modification times are
+     * read from the metadata store when they are needed.
      */
     virtual void reinstate();
     /**
@@ -77,11 +99,25 @@ public:
     /**
      * Updates all files on the server.
      * @param pszHash (in): pointer to a string that contains the hash value
+     * @param paced (in): pace the copies by the WritebackThrottle
      * @return 
      */
-    void ReintegrateAll(const char* pszHash);
+    void ReintegrateAll(const char* pszHash, bool paced = false);
+    /**
+     * Updates the file of a single sync log entry on the server and
+     * removes the entry from the log.
+     * @param pszHash (in): pointer to a string that contains the hash value
+     * @param sle (in): entry to reintegrate
+     * @param stats (in/out): statistics of the current run
+     * @return false if the entry could not be reintegrated
+     */
+    bool ReintegrateEntry(const char* pszHash, SyncLogEntry& sle, ReintegrationStats& stats);
+    /**
+     * Returns the statistics of the last reintegration run
+     */
+    ReintegrationStats getLastReintegrationStats();
     /**
-     * Add a new modification time entry
+     * Add a new modification time entry, an existing one is kept
      * @param path 
      * @param mtime 
      */
@@ -102,14 +138,19 @@ public:
 
 protected:
     SynchronizationManager();
-    void ReintegrateFiles(const char* pszHash, list<SyncLogEntry> listOfEntries);
-    int CreateFile(const File& fileInfo);
-    int ModifyFile(const File& fileInfo);
+    void ReintegrateFiles(const char* pszHash, list<SyncLogEntry> listOfEntries,
+                          bool paced = false);
+    int CreateFile(const File& fileInfo, off_t* pBytesCopied = NULL);
+    int ModifyFile(const File& fileInfo, off_t* pBytesCopied = NULL);
     int DeleteFile(const File& fileInfo);
 private:
-    map<string,time_t> mtimes;
+    ReintegrationStats lastStats;
     static std::auto_ptr<SynchronizationManager> theSynchronizationManagerInstance;
     static Mutex m_mutex;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
+    /// only one reintegration run at a time
+    static Mutex m_reintegrationMutex;
     char * readlink_alloc_buffer(const char * path);
 };
 
@@ -18,16 +18,52 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "synchronizationpersistence.h"
+#include "metastore.h"
+#include "journal.h"
+#include "ofslog.h"
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <sstream>
 using namespace std;
 
+// Record types of the modification time journal of older versions.
+#define MTIME_RECORD_SET 1
+#define MTIME_RECORD_REMOVE 2
+
+/**
+ * Collects the modification times of an old journal.
+ */
+class MtimeJournalReplay : public Journal::Visitor
+{
+public:
+	virtual void record(unsigned int type, const string& payload)
+	{
+		if (type == MTIME_RECORD_REMOVE)
+		{
+			mtimes.erase(payload);
+		}
+		else if (type == MTIME_RECORD_SET && payload.size() > sizeof(int64_t))
+		{
+			int64_t nMtime;
+			memcpy(&nMtime, payload.data(), sizeof(nMtime));
+			mtimes[payload.substr(sizeof(nMtime))] = nMtime;
+		}
+	}
+	map<string,time_t> mtimes;
+};
+
 std::auto_ptr<SynchronizationPersistence> SynchronizationPersistence::theSynchronizationPersistenceInstance;
 Mutex SynchronizationPersistence::m;
+pthread_once_t SynchronizationPersistence::instanceOnce = PTHREAD_ONCE_INIT;
 
 SynchronizationPersistence::SynchronizationPersistence() :
-    PersistenceManager(PERSISTENCE_MODULE_NAME)
+    PersistenceManager(PERSISTENCE_MODULE_NAME), unsynced(0),
+    lastSync(time(NULL)), lastSeq(0)
 {
 }
 
@@ -38,14 +74,18 @@ SynchronizationPersistence::~SynchronizationPersistence()
 
 SynchronizationPersistence& SynchronizationPersistence::Instance()
 {
-    MutexLocker obtain_lock(m);
-    if (theSynchronizationPersistenceInstance.get() == 0) {
-    	theSynchronizationPersistenceInstance.reset(new SynchronizationPersistence());
-        theSynchronizationPersistenceInstance->init();
-    }
+    // looked up for every modification time, so it does not lock
+    pthread_once(&instanceOnce, createInstance);
     return *theSynchronizationPersistenceInstance;
 }
 
+void SynchronizationPersistence::createInstance()
+{
+    theSynchronizationPersistenceInstance.reset(new SynchronizationPersistence());
+    theSynchronizationPersistenceInstance->init();
+    theSynchronizationPersistenceInstance->migrate_journal();
+}
+
 
 cfg_opt_t *SynchronizationPersistence::init_parser()
 {
@@ -56,35 +96,129 @@ cfg_opt_t *SynchronizationPersistence::init_parser()
 	return opts;
 }
 
-string SynchronizationPersistence::get_persistence()
+void SynchronizationPersistence::get_records(map<string, string>& records)
 {
-	stringstream pers;
-	pers << CONFIGKEY_MTIMES << " = {" << endl;
 	map<string,time_t>::iterator it;
-	bool first = true;
 	for ( it=mtimemap.begin() ; it != mtimemap.end(); it++ ) {
-		if(first)
-			first = false;
-		else
-			pers << "," << endl;
-		pers << "\"" << it->first << "\"," << endl;
-		pers << it->second;
+		stringstream mtime;
+		mtime << it->second;
+		records[it->first] = mtime.str();
 	}
-	pers << endl << "}" << endl;
-	return pers.str();
+}
+
+void SynchronizationPersistence::set_records(const map<string, string>& records)
+{
+	mtimemap.clear();
+	map<string, string>::const_iterator it;
+	for ( it=records.begin() ; it != records.end(); it++ )
+		mtimemap[it->first] = atol(it->second.c_str());
 }
 
 
 map<string,time_t> SynchronizationPersistence::mtimes()
 {
+	MutexLocker obtain_lock(m);
 	reload();
-	return mtimemap;
+	map<string,time_t> result;
+	result.swap(mtimemap);
+	return result;
 }
 
 void SynchronizationPersistence::mtimes(const map<string,time_t> modtimes)
 {
+	MutexLocker obtain_lock(m);
 	mtimemap = modtimes;
 	make_persistent();
+	mtimemap.clear();
+}
+
+bool SynchronizationPersistence::get(const string& path, time_t& mtime)
+{
+	string value;
+	if (!MetaStore::Instance().get(get_prefix() + path, value))
+		return false;
+	mtime = atol(value.c_str());
+	return true;
+}
+
+void SynchronizationPersistence::add(const string& path, time_t mtime)
+{
+	stringstream value;
+	value << mtime;
+	MetaStore::Batch batch;
+	batch.put(get_prefix() + path, value.str());
+	MutexLocker obtain_lock(m);
+	stored(MetaStore::Instance().apply(batch));
+}
+
+void SynchronizationPersistence::remove(const string& path)
+{
+	MetaStore::Batch batch;
+	batch.remove(get_prefix() + path);
+	MutexLocker obtain_lock(m);
+	stored(MetaStore::Instance().apply(batch));
+}
+
+void SynchronizationPersistence::stored(unsigned long long seq)
+{
+	// inside a transaction the change is written when it ends
+	if (seq == 0)
+		return;
+	lastSeq = seq;
+	unsynced++;
+	if (!MetaStore::Instance().write(seq)) {
+		ofslog::error("Could not write modification time");
+		return;
+	}
+	if (unsynced >= MTIME_SYNC_RECORDS
+	    || time(NULL) - lastSync >= MTIME_SYNC_INTERVAL)
+		flush();
+}
+
+void SynchronizationPersistence::flush()
+{
+	MutexLocker obtain_lock(m);
+	if (unsynced == 0)
+		return;
+	if (MetaStore::Instance().sync(lastSeq))
+		unsynced = 0;
+	lastSync = time(NULL);
+}
+
+/**
+ * Move the modification time journal of the previous version into the
+ * metadata store.
+ */
+void SynchronizationPersistence::migrate_journal()
+{
+	string filename = get_filename() + ".journal";
+	struct stat fileinfo;
+	if (lstat(filename.c_str(), &fileinfo) < 0)
+		return;
+
+	Journal journal(filename);
+	MtimeJournalReplay replay;
+	if (!journal.open() || !journal.replay(replay)) {
+		ofslog::error("Could not read %s for migration", filename.c_str());
+		return;
+	}
+	journal.close();
+	MetaStore::Batch batch;
+	map<string,time_t>::iterator it;
+	for (it = replay.mtimes.begin(); it != replay.mtimes.end(); it++) {
+		stringstream mtime;
+		mtime << it->second;
+		batch.put(get_prefix() + it->first, mtime.str());
+	}
+	if (!MetaStore::Instance().commit(batch))
+		return;
+
+	string migrated = filename + ".migrated";
+	if (rename(filename.c_str(), migrated.c_str()) < 0)
+		ofslog::warning("Could not rename migrated file %s: %s",
+			filename.c_str(), strerror(errno));
+	ofslog::info("Migrated %lu modification times from %s",
+		(unsigned long)replay.mtimes.size(), filename.c_str());
 }
 
 void SynchronizationPersistence::read_values()
@@ -23,13 +23,23 @@
 #include "mutexlocker.h"
 #include <map>
 #include <memory>
+#include <time.h>
 using namespace std;
 
 #define CONFIGKEY_MTIMES "mtimes"
 #define PERSISTENCE_MODULE_NAME "synchronization"
 
+// Changes are forced to disk after this many records or seconds, whatever
+// comes first. Until then they are only in the page cache.
+#define MTIME_SYNC_RECORDS 256
+#define MTIME_SYNC_INTERVAL 5
+
 /**
 	@author Tobias Jaehnel <tjaehnel@gmail.com>
+
+	The times are looked up with get() and stored with add() and
+	remove() one at a time, they are never loaded all at once.
+	mtimes() with a map writes the differences to the stored times.
 */
 class SynchronizationPersistence : public PersistenceManager {
 public:
@@ -49,18 +59,50 @@ public:
      * @return list of modification times per file
      */
     map<string,time_t> mtimes();
+    /**
+     * look up a single modification time
+     * @param path relative path of the file
+     * @param mtime receives the modification time
+     * @return false if there is none for the file
+     */
+    bool get(const string& path, time_t& mtime);
+    /**
+     * store a single modification time
+     * @param path relative path of the file
+     * @param mtime modification time
+     */
+    void add(const string& path, time_t mtime);
+    /**
+     * remove a single modification time
+     * @param path relative path of the file
+     */
+    void remove(const string& path);
+    /**
+     * force all stored changes to disk
+     */
+    void flush();
 protected:
     SynchronizationPersistence();
     virtual cfg_opt_t * init_parser();
-    virtual string get_persistence();
+    virtual void get_records(map<string, string>& records);
+    virtual void set_records(const map<string, string>& records);
     virtual void read_values();
 
 private:
+    void migrate_journal();
+    void stored(unsigned long long seq);
+
     map<string,time_t> mtimemap;
+    /// changes written since the last fdatasync
+    int unsynced;
+    time_t lastSync;
+    unsigned long long lastSeq;
 
     static std::auto_ptr<SynchronizationPersistence> 
         theSynchronizationPersistenceInstance;
     static Mutex m;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 
 
 };
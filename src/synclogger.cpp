@@ -19,11 +19,17 @@
  ***************************************************************************/
 
 #include "synclogger.h"
+#include "dirtyextentmanager.h"
 
 #include "synclogentry.h"
 #include "confuse.h"
 #include "ofsexception.h"
 #include "ofsenvironment.h"
+#include "ofslog.h"
+#include "journal.h"
+#include "metastore.h"
+#include "ofsstats.h"
+#include "filesystemstatusmanager.h"
 
 #include <cstdlib>
 #include <cstdio>
@@ -36,6 +42,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 
 #define FILE_PATH_VARNAME "filePath"
 #define MOD_TIME_VARNAME "modTime"
@@ -47,10 +54,88 @@
 #define MOD_TIME_DEFAULT "0000/00/00 25:00:00"
 #define MOD_TYPE_DEFAULT "e"
 
+// Record types of the binary sync journal of older versions.
+#define SYNC_RECORD_ENTRY 1
+#define SYNC_RECORD_TOMBSTONE 2
+
+// Prefix of the entries in the metadata store, followed by the hash of the
+// share and the zero padded modification number.
+#define SYNC_KEY_PREFIX "synclog/"
+
+//////////////////////////////////////////////////////////////////////////////
+// STORED ENTRIES
+//////////////////////////////////////////////////////////////////////////////
+
+static string EntryPrefix(const char* pszHash)
+{
+	return string(SYNC_KEY_PREFIX) + pszHash + "/";
+}
+
+// numbers are padded so the keys sort in log order
+static string EntryKey(const char* pszHash, int nNumber)
+{
+	char szNumber[16];
+	snprintf(szNumber, sizeof(szNumber), "%010d", nNumber);
+	return EntryPrefix(pszHash) + szNumber;
+}
+
+// entry value: modNumber (int32), modTime (int64), modType (char), filePath
+static string EncodeEntry(const SyncLogEntry& sle)
+{
+	int32_t nNumber = sle.GetNumber();
+	int64_t nModTime = atol(sle.GetModTime().c_str());
+	char chType = sle.GetModType();
+	string payload;
+	payload.append((const char*)&nNumber, sizeof(nNumber));
+	payload.append((const char*)&nModTime, sizeof(nModTime));
+	payload.append(&chType, sizeof(chType));
+	payload.append(sle.GetFilePath());
+	return payload;
+}
+
+// adds the encoded entry to the map, replacing one with the same number
+static void DecodeEntry(const string& payload, map<int, SyncLogEntry>& entries)
+{
+	int32_t nNumber;
+	int64_t nModTime;
+	if (payload.size() <= sizeof(nNumber) + sizeof(nModTime) + 1)
+		return;
+	memcpy(&nNumber, payload.data(), sizeof(nNumber));
+	memcpy(&nModTime, payload.data() + sizeof(nNumber), sizeof(nModTime));
+	char chType = payload[sizeof(nNumber) + sizeof(nModTime)];
+	ostringstream ostTime;
+	ostTime << nModTime;
+	entries.erase(nNumber);
+	entries.insert(pair<int, SyncLogEntry>(nNumber,
+		SyncLogEntry(payload.substr(sizeof(nNumber) + sizeof(nModTime) + 1),
+			ostTime.str(), chType, nNumber)));
+}
+
+/**
+ * Collects the live entries of an old sync journal.
+ */
+class SyncJournalReplay : public Journal::Visitor
+{
+public:
+	virtual void record(unsigned int type, const string& payload)
+	{
+		int32_t nNumber;
+		if (payload.size() < sizeof(nNumber))
+			return;
+		memcpy(&nNumber, payload.data(), sizeof(nNumber));
+		if (type == SYNC_RECORD_TOMBSTONE)
+			m_entries.erase(nNumber);
+		else if (type == SYNC_RECORD_ENTRY)
+			DecodeEntry(payload, m_entries);
+	}
+	map<int, SyncLogEntry> m_entries;
+};
+
 
 // Initializes the class attributes.
 std::auto_ptr<SyncLogger> SyncLogger::theSyncLoggerInstance;
 Mutex SyncLogger::m_mutex;
+pthread_once_t SyncLogger::instanceOnce = PTHREAD_ONCE_INIT;
 
 //////////////////////////////////////////////////////////////////////////////
 // CONSTRUCTION/ DESTRUCTION
@@ -69,81 +154,77 @@ SyncLogger::~SyncLogger()
 
 SyncLogger& SyncLogger::Instance()
 {
-    MutexLocker obtainLock(m_mutex);
-    if (theSyncLoggerInstance.get() == 0)
-    {
-        theSyncLoggerInstance.reset(new SyncLogger);
-    }
-
+    pthread_once(&instanceOnce, createInstance);
     return *theSyncLoggerInstance;
 }
 
+void SyncLogger::createInstance()
+{
+    theSyncLoggerInstance.reset(new SyncLogger);
+}
+
 bool SyncLogger::AddEntry(const char* pszHash,
 						  const char* pszFilePath,
 						  const char chType)
 {
-    // modNumber 123
-	// {
-	//     filePath = ABC/XYZ.xyz
-	//     modTime = 00/00/00 25:00:00
-	//     modType = ?
-	// }
-
-    //oreiche
-    // every file needs only ONE syncentry
-    // depending on earlier entries
-    string strFilePath = pszFilePath;
-    char newType = getModDependingOnOtherEntries(pszHash, strFilePath, chType);
-    if (newType == 'x') //nothing to do
-        return false;
+	// Creating or deleting a path replaces its content, changes that were
+	// tracked for the old file do not describe the new one.
+	if (chType != 'm')
+		DirtyExtentManager::Instance().invalidate(pszFilePath);
+
+	// The entry and the removal of the entries it replaces are stored in
+	// the same batch.
+	MetaStore& store = MetaStore::Instance();
+	unsigned long long nSeq;
+	bool bAdded = false;
+	int nEntries;
+	{
+		MutexLocker obtainLock(m_mutex);
+		if (!LoadIndex(pszHash))
+			return false;
+
+		//oreiche
+		// every file needs only ONE syncentry
+		// depending on earlier entries
+		string strFilePath = pszFilePath;
+		MetaStore::Batch batch;
+		char newType = MergeWithOtherEntries(pszHash, strFilePath, chType, batch);
+		if (newType != 'x') //nothing to do
+		{
+			ostringstream ostTime;
+			ostTime << time(NULL);
+			SyncLogEntry sle(strFilePath, ostTime.str(), newType, m_nNewIndex);
+			batch.put(EntryKey(pszHash, m_nNewIndex), EncodeEntry(sle));
+			IndexEntry(sle);
+			m_nNewIndex++;
+			bAdded = true;
+		}
+		if (batch.empty())
+			return false;
+		nSeq = store.apply(batch);
+		nEntries = m_entriesByNumber.size();
+	}
+	OFSStats::count(OFSStats::SYNCLOG_APPENDS);
+	FilesystemStatusManager::Instance().setdirtyentries(nEntries);
 
-	fstream& logStream = *(OpenLogFile(pszHash, ios::app));
-	if (logStream == NULL)
+	// Waits for the group commit outside of the lock, so appends of other
+	// threads can join the same write.
+	if (!store.sync(nSeq))
 		return false;
-
-	// Writes new entry into sync log.
-	// TODO: define << operator in SyncLogEntry
-	logStream << MOD_NUMBER_VARNAME << " " << m_nNewIndex << endl;
-	logStream << "{" << endl;
-	logStream << "\t" << FILE_PATH_VARNAME << " = \"" << pszFilePath << "\"" << endl;
-	logStream << "\t" << MOD_TIME_VARNAME << " = " << time(NULL) << endl;
-	logStream << "\t" << MOD_TYPE_VARNAME << " = " << newType << endl;
-	logStream << "}" << endl << endl;
-    logStream.close();
-
-    m_nNewIndex++;
-
-    return true;
+	return bAdded;
 }
 
 
 SyncLogEntry SyncLogger::ReadFirstEntry(const char* pszHash)
 {
-	ParseFile(pszHash);
-
-	// Assures the correct parsing of the file.
-	assert(m_pCFG != NULL);
-
-//	cfg_t* pEntryCFG = cfg_getnsec(m_pCFG, MOD_NUMBER_VARNAME, 0);
-	return ReadEntry(cfg_getnsec(m_pCFG, MOD_NUMBER_VARNAME, 0));
-/*
-	// Assures that the section has been found, which means there is at least one section.
-    assert(pEntryCFG != NULL);
+	MutexLocker obtainLock(m_mutex);
+	if (!LoadIndex(pszHash))
+		throw OFSException("Synclogger parse error", 0, true);
 
-	// TODO: Copy values
-	SyncLogEntry sle;
-	sle.m_strFilePath = cfg_getstr(pEntryCFG, FILE_PATH_VARNAME);
-	sle.m_strModTime = cfg_getstr(pEntryCFG, MOD_TIME_VARNAME);
-	string strModType = cfg_getstr(pEntryCFG, MOD_TYPE_VARNAME);
-	if (strModType.length() != 1)
-	{
-		// The log entry does not meet the standard.
-		return NULL;
-	}
-	sle.m_chModType = strModType.c_str()[0];
+	// Assures that there is at least one entry.
+	assert(!m_entriesByNumber.empty());
 
-    return sle;
-*/
+	return m_entriesByNumber.begin()->second;
 }
 
 SyncLogEntry SyncLogger::ReadEntry(cfg_t* pEntryCFG)
@@ -190,6 +271,8 @@ bool SyncLogger::ParseFile(const char* pszHash)
     };
 
     // Initializes the parser.
+    if (m_pCFG != NULL)
+        cfg_free(m_pCFG);
     m_pCFG = cfg_init(entries, CFGF_NONE);
 
     // Parses the file.
@@ -210,98 +293,100 @@ void SyncLogger::CalcLogFileName(const char* pszHash, char* pszLogName)
 
 list<SyncLogEntry> SyncLogger::GetEntries(const char* pszHash, const string strFilePath)
 {
-	if(!ParseFile(pszHash)) 
+	MutexLocker obtainLock(m_mutex);
+	if(!LoadIndex(pszHash))
 	   throw OFSException("Synclogger parse error", 0,true);
 
-	// Assures the correct parsing of the file.
-	assert(m_pCFG != NULL);
-
 	list<SyncLogEntry> listOfEntries;
-	const int nCount = cfg_size(m_pCFG, MOD_NUMBER_VARNAME);
-	for (int i = 0; i < nCount; i++)
+	if (strFilePath == "")
 	{
-		SyncLogEntry sle = ReadEntry(cfg_getnsec(m_pCFG, MOD_NUMBER_VARNAME, i));
-		if (strFilePath == "" || sle == strFilePath)
-			listOfEntries.push_back(sle);
+		for (map<int, SyncLogEntry>::iterator it = m_entriesByNumber.begin();
+		     it != m_entriesByNumber.end(); ++it)
+			listOfEntries.push_back(it->second);
+		return listOfEntries;
 	}
+
+	// Entries of one path are indexed in log order.
+	pair<multimap<string, int>::iterator, multimap<string, int>::iterator>
+		range = m_entriesByPath.equal_range(strFilePath);
+	for (multimap<string, int>::iterator it = range.first;
+	     it != range.second; ++it)
+		listOfEntries.push_back(m_entriesByNumber.find(it->second)->second);
 	return listOfEntries;
 }
 
 bool SyncLogger::RemoveEntry(const char* pszHash, SyncLogEntry& sle)
 {
-	struct stat fileinfo;
-	char szLogName[MAX_PATH];
-	CalcLogFileName(pszHash, szLogName);
-	int nRet = lstat(szLogName, &fileinfo);
-	if (nRet < 0 && errno == ENOENT)
-		throw OFSException(strerror(errno), errno);
-
-	char* pszBuffer = new char[fileinfo.st_size];
-
-	// Opens the sync log file for reading.
-	fstream& logStream = *(OpenLogFile(pszHash, ios::in));
-	//if (logStream == NULL)
-	//	return false;
-
-	logStream.read(pszBuffer, fileinfo.st_size);
-	logStream.close();
-
-	// Looks for the begin of the entry.
-	ostringstream ost;
-	ost << MOD_NUMBER_VARNAME << " " << sle.GetNumber();
-
-	char* pszEntry = strstr(pszBuffer, ost.str().c_str());
-
-	if (pszEntry == NULL)
+	MetaStore& store = MetaStore::Instance();
+	unsigned long long nSeq;
+	int nEntries;
 	{
-		// Entry already removed, nothing to do
-		delete[] pszBuffer;
-		return true;
-	}
-	int nEntryBegin = pszEntry - pszBuffer;
+		MutexLocker obtainLock(m_mutex);
+		if (!LoadIndex(pszHash))
+			throw OFSException("Synclogger parse error", 0, true);
+
+		if (m_entriesByNumber.find(sle.GetNumber()) == m_entriesByNumber.end())
+		{
+			// Entry already removed, nothing to do
+			return true;
+		}
+		UnindexEntry(sle);
 
-	// Looks for the end of the entry.
-	// FIXME: breaks on '}' in file path
-	pszEntry = strstr(pszEntry, "}");
+		MetaStore::Batch batch;
+		batch.remove(EntryKey(pszHash, sle.GetNumber()));
+		nSeq = store.apply(batch);
+		nEntries = m_entriesByNumber.size();
+	}
+	FilesystemStatusManager::Instance().setdirtyentries(nEntries);
+	return store.sync(nSeq);
+}
 
-	// Opens the sync log file for writing.
-	fstream& outStream = *(OpenLogFile(pszHash, ios::out));
-	//if (outStream == NULL)
-	//	return false;
+int SyncLogger::GetEntryCount(const char* pszHash)
+{
+	MutexLocker obtainLock(m_mutex);
+	if (!LoadIndex(pszHash))
+		throw OFSException("Synclogger parse error", 0, true);
 
-	outStream.write(pszBuffer,nEntryBegin);
-	// fwrite(pszBuffer, sizeof(char), nEntryBegin, logStream);
+	return m_entriesByNumber.size();
+}
 
-	if (pszEntry != NULL)
+char SyncLogger::getModDependingOnOtherEntries(const char* pszHash, const string strFilePath, const char chType) {
+	MetaStore& store = MetaStore::Instance();
+	unsigned long long nSeq;
+	char modType;
 	{
-		// Entry removed, write rest
-		int nEntryEnd = pszEntry - pszBuffer;
-		outStream.write(pszBuffer, fileinfo.st_size - nEntryEnd-1);
-		//fwrite(pszEntry+1, sizeof(char), fileinfo.st_size - nEntryEnd-1, logStream);
+		MutexLocker obtainLock(m_mutex);
+		if (!LoadIndex(pszHash))
+			throw OFSException("Synclogger parse error", 0, true);
+		MetaStore::Batch batch;
+		modType = MergeWithOtherEntries(pszHash, strFilePath, chType, batch);
+		if (batch.empty())
+			return modType;
+		nSeq = store.apply(batch);
 	}
-
-	outStream.close();
-
-	delete[] pszBuffer;
-
-	return true;
+	store.sync(nSeq);
+	return modType;
 }
 
-char SyncLogger::getModDependingOnOtherEntries(const char* pszHash, const string strFilePath, const char chType) {
-	/* get the whole list with iterator */
-	list<SyncLogEntry> entrylist = GetEntries(pszHash, strFilePath);
+char SyncLogger::MergeWithOtherEntries(const char* pszHash, const string& strFilePath,
+                                       const char chType, MetaStore::Batch& batch) {
+	/* get the entries of the given path in log order */
+	pair<multimap<string, int>::iterator, multimap<string, int>::iterator>
+		range = m_entriesByPath.equal_range(strFilePath);
+	list<SyncLogEntry> entrylist;
+	for (multimap<string, int>::iterator it = range.first; it != range.second; ++it)
+		entrylist.push_back(m_entriesByNumber.find(it->second)->second);
 	list<SyncLogEntry>::iterator iter;
 	char modType = (char)0;
 
-	/* search for entries on given path and delete ALL... */
+	/* delete ALL entries on given path... */
 	for (iter = entrylist.begin(); iter != entrylist.end(); iter++) {
-		SyncLogEntry sle = (SyncLogEntry)*iter;
-		if (sle == strFilePath) {
-			/* ... but store FIRST modification type */
-			if ((int)modType == 0)
-				modType = sle.GetModType();
-			RemoveEntry(pszHash, sle);
-		}
+		SyncLogEntry& sle = *iter;
+		/* ... but store FIRST modification type */
+		if ((int)modType == 0)
+			modType = sle.GetModType();
+		UnindexEntry(sle);
+		batch.remove(EntryKey(pszHash, sle.GetNumber()));
 	}
 	
 	/* determine the correct modtype of the entry */
@@ -344,3 +429,170 @@ bool SyncLogger::deleteOtherEntries(const char* pszHash) {
 	return false;
 }
 
+void SyncLogger::CalcJournalFileName(const char* pszHash, char* pszJournalName)
+{
+    strcpy(pszJournalName, OFSEnvironment::Instance().getOfsDir().c_str());
+    strcat(pszJournalName, "/Sync_");
+    strcat(pszJournalName, pszHash);
+    strcat(pszJournalName, ".journal");
+}
+
+bool SyncLogger::LoadIndex(const char* pszHash)
+{
+	MutexLocker obtainLock(m_mutex);
+	if (m_strIndexedShare == pszHash)
+	{
+		// Index is resident, there is no need to read the journal again.
+		return true;
+	}
+
+	m_entriesByNumber.clear();
+	m_entriesByPath.clear();
+
+	if (!MigrateJournal(pszHash) || !MigrateTextLog(pszHash))
+		return false;
+
+	map<string, string> values;
+	MetaStore::Instance().scan(EntryPrefix(pszHash), values);
+	map<int, SyncLogEntry> entries;
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it)
+		DecodeEntry(it->second, entries);
+
+	m_nNewIndex = 0;
+	for (map<int, SyncLogEntry>::iterator it = entries.begin();
+	     it != entries.end(); ++it)
+	{
+		IndexEntry(it->second);
+		// Continues numbering after the highest number in the log, otherwise
+		// RemoveEntry could hit an old entry with the same number.
+		if (it->first >= m_nNewIndex)
+			m_nNewIndex = it->first + 1;
+	}
+
+	m_strIndexedShare = pszHash;
+	return true;
+}
+
+bool SyncLogger::MigrateTextLog(const char* pszHash)
+{
+	char szLogName[MAX_PATH];
+	CalcLogFileName(pszHash, szLogName);
+	struct stat fileinfo;
+	if (lstat(szLogName, &fileinfo) < 0)
+		return true;	// nothing to migrate
+
+	m_szCurShare[0] = '\0';
+	if (!ParseFile(pszHash))
+	{
+		ofslog::error("Could not parse sync log %s for migration", szLogName);
+		return false;
+	}
+
+	// Assures the correct parsing of the file.
+	assert(m_pCFG != NULL);
+
+	MetaStore::Batch batch;
+	const int nCount = cfg_size(m_pCFG, MOD_NUMBER_VARNAME);
+	for (int i = 0; i < nCount; i++)
+	{
+		SyncLogEntry sle = ReadEntry(cfg_getnsec(m_pCFG, MOD_NUMBER_VARNAME, i));
+		batch.put(EntryKey(pszHash, sle.GetNumber()), EncodeEntry(sle));
+	}
+
+	// The parsed configuration is not needed anymore.
+	cfg_free(m_pCFG);
+	m_pCFG = NULL;
+
+	if (!MetaStore::Instance().commit(batch))
+		return false;
+
+	// Keeps the old log for reference, it is not read anymore.
+	string strMigrated = string(szLogName) + ".migrated";
+	if (rename(szLogName, strMigrated.c_str()) < 0)
+		ofslog::warning("Could not rename migrated sync log %s: %s", szLogName, strerror(errno));
+	ofslog::info("Migrated %d entries from %s to the metadata store", nCount, szLogName);
+	return true;
+}
+
+bool SyncLogger::MigrateJournal(const char* pszHash)
+{
+	char szJournalName[MAX_PATH];
+	CalcJournalFileName(pszHash, szJournalName);
+	struct stat fileinfo;
+	if (lstat(szJournalName, &fileinfo) < 0)
+		return true;	// nothing to migrate
+
+	Journal journal(szJournalName);
+	SyncJournalReplay replay;
+	if (!journal.open() || !journal.replay(replay))
+	{
+		ofslog::error("Could not read sync journal %s for migration", szJournalName);
+		return false;
+	}
+	journal.close();
+
+	MetaStore::Batch batch;
+	for (map<int, SyncLogEntry>::iterator it = replay.m_entries.begin();
+	     it != replay.m_entries.end(); ++it)
+		batch.put(EntryKey(pszHash, it->first), EncodeEntry(it->second));
+	if (!MetaStore::Instance().commit(batch))
+		return false;
+
+	string strMigrated = string(szJournalName) + ".migrated";
+	if (rename(szJournalName, strMigrated.c_str()) < 0)
+		ofslog::warning("Could not rename migrated sync journal %s: %s", szJournalName, strerror(errno));
+	ofslog::info("Migrated %lu entries from %s to the metadata store",
+		(unsigned long)replay.m_entries.size(), szJournalName);
+	return true;
+}
+
+bool SyncLogger::IsDirty(const char* pszHash, const string& strFilePath)
+{
+	MutexLocker obtainLock(m_mutex);
+	if (!LoadIndex(pszHash))
+		throw OFSException("Synclogger parse error", 0, true);
+
+	return m_entriesByPath.find(strFilePath) != m_entriesByPath.end();
+}
+
+bool SyncLogger::HasDirtyBelow(const char* pszHash, const string& strDirPath)
+{
+	MutexLocker obtainLock(m_mutex);
+	if (!LoadIndex(pszHash))
+		throw OFSException("Synclogger parse error", 0, true);
+
+	if (m_entriesByPath.find(strDirPath) != m_entriesByPath.end())
+		return true;
+
+	// All descendants sort directly behind "<dir>/", so the first path not
+	// less than that prefix decides.
+	string strPrefix = strDirPath;
+	if (strPrefix.length() == 0 || strPrefix[strPrefix.length() - 1] != '/')
+		strPrefix += '/';
+	multimap<string, int>::iterator it = m_entriesByPath.lower_bound(strPrefix);
+	return it != m_entriesByPath.end()
+		&& it->first.compare(0, strPrefix.length(), strPrefix) == 0;
+}
+
+void SyncLogger::IndexEntry(const SyncLogEntry& sle)
+{
+	m_entriesByNumber.insert(pair<int, SyncLogEntry>(sle.GetNumber(), sle));
+	m_entriesByPath.insert(pair<string, int>(sle.GetFilePath(), sle.GetNumber()));
+}
+
+void SyncLogger::UnindexEntry(SyncLogEntry& sle)
+{
+	m_entriesByNumber.erase(sle.GetNumber());
+	pair<multimap<string, int>::iterator, multimap<string, int>::iterator>
+		range = m_entriesByPath.equal_range(sle.GetFilePath());
+	for (multimap<string, int>::iterator it = range.first;
+	     it != range.second; ++it)
+	{
+		if (it->second == sle.GetNumber())
+		{
+			m_entriesByPath.erase(it);
+			break;
+		}
+	}
+}
+
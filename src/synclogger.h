@@ -36,9 +36,11 @@ using namespace std;
 
 
 #include "logger.h"
+#include "metastore.h"
 
 #include <string>
 #include <list>
+#include <map>
 using namespace std;
 
 struct cfg_t;
@@ -59,15 +61,78 @@ public:
     virtual bool RemoveEntry(const char* pszHash, SyncLogEntry& sle);
     virtual char getModDependingOnOtherEntries(const char* pszHash, const string strFilePath,const char chType); //oreiche	
     virtual bool deleteOtherEntries(const char* pszHash);
+    /**
+     * Loads the sync log of the given share into the resident index.
+     * The log file is only parsed if the index currently holds another
+     * share, afterwards all queries are answered from memory and
+     * AddEntry/RemoveEntry keep the index up to date.
+     * @param pszHash (in): hash value of the share
+     * @return false if the log file could not be parsed
+     */
+    virtual bool LoadIndex(const char* pszHash);
+    /**
+     * Checks if there is a pending modification for the given path.
+     * @param pszHash (in): hash value of the share
+     * @param strFilePath (in): path relative to the share root
+     * @return true if the path has a sync log entry
+     */
+    virtual bool IsDirty(const char* pszHash, const string& strFilePath);
+    /**
+     * Checks if there is a pending modification for the given directory
+     * or anything below it.
+     * @param pszHash (in): hash value of the share
+     * @param strDirPath (in): directory path relative to the share root
+     * @return true if the directory or one of its descendants is dirty
+     */
+    virtual bool HasDirtyBelow(const char* pszHash, const string& strDirPath);
+    /**
+     * Counts the pending modifications.
+     * @param pszHash (in): hash value of the share
+     * @return number of sync log entries
+     */
+    virtual int GetEntryCount(const char* pszHash);
 
 protected:
     SyncLogger();
     SyncLogEntry ReadEntry(cfg_t* pEntryCFG);
+    void IndexEntry(const SyncLogEntry& sle);
+    void UnindexEntry(SyncLogEntry& sle);
+    /**
+     * Removes all entries of the given path from the index and determines
+     * the modification type of the merged entry.
+     * @param pszHash (in): hash value of the share
+     * @param strFilePath (in): path relative to the share root
+     * @param chType (in): type of the new modification
+     * @param batch (out): receives the removal of the old entries
+     * @return merged modification type, 'x' if nothing is left to do
+     */
+    char MergeWithOtherEntries(const char* pszHash, const string& strFilePath,
+                               const char chType, MetaStore::Batch& batch);
+    /**
+     * Calculates the file name of the binary sync journal of older versions
+     */
+    void CalcJournalFileName(const char* pszHash, char* pszJournalName);
+    /**
+     * Moves the libconfuse sync log of older versions into the metadata store
+     */
+    bool MigrateTextLog(const char* pszHash);
+    /**
+     * Moves the binary sync journal of older versions into the metadata store
+     */
+    bool MigrateJournal(const char* pszHash);
 protected:
 //    FILE* m_pFile;
 private:
+    /// share the index has been loaded for
+    string m_strIndexedShare;
+    /// all pending entries in log order, keyed by modification number
+    map<int, SyncLogEntry> m_entriesByNumber;
+    /// modification numbers by file path, sorted for prefix queries
+    multimap<string, int> m_entriesByPath;
     static std::auto_ptr<SyncLogger> theSyncLoggerInstance;
     static Mutex m_mutex;
+    static pthread_once_t instanceOnce;
+    static void createInstance();
 };
 
 #include "synclogentry.h"
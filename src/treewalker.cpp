@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "treewalker.h"
+#include "ofsexception.h"
+#include "ofslog.h"
+
+TreeWalker::TreeWalker(const string& name)
+    : name(name), visitor(NULL), nQueued(0), nRunning(0),
+      nDirectories(0), nFiles(0), lastProgress(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+}
+
+TreeWalker::~TreeWalker()
+{
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+void TreeWalker::run(Visitor& visitor, const string& root, int nThreads)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+    this->visitor = &visitor;
+    queues.assign(nThreads, deque<Task>());
+    queues[0].push_back(Task(root, true));
+    nQueued = 1;
+    lastProgress = time(NULL);
+
+    vector<Worker> workers(nThreads);
+    vector<pthread_t> threads;
+    for (int i = 0; i < nThreads; i++)
+    {
+        workers[i].walker = this;
+        workers[i].index = i;
+    }
+    for (int i = 1; i < nThreads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, TreeWalker::workerRun, &workers[i]) != 0)
+        {
+            ofslog::warning("%s: could only start %d workers", name.c_str(), i);
+            break;
+        }
+        threads.push_back(thread);
+    }
+    work(0);
+    for (vector<pthread_t>::iterator it = threads.begin(); it != threads.end(); it++)
+        pthread_join(*it, NULL);
+}
+
+void* TreeWalker::workerRun(void* worker)
+{
+    Worker* self = static_cast<Worker*>(worker);
+    self->walker->work(self->index);
+    return NULL;
+}
+
+/**
+ * Get the next task, the own queue first. Must be called with the
+ * mutex held.
+ */
+bool TreeWalker::take(int worker, Task& task)
+{
+    if (!queues[worker].empty())
+    {
+        task = queues[worker].back();
+        queues[worker].pop_back();
+        return true;
+    }
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        deque<Task>& victim = queues[(worker + i) % queues.size()];
+        if (!victim.empty())
+        {
+            task = victim.front();
+            victim.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void TreeWalker::work(int worker)
+{
+    Task task("", false);
+    pthread_mutex_lock(&mutex);
+    while (true)
+    {
+        if (take(worker, task))
+        {
+            nQueued--;
+            nRunning++;
+            pthread_mutex_unlock(&mutex);
+
+            process(worker, task);
+
+            pthread_mutex_lock(&mutex);
+            nRunning--;
+            reportProgress();
+            if (nQueued == 0 && nRunning == 0)
+                pthread_cond_broadcast(&changed);
+        }
+        // nothing left and nobody who could add something
+        else if (nRunning == 0)
+            break;
+        else
+            pthread_cond_wait(&changed, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void TreeWalker::process(int worker, const Task& task)
+{
+    try
+    {
+        if (task.directory)
+        {
+            list<string> subdirs;
+            list<string> files;
+            visitor->visitDirectory(task.path, subdirs, files);
+            __sync_fetch_and_add(&nDirectories, 1);
+            // the files are pushed last and thus taken first, so they
+            // are done before the walk goes deeper
+            push(worker, subdirs, true);
+            push(worker, files, false);
+        }
+        else
+        {
+            visitor->visitFile(task.path);
+            __sync_fetch_and_add(&nFiles, 1);
+        }
+    }
+    catch (OFSException& e)
+    {
+        ofslog::error("%s: %s (%d) - %s", name.c_str(), e.what(),
+                      e.get_posixerrno(), task.path.c_str());
+    }
+}
+
+void TreeWalker::push(int worker, const list<string>& paths, bool directories)
+{
+    list<string>::const_iterator it = paths.begin();
+    pthread_mutex_lock(&mutex);
+    for (; it != paths.end() && nQueued < TREE_WALKER_MAX_QUEUED; ++it)
+    {
+        queues[worker].push_back(Task(*it, directories));
+        nQueued++;
+    }
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+
+    // too much is waiting already, do the rest right here
+    for (; it != paths.end(); ++it)
+        process(worker, Task(*it, directories));
+}
+
+/**
+ * Log how far the walk is, at most every TREE_WALKER_PROGRESS_INTERVAL
+ * seconds. Must be called with the mutex held.
+ */
+void TreeWalker::reportProgress()
+{
+    time_t now = time(NULL);
+    if (now - lastProgress < TREE_WALKER_PROGRESS_INTERVAL)
+        return;
+    lastProgress = now;
+    ofslog::info("%s: %ld directories and %ld files done, %ld waiting",
+                 name.c_str(), nDirectories, nFiles, nQueued);
+}
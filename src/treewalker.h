@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef TREEWALKER_H
+#define TREEWALKER_H
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+/// a directory pushes its entries to the queues only while fewer are queued
+#define TREE_WALKER_MAX_QUEUED 65536
+/// seconds between two progress messages
+#define TREE_WALKER_PROGRESS_INTERVAL 10
+
+/**
+ * Walks a directory tree on a pool of worker threads.
+ *
+ * Every worker has its own queue of directories and files. It takes its
+ * own work from the back of the queue, so it goes depth first and the
+ * queues only hold the entries of the directories on its current path.
+ * An idle worker steals from the front of the other queues, which holds
+ * the entries closest to the root and therefore the largest subtrees.
+ * When more than TREE_WALKER_MAX_QUEUED entries are waiting, a directory
+ * processes its entries itself instead of queueing them, which keeps the
+ * memory bounded for very wide directories.
+ */
+class TreeWalker
+{
+public:
+    /**
+     * Does the actual work, called concurrently from the workers
+     */
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() {}
+        /**
+         * Process a directory and list its entries
+         * @param relativePath path of the directory
+         * @param subdirs (out) paths of the sub-directories to visit
+         * @param files (out) paths of the other entries to visit
+         */
+        virtual void visitDirectory(const string& relativePath,
+                                    list<string>& subdirs, list<string>& files) = 0;
+        /**
+         * Process anything that is not a directory
+         * @param relativePath path of the file
+         */
+        virtual void visitFile(const string& relativePath) = 0;
+    };
+
+    /**
+     * @param name what is walked, used in the progress messages
+     */
+    explicit TreeWalker(const string& name);
+    ~TreeWalker();
+
+    /**
+     * Visit the tree and wait until everything has been visited. The
+     * calling thread takes part in the work.
+     * @param visitor processes the entries
+     * @param root path of the root directory
+     * @param nThreads number of workers
+     */
+    void run(Visitor& visitor, const string& root, int nThreads);
+
+    inline long getDirectories() const { return nDirectories; };
+    inline long getFiles() const { return nFiles; };
+
+private:
+    struct Task
+    {
+        Task(const string& path, bool directory) : path(path), directory(directory) {}
+        string path;
+        bool directory;
+    };
+
+    struct Worker
+    {
+        TreeWalker *walker;
+        int index;
+    };
+
+    bool take(int worker, Task& task);
+    void process(int worker, const Task& task);
+    void push(int worker, const list<string>& paths, bool directories);
+    void reportProgress();
+    void work(int worker);
+    static void* workerRun(void* worker);
+
+    string name;
+    Visitor* visitor;
+    vector<deque<Task> > queues;
+    long nQueued;
+    /// tasks taken from a queue and not yet finished
+    int nRunning;
+    long nDirectories;
+    long nFiles;
+    time_t lastProgress;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    TreeWalker(const TreeWalker&);
+    TreeWalker& operator=(const TreeWalker&);
+};
+
+#endif
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "writebackthrottle.h"
+#include "loadsampler.h"
+#include "ofsenvironment.h"
+#include "ofsstats.h"
+#include <unistd.h>
+#include <algorithm>
+
+__thread bool WritebackThrottle::paced = false;
+std::auto_ptr<WritebackThrottle> WritebackThrottle::theWritebackThrottleInstance;
+pthread_once_t WritebackThrottle::instanceOnce = PTHREAD_ONCE_INIT;
+
+WritebackThrottle::WritebackThrottle()
+    : lastForeign(0), lastAdjust(0), limited(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    capacity = OFSEnvironment::Instance().getLazywriteBandwidth() * 1024.0;
+    // start from what the link has carried since the sampling started
+    rate = WRITEBACK_MIN_RATE;
+    adjust();
+    tokens = rate * WRITEBACK_BURST;
+    lastRefill = lastAdjust = OFSStats::now();
+}
+
+WritebackThrottle& WritebackThrottle::Instance()
+{
+    pthread_once(&instanceOnce, createInstance);
+    return *theWritebackThrottleInstance;
+}
+
+void WritebackThrottle::createInstance()
+{
+    theWritebackThrottleInstance.reset(new WritebackThrottle());
+}
+
+size_t WritebackThrottle::acquire(size_t wanted)
+{
+    size_t granted = min(wanted, (size_t)WRITEBACK_CHUNK);
+    pthread_mutex_lock(&mutex);
+    refill(OFSStats::now());
+    // the bucket may go into debt by one chunk, so a chunk larger than
+    // the bucket still gets through
+    while (tokens <= 0)
+    {
+        limited = true;
+        useconds_t wait = (useconds_t)(-tokens / rate * 1000000) + 1000;
+        pthread_mutex_unlock(&mutex);
+        usleep(wait);
+        pthread_mutex_lock(&mutex);
+        refill(OFSStats::now());
+    }
+    tokens -= granted;
+    pthread_mutex_unlock(&mutex);
+    LoadSampler::Instance().exclude(granted);
+    return granted;
+}
+
+/**
+ * Add the tokens since the last refill, the caller holds the mutex
+ */
+void WritebackThrottle::refill(unsigned long long now)
+{
+    if (now - lastAdjust >= LOAD_SAMPLE_INTERVAL * 1000000000ULL)
+    {
+        adjust();
+        lastAdjust = now;
+    }
+    tokens = min(tokens + rate * (now - lastRefill) / 1e9, rate * WRITEBACK_BURST);
+    lastRefill = now;
+}
+
+/**
+ * Set the rate from the last sample of the link, the caller holds the
+ * mutex
+ */
+void WritebackThrottle::adjust()
+{
+    LoadSampler& sampler = LoadSampler::Instance();
+    double foreign = sampler.getForeignRate();
+    if (capacity > 0)
+        rate = capacity * WRITEBACK_SHARE - foreign;
+    else if (limited && foreign <= lastForeign + WRITEBACK_MIN_RATE)
+        rate *= WRITEBACK_PROBE;
+    else
+        rate = sampler.getPeakRate() * WRITEBACK_SHARE - foreign;
+    double floor = WRITEBACK_MIN_RATE;
+    if (capacity > 0)
+        floor = min(floor, capacity * WRITEBACK_SHARE);
+    rate = max(rate, floor);
+    lastForeign = foreign;
+    limited = false;
+}
+
+double WritebackThrottle::getRate()
+{
+    pthread_mutex_lock(&mutex);
+    double value = rate;
+    pthread_mutex_unlock(&mutex);
+    return value;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef WRITEBACKTHROTTLE_H
+#define WRITEBACKTHROTTLE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <memory>
+using namespace std;
+
+/// most bytes a paced copy hands to the kernel at once
+#define WRITEBACK_CHUNK (256 * 1024)
+/// the writeback never gets slower than this many bytes per second
+#define WRITEBACK_MIN_RATE (64 * 1024)
+/// share of the link the writeback may fill
+#define WRITEBACK_SHARE 0.9
+/// factor the rate grows by while the link takes all of it
+#define WRITEBACK_PROBE 1.25
+/// seconds of the rate that can be sent in one burst
+#define WRITEBACK_BURST 1
+
+/**
+ * Paces the writeback of lazy write with a token bucket, so it uses
+ * the capacity of the link that nobody else needs.
+ *
+ * Every LOAD_SAMPLE_INTERVAL the rate is set to WRITEBACK_SHARE of the
+ * capacity less what others send according to the LoadSampler. The
+ * capacity is given by the lwbandwidth mount option or estimated as
+ * the peak rate of the link. Without lwbandwidth the rate grows by
+ * WRITEBACK_PROBE every interval in which the link took all the tokens
+ * and the other traffic did not grow, which finds the capacity of an
+ * idle link; more traffic of others brings it back down at the next
+ * interval.
+ *
+ * Copies are only paced on threads that are inside a Scope, see
+ * FileCopy.
+ */
+class WritebackThrottle
+{
+public:
+    static WritebackThrottle& Instance();
+    /**
+     * Paces the copies of the calling thread while it exists
+     */
+    class Scope
+    {
+    public:
+        Scope(bool pace) : previous(paced) { paced = pace; }
+        ~Scope() { paced = previous; }
+    private:
+        bool previous;
+    };
+    /**
+     * Wait until a part of a copy may be sent if the calling thread is
+     * paced
+     * @param wanted bytes the caller wants to send
+     * @return bytes the caller may send now, at most wanted
+     */
+    static inline size_t pace(size_t wanted)
+        { return paced ? Instance().acquire(wanted) : wanted; }
+    /**
+     * @return current rate in bytes per second
+     */
+    double getRate();
+
+private:
+    WritebackThrottle();
+    static void createInstance();
+    size_t acquire(size_t wanted);
+    void refill(unsigned long long now);
+    void adjust();
+
+    double tokens;
+    double rate;
+    /// capacity set by lwbandwidth in bytes per second, 0 to estimate it
+    double capacity;
+    double lastForeign;
+    unsigned long long lastRefill;
+    unsigned long long lastAdjust;
+    /// somebody had to wait for tokens since the last adjustment
+    bool limited;
+    pthread_mutex_t mutex;
+
+    static __thread bool paced;
+    static std::auto_ptr<WritebackThrottle> theWritebackThrottleInstance;
+    static pthread_once_t instanceOnce;
+};
+
+#endif
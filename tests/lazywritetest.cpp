@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * Entries a lazy write-back could not write back must not trigger the
+ * next write-back on idle at once, only after new activity or
+ * LAZYWRITE_RECHECK seconds.
+ */
+
+#include "testenv.h"
+#include "lazywrite.h"
+#include "filesystemstatusmanager.h"
+#include "ofsstats.h"
+#include <unistd.h>
+#include <cstring>
+
+int main()
+{
+    string root = test_init("lazywrite=t,lwidle=1,lwexpire=600");
+    FilesystemStatusManager& fsm = FilesystemStatusManager::Instance();
+    Lazywrite lazywrite(0);
+    int wait;
+
+    fsm.setdirtyentries(5);
+    OFSStats::active(OFSStats::now());
+    CHECK(lazywrite.trigger(wait) == NULL);
+    sleep(2);
+    const char* reason = lazywrite.trigger(wait);
+    CHECK(reason != NULL && strcmp(reason, "idle") == 0);
+
+    // the write-back failed on all entries
+    lazywrite.finished(fsm.getdirty());
+    sleep(2);
+    CHECK(lazywrite.trigger(wait) == NULL);
+    CHECK(wait > 0 && wait <= LAZYWRITE_RECHECK);
+
+    // new activity makes the next quiet moment count again
+    OFSStats::active(OFSStats::now());
+    CHECK(lazywrite.trigger(wait) == NULL);
+    sleep(2);
+    reason = lazywrite.trigger(wait);
+    CHECK(reason != NULL && strcmp(reason, "idle") == 0);
+
+    // a write-back that leaves nothing
+    fsm.setdirtyentries(0);
+    lazywrite.finished(fsm.getdirty());
+    CHECK(fsm.getdirty().sync);
+    CHECK(lazywrite.trigger(wait) == NULL && wait == 0);
+    printf("idle write-back is not repeated without new activity\n");
+    test_cleanup(root);
+    return 0;
+}
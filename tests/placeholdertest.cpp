@@ -0,0 +1,99 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * The placeholders must be known after a crash, a new one right after
+ * its cache file has been truncated, otherwise the empty cache file is
+ * taken for the content of the remote file. Each step runs in a child
+ * that exits without flushing anything, the parent has not touched the
+ * singletons and loads the stored state at the end.
+ */
+
+#include "testenv.h"
+#include "placeholdermanager.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+
+static string root;
+static struct stat remote;
+
+static void create()
+{
+    PlaceholderManager::Instance().create("file", root + "/cache/file", remote);
+    PlaceholderManager::Instance().create("fetched", root + "/cache/fetched", remote);
+}
+
+static void change()
+{
+    PlaceholderManager& manager = PlaceholderManager::Instance();
+    manager.rename("file", "moved");
+    if (manager.beginFetch("fetched"))
+        manager.endFetch("fetched", true);
+}
+
+/**
+ * Run a step in a child that dies right after it
+ */
+static void crash_after(void (*step)())
+{
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        try {
+            step();
+        } catch (OFSException& e) {
+            fprintf(stderr, "%s\n", e.what());
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main()
+{
+    root = test_init("lazypin");
+    memset(&remote, 0, sizeof(remote));
+    remote.st_mode = S_IFREG | S_IRUSR | S_IWUSR;
+    remote.st_size = 3 * BLOCK_FETCH_SIZE + 1;
+    remote.st_mtime = 1000000000;
+
+    crash_after(create);
+    struct stat cache;
+    CHECK(stat((root + "/cache/file").c_str(), &cache) == 0);
+    CHECK(cache.st_size == remote.st_size);
+    crash_after(change);
+
+    PlaceholderManager& manager = PlaceholderManager::Instance();
+    CHECK(manager.isPlaceholder("moved"));
+    CHECK(manager.isCurrent("moved", remote));
+    CHECK(!manager.isPlaceholder("file"));
+    CHECK(!manager.isPlaceholder("fetched"));
+    printf("placeholders survive a crash after create, rename and fetch\n");
+    test_cleanup(root);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by                                                 *
+ *                 Frank Gsellmann, Tobias Jaehnel, Carsten Kolassa        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef TESTENV_H
+#define TESTENV_H
+
+#include "ofsenvironment.h"
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace std;
+
+/**
+ * Fail the test with a message
+ */
+#define CHECK(condition) \
+    do { if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        exit(1); } } while (0)
+
+/**
+ * Set up OFSEnvironment for a test, with the state and the cache in a
+ * new temporary directory
+ * @param options more mount options, may be empty
+ * @return the temporary directory
+ */
+inline string test_init(const string& options)
+{
+    char dir[] = "/tmp/ofstest.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    string root = dir;
+    mkdir((root + "/state").c_str(), S_IRWXU);
+    mkdir((root + "/cache").c_str(), S_IRWXU);
+    mkdir((root + "/remote").c_str(), S_IRWXU);
+
+    string opts = "statedir=" + root + "/state,backing=" + root + "/cache,shareid=test";
+    if (!options.empty())
+        opts += "," + options;
+    vector<string> args;
+    args.push_back("ofstest");
+    args.push_back("file://" + root + "/remote");
+    args.push_back(root + "/mnt");
+    args.push_back("-r");
+    args.push_back(root + "/remote");
+    args.push_back("-o");
+    args.push_back(opts);
+    vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+    try {
+        OFSEnvironment::init(args.size(), &argv[0]);
+    } catch (OFSException& e) {
+        fprintf(stderr, "OFSEnvironment::init: %s\n", e.what());
+        exit(1);
+    }
+    return root;
+}
+
+/**
+ * Remove the directory made by test_init()
+ */
+inline void test_cleanup(const string& root)
+{
+    string command = "rm -rf '" + root + "'";
+    if (system(command.c_str()) != 0)
+        fprintf(stderr, "could not remove %s\n", root.c_str());
+}
+
+#endif